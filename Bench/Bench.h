@@ -0,0 +1,28 @@
+#pragma once
+#include <cstdint>
+#include <string>
+
+class ThreadPool;
+struct VirtualTextureConfig;
+
+// Timings of the engine's CPU side, outside the engine. Each logs its numbers, checks the results it timed
+// and returns false if any were wrong.
+namespace Benchmarks
+{
+	// Times the per-draw texture lookup a backend does, over numObjects textures and a draw stream visiting them
+	// in material order and in random order: a pointer keyed std::map, a pointer keyed std::unordered_map and a
+	// SlotMap. Also checks that every handle to a removed object is rejected after its slot is reused.
+	bool RunHandleLookups(uint32_t numObjects);
+
+	// Times std::sort, std::stable_sort and the radix sort on one and on every thread over numPackets packets
+	// with scene-like keys, and checks every result against std::stable_sort.
+	bool RunDrawSort(uint32_t numPackets, ThreadPool& pool);
+
+	// Reads every file in the directory at queue depths 1 through 64 and logs the wall time and throughput of
+	// each. On Linux the files are dropped from the page cache before every pass so the reads hit the disk.
+	bool RunFileReads(const std::string& directory);
+
+	// Replays a virtual texture feedback recording against a fresh VirtualTextureSystem and logs per-frame and
+	// total stats. Only page layouts are cooked, so no texture data or device is needed and results are deterministic.
+	bool RunVirtualTextureSim(const std::string& recordingPath, const VirtualTextureConfig& config);
+}
\ No newline at end of file
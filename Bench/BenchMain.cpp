@@ -0,0 +1,79 @@
+#include <filesystem>
+#include <sstream>
+#include <string>
+
+#include "sdl/SDL.h"
+
+#include "ThreadPool.h"
+#include "VirtualTexture.h"
+#include "Bench.h"
+
+namespace fs = std::filesystem;
+
+// Runs the benchmarks named by key=value arguments, in order, and fails if any did:
+//   handlebench=<textures>	slot map handle lookups against pointer keyed maps
+//   sortbench=<packets>		the draw packet radix sort against the standard library sorts
+//   iobench=<directory>		async file reads at each queue depth, relative to the project directory
+//   vtsim=<recording>		virtual texture feedback replayed headless, relative to the project directory, with
+//							the vtpages=, vtuploads= and vtlatency= given before it
+int main(int argc, char** argv)
+{
+	// Built next to the engine, so the same way up to the project.
+	std::string projectDir = fs::canonical(std::string(SDL_GetBasePath()) + "../../../../").string();
+
+	ThreadPool threadPool;
+	VirtualTextureConfig virtualTextureSettings;
+	uint32_t numRun = 0;
+	bool ok = true;
+	for (int i = 1; i < argc; ++i)
+	{
+		std::stringstream ss(argv[i]);
+		std::string key;
+		std::string value;
+		getline(ss, key, '=');
+		getline(ss, value);
+
+		// Settings apply to the benchmarks after them and don't count as one.
+		if (key == "vtpages")
+		{
+			virtualTextureSettings.numPhysicalPages = stoi(value);
+			continue;
+		}
+		else if (key == "vtuploads")
+		{
+			virtualTextureSettings.maxUploadsPerFrame = stoi(value);
+			continue;
+		}
+		else if (key == "vtlatency")
+		{
+			virtualTextureSettings.loadLatencyFrames = stoi(value);
+			continue;
+		}
+
+		if (key == "handlebench")
+		{
+			ok &= Benchmarks::RunHandleLookups(stoi(value));
+		}
+		else if (key == "sortbench")
+		{
+			ok &= Benchmarks::RunDrawSort(stoi(value), threadPool);
+		}
+		else if (key == "iobench")
+		{
+			ok &= Benchmarks::RunFileReads((fs::path(projectDir) / value).string());
+		}
+		else if (key == "vtsim")
+		{
+			ok &= Benchmarks::RunVirtualTextureSim((fs::path(projectDir) / value).string(), virtualTextureSettings);
+		}
+		else
+		{
+			SDL_Log("Unknown benchmark \"%s\".", key.c_str());
+			return 1;
+		}
+		++numRun;
+	}
+
+	if (numRun == 0) SDL_Log("No benchmark given.");
+	return numRun > 0 && ok ? 0 : 1;
+}
\ No newline at end of file
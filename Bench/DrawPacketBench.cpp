@@ -0,0 +1,70 @@
+#include <algorithm>
+#include <chrono>
+#include <random>
+
+#include "sdl/SDL.h"
+#include "DrawPacket.h"
+#include "ThreadPool.h"
+#include "Bench.h"
+
+bool Benchmarks::RunDrawSort(uint32_t numPackets, ThreadPool& pool)
+{
+	if (numPackets == 0)
+	{
+		SDL_Log("Draw sort benchmark needs at least one packet.");
+		return false;
+	}
+
+	// One pass, mostly opaque, two shaders, a few hundred textures and depths spread over the whole range.
+	std::mt19937 random(1);
+	std::vector<DrawPacket> input(numPackets);
+	for (uint32_t i = 0; i < numPackets; ++i)
+	{
+		uint32_t bucket = random() % 8 == 0 ? 1 : 0;
+		uint32_t diffuse = 1 + random() % 400;
+		uint32_t mask = bucket == 1 ? 1 + random() % 50 : 0;
+		input[i].key = DrawKeys::Make(0, bucket, bucket, diffuse, mask, random() & ((1u << DrawKeys::DepthBits) - 1));
+		input[i].meshIndex = i;
+	}
+
+	std::vector<DrawPacket> expected = input;
+	std::stable_sort(expected.begin(), expected.end(), [](const DrawPacket& a, const DrawPacket& b) { return a.key < b.key; });
+
+	const uint32_t numRepeats = 5;
+	bool ok = true;
+	auto time = [&](const char* name, bool checkOrder, auto sort) {
+		double bestMs = 0.0;
+		std::vector<DrawPacket> packets;
+		for (uint32_t repeat = 0; repeat < numRepeats; ++repeat)
+		{
+			packets = input;
+			auto start = std::chrono::steady_clock::now();
+			sort(packets);
+			double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+			bestMs = repeat == 0 ? ms : std::min(bestMs, ms);
+		}
+
+		// Unstable sorts only have to agree on the keys.
+		bool sorted = std::equal(packets.begin(), packets.end(), expected.begin(), [&](const DrawPacket& a, const DrawPacket& b) {
+			return a.key == b.key && (!checkOrder || a.meshIndex == b.meshIndex);
+		});
+		ok &= sorted;
+		SDL_Log("  %-24s %8.2f ms  %7.1f M packets/s%s", name, bestMs, numPackets / (bestMs * 1000.0), sorted ? "" : "  WRONG ORDER");
+		return bestMs;
+	};
+
+	SDL_Log("Sorting %u draw packets, best of %u runs:", numPackets, numRepeats);
+	std::vector<DrawPacket> scratch;
+	time("std::sort", false, [](std::vector<DrawPacket>& packets) {
+		std::sort(packets.begin(), packets.end(), [](const DrawPacket& a, const DrawPacket& b) { return a.key < b.key; });
+	});
+	double stableMs = time("std::stable_sort", true, [](std::vector<DrawPacket>& packets) {
+		std::stable_sort(packets.begin(), packets.end(), [](const DrawPacket& a, const DrawPacket& b) { return a.key < b.key; });
+	});
+	double radixMs = time("radix, 1 thread", true, [&](std::vector<DrawPacket>& packets) { DrawPackets::Sort(packets, scratch, nullptr); });
+	double parallelMs = time("radix, pool", true, [&](std::vector<DrawPacket>& packets) { DrawPackets::Sort(packets, scratch, &pool); });
+
+	SDL_Log("Radix sort is %.1fx std::stable_sort on 1 thread and %.1fx on %u threads. State changes: %u unsorted, %u sorted.",
+		stableMs / radixMs, stableMs / parallelMs, pool.GetNumThreads() + 1, DrawPackets::CountStateChanges(input), DrawPackets::CountStateChanges(expected));
+	return ok;
+}
\ No newline at end of file
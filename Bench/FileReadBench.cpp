@@ -0,0 +1,74 @@
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+
+#include "sdl/SDL.h"
+#include "AsyncFileReader.h"
+#include "ThreadPool.h"
+#include "Bench.h"
+
+namespace fs = std::filesystem;
+
+bool Benchmarks::RunFileReads(const std::string& directory)
+{
+	std::vector<std::string> paths;
+	std::vector<uint64_t> sizes;
+	uint64_t totalBytes = 0;
+	for (const auto& entry : fs::directory_iterator(directory))
+	{
+		if (!fs::is_regular_file(entry.path())) continue;
+		paths.push_back(entry.path().string());
+		sizes.push_back(fs::file_size(entry.path()));
+		totalBytes += sizes.back();
+	}
+	if (paths.empty())
+	{
+		SDL_Log("No files to read in \"%s\".", directory.c_str());
+		return false;
+	}
+
+	std::vector<std::vector<char>> buffers(paths.size());
+	for (size_t i = 0; i < paths.size(); ++i) buffers[i].resize(sizes[i]);
+
+#ifndef __linux__
+	SDL_Log("Page cache can't be dropped on this platform, so the numbers below are warm-cache reads.");
+#endif
+	SDL_Log("%u files, %.1f MB", static_cast<uint32_t>(paths.size()), totalBytes / (1024.0 * 1024.0));
+
+	ThreadPool completionPool;
+	bool ok = true;
+	for (bool useIoUring : { true, false })
+	{
+#ifndef __linux__
+		if (useIoUring) continue;
+#endif
+		for (uint32_t queueDepth = 1; queueDepth <= 64; queueDepth *= 2)
+		{
+			for (const auto& path : paths) AsyncFileIO::DropFromPageCache(path);
+
+			AsyncFileReader reader;
+			reader.Init(completionPool, queueDepth, useIoUring);
+			if (useIoUring && strcmp(reader.GetBackendName(), "io_uring") != 0) break;
+
+			std::vector<FileReadRequest> batch(paths.size());
+			for (size_t i = 0; i < paths.size(); ++i)
+			{
+				batch[i].path = paths[i];
+				batch[i].size = sizes[i];
+				batch[i].buffer = buffers[i].data();
+			}
+
+			auto start = std::chrono::steady_clock::now();
+			reader.Submit(std::move(batch));
+			reader.WaitIdle();
+			double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+			auto stats = reader.GetStats();
+			ok &= stats.numFailed == 0 && stats.bytesRead == totalBytes;
+			SDL_Log("%-8s qd %2u: %8.1f ms  %7.1f MB/s  (max in flight %u, failed %u)",
+				reader.GetBackendName(), queueDepth, ms, totalBytes / (1024.0 * 1024.0) / (ms / 1000.0),
+				stats.maxInFlight, static_cast<uint32_t>(stats.numFailed));
+		}
+	}
+	return ok;
+}
\ No newline at end of file
@@ -0,0 +1,113 @@
+#include <algorithm>
+#include <chrono>
+#include <map>
+#include <memory>
+#include <random>
+#include <unordered_map>
+
+#include "sdl/SDL.h"
+#include "SlotMap.h"
+#include "Bench.h"
+
+namespace
+{
+// Stands in for a backend's texture record: the API objects a draw binds.
+struct TextureRecord
+{
+	void* texture = nullptr;
+	void* srv = nullptr;
+	void* sampler = nullptr;
+};
+
+// Stands in for the API object whose address keyed the lookup, each one its own heap allocation.
+struct FakeApiTexture
+{
+	char payload[64];
+};
+
+const uint32_t NumDraws = 1 << 20;
+const uint32_t NumRepeats = 5;
+
+// Best of a few runs, in nanoseconds per lookup. The checksum keeps the lookups from being optimized away.
+template <class Lookup>
+double TimeLookups(const Lookup& lookup, uint64_t& checksum)
+{
+	double bestNs = 0.0;
+	for (uint32_t repeat = 0; repeat < NumRepeats; ++repeat)
+	{
+		auto start = std::chrono::steady_clock::now();
+		uint64_t sum = 0;
+		for (uint32_t draw = 0; draw < NumDraws; ++draw)
+		{
+			sum += reinterpret_cast<uintptr_t>(lookup(draw).srv);
+		}
+		double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / NumDraws;
+		bestNs = repeat == 0 ? ns : std::min(bestNs, ns);
+		checksum += sum;
+	}
+	return bestNs;
+}
+}
+
+bool Benchmarks::RunHandleLookups(uint32_t numObjects)
+{
+	if (numObjects == 0 || numObjects >= SlotMap<TextureRecord>::MaxSlots)
+	{
+		SDL_Log("Handle benchmark object count must be between 1 and %u.", SlotMap<TextureRecord>::MaxSlots - 1);
+		return false;
+	}
+
+	std::mt19937 random(1);
+	std::vector<std::unique_ptr<FakeApiTexture>> apiTextures(numObjects);
+	for (auto& apiTexture : apiTextures) apiTexture.reset(new FakeApiTexture());
+
+	std::map<void*, TextureRecord> pointerMap;
+	std::unordered_map<void*, TextureRecord> pointerHashMap;
+	SlotMap<TextureRecord> slotMap;
+	std::vector<SlotHandle<TextureRecord>> handles(numObjects);
+	for (uint32_t i = 0; i < numObjects; ++i)
+	{
+		TextureRecord record;
+		record.texture = apiTextures[i].get();
+		record.srv = reinterpret_cast<void*>(static_cast<uintptr_t>(i + 1));
+		pointerMap.insert({ record.texture, record });
+		pointerHashMap.insert({ record.texture, record });
+		handles[i] = slotMap.Insert(record);
+	}
+
+	// Draws sorted by material touch each texture for a run of draws, unsorted ones jump around.
+	std::vector<uint32_t> sortedOrder(NumDraws);
+	std::vector<uint32_t> randomOrder(NumDraws);
+	for (uint32_t draw = 0; draw < NumDraws; ++draw)
+	{
+		sortedOrder[draw] = static_cast<uint32_t>(uint64_t(draw) * numObjects / NumDraws);
+		randomOrder[draw] = random() % numObjects;
+	}
+
+	SDL_Log("%u textures, %u draws, best of %u runs, ns per lookup:", numObjects, NumDraws, NumRepeats);
+	uint64_t checksum = 0;
+	for (const auto* order : { &sortedOrder, &randomOrder })
+	{
+		const auto& textures = *order;
+		double mapNs = TimeLookups([&](uint32_t draw) -> const TextureRecord& { return pointerMap.at(apiTextures[textures[draw]].get()); }, checksum);
+		double hashMapNs = TimeLookups([&](uint32_t draw) -> const TextureRecord& { return pointerHashMap.at(apiTextures[textures[draw]].get()); }, checksum);
+		double slotMapNs = TimeLookups([&](uint32_t draw) -> const TextureRecord& { return slotMap[handles[textures[draw]]]; }, checksum);
+		SDL_Log("%-14s std::map %6.2f  std::unordered_map %6.2f  SlotMap %6.2f  (%.1fx faster than std::map)",
+			order == &sortedOrder ? "material order" : "random order", mapNs, hashMapNs, slotMapNs, mapNs / slotMapNs);
+	}
+
+	// Free every other texture and fill the slots again, the old handles must all be turned away.
+	for (uint32_t i = 0; i < numObjects; i += 2) slotMap.Remove(handles[i]);
+	for (uint32_t i = 0; i < numObjects; i += 2) slotMap.Insert(TextureRecord());
+	uint32_t numStale = 0;
+	uint32_t numRejected = 0;
+	for (uint32_t i = 0; i < numObjects; i += 2)
+	{
+		++numStale;
+		if (!slotMap.Get(handles[i]) && !slotMap.Remove(handles[i])) ++numRejected;
+	}
+	bool ok = numRejected == numStale && slotMap.GetCapacity() == numObjects;
+	SDL_Log("Stale handles rejected after slot reuse: %u of %u, %u slots for %u objects (checksum %llx).", numRejected, numStale,
+		slotMap.GetCapacity(), slotMap.GetSize(), static_cast<unsigned long long>(checksum));
+	return ok;
+}
\ No newline at end of file
@@ -0,0 +1,40 @@
+#include "sdl/SDL.h"
+#include "VirtualTexture.h"
+#include "Bench.h"
+
+bool Benchmarks::RunVirtualTextureSim(const std::string& recordingPath, const VirtualTextureConfig& config)
+{
+	VirtualTextureRecording recording;
+	if (!recording.Load(recordingPath))
+	{
+		SDL_Log("Failed to load feedback recording \"%s\".", recordingPath.c_str());
+		return false;
+	}
+
+	VirtualTextureSystem system;
+	system.Init(config);
+	for (const auto& texture : recording.textures)
+	{
+		uint32_t textureId;
+		if (!system.RegisterTexture(CookedVirtualTexture::CookLayout(texture.width, texture.height), textureId)) return false;
+	}
+
+	VirtualTextureFrameStats totals;
+	for (const auto& frame : recording.frames)
+	{
+		auto stats = system.Update(frame.data(), frame.size());
+		SDL_Log("VT frame %u: %u requested, %u resident hits, %u loaded, %u deferred, %u evicted, %u/%u pages resident.",
+			stats.frame, stats.uniquePagesRequested, stats.pagesAlreadyResident, stats.pagesLoaded,
+			stats.pagesDeferred, stats.pagesEvicted, stats.pagesResident, config.numPhysicalPages);
+
+		totals.uniquePagesRequested += stats.uniquePagesRequested;
+		totals.pagesAlreadyResident += stats.pagesAlreadyResident;
+		totals.pagesLoaded += stats.pagesLoaded;
+		totals.pagesEvicted += stats.pagesEvicted;
+	}
+
+	SDL_Log("VT simulation: %u textures, %u frames, %u page requests, %u hits, %u loads, %u evictions.",
+		(uint32_t)recording.textures.size(), (uint32_t)recording.frames.size(), totals.uniquePagesRequested,
+		totals.pagesAlreadyResident, totals.pagesLoaded, totals.pagesEvicted);
+	return true;
+}
\ No newline at end of file
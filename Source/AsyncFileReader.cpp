@@ -0,0 +1,496 @@
+#include "AsyncFileReader.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cstring>
+#include <sdl/SDL.h>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#ifdef __linux__
+#include <cerrno>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#endif
+
+#include "ThreadPool.h"
+
+namespace
+{
+#ifdef _WIN32
+typedef HANDLE NativeFile;
+const NativeFile InvalidFile = INVALID_HANDLE_VALUE;
+
+NativeFile OpenForRead(const std::string& path)
+{
+	return CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+}
+
+void CloseFile(NativeFile file)
+{
+	CloseHandle(file);
+}
+
+// Positional read on a synchronous handle, so several threads can share nothing but the path.
+int64_t ReadAt(NativeFile file, char* buffer, uint64_t size, uint64_t offset)
+{
+	uint64_t done = 0;
+	while (done < size)
+	{
+		OVERLAPPED overlapped = {};
+		overlapped.Offset = static_cast<DWORD>(offset + done);
+		overlapped.OffsetHigh = static_cast<DWORD>((offset + done) >> 32);
+		DWORD chunk = static_cast<DWORD>(std::min<uint64_t>(size - done, 1u << 30));
+		DWORD read = 0;
+		if (!ReadFile(file, buffer + done, chunk, &read, &overlapped))
+		{
+			if (GetLastError() == ERROR_HANDLE_EOF) break;
+			return -1;
+		}
+		if (read == 0) break;
+		done += read;
+	}
+	return static_cast<int64_t>(done);
+}
+#else
+typedef int NativeFile;
+const NativeFile InvalidFile = -1;
+
+NativeFile OpenForRead(const std::string& path)
+{
+	return open(path.c_str(), O_RDONLY);
+}
+
+void CloseFile(NativeFile file)
+{
+	close(file);
+}
+
+int64_t ReadAt(NativeFile file, char* buffer, uint64_t size, uint64_t offset)
+{
+	uint64_t done = 0;
+	while (done < size)
+	{
+		ssize_t read = pread(file, buffer + done, size - done, offset + done);
+		if (read < 0) return -1;
+		if (read == 0) break;
+		done += read;
+	}
+	return static_cast<int64_t>(done);
+}
+#endif
+}
+
+class AsyncFileReadBackend
+{
+public:
+	explicit AsyncFileReadBackend(AsyncFileReader& owner) : m_Owner(owner) {}
+	virtual ~AsyncFileReadBackend() {}
+
+	virtual const char* GetName() const = 0;
+	virtual void Submit(std::vector<FileReadRequest>&& batch) = 0;
+	// Finishes every submitted read, then joins the I/O threads.
+	virtual void Stop() = 0;
+
+protected:
+	void Complete(FileReadRequest& request, int64_t bytesRead) { m_Owner.Complete(request, bytesRead); }
+	void NoteInFlight(uint32_t inFlight)
+	{
+		std::lock_guard<std::mutex> lock(m_Owner.m_Mutex);
+		m_Owner.m_Stats.maxInFlight = std::max(m_Owner.m_Stats.maxInFlight, inFlight);
+	}
+
+	AsyncFileReader& m_Owner;
+};
+
+namespace
+{
+// queueDepth threads each doing one blocking read at a time.
+class BlockingReadBackend : public AsyncFileReadBackend
+{
+public:
+	BlockingReadBackend(AsyncFileReader& owner, uint32_t queueDepth)
+		: AsyncFileReadBackend(owner)
+		, m_IoThreads(new ThreadPool(queueDepth))
+	{}
+	~BlockingReadBackend() { Stop(); }
+
+	const char* GetName() const override { return "blocking"; }
+
+	void Submit(std::vector<FileReadRequest>&& batch) override
+	{
+		for (auto& request : batch)
+		{
+			// ThreadPool jobs must be copyable, so the request lives behind a shared_ptr.
+			auto shared = std::make_shared<FileReadRequest>(std::move(request));
+			m_IoThreads->Enqueue([this, shared]() {
+				NoteInFlight(++m_InFlight);
+				int64_t bytesRead = -1;
+				NativeFile file = OpenForRead(shared->path);
+				if (file != InvalidFile)
+				{
+					bytesRead = ReadAt(file, shared->buffer, shared->size, shared->offset);
+					CloseFile(file);
+				}
+				--m_InFlight;
+				Complete(*shared, bytesRead);
+			});
+		}
+	}
+
+	void Stop() override
+	{
+		// The pool drains its queue before joining.
+		m_IoThreads.reset();
+	}
+
+private:
+	std::unique_ptr<ThreadPool>	m_IoThreads;
+	std::atomic<uint32_t>		m_InFlight{ 0 };
+};
+
+#ifdef __linux__
+// One I/O thread keeping up to queueDepth reads in an io_uring. Short reads are resubmitted for the rest.
+class IoUringReadBackend : public AsyncFileReadBackend
+{
+public:
+	static std::unique_ptr<AsyncFileReadBackend> Create(AsyncFileReader& owner, uint32_t queueDepth)
+	{
+		std::unique_ptr<IoUringReadBackend> backend(new IoUringReadBackend(owner, queueDepth));
+		if (!backend->SetupRing()) return nullptr;
+		backend->m_Thread = std::thread([raw = backend.get()]() { raw->IoLoop(); });
+		return std::move(backend);
+	}
+
+	~IoUringReadBackend()
+	{
+		Stop();
+		if (m_Sqes) munmap(m_Sqes, m_SqesSize);
+		if (m_CqRing && m_CqRing != m_SqRing) munmap(m_CqRing, m_CqRingSize);
+		if (m_SqRing) munmap(m_SqRing, m_SqRingSize);
+		if (m_RingFd >= 0) close(m_RingFd);
+	}
+
+	const char* GetName() const override { return "io_uring"; }
+
+	void Submit(std::vector<FileReadRequest>&& batch) override
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_Mutex);
+			for (auto& request : batch) m_Pending.push_back(std::move(request));
+		}
+		m_Condition.notify_one();
+	}
+
+	void Stop() override
+	{
+		if (!m_Thread.joinable()) return;
+		{
+			std::lock_guard<std::mutex> lock(m_Mutex);
+			m_Stopping = true;
+		}
+		m_Condition.notify_one();
+		m_Thread.join();
+	}
+
+private:
+	struct InFlightRead
+	{
+		FileReadRequest request;
+		int fd = -1;
+		uint64_t done = 0;
+	};
+
+	IoUringReadBackend(AsyncFileReader& owner, uint32_t queueDepth)
+		: AsyncFileReadBackend(owner)
+		, m_Slots(queueDepth)
+	{}
+
+	bool SetupRing()
+	{
+		io_uring_params params;
+		memset(&params, 0, sizeof(params));
+		m_RingFd = static_cast<int>(syscall(__NR_io_uring_setup, static_cast<unsigned>(m_Slots.size()), &params));
+		if (m_RingFd < 0) return false;
+
+		// IORING_OP_READ arrived in 5.6. FAST_POLL (5.7) is the nearest feature bit that implies it.
+		if (!(params.features & IORING_FEAT_FAST_POLL)) return false;
+
+		m_SqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+		m_CqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+		bool singleMmap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+		if (singleMmap) m_SqRingSize = m_CqRingSize = std::max(m_SqRingSize, m_CqRingSize);
+
+		m_SqRing = mmap(nullptr, m_SqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_RingFd, IORING_OFF_SQ_RING);
+		if (m_SqRing == MAP_FAILED) { m_SqRing = nullptr; return false; }
+		if (singleMmap)
+		{
+			m_CqRing = m_SqRing;
+		}
+		else
+		{
+			m_CqRing = mmap(nullptr, m_CqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_RingFd, IORING_OFF_CQ_RING);
+			if (m_CqRing == MAP_FAILED) { m_CqRing = nullptr; return false; }
+		}
+
+		m_SqesSize = params.sq_entries * sizeof(io_uring_sqe);
+		void* sqes = mmap(nullptr, m_SqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_RingFd, IORING_OFF_SQES);
+		if (sqes == MAP_FAILED) return false;
+		m_Sqes = static_cast<io_uring_sqe*>(sqes);
+
+		auto sq = static_cast<char*>(m_SqRing);
+		m_SqTail = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+		m_SqMask = *reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+		m_SqArray = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+
+		auto cq = static_cast<char*>(m_CqRing);
+		m_CqHead = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+		m_CqTail = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+		m_CqMask = *reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+		m_Cqes = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+		return true;
+	}
+
+	void QueueRead(uint32_t slotIndex)
+	{
+		const auto& slot = m_Slots[slotIndex];
+		unsigned tail = *m_SqTail;
+		unsigned index = tail & m_SqMask;
+		io_uring_sqe& sqe = m_Sqes[index];
+		memset(&sqe, 0, sizeof(sqe));
+		sqe.opcode = IORING_OP_READ;
+		sqe.fd = slot.fd;
+		sqe.addr = reinterpret_cast<uint64_t>(slot.request.buffer + slot.done);
+		sqe.len = static_cast<uint32_t>(std::min<uint64_t>(slot.request.size - slot.done, 1u << 30));
+		sqe.off = slot.request.offset + slot.done;
+		sqe.user_data = slotIndex;
+		m_SqArray[index] = index;
+		__atomic_store_n(m_SqTail, tail + 1, __ATOMIC_RELEASE);
+		++m_Unsubmitted;
+	}
+
+	void FinishRead(uint32_t slotIndex, int64_t bytesRead)
+	{
+		auto& slot = m_Slots[slotIndex];
+		close(slot.fd);
+		slot.fd = -1;
+		Complete(slot.request, bytesRead);
+		slot.request = FileReadRequest();
+		m_FreeSlots.push_back(slotIndex);
+		--m_InFlight;
+	}
+
+	void IoLoop()
+	{
+		for (uint32_t i = 0; i < m_Slots.size(); ++i) m_FreeSlots.push_back(static_cast<uint32_t>(m_Slots.size()) - 1 - i);
+
+		std::deque<FileReadRequest> pending;
+		while (true)
+		{
+			{
+				std::unique_lock<std::mutex> lock(m_Mutex);
+				if (m_InFlight == 0 && pending.empty())
+				{
+					m_Condition.wait(lock, [this]() { return m_Stopping || !m_Pending.empty(); });
+				}
+				while (!m_Pending.empty())
+				{
+					pending.push_back(std::move(m_Pending.front()));
+					m_Pending.pop_front();
+				}
+				if (m_Stopping && m_InFlight == 0 && pending.empty()) return;
+			}
+
+			// Top the ring up to the queue depth.
+			while (!pending.empty() && !m_FreeSlots.empty())
+			{
+				FileReadRequest request = std::move(pending.front());
+				pending.pop_front();
+
+				int fd = open(request.path.c_str(), O_RDONLY);
+				if (fd < 0 || request.size == 0)
+				{
+					if (fd >= 0) close(fd);
+					Complete(request, fd < 0 ? -1 : 0);
+					continue;
+				}
+
+				uint32_t slotIndex = m_FreeSlots.back();
+				m_FreeSlots.pop_back();
+				m_Slots[slotIndex].request = std::move(request);
+				m_Slots[slotIndex].fd = fd;
+				m_Slots[slotIndex].done = 0;
+				QueueRead(slotIndex);
+				++m_InFlight;
+			}
+			if (m_InFlight == 0) continue;
+			NoteInFlight(m_InFlight);
+
+			int submitted = static_cast<int>(syscall(__NR_io_uring_enter, m_RingFd, m_Unsubmitted, 1, IORING_ENTER_GETEVENTS, nullptr, 0));
+			if (submitted < 0)
+			{
+				if (errno != EINTR && errno != EAGAIN && errno != EBUSY)
+				{
+					SDL_Log("io_uring_enter failed: %s", strerror(errno));
+					assert(false);
+				}
+				submitted = 0;
+			}
+			m_Unsubmitted -= std::min<uint32_t>(m_Unsubmitted, submitted);
+
+			unsigned head = *m_CqHead;
+			unsigned tail = __atomic_load_n(m_CqTail, __ATOMIC_ACQUIRE);
+			for (; head != tail; ++head)
+			{
+				const io_uring_cqe& cqe = m_Cqes[head & m_CqMask];
+				uint32_t slotIndex = static_cast<uint32_t>(cqe.user_data);
+				auto& slot = m_Slots[slotIndex];
+				if (cqe.res == -EINTR || cqe.res == -EAGAIN)
+				{
+					QueueRead(slotIndex);
+				}
+				else if (cqe.res < 0)
+				{
+					FinishRead(slotIndex, -1);
+				}
+				else
+				{
+					slot.done += cqe.res;
+					if (cqe.res == 0 || slot.done == slot.request.size) FinishRead(slotIndex, static_cast<int64_t>(slot.done));
+					else QueueRead(slotIndex);
+				}
+			}
+			__atomic_store_n(m_CqHead, head, __ATOMIC_RELEASE);
+		}
+	}
+
+	int							m_RingFd = -1;
+	void*						m_SqRing = nullptr;
+	void*						m_CqRing = nullptr;
+	size_t						m_SqRingSize = 0;
+	size_t						m_CqRingSize = 0;
+	size_t						m_SqesSize = 0;
+	io_uring_sqe*				m_Sqes = nullptr;
+	unsigned*					m_SqTail = nullptr;
+	unsigned*					m_SqArray = nullptr;
+	unsigned					m_SqMask = 0;
+	unsigned*					m_CqHead = nullptr;
+	unsigned*					m_CqTail = nullptr;
+	unsigned					m_CqMask = 0;
+	io_uring_cqe*				m_Cqes = nullptr;
+
+	// Only touched by the I/O thread.
+	std::vector<InFlightRead>	m_Slots;
+	std::vector<uint32_t>		m_FreeSlots;
+	uint32_t					m_InFlight = 0;
+	uint32_t					m_Unsubmitted = 0;
+
+	std::thread					m_Thread;
+	std::mutex					m_Mutex;
+	std::condition_variable		m_Condition;
+	std::deque<FileReadRequest>	m_Pending;
+	bool						m_Stopping = false;
+};
+#endif
+}
+
+AsyncFileReader::AsyncFileReader() = default;
+
+AsyncFileReader::~AsyncFileReader()
+{
+	Shutdown();
+}
+
+bool AsyncFileReader::Init(ThreadPool& completionPool, uint32_t queueDepth, bool allowIoUring)
+{
+	assert(!m_Backend);
+	assert(queueDepth > 0);
+	m_CompletionPool = &completionPool;
+	m_QueueDepth = queueDepth;
+
+#ifdef __linux__
+	if (allowIoUring)
+	{
+		m_Backend = IoUringReadBackend::Create(*this, queueDepth);
+		if (!m_Backend) SDL_Log("io_uring unavailable, falling back to blocking reads.");
+	}
+#endif
+	if (!m_Backend)
+	{
+		m_Backend.reset(new BlockingReadBackend(*this, queueDepth));
+	}
+	return true;
+}
+
+void AsyncFileReader::Shutdown()
+{
+	if (!m_Backend) return;
+	WaitIdle();
+	m_Backend->Stop();
+	m_Backend.reset();
+}
+
+void AsyncFileReader::Submit(std::vector<FileReadRequest>&& batch)
+{
+	assert(m_Backend);
+	if (batch.empty()) return;
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		m_Outstanding += batch.size();
+		m_Stats.numRequests += batch.size();
+	}
+	m_Backend->Submit(std::move(batch));
+}
+
+void AsyncFileReader::WaitIdle()
+{
+	std::unique_lock<std::mutex> lock(m_Mutex);
+	m_IdleCondition.wait(lock, [this]() { return m_Outstanding == 0; });
+}
+
+const char* AsyncFileReader::GetBackendName() const
+{
+	return m_Backend ? m_Backend->GetName() : "none";
+}
+
+AsyncFileReaderStats AsyncFileReader::GetStats() const
+{
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	return m_Stats;
+}
+
+void AsyncFileReader::Complete(FileReadRequest& request, int64_t bytesRead)
+{
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		if (bytesRead < 0) ++m_Stats.numFailed;
+		else m_Stats.bytesRead += bytesRead;
+	}
+
+	auto onComplete = std::make_shared<std::function<void(int64_t)>>(std::move(request.onComplete));
+	m_CompletionPool->Enqueue([this, onComplete, bytesRead]() {
+		if (*onComplete) (*onComplete)(bytesRead);
+
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		if (--m_Outstanding == 0) m_IdleCondition.notify_all();
+	});
+}
+
+void AsyncFileIO::DropFromPageCache(const std::string& path)
+{
+#ifdef __linux__
+	int fd = open(path.c_str(), O_RDONLY);
+	if (fd < 0) return;
+	posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+	close(fd);
+#endif
+}
\ No newline at end of file
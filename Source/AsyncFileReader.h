@@ -0,0 +1,78 @@
+#pragma once
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+class ThreadPool;
+
+struct FileReadRequest
+{
+	std::string path;
+	uint64_t offset = 0;
+	uint64_t size = 0;
+	char* buffer = nullptr;		// Caller-owned, at least size bytes, and must stay alive until onComplete has run.
+	// Runs on a completion pool thread with the number of bytes read, which is short at end of file
+	// and negative when the file could not be opened or read.
+	std::function<void(int64_t bytesRead)> onComplete;
+};
+
+struct AsyncFileReaderStats
+{
+	uint64_t numRequests = 0;
+	uint64_t numFailed = 0;
+	uint64_t bytesRead = 0;
+	uint32_t maxInFlight = 0;
+};
+
+class AsyncFileReadBackend;
+
+// Batched reads into caller buffers with up to queueDepth reads outstanding at once.
+// On Linux the reads go through io_uring. Elsewhere, or when the kernel refuses a ring, queueDepth
+// threads issue blocking positional reads. Either way the callbacks run on the completion pool.
+class AsyncFileReader
+{
+public:
+	AsyncFileReader();
+	~AsyncFileReader();
+
+	AsyncFileReader(const AsyncFileReader&) = delete;
+	AsyncFileReader& operator=(const AsyncFileReader&) = delete;
+
+	bool Init(ThreadPool& completionPool, uint32_t queueDepth, bool allowIoUring = true);
+	// Waits for everything submitted, then stops the I/O threads.
+	void Shutdown();
+
+	void Submit(std::vector<FileReadRequest>&& batch);
+	// Blocks until every submitted read has completed and its callback has returned.
+	void WaitIdle();
+
+	bool IsInitialized() const { return m_Backend != nullptr; }
+	const char* GetBackendName() const;
+	uint32_t GetQueueDepth() const { return m_QueueDepth; }
+	AsyncFileReaderStats GetStats() const;
+
+private:
+	friend class AsyncFileReadBackend;
+	void Complete(FileReadRequest& request, int64_t bytesRead);
+
+	std::unique_ptr<AsyncFileReadBackend>	m_Backend;
+	ThreadPool*								m_CompletionPool = nullptr;
+	uint32_t								m_QueueDepth = 0;
+
+	mutable std::mutex						m_Mutex;
+	std::condition_variable					m_IdleCondition;
+	uint64_t								m_Outstanding = 0;
+	AsyncFileReaderStats					m_Stats;
+};
+
+namespace AsyncFileIO
+{
+// Best effort eviction of the file's clean pages, so the next read goes to disk. Only Linux allows it unprivileged.
+void DropFromPageCache(const std::string& path);
+}
\ No newline at end of file
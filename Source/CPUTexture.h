@@ -2,8 +2,16 @@
 
 #include <vector>
 
+enum class CPUTextureFormat
+{
+	BGRA8,		// 4 bytes per texel
+	BC4,		// 8 bytes per 4x4 block, single channel
+};
+
 struct CPUTexture
 {
 	int width, height;
+	CPUTextureFormat format = CPUTextureFormat::BGRA8;
 	std::vector<char> data;
-};
\ No newline at end of file
+	std::vector<std::vector<char>> mips;	// Levels below data, largest first. Empty if not generated.
+};
@@ -0,0 +1,986 @@
+#include "CaptureRHI.h"
+
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <chrono>
+#include <cstring>
+
+#include "sdl/SDL.h"
+
+#include "Compression.h"
+#include "FileUtils.h"
+#include "Hash.h"
+#include "Mesh.h"
+#include "TexturePacker.h"
+#include "Window.h"
+
+namespace
+{
+const uint32_t CaptureMagic = 0x43494852;		// "RHIC"
+const uint32_t CaptureVersion = 3;
+const size_t HeaderSize = 4 * sizeof(uint32_t);		// Magic, version, width and height
+
+// Each record is the opcode, a 32-bit payload size and the payload. Values are written in native byte order.
+enum class Op : uint8_t
+{
+	GetDebugTexture2D,
+	CreateVertexBuffer,
+	CreateIndexBuffer,
+	CreateConstantBuffer,
+	UpdateConstantBuffer,
+	UpdateMaterialTable,
+	CreateTexture2D,
+	CreateTexture2DArray,
+	ReleaseTexture2D,
+	HandleWindowResize,
+	BeginGeometryPass,
+	BeginMaskedGeometryPass,
+	SetGeometryShaderFeatures,
+	DrawMesh,
+	BeginLightingPass,
+	DrawAmbient,
+	DrawDirectionalLight,
+	Present,
+	EndSnapshot,				// Everything before it recreates the resources alive when the capture started
+	Count,
+};
+
+const char* const OpNames[] = {
+	"GetDebugTexture2D",
+	"CreateVertexBuffer",
+	"CreateIndexBuffer",
+	"CreateConstantBuffer",
+	"UpdateConstantBuffer",
+	"UpdateMaterialTable",
+	"CreateTexture2D",
+	"CreateTexture2DArray",
+	"ReleaseTexture2D",
+	"HandleWindowResize",
+	"BeginGeometryPass",
+	"BeginMaskedGeometryPass",
+	"SetGeometryShaderFeatures",
+	"DrawMesh",
+	"BeginLightingPass",
+	"DrawAmbient",
+	"DrawDirectionalLight",
+	"Present",
+	"EndSnapshot",
+};
+static_assert(sizeof(OpNames) / sizeof(OpNames[0]) == static_cast<size_t>(Op::Count), "Every opcode needs a name");
+
+class PayloadWriter
+{
+public:
+	template <class T>
+	void Write(const T& value) { WriteBytes(&value, sizeof(value)); }
+	void WriteBytes(const void* data, size_t size)
+	{
+		auto bytes = static_cast<const char*>(data);
+		payload.insert(payload.end(), bytes, bytes + size);
+	}
+	// Length-prefixed, for variable sized data.
+	void WriteBlob(const void* data, size_t size)
+	{
+		Write(static_cast<uint32_t>(size));
+		WriteBytes(data, size);
+	}
+
+	std::vector<char> payload;
+};
+
+// Reads past the end return zeroes and clear ok, so a truncated capture fails instead of overrunning.
+class PayloadReader
+{
+public:
+	PayloadReader(const char* data, size_t size) : m_Data(data), m_Size(size) {}
+
+	template <class T>
+	T Read()
+	{
+		T value{};
+		if (auto bytes = ReadBytes(sizeof(value))) memcpy(&value, bytes, sizeof(value));
+		return value;
+	}
+	const char* ReadBytes(size_t size)
+	{
+		if (!ok || size > m_Size - m_Position)
+		{
+			ok = false;
+			return nullptr;
+		}
+		auto bytes = m_Data + m_Position;
+		m_Position += size;
+		return bytes;
+	}
+	std::vector<char> ReadBlob()
+	{
+		auto size = Read<uint32_t>();
+		auto bytes = ReadBytes(size);
+		return bytes ? std::vector<char>(bytes, bytes + size) : std::vector<char>();
+	}
+	bool AtEnd() const { return m_Position == m_Size; }
+
+	bool ok = true;
+
+private:
+	const char* m_Data;
+	size_t m_Size;
+	size_t m_Position = 0;
+};
+
+uint64_t HashTexture(const CPUTexture& texture)
+{
+	auto hash = Hash::HashBytes(texture.data.data(), texture.data.size());
+	hash = Hash::Combine(hash, (uint64_t(texture.width) << 32) | uint32_t(texture.height));
+	return Hash::Combine(hash, uint64_t(texture.format));
+}
+
+void WriteTexture(PayloadWriter& writer, const CPUTexture& texture)
+{
+	writer.Write(static_cast<uint32_t>(texture.width));
+	writer.Write(static_cast<uint32_t>(texture.height));
+	writer.Write(static_cast<uint32_t>(texture.format));
+	writer.WriteBlob(texture.data.data(), texture.data.size());
+	writer.Write(static_cast<uint32_t>(texture.mips.size()));
+	for (const auto& mip : texture.mips) writer.WriteBlob(mip.data(), mip.size());
+}
+
+CPUTexture ReadTexture(PayloadReader& reader)
+{
+	CPUTexture texture;
+	texture.width = reader.Read<uint32_t>();
+	texture.height = reader.Read<uint32_t>();
+	texture.format = static_cast<CPUTextureFormat>(reader.Read<uint32_t>());
+	texture.data = reader.ReadBlob();
+	auto numMips = reader.Read<uint32_t>();
+	for (uint32_t i = 0; i < numMips && reader.ok; ++i) texture.mips.push_back(reader.ReadBlob());
+	return texture;
+}
+
+struct RecordRef
+{
+	Op op;
+	const char* payload;
+	uint32_t size;
+};
+
+struct CallStats
+{
+	uint64_t count = 0;
+	double totalMs = 0.0;
+	double maxMs = 0.0;
+};
+
+typedef std::array<CallStats, static_cast<size_t>(Op::Count)> CallStatsTable;
+
+// Handles created so far in the replay, indexed by capture id.
+struct ReplayState
+{
+	RHI* rhi;
+	std::vector<RHIBuffer> buffers;
+	std::vector<RHITexture> textures;
+
+	RHIBuffer GetBuffer(uint32_t id) const { return id < buffers.size() ? buffers[id] : nullptr; }
+	RHITexture GetTexture(uint32_t id) const { return id < textures.size() ? textures[id] : nullptr; }
+	void SetBuffer(uint32_t id, RHIBuffer buffer)
+	{
+		if (id >= buffers.size()) buffers.resize(id + 1, nullptr);
+		buffers[id] = buffer;
+	}
+	void SetTexture(uint32_t id, RHITexture texture)
+	{
+		if (id >= textures.size()) textures.resize(id + 1, nullptr);
+		textures[id] = texture;
+	}
+};
+
+// Decodes the record's arguments, then times only the call itself. Returns false on a malformed payload.
+bool ReplayRecord(ReplayState& state, const RecordRef& record, double& callMs)
+{
+	typedef std::chrono::steady_clock Clock;
+	RHI& rhi = *state.rhi;
+	PayloadReader reader(record.payload, record.size);
+	Clock::time_point begin;
+	auto startTimer = [&]() { begin = Clock::now(); };
+
+	switch (record.op)
+	{
+	case Op::GetDebugTexture2D:
+	{
+		auto id = reader.Read<uint32_t>();
+		startTimer();
+		state.SetTexture(id, rhi.GetDebugTexture2D());
+		break;
+	}
+	case Op::CreateVertexBuffer:
+	{
+		auto id = reader.Read<uint32_t>();
+		auto stride = reader.Read<uint32_t>();
+		auto numVertices = reader.Read<uint32_t>();
+		auto data = reader.ReadBytes(size_t(stride) * numVertices);
+		if (!reader.ok) return false;
+		startTimer();
+		state.SetBuffer(id, rhi.CreateVertexBuffer(data, stride, numVertices));
+		break;
+	}
+	case Op::CreateIndexBuffer:
+	{
+		auto id = reader.Read<uint32_t>();
+		auto numIndices = reader.Read<uint32_t>();
+		auto data = reader.ReadBytes(size_t(numIndices) * sizeof(IndexType));
+		if (!reader.ok) return false;
+		std::vector<IndexType> indices(numIndices);
+		memcpy(indices.data(), data, indices.size() * sizeof(IndexType));
+		startTimer();
+		state.SetBuffer(id, rhi.CreateIndexBuffer(indices));
+		break;
+	}
+	case Op::CreateConstantBuffer:
+	{
+		auto id = reader.Read<uint32_t>();
+		auto size = reader.Read<int32_t>();
+		startTimer();
+		state.SetBuffer(id, rhi.CreateConstantBuffer(size));
+		break;
+	}
+	case Op::UpdateConstantBuffer:
+	{
+		auto buffer = state.GetBuffer(reader.Read<uint32_t>());
+		auto numBytes = reader.Read<uint32_t>();
+		auto data = reader.ReadBytes(numBytes);
+		if (!reader.ok) return false;
+		startTimer();
+		rhi.UpdateConstantBuffer(buffer, data, static_cast<int>(numBytes));
+		break;
+	}
+	case Op::UpdateMaterialTable:
+	{
+		auto bytes = reader.ReadBlob();
+		if (!reader.ok || bytes.size() % sizeof(GPUMaterial)) return false;
+		std::vector<GPUMaterial> materials(bytes.size() / sizeof(GPUMaterial));
+		if (!bytes.empty()) memcpy(materials.data(), bytes.data(), bytes.size());
+		startTimer();
+		rhi.UpdateMaterialTable(materials);
+		break;
+	}
+	case Op::CreateTexture2D:
+	{
+		auto id = reader.Read<uint32_t>();
+		auto texture = ReadTexture(reader);
+		if (!reader.ok) return false;
+		startTimer();
+		state.SetTexture(id, rhi.CreateTexture2D(texture));
+		break;
+	}
+	case Op::CreateTexture2DArray:
+	{
+		// The plan's format is backend specific, so it is rebuilt from what this backend reports for the slices.
+		auto id = reader.Read<uint32_t>();
+		auto numSlices = reader.Read<uint32_t>();
+		TextureArrayPlan plan;
+		for (uint32_t i = 0; i < numSlices && reader.ok; ++i) plan.slices.push_back(state.GetTexture(reader.Read<uint32_t>()));
+		if (!reader.ok || plan.slices.empty() || !plan.slices[0]) return false;
+		auto input = rhi.GetTexturePackingInput(plan.slices[0]);
+		plan.width = input.width;
+		plan.height = input.height;
+		plan.mipLevels = input.mipLevels;
+		plan.format = input.format;
+		startTimer();
+		state.SetTexture(id, rhi.CreateTexture2DArray(plan));
+		break;
+	}
+	case Op::ReleaseTexture2D:
+	{
+		auto id = reader.Read<uint32_t>();
+		auto texture = state.GetTexture(id);
+		startTimer();
+		rhi.ReleaseTexture2D(texture);
+		state.SetTexture(id, nullptr);
+		break;
+	}
+	case Op::HandleWindowResize:
+	{
+		auto width = reader.Read<uint32_t>();
+		auto height = reader.Read<uint32_t>();
+		startTimer();
+		rhi.HandleWindowResize(width, height);
+		break;
+	}
+	case Op::BeginGeometryPass:
+		startTimer();
+		rhi.BeginGeometryPass();
+		break;
+	case Op::BeginMaskedGeometryPass:
+		startTimer();
+		rhi.BeginMaskedGeometryPass();
+		break;
+	case Op::SetGeometryShaderFeatures:
+	{
+		auto features = reader.Read<uint32_t>();
+		startTimer();
+		rhi.SetGeometryShaderFeatures(features);
+		break;
+	}
+	case Op::DrawMesh:
+	{
+		Mesh mesh;
+		mesh.gpuMesh.positionBuffer = state.GetBuffer(reader.Read<uint32_t>());
+		mesh.gpuMesh.normalBuffer = state.GetBuffer(reader.Read<uint32_t>());
+		mesh.gpuMesh.uvBuffer = state.GetBuffer(reader.Read<uint32_t>());
+		mesh.gpuMesh.indexBuffer = state.GetBuffer(reader.Read<uint32_t>());
+		mesh.constantBuffer = state.GetBuffer(reader.Read<uint32_t>());
+		mesh.numFaces = reader.Read<uint32_t>();
+		mesh.alphaMode = static_cast<AlphaMode>(reader.Read<uint8_t>());
+		auto diffuse = state.GetTexture(reader.Read<uint32_t>());
+		auto mask = state.GetTexture(reader.Read<uint32_t>());
+		startTimer();
+		rhi.DrawMesh(mesh, diffuse, mask);
+		break;
+	}
+	case Op::BeginLightingPass:
+		startTimer();
+		rhi.BeginLightingPass();
+		break;
+	case Op::DrawAmbient:
+	{
+		auto color = reader.Read<glm::vec3>();
+		startTimer();
+		rhi.DrawAmbient(color);
+		break;
+	}
+	case Op::DrawDirectionalLight:
+	{
+		auto color = reader.Read<glm::vec3>();
+		auto angles = reader.Read<glm::vec3>();
+		startTimer();
+		rhi.DrawDirectionalLight(color, angles);
+		break;
+	}
+	case Op::Present:
+		startTimer();
+		rhi.Present();
+		break;
+	default:
+		return false;
+	}
+
+	callMs = std::chrono::duration<double, std::milli>(Clock::now() - begin).count();
+	return reader.ok && reader.AtEnd();
+}
+
+void LogCallStats(const char* title, const CallStatsTable& table)
+{
+	std::vector<size_t> order;
+	for (size_t op = 0; op < table.size(); ++op)
+	{
+		if (table[op].count > 0) order.push_back(op);
+	}
+	std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) { return table[a].totalMs > table[b].totalMs; });
+
+	SDL_Log("%s:", title);
+	for (auto op : order)
+	{
+		const auto& stats = table[op];
+		SDL_Log("  %-24s %8llu calls %10.3f ms total %9.2f us mean %9.2f us max", OpNames[op], static_cast<unsigned long long>(stats.count),
+			stats.totalMs, 1000.0 * stats.totalMs / stats.count, 1000.0 * stats.maxMs);
+	}
+}
+}
+
+CaptureRHI::CaptureRHI(std::unique_ptr<RHI> inner, const std::string& path, uint32_t numFrames)
+	: m_Inner(std::move(inner))
+	, m_Path(path)
+	, m_NumFrames(numFrames)
+{
+	assert(m_Inner);
+}
+
+CaptureRHI::~CaptureRHI()
+{
+	if (m_Capturing && m_Stats.numFrames > 0) EndCapture();
+}
+
+void CaptureRHI::WriteRecord(uint8_t opcode, const std::vector<char>& payload)
+{
+	uint32_t size = static_cast<uint32_t>(payload.size());
+	m_Stream.push_back(static_cast<char>(opcode));
+	m_Stream.insert(m_Stream.end(), reinterpret_cast<const char*>(&size), reinterpret_cast<const char*>(&size) + sizeof(size));
+	m_Stream.insert(m_Stream.end(), payload.begin(), payload.end());
+	++m_Stats.numRecords;
+}
+
+uint32_t CaptureRHI::AddBufferId(RHIBuffer buffer)
+{
+	auto id = m_NextId++;
+	m_BufferIds[buffer] = id;
+	return id;
+}
+
+uint32_t CaptureRHI::AddTextureId(RHITexture texture)
+{
+	auto id = m_NextId++;
+	m_TextureIds[texture] = id;
+	return id;
+}
+
+uint32_t CaptureRHI::FindBufferId(RHIBuffer buffer) const
+{
+	if (!buffer) return 0;
+	auto iter = m_BufferIds.find(buffer);
+	assert(iter != m_BufferIds.end());
+	return iter != m_BufferIds.end() ? iter->second : 0;
+}
+
+uint32_t CaptureRHI::FindTextureId(RHITexture texture) const
+{
+	if (!texture) return 0;
+	auto iter = m_TextureIds.find(texture);
+	assert(iter != m_TextureIds.end());
+	return iter != m_TextureIds.end() ? iter->second : 0;
+}
+
+void CaptureRHI::WriteCreateBuffer(const ShadowBuffer& shadow)
+{
+	PayloadWriter writer;
+	writer.Write(AddBufferId(shadow.buffer));
+	switch (shadow.kind)
+	{
+	case BufferKind::Vertex:
+		writer.Write(shadow.stride);
+		writer.Write(static_cast<uint32_t>(shadow.contents.size() / shadow.stride));
+		writer.WriteBytes(shadow.contents.data(), shadow.contents.size());
+		WriteRecord(static_cast<uint8_t>(Op::CreateVertexBuffer), writer.payload);
+		break;
+	case BufferKind::Index:
+		writer.Write(static_cast<uint32_t>(shadow.contents.size() / sizeof(IndexType)));
+		writer.WriteBytes(shadow.contents.data(), shadow.contents.size());
+		WriteRecord(static_cast<uint8_t>(Op::CreateIndexBuffer), writer.payload);
+		break;
+	case BufferKind::Constant:
+		writer.Write(static_cast<int32_t>(shadow.stride));
+		WriteRecord(static_cast<uint8_t>(Op::CreateConstantBuffer), writer.payload);
+		if (!shadow.contents.empty())
+		{
+			PayloadWriter update;
+			update.Write(FindBufferId(shadow.buffer));
+			update.WriteBlob(shadow.contents.data(), shadow.contents.size());
+			WriteRecord(static_cast<uint8_t>(Op::UpdateConstantBuffer), update.payload);
+		}
+		break;
+	}
+}
+
+void CaptureRHI::WriteCreateTexture(uint32_t id, const CPUTexture& cpuTexture)
+{
+	PayloadWriter writer;
+	writer.Write(id);
+	WriteTexture(writer, cpuTexture);
+	WriteRecord(static_cast<uint8_t>(Op::CreateTexture2D), writer.payload);
+}
+
+void CaptureRHI::WriteUpdateMaterialTable(const std::vector<GPUMaterial>& materials)
+{
+	PayloadWriter writer;
+	writer.WriteBlob(materials.data(), materials.size() * sizeof(GPUMaterial));
+	WriteRecord(static_cast<uint8_t>(Op::UpdateMaterialTable), writer.payload);
+}
+
+void CaptureRHI::WriteSnapshot()
+{
+	PayloadWriter debug;
+	debug.Write(AddTextureId(m_Inner->GetDebugTexture2D()));
+	WriteRecord(static_cast<uint8_t>(Op::GetDebugTexture2D), debug.payload);
+
+	// Buffers are all created while loading on the main thread, so their order is already stable.
+	for (const auto& shadow : m_ShadowBuffers) WriteCreateBuffer(shadow);
+
+	// Texture uploads follow decode completion, which varies from run to run, so they are written by content.
+	std::vector<std::pair<RHITexture, const ShadowTexture*>> textures;
+	for (const auto& entry : m_ShadowTextures) textures.push_back({ entry.first, &entry.second });
+	std::sort(textures.begin(), textures.end(), [](const auto& a, const auto& b) {
+		if (a.second->contentHash != b.second->contentHash) return a.second->contentHash < b.second->contentHash;
+		return a.second->serial < b.second->serial;
+	});
+
+	// Arrays are rebuilt the way they were made: from standalone slices that are released straight after.
+	// The slices no longer exist in the backend, so they only get ids.
+	for (const auto& entry : textures)
+	{
+		const auto& shadow = *entry.second;
+		if (shadow.source)
+		{
+			WriteCreateTexture(AddTextureId(entry.first), *shadow.source);
+			continue;
+		}
+
+		std::vector<uint32_t> sliceIds;
+		for (const auto& slice : shadow.slices)
+		{
+			sliceIds.push_back(m_NextId++);
+			WriteCreateTexture(sliceIds.back(), *slice);
+		}
+
+		PayloadWriter writer;
+		writer.Write(AddTextureId(entry.first));
+		writer.Write(static_cast<uint32_t>(sliceIds.size()));
+		for (auto id : sliceIds) writer.Write(id);
+		WriteRecord(static_cast<uint8_t>(Op::CreateTexture2DArray), writer.payload);
+
+		for (auto id : sliceIds)
+		{
+			PayloadWriter release;
+			release.Write(id);
+			WriteRecord(static_cast<uint8_t>(Op::ReleaseTexture2D), release.payload);
+		}
+	}
+
+	// Sent after the textures, as the slices it holds are only valid once the arrays exist.
+	if (!m_ShadowMaterialTable.empty()) WriteUpdateMaterialTable(m_ShadowMaterialTable);
+
+	WriteRecord(static_cast<uint8_t>(Op::EndSnapshot), {});
+}
+
+void CaptureRHI::BeginCapture()
+{
+	if (m_Capturing || m_Written) return;
+
+	m_Stream.clear();
+	PayloadWriter header;
+	header.Write(CaptureMagic);
+	header.Write(CaptureVersion);
+	header.Write(m_Width);
+	header.Write(m_Height);
+	m_Stream = header.payload;
+
+	m_Capturing = true;
+	WriteSnapshot();
+
+	// Only needed for the snapshot. From here on calls are written as they come.
+	m_ShadowBuffers = std::vector<ShadowBuffer>();
+	m_ShadowBufferIndices.clear();
+	m_ShadowTextures.clear();
+	m_ShadowMaterialTable = std::vector<GPUMaterial>();
+	SDL_Log("Started RHI capture with %llu resource records (%.1f MB).", static_cast<unsigned long long>(m_Stats.numRecords), m_Stream.size() / (1024.0 * 1024.0));
+}
+
+void CaptureRHI::EndCapture()
+{
+	m_Capturing = false;
+	m_Written = true;
+	m_BufferIds.clear();
+	m_TextureIds.clear();
+
+	auto file = Compression::CompressContainer(m_Stream.data(), m_Stream.size());
+	m_Stats.rawBytes = m_Stream.size();
+	m_Stats.fileBytes = file.size();
+	m_Stream = std::vector<char>();
+
+	SDL_RWops* out = SDL_RWFromFile(m_Path.c_str(), "wb");
+	if (!out)
+	{
+		SDL_Log("Unable to write RHI capture \"%s\".", m_Path.c_str());
+		return;
+	}
+	bool ok = SDL_RWwrite(out, file.data(), file.size(), 1) == 1;
+	SDL_RWclose(out);
+	if (!ok)
+	{
+		SDL_Log("Unable to write RHI capture \"%s\".", m_Path.c_str());
+		return;
+	}
+	SDL_Log("Wrote RHI capture \"%s\": %llu records, %llu frames, %.1f MB raw, %.1f MB on disk.", m_Path.c_str(),
+		static_cast<unsigned long long>(m_Stats.numRecords), static_cast<unsigned long long>(m_Stats.numFrames),
+		m_Stats.rawBytes / (1024.0 * 1024.0), m_Stats.fileBytes / (1024.0 * 1024.0));
+}
+
+bool CaptureRHI::InitRHI(const Window& window)
+{
+	m_Width = window.width;
+	m_Height = window.height;
+	return m_Inner->InitRHI(window);
+}
+
+void CaptureRHI::HandleWindowResize(uint32_t windowWidth, uint32_t windowHeight)
+{
+	m_Inner->HandleWindowResize(windowWidth, windowHeight);
+	m_Width = windowWidth;
+	m_Height = windowHeight;
+	if (!m_Capturing) return;
+
+	PayloadWriter writer;
+	writer.Write(windowWidth);
+	writer.Write(windowHeight);
+	WriteRecord(static_cast<uint8_t>(Op::HandleWindowResize), writer.payload);
+}
+
+RHIBuffer CaptureRHI::CreateVertexBuffer(const void* data, uint32_t stride, uint32_t numVertices)
+{
+	auto buffer = m_Inner->CreateVertexBuffer(data, stride, numVertices);
+	if (!buffer || m_Written) return buffer;
+
+	auto bytes = static_cast<const char*>(data);
+	ShadowBuffer shadow{ buffer, BufferKind::Vertex, stride, std::vector<char>(bytes, bytes + size_t(stride) * numVertices) };
+	if (m_Capturing)
+	{
+		WriteCreateBuffer(shadow);
+		return buffer;
+	}
+	m_ShadowBufferIndices[buffer] = m_ShadowBuffers.size();
+	m_ShadowBuffers.push_back(std::move(shadow));
+	return buffer;
+}
+
+RHIBuffer CaptureRHI::CreateIndexBuffer(const std::vector<IndexType>& indices)
+{
+	auto buffer = m_Inner->CreateIndexBuffer(indices);
+	if (!buffer || m_Written) return buffer;
+
+	auto bytes = reinterpret_cast<const char*>(indices.data());
+	ShadowBuffer shadow{ buffer, BufferKind::Index, sizeof(IndexType), std::vector<char>(bytes, bytes + indices.size() * sizeof(IndexType)) };
+	if (m_Capturing)
+	{
+		WriteCreateBuffer(shadow);
+		return buffer;
+	}
+	m_ShadowBufferIndices[buffer] = m_ShadowBuffers.size();
+	m_ShadowBuffers.push_back(std::move(shadow));
+	return buffer;
+}
+
+RHIBuffer CaptureRHI::CreateConstantBuffer(int size)
+{
+	auto buffer = m_Inner->CreateConstantBuffer(size);
+	if (!buffer || m_Written) return buffer;
+
+	// The stride carries the size, contents stay empty until the first update.
+	ShadowBuffer shadow{ buffer, BufferKind::Constant, static_cast<uint32_t>(size), {} };
+	if (m_Capturing)
+	{
+		WriteCreateBuffer(shadow);
+		return buffer;
+	}
+	m_ShadowBufferIndices[buffer] = m_ShadowBuffers.size();
+	m_ShadowBuffers.push_back(std::move(shadow));
+	return buffer;
+}
+
+bool CaptureRHI::UpdateConstantBuffer(RHIBuffer buffer, const void* data, int numBytes)
+{
+	bool result = m_Inner->UpdateConstantBuffer(buffer, data, numBytes);
+	if (m_Written || numBytes < 0) return result;
+
+	auto bytes = static_cast<const char*>(data);
+	if (m_Capturing)
+	{
+		PayloadWriter writer;
+		writer.Write(FindBufferId(buffer));
+		writer.WriteBlob(bytes, numBytes);
+		WriteRecord(static_cast<uint8_t>(Op::UpdateConstantBuffer), writer.payload);
+		return result;
+	}
+	auto iter = m_ShadowBufferIndices.find(buffer);
+	if (iter != m_ShadowBufferIndices.end()) m_ShadowBuffers[iter->second].contents.assign(bytes, bytes + numBytes);
+	return result;
+}
+
+void CaptureRHI::UpdateMaterialTable(const std::vector<GPUMaterial>& materials)
+{
+	m_Inner->UpdateMaterialTable(materials);
+	if (m_Written) return;
+
+	if (m_Capturing) WriteUpdateMaterialTable(materials);
+	else m_ShadowMaterialTable = materials;
+}
+
+RHITexture CaptureRHI::CreateTexture2D(const CPUTexture& cpuTexture)
+{
+	auto texture = m_Inner->CreateTexture2D(cpuTexture);
+	if (!texture || m_Written) return texture;
+
+	if (m_Capturing)
+	{
+		WriteCreateTexture(AddTextureId(texture), cpuTexture);
+		return texture;
+	}
+	ShadowTexture shadow;
+	shadow.serial = m_NextSerial++;
+	shadow.contentHash = HashTexture(cpuTexture);
+	shadow.source = std::make_shared<const CPUTexture>(cpuTexture);
+	m_ShadowTextures[texture] = std::move(shadow);
+	return texture;
+}
+
+RHITexture CaptureRHI::CreateTexture2DArray(const TextureArrayPlan& arrayPlan)
+{
+	auto texture = m_Inner->CreateTexture2DArray(arrayPlan);
+	if (!texture || m_Written) return texture;
+
+	if (m_Capturing)
+	{
+		PayloadWriter writer;
+		writer.Write(AddTextureId(texture));
+		writer.Write(static_cast<uint32_t>(arrayPlan.slices.size()));
+		for (auto slice : arrayPlan.slices) writer.Write(FindTextureId(slice));
+		WriteRecord(static_cast<uint8_t>(Op::CreateTexture2DArray), writer.payload);
+		return texture;
+	}
+
+	// Keeps the slices' data alive past their release, the array is rebuilt from it.
+	ShadowTexture shadow;
+	shadow.serial = m_NextSerial++;
+	shadow.contentHash = 0;
+	for (auto slice : arrayPlan.slices)
+	{
+		auto iter = m_ShadowTextures.find(slice);
+		assert(iter != m_ShadowTextures.end() && iter->second.source);
+		if (iter == m_ShadowTextures.end() || !iter->second.source) continue;
+		shadow.slices.push_back(iter->second.source);
+		shadow.contentHash = Hash::Combine(shadow.contentHash, iter->second.contentHash);
+	}
+	m_ShadowTextures[texture] = std::move(shadow);
+	return texture;
+}
+
+void CaptureRHI::ReleaseTexture2D(RHITexture texture)
+{
+	if (m_Capturing)
+	{
+		PayloadWriter writer;
+		writer.Write(FindTextureId(texture));
+		WriteRecord(static_cast<uint8_t>(Op::ReleaseTexture2D), writer.payload);
+		m_TextureIds.erase(texture);
+	}
+	else
+	{
+		m_ShadowTextures.erase(texture);
+	}
+	m_Inner->ReleaseTexture2D(texture);
+}
+
+TexturePackingInput CaptureRHI::GetTexturePackingInput(RHITexture texture) const
+{
+	return m_Inner->GetTexturePackingInput(texture);
+}
+
+void CaptureRHI::BeginGeometryPass()
+{
+	m_Inner->BeginGeometryPass();
+	if (m_Capturing) WriteRecord(static_cast<uint8_t>(Op::BeginGeometryPass), {});
+}
+
+void CaptureRHI::BeginMaskedGeometryPass()
+{
+	m_Inner->BeginMaskedGeometryPass();
+	if (m_Capturing) WriteRecord(static_cast<uint8_t>(Op::BeginMaskedGeometryPass), {});
+}
+
+void CaptureRHI::SetGeometryShaderFeatures(uint32_t features)
+{
+	m_Inner->SetGeometryShaderFeatures(features);
+	if (!m_Capturing) return;
+
+	PayloadWriter writer;
+	writer.Write(features);
+	WriteRecord(static_cast<uint8_t>(Op::SetGeometryShaderFeatures), writer.payload);
+}
+
+void CaptureRHI::DrawMesh(const Mesh& mesh, RHITexture diffuseTexture, RHITexture maskTexture)
+{
+	m_Inner->DrawMesh(mesh, diffuseTexture, maskTexture);
+	if (!m_Capturing) return;
+
+	PayloadWriter writer;
+	writer.Write(FindBufferId(mesh.gpuMesh.positionBuffer));
+	writer.Write(FindBufferId(mesh.gpuMesh.normalBuffer));
+	writer.Write(FindBufferId(mesh.gpuMesh.uvBuffer));
+	writer.Write(FindBufferId(mesh.gpuMesh.indexBuffer));
+	writer.Write(FindBufferId(mesh.constantBuffer));
+	writer.Write(mesh.numFaces);
+	writer.Write(static_cast<uint8_t>(mesh.alphaMode));
+	writer.Write(FindTextureId(diffuseTexture));
+	writer.Write(FindTextureId(maskTexture));
+	WriteRecord(static_cast<uint8_t>(Op::DrawMesh), writer.payload);
+}
+
+void CaptureRHI::BeginLightingPass()
+{
+	m_Inner->BeginLightingPass();
+	if (m_Capturing) WriteRecord(static_cast<uint8_t>(Op::BeginLightingPass), {});
+}
+
+void CaptureRHI::DrawAmbient(glm::vec3 color)
+{
+	m_Inner->DrawAmbient(color);
+	if (!m_Capturing) return;
+
+	PayloadWriter writer;
+	writer.Write(color);
+	WriteRecord(static_cast<uint8_t>(Op::DrawAmbient), writer.payload);
+}
+
+void CaptureRHI::DrawDirectionalLight(glm::vec3 color, glm::vec3 angles)
+{
+	m_Inner->DrawDirectionalLight(color, angles);
+	if (!m_Capturing) return;
+
+	PayloadWriter writer;
+	writer.Write(color);
+	writer.Write(angles);
+	WriteRecord(static_cast<uint8_t>(Op::DrawDirectionalLight), writer.payload);
+}
+
+void CaptureRHI::Present()
+{
+	m_Inner->Present();
+	if (!m_Capturing) return;
+
+	WriteRecord(static_cast<uint8_t>(Op::Present), {});
+	if (++m_Stats.numFrames >= m_NumFrames) EndCapture();
+}
+
+void CaptureRHI::LogStats() const
+{
+	m_Inner->LogStats();
+	if (m_Stats.numRecords == 0) return;
+	SDL_Log("RHI capture: %llu records over %llu frames%s.", static_cast<unsigned long long>(m_Stats.numRecords),
+		static_cast<unsigned long long>(m_Stats.numFrames), m_Capturing ? ", still recording" : "");
+}
+
+bool CaptureRHI::Replay(const std::string& path, const std::string& rhiName, uint32_t numFrames)
+{
+	auto view = FileUtils::MapFileAbsolute(path);
+	if (!view.IsValid())
+	{
+		SDL_Log("Unable to read RHI capture \"%s\".", path.c_str());
+		return false;
+	}
+	std::vector<char> stream = Compression::IsContainer(view.data(), view.size())
+		? Compression::DecompressContainer(view.data(), view.size())
+		: std::vector<char>(view.begin(), view.end());
+
+	PayloadReader header(stream.data(), stream.size());
+	auto magic = header.Read<uint32_t>();
+	auto version = header.Read<uint32_t>();
+	auto width = header.Read<uint32_t>();
+	auto height = header.Read<uint32_t>();
+	Window window(width, height);
+	if (!header.ok || magic != CaptureMagic || version != CaptureVersion)
+	{
+		SDL_Log("\"%s\" is not a version %u RHI capture.", path.c_str(), CaptureVersion);
+		return false;
+	}
+
+	// Index every record up front so walking the stream isn't part of the timings. Frames end at each Present.
+	std::vector<RecordRef> records;
+	size_t snapshotEnd = 0;
+	std::vector<std::pair<size_t, size_t>> frames;
+	size_t frameBegin = 0;
+	for (size_t position = HeaderSize; position < stream.size();)
+	{
+		PayloadReader reader(stream.data() + position, stream.size() - position);
+		auto op = reader.Read<uint8_t>();
+		auto size = reader.Read<uint32_t>();
+		auto payload = reader.ReadBytes(size);
+		if (!reader.ok || op >= static_cast<uint8_t>(Op::Count))
+		{
+			SDL_Log("RHI capture \"%s\" is truncated or corrupt at byte %llu.", path.c_str(), static_cast<unsigned long long>(position));
+			return false;
+		}
+		records.push_back({ static_cast<Op>(op), payload, size });
+		position += 1 + sizeof(uint32_t) + size;
+
+		if (records.back().op == Op::EndSnapshot) snapshotEnd = frameBegin = records.size();
+		if (records.back().op == Op::Present)
+		{
+			frames.push_back({ frameBegin, records.size() });
+			frameBegin = records.size();
+		}
+	}
+	if (frames.empty())
+	{
+		SDL_Log("RHI capture \"%s\" has no complete frames.", path.c_str());
+		return false;
+	}
+
+	auto rhi = CreateRHI(rhiName);
+	if (!rhi)
+	{
+		SDL_Log("Unknown RHI '%s'.", rhiName.c_str());
+		return false;
+	}
+	window.headless = rhi->IsHeadless();
+	if (SDL_Init(window.headless ? 0 : SDL_INIT_VIDEO) < 0)
+	{
+		SDL_Log("Unable to init Video: %s", SDL_GetError());
+		return false;
+	}
+	if (!window.headless)
+	{
+		window.sdlWindow.reset(SDL_CreateWindow("Rndr replay", SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED,
+			window.width, window.height, SDL_WINDOW_SHOWN | rhi->GetWindowFlags()));
+		if (!window.sdlWindow)
+		{
+			SDL_Log("Unable to create SDL Window: %s", SDL_GetError());
+			return false;
+		}
+	}
+	if (!rhi->InitRHI(window))
+	{
+		SDL_Log("Unable to init the %s RHI.", rhi->GetName());
+		return false;
+	}
+
+	ReplayState state;
+	state.rhi = rhi.get();
+	CallStatsTable snapshotStats;
+	CallStatsTable frameStats;
+	auto replay = [&](size_t begin, size_t end, CallStatsTable& table, double& totalMs) {
+		for (size_t i = begin; i < end; ++i)
+		{
+			if (records[i].op == Op::EndSnapshot) continue;
+			double callMs = 0.0;
+			if (!ReplayRecord(state, records[i], callMs))
+			{
+				SDL_Log("Malformed %s record at index %llu.", OpNames[static_cast<size_t>(records[i].op)], static_cast<unsigned long long>(i));
+				return false;
+			}
+			auto& stats = table[static_cast<size_t>(records[i].op)];
+			++stats.count;
+			stats.totalMs += callMs;
+			stats.maxMs = std::max(stats.maxMs, callMs);
+			totalMs += callMs;
+		}
+		return true;
+	};
+
+	double snapshotMs = 0.0;
+	if (!replay(0, snapshotEnd, snapshotStats, snapshotMs)) return false;
+
+	// Resources created inside the captured frames are created again on every loop, and kept until shutdown.
+	uint32_t framesToReplay = numFrames > 0 ? numFrames : static_cast<uint32_t>(frames.size());
+	std::vector<double> frameTimesMs;
+	for (uint32_t frame = 0; frame < framesToReplay; ++frame)
+	{
+		const auto& range = frames[frame % frames.size()];
+		double frameMs = 0.0;
+		if (!replay(range.first, range.second, frameStats, frameMs)) return false;
+		frameTimesMs.push_back(frameMs);
+	}
+
+	std::sort(frameTimesMs.begin(), frameTimesMs.end());
+	double totalMs = 0.0;
+	for (auto ms : frameTimesMs) totalMs += ms;
+	uint64_t numResourceCalls = 0;
+	for (const auto& stats : snapshotStats) numResourceCalls += stats.count;
+	SDL_Log("Replayed \"%s\" on the %s RHI: %ux%u, %llu resource calls in %.3f ms, %u frames from %u captured.",
+		path.c_str(), rhi->GetName(), window.width, window.height, static_cast<unsigned long long>(numResourceCalls), snapshotMs, framesToReplay,
+		static_cast<uint32_t>(frames.size()));
+	SDL_Log("Frame call time: mean %.3f ms, median %.3f ms, max %.3f ms.",
+		totalMs / frameTimesMs.size(), frameTimesMs[frameTimesMs.size() / 2], frameTimesMs.back());
+	LogCallStats("Resource calls", snapshotStats);
+	LogCallStats("Frame calls", frameStats);
+
+	rhi->LogStats();
+	return rhi->GetNumValidationErrors() == 0;
+}
\ No newline at end of file
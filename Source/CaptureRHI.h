@@ -0,0 +1,133 @@
+#pragma once
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "CPUTexture.h"
+#include "RHI.h"
+
+struct CaptureRHIStats
+{
+	uint64_t numRecords = 0;
+	uint64_t numFrames = 0;
+	uint64_t rawBytes = 0;
+	uint64_t fileBytes = 0;
+};
+
+// Forwards every call to another backend and records the ones that reach the device into a binary command
+// stream: resource creation with its data, constant buffer payloads, passes, draws (which carry the binds)
+// and lights. Recording starts at BeginCapture, which first writes the resources alive at that point, so a
+// capture replays without the scene or its assets. Handles are written as ids numbered in stream order,
+// live textures are snapshotted in content hash order and nothing else depends on addresses or time, so the
+// same frames give the same bytes and captures can be diffed between builds. ImGui is not captured.
+class CaptureRHI : public RHI
+{
+public:
+	// Writes to path after numFrames presents, or on destruction if fewer were recorded.
+	CaptureRHI(std::unique_ptr<RHI> inner, const std::string& path, uint32_t numFrames);
+	~CaptureRHI();
+
+	void BeginCapture();
+	bool IsCapturing() const { return m_Capturing; }
+
+	// Runs a capture against the named backend: the resources once, then the captured frames looped until
+	// numFrames have been replayed (once through if 0), and logs the CPU cost of every kind of call.
+	static bool Replay(const std::string& path, const std::string& rhiName, uint32_t numFrames);
+
+	const char* GetName() const override { return m_Inner->GetName(); }
+	bool IsHeadless() const override { return m_Inner->IsHeadless(); }
+	uint32_t GetWindowFlags() const override { return m_Inner->GetWindowFlags(); }
+	bool InitRHI(const Window& window) override;
+	void HandleWindowResize(uint32_t windowWidth, uint32_t windowHeight) override;
+
+	using RHI::CreateVertexBuffer;
+	RHIBuffer CreateVertexBuffer(const void* data, uint32_t stride, uint32_t numVertices) override;
+	RHIBuffer CreateIndexBuffer(const std::vector<IndexType>& indices) override;
+	RHIBuffer CreateConstantBuffer(int size) override;
+	bool UpdateConstantBuffer(RHIBuffer buffer, const void* data, int numBytes) override;
+	void UpdateMaterialTable(const std::vector<GPUMaterial>& materials) override;
+
+	RHITexture CreateTexture2D(const CPUTexture& cpuTexture) override;
+	RHITexture CreateTexture2DArray(const TextureArrayPlan& arrayPlan) override;
+	void ReleaseTexture2D(RHITexture texture) override;
+	TexturePackingInput GetTexturePackingInput(RHITexture texture) const override;
+	uint32_t GetMaxTextureArraySlices() const override { return m_Inner->GetMaxTextureArraySlices(); }
+	RHITexture GetDebugTexture2D() override { return m_Inner->GetDebugTexture2D(); }
+
+	void BeginGeometryPass() override;
+	void BeginMaskedGeometryPass() override;
+	void SetGeometryShaderFeatures(uint32_t features) override;
+	void DrawMesh(const Mesh& mesh, RHITexture diffuseTexture, RHITexture maskTexture) override;
+	void BeginLightingPass() override;
+	void DrawAmbient(glm::vec3 color) override;
+	void DrawDirectionalLight(glm::vec3 color, glm::vec3 angles) override;
+	void Present() override;
+
+	void InitImGui(const Window& window) override { m_Inner->InitImGui(window); }
+	void NewImGuiFrame() override { m_Inner->NewImGuiFrame(); }
+	void RenderImGui() override { m_Inner->RenderImGui(); }
+	void ShutdownImGui() override { m_Inner->ShutdownImGui(); }
+
+	uint32_t GetNumValidationErrors() const override { return m_Inner->GetNumValidationErrors(); }
+	void LogStats() const override;
+	const CaptureRHIStats& GetStats() const { return m_Stats; }
+
+private:
+	enum class BufferKind : uint8_t
+	{
+		Vertex,
+		Index,
+		Constant,
+	};
+
+	// Copies of everything created before BeginCapture, so the live set can be written out when it starts.
+	struct ShadowBuffer
+	{
+		RHIBuffer buffer;
+		BufferKind kind;
+		uint32_t stride;
+		std::vector<char> contents;		// Last update for constant buffers
+	};
+
+	struct ShadowTexture
+	{
+		uint64_t serial;				// Creation order, to break content hash ties
+		uint64_t contentHash;
+		std::shared_ptr<const CPUTexture> source;
+		std::vector<std::shared_ptr<const CPUTexture>> slices;	// Arrays only
+	};
+
+	void WriteRecord(uint8_t opcode, const std::vector<char>& payload);
+	uint32_t AddBufferId(RHIBuffer buffer);
+	uint32_t AddTextureId(RHITexture texture);
+	uint32_t FindBufferId(RHIBuffer buffer) const;
+	uint32_t FindTextureId(RHITexture texture) const;
+	void WriteCreateBuffer(const ShadowBuffer& shadow);
+	void WriteCreateTexture(uint32_t id, const CPUTexture& cpuTexture);
+	void WriteUpdateMaterialTable(const std::vector<GPUMaterial>& materials);
+	void WriteSnapshot();
+	void EndCapture();
+
+	std::unique_ptr<RHI>				m_Inner;
+	std::string							m_Path;
+	uint32_t							m_NumFrames;
+	uint32_t							m_Width = 0;
+	uint32_t							m_Height = 0;
+
+	bool								m_Capturing = false;
+	bool								m_Written = false;
+	std::vector<char>					m_Stream;
+	uint32_t							m_NextId = 1;		// 0 stands for a null handle
+	std::unordered_map<RHIBuffer, uint32_t>		m_BufferIds;
+	std::unordered_map<RHITexture, uint32_t>	m_TextureIds;
+
+	std::vector<ShadowBuffer>			m_ShadowBuffers;
+	std::unordered_map<RHIBuffer, size_t>		m_ShadowBufferIndices;
+	std::unordered_map<RHITexture, ShadowTexture> m_ShadowTextures;
+	std::vector<GPUMaterial>			m_ShadowMaterialTable;		// Last update
+	uint64_t							m_NextSerial = 0;
+
+	CaptureRHIStats						m_Stats;
+};
\ No newline at end of file
@@ -0,0 +1,467 @@
+#include "Compression.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+#include <future>
+#include <sdl/SDL.h>
+
+#include "AsyncFileReader.h"
+#include "FileUtils.h"
+#include "ThreadPool.h"
+
+namespace
+{
+const uint32_t MinMatch = 4;
+// The encoder leaves the tail of a block as literals, so the decoder's wide copies can't run past the end.
+const uint32_t LastLiterals = 5;
+const uint32_t MatchFindLimit = 12;
+const uint32_t MaxOffset = 65535;
+const uint32_t HashLog = 16;
+
+const uint32_t ContainerMagic = 0x315A4C52; // "RLZ1"
+const uint32_t StoredBlockFlag = 0x80000000;
+
+struct ContainerHeader
+{
+	uint32_t magic;
+	uint32_t blockSize;
+	uint64_t rawSize;
+	uint32_t numBlocks;
+	uint32_t reserved;
+};
+
+inline uint32_t Read32(const char* p)
+{
+	uint32_t value;
+	memcpy(&value, p, sizeof(value));
+	return value;
+}
+
+inline uint32_t Hash4(uint32_t sequence)
+{
+	return (sequence * 2654435761u) >> (32 - HashLog);
+}
+
+inline char* WriteLength(char* op, size_t length)
+{
+	while (length >= 255)
+	{
+		*op++ = char(255);
+		length -= 255;
+	}
+	*op++ = char(length);
+	return op;
+}
+
+char* WriteSequence(char* op, const char* literals, size_t numLiterals, uint32_t offset, size_t matchLength)
+{
+	char* token = op++;
+	size_t litToken = std::min<size_t>(numLiterals, 15);
+	if (numLiterals >= 15) op = WriteLength(op, numLiterals - 15);
+	memcpy(op, literals, numLiterals);
+	op += numLiterals;
+
+	if (matchLength == 0)
+	{
+		// Last sequence: literals only.
+		*token = char(litToken << 4);
+		return op;
+	}
+
+	*op++ = char(offset & 0xFF);
+	*op++ = char(offset >> 8);
+	size_t matchCode = matchLength - MinMatch;
+	if (matchCode >= 15) op = WriteLength(op, matchCode - 15);
+	*token = char((litToken << 4) | std::min<size_t>(matchCode, 15));
+	return op;
+}
+
+inline bool ReadLength(const uint8_t*& ip, const uint8_t* iend, size_t& length)
+{
+	uint8_t byte;
+	do
+	{
+		if (ip >= iend) return false;
+		byte = *ip++;
+		length += byte;
+	} while (byte == 255);
+	return true;
+}
+}
+
+size_t Compression::CompressBound(size_t size)
+{
+	return size + size / 255 + 16;
+}
+
+size_t Compression::CompressBlock(const char* src, size_t size, char* dst)
+{
+	char* op = dst;
+	const char* anchor = src;
+	if (size < MatchFindLimit + 1)
+	{
+		return WriteSequence(op, anchor, size, 0, 0) - dst;
+	}
+
+	const char* iend = src + size;
+	const char* mflimit = iend - MatchFindLimit;
+	const char* matchlimit = iend - LastLiterals;
+
+	std::vector<uint32_t> table(size_t(1) << HashLog, 0);
+	const char* ip = src + 1;
+	while (ip < mflimit)
+	{
+		uint32_t sequence = Read32(ip);
+		uint32_t hash = Hash4(sequence);
+		const char* ref = src + table[hash];
+		table[hash] = static_cast<uint32_t>(ip - src);
+
+		if (ref >= ip || ip - ref > MaxOffset || Read32(ref) != sequence)
+		{
+			// Step further the longer nothing has matched, so incompressible data goes through quickly.
+			ip += 1 + ((ip - anchor) >> 6);
+			continue;
+		}
+
+		while (ip > anchor && ref > src && ip[-1] == ref[-1])
+		{
+			--ip;
+			--ref;
+		}
+		size_t matchLength = MinMatch;
+		while (ip + matchLength < matchlimit && ip[matchLength] == ref[matchLength]) ++matchLength;
+
+		op = WriteSequence(op, anchor, ip - anchor, static_cast<uint32_t>(ip - ref), matchLength);
+		ip += matchLength;
+		anchor = ip;
+		if (ip - 2 > src) table[Hash4(Read32(ip - 2))] = static_cast<uint32_t>(ip - 2 - src);
+	}
+
+	op = WriteSequence(op, anchor, iend - anchor, 0, 0);
+	return op - dst;
+}
+
+bool Compression::DecompressBlock(const char* src, size_t srcSize, char* dst, size_t dstSize)
+{
+	auto ip = reinterpret_cast<const uint8_t*>(src);
+	auto iend = ip + srcSize;
+	char* op = dst;
+	char* oend = dst + dstSize;
+
+	while (true)
+	{
+		if (ip >= iend) return false;
+		uint8_t token = *ip++;
+
+		// Fast path for the common short sequence: up to 14 literals and an 18 byte match, both copied with
+		// fixed-size moves. The last sequence never qualifies as it has no room left after its literals.
+		if (token < 0xF0 && (token & 15) != 15 && ip + 16 + 2 <= iend && op + 16 + 18 <= oend)
+		{
+			size_t numLiterals = token >> 4;
+			memcpy(op, ip, 16);
+			op += numLiterals;
+			ip += numLiterals;
+
+			size_t offset = ip[0] | (size_t(ip[1]) << 8);
+			if (offset >= 8 && offset <= size_t(op - dst))
+			{
+				ip += 2;
+				const char* match = op - offset;
+				memcpy(op, match, 8);
+				memcpy(op + 8, match + 8, 8);
+				memcpy(op + 16, match + 16, 2);
+				op += (token & 15) + MinMatch;
+				continue;
+			}
+			// Short or bad offset: let the general match copy below handle it.
+			token &= 15;
+		}
+
+		size_t numLiterals = token >> 4;
+		if (numLiterals == 15 && !ReadLength(ip, iend, numLiterals)) return false;
+		if (numLiterals > size_t(iend - ip) || numLiterals > size_t(oend - op)) return false;
+		if (op + numLiterals + 16 <= oend && ip + numLiterals + 16 <= iend)
+		{
+			// Copy in 16 byte steps. Overshooting is fine because the slack was checked above.
+			const uint8_t* s = ip;
+			char* d = op;
+			char* e = op + numLiterals;
+			do
+			{
+				memcpy(d, s, 16);
+				d += 16;
+				s += 16;
+			} while (d < e);
+		}
+		else
+		{
+			memcpy(op, ip, numLiterals);
+		}
+		ip += numLiterals;
+		op += numLiterals;
+
+		if (ip == iend) return op == oend;
+
+		if (iend - ip < 2) return false;
+		size_t offset = ip[0] | (size_t(ip[1]) << 8);
+		ip += 2;
+		if (offset == 0 || offset > size_t(op - dst)) return false;
+
+		size_t matchLength = token & 15;
+		if (matchLength == 15 && !ReadLength(ip, iend, matchLength)) return false;
+		matchLength += MinMatch;
+		if (matchLength > size_t(oend - op)) return false;
+
+		const char* match = op - offset;
+		if (op + matchLength + 8 <= oend)
+		{
+			char* e = op + matchLength;
+			if (offset < 8)
+			{
+				// Short offsets repeat a pattern. Lay down the first few bytes one at a time, then continue
+				// from a whole number of periods back, which is far enough for the 8 byte steps below.
+				size_t period = offset * ((8 + offset - 1) / offset);
+				char* patternEnd = op + std::min(period, matchLength);
+				while (op < patternEnd) *op++ = *match++;
+				match = op - period;
+			}
+			// Source and destination are at least 8 apart, so every 8 byte step reads finished output.
+			while (op < e)
+			{
+				memcpy(op, match, 8);
+				op += 8;
+				match += 8;
+			}
+			op = e;
+		}
+		else
+		{
+			for (size_t i = 0; i < matchLength; ++i) op[i] = match[i];
+			op += matchLength;
+		}
+	}
+}
+
+std::vector<char> Compression::CompressContainer(const char* data, size_t size, uint32_t blockSize, ThreadPool* pool)
+{
+	uint32_t numBlocks = static_cast<uint32_t>((size + blockSize - 1) / blockSize);
+	std::vector<std::vector<char>> blocks(numBlocks);
+
+	auto compressBlock = [&](uint32_t blockIdx) {
+		size_t begin = size_t(blockIdx) * blockSize;
+		size_t rawSize = std::min<size_t>(blockSize, size - begin);
+		auto& block = blocks[blockIdx];
+		block.resize(CompressBound(rawSize));
+		size_t compressedSize = CompressBlock(data + begin, rawSize, block.data());
+		if (compressedSize >= rawSize)
+		{
+			block.assign(data + begin, data + begin + rawSize);
+		}
+		else
+		{
+			block.resize(compressedSize);
+		}
+	};
+
+	if (pool && numBlocks > 1)
+	{
+		std::vector<std::future<void>> jobs;
+		for (uint32_t blockIdx = 0; blockIdx < numBlocks; ++blockIdx)
+		{
+			jobs.push_back(pool->Submit([&compressBlock, blockIdx]() { compressBlock(blockIdx); }));
+		}
+		for (auto& job : jobs) job.wait();
+	}
+	else
+	{
+		for (uint32_t blockIdx = 0; blockIdx < numBlocks; ++blockIdx) compressBlock(blockIdx);
+	}
+
+	ContainerHeader header = { ContainerMagic, blockSize, size, numBlocks, 0 };
+	std::vector<char> out(sizeof(header) + numBlocks * sizeof(uint32_t));
+	memcpy(out.data(), &header, sizeof(header));
+	for (uint32_t blockIdx = 0; blockIdx < numBlocks; ++blockIdx)
+	{
+		size_t rawSize = std::min<size_t>(blockSize, size - size_t(blockIdx) * blockSize);
+		uint32_t entry = static_cast<uint32_t>(blocks[blockIdx].size());
+		if (entry == rawSize) entry |= StoredBlockFlag;
+		memcpy(out.data() + sizeof(header) + blockIdx * sizeof(uint32_t), &entry, sizeof(entry));
+		out.insert(out.end(), blocks[blockIdx].begin(), blocks[blockIdx].end());
+	}
+	return out;
+}
+
+bool Compression::IsContainer(const char* data, size_t size)
+{
+	return size >= sizeof(ContainerHeader) && Read32(data) == ContainerMagic;
+}
+
+uint64_t Compression::GetContainerRawSize(const char* data, size_t size)
+{
+	if (!IsContainer(data, size)) return 0;
+	ContainerHeader header;
+	memcpy(&header, data, sizeof(header));
+	return header.rawSize;
+}
+
+bool Compression::DecompressContainer(const char* data, size_t size, char* dst, ThreadPool* pool)
+{
+	if (!IsContainer(data, size)) return false;
+	ContainerHeader header;
+	memcpy(&header, data, sizeof(header));
+	if (header.blockSize == 0 || (header.rawSize + header.blockSize - 1) / header.blockSize != header.numBlocks) return false;
+
+	size_t tableEnd = sizeof(header) + size_t(header.numBlocks) * sizeof(uint32_t);
+	if (tableEnd > size) return false;
+
+	// Prefix sum of the block sizes gives every block's offset, so blocks can decode in any order.
+	struct Block { size_t srcOffset; uint32_t srcSize; bool stored; };
+	std::vector<Block> blocks(header.numBlocks);
+	size_t srcOffset = tableEnd;
+	for (uint32_t blockIdx = 0; blockIdx < header.numBlocks; ++blockIdx)
+	{
+		uint32_t entry = Read32(data + sizeof(header) + blockIdx * sizeof(uint32_t));
+		blocks[blockIdx] = { srcOffset, entry & ~StoredBlockFlag, (entry & StoredBlockFlag) != 0 };
+		srcOffset += blocks[blockIdx].srcSize;
+	}
+	if (srcOffset > size) return false;
+
+	auto decodeBlock = [&](uint32_t blockIdx) {
+		const auto& block = blocks[blockIdx];
+		size_t dstOffset = size_t(blockIdx) * header.blockSize;
+		size_t rawSize = std::min<uint64_t>(header.blockSize, header.rawSize - dstOffset);
+		if (block.stored)
+		{
+			if (block.srcSize != rawSize) return false;
+			memcpy(dst + dstOffset, data + block.srcOffset, rawSize);
+			return true;
+		}
+		return DecompressBlock(data + block.srcOffset, block.srcSize, dst + dstOffset, rawSize);
+	};
+
+	bool ok = true;
+	if (pool && header.numBlocks > 1)
+	{
+		std::vector<std::future<bool>> jobs;
+		for (uint32_t blockIdx = 0; blockIdx < header.numBlocks; ++blockIdx)
+		{
+			jobs.push_back(pool->Submit([&decodeBlock, blockIdx]() { return decodeBlock(blockIdx); }));
+		}
+		for (auto& job : jobs) ok &= job.get();
+	}
+	else
+	{
+		for (uint32_t blockIdx = 0; blockIdx < header.numBlocks && ok; ++blockIdx) ok = decodeBlock(blockIdx);
+	}
+	return ok;
+}
+
+std::vector<char> Compression::DecompressContainer(const char* data, size_t size, ThreadPool* pool)
+{
+	std::vector<char> out(GetContainerRawSize(data, size));
+	if (!DecompressContainer(data, size, out.data(), pool))
+	{
+		SDL_Log("Corrupt compressed container.");
+		out.clear();
+	}
+	return out;
+}
+
+bool Compression::CookDirectory(const std::string& directory)
+{
+	namespace fs = std::filesystem;
+	typedef std::chrono::steady_clock Clock;
+	auto elapsedMs = [](Clock::time_point start) { return std::chrono::duration<double, std::milli>(Clock::now() - start).count(); };
+
+	std::vector<std::string> rawPaths;
+	for (const auto& entry : fs::directory_iterator(directory))
+	{
+		if (fs::is_regular_file(entry.path()) && entry.path().extension() != CookedExtension) rawPaths.push_back(entry.path().string());
+	}
+	if (rawPaths.empty())
+	{
+		SDL_Log("No files to cook in \"%s\".", directory.c_str());
+		return false;
+	}
+
+	ThreadPool pool;
+	std::vector<std::vector<char>> raw(rawPaths.size());
+	std::vector<std::vector<char>> cooked(rawPaths.size());
+	std::vector<std::string> cookedPaths(rawPaths.size());
+	uint64_t rawBytes = 0;
+	uint64_t cookedBytes = 0;
+	for (size_t i = 0; i < rawPaths.size(); ++i)
+	{
+		raw[i] = FileUtils::LoadFileAbsolute(rawPaths[i]);
+		rawBytes += raw[i].size();
+	}
+
+	auto start = Clock::now();
+	for (size_t i = 0; i < rawPaths.size(); ++i)
+	{
+		cooked[i] = CompressContainer(raw[i].data(), raw[i].size(), DefaultBlockSize);
+		cookedBytes += cooked[i].size();
+	}
+	double encodeMs = elapsedMs(start);
+
+	for (size_t i = 0; i < rawPaths.size(); ++i)
+	{
+		cookedPaths[i] = rawPaths[i] + CookedExtension;
+		SDL_RWops* file = SDL_RWFromFile(cookedPaths[i].c_str(), "wb");
+		if (!file || SDL_RWwrite(file, cooked[i].data(), cooked[i].size(), 1) != 1)
+		{
+			SDL_Log("Unable to write \"%s\".", cookedPaths[i].c_str());
+			if (file) SDL_RWclose(file);
+			return false;
+		}
+		SDL_RWclose(file);
+	}
+
+	// Decode throughput on one thread, then with blocks spread over the pool.
+	std::vector<char> scratch;
+	start = Clock::now();
+	for (size_t i = 0; i < rawPaths.size(); ++i)
+	{
+		scratch.resize(raw[i].size());
+		if (!DecompressContainer(cooked[i].data(), cooked[i].size(), scratch.data()) || scratch != raw[i])
+		{
+			SDL_Log("Round trip failed for \"%s\".", rawPaths[i].c_str());
+			return false;
+		}
+	}
+	double decodeMs = elapsedMs(start);
+	start = Clock::now();
+	for (size_t i = 0; i < rawPaths.size(); ++i)
+	{
+		scratch.resize(raw[i].size());
+		DecompressContainer(cooked[i].data(), cooked[i].size(), scratch.data(), &pool);
+	}
+	double parallelDecodeMs = elapsedMs(start);
+
+	double rawMb = rawBytes / (1024.0 * 1024.0);
+	SDL_Log("%u files: %.1f MB -> %.1f MB (ratio %.2f)", static_cast<uint32_t>(rawPaths.size()), rawMb, cookedBytes / (1024.0 * 1024.0), double(rawBytes) / cookedBytes);
+	SDL_Log("Encode: %.0f MB/s, decode: %.0f MB/s on 1 thread, %.0f MB/s on %u threads",
+		rawMb / (encodeMs / 1000.0), rawMb / (decodeMs / 1000.0), rawMb / (parallelDecodeMs / 1000.0), pool.GetNumThreads());
+
+	// Cold loads through the engine's read path, which decodes cooked files in the completion callback.
+	auto coldLoad = [&](const std::vector<std::string>& paths) {
+		for (const auto& path : paths) AsyncFileIO::DropFromPageCache(path);
+		AsyncFileReader reader;
+		reader.Init(pool, 32);
+		std::atomic<uint64_t> loadedBytes{ 0 };
+		auto loadStart = Clock::now();
+		FileUtils::ReadFilesAsync(reader, paths, [&loadedBytes](size_t, std::vector<char>&& data) { loadedBytes += data.size(); });
+		reader.WaitIdle();
+		double ms = elapsedMs(loadStart);
+		assert(loadedBytes == rawBytes);
+		return ms;
+	};
+	double rawLoadMs = coldLoad(rawPaths);
+	double cookedLoadMs = coldLoad(cookedPaths);
+	SDL_Log("Cold load: raw %.1f ms, cooked %.1f ms", rawLoadMs, cookedLoadMs);
+	return true;
+}
\ No newline at end of file
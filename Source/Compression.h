@@ -0,0 +1,36 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+class ThreadPool;
+
+// Byte-oriented LZ77 in the LZ4 mould: sequences of a token, literals, a 16-bit offset and a match length.
+// No entropy stage, so decoding is a tight copy loop. Payloads are split into blocks that compress
+// independently, which lets the decoder spread one file over several threads.
+namespace Compression
+{
+const uint32_t DefaultBlockSize = 256 * 1024;
+// Suffix for cooked, compressed copies that sit next to the source file.
+const char* const CookedExtension = ".lz";
+
+size_t CompressBound(size_t size);
+// Returns the compressed size. dst must hold CompressBound(size) bytes.
+size_t CompressBlock(const char* src, size_t size, char* dst);
+// dstSize must be the exact uncompressed size. Returns false on malformed input rather than overrunning.
+bool DecompressBlock(const char* src, size_t srcSize, char* dst, size_t dstSize);
+
+// Container of independently compressed blocks. Blocks that don't shrink are stored raw.
+// When a pool is given the blocks are processed on it. Never pass the pool a caller is itself running on.
+std::vector<char> CompressContainer(const char* data, size_t size, uint32_t blockSize = DefaultBlockSize, ThreadPool* pool = nullptr);
+bool IsContainer(const char* data, size_t size);
+uint64_t GetContainerRawSize(const char* data, size_t size);
+// dst must hold GetContainerRawSize bytes.
+bool DecompressContainer(const char* data, size_t size, char* dst, ThreadPool* pool = nullptr);
+std::vector<char> DecompressContainer(const char* data, size_t size, ThreadPool* pool = nullptr);
+
+// Writes a cooked copy of every file in the directory and logs the ratio, encode and decode throughput,
+// and the cold load time of the raw files against the cooked ones (read plus decode).
+bool CookDirectory(const std::string& directory);
+}
\ No newline at end of file
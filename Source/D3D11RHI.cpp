@@ -1,6 +1,10 @@
 #include "D3D11RHI.h"
 
+#include <algorithm>
 #include <array>
+#include <chrono>
+#include <future>
+#include <thread>
 #include <vector>
 
 #include <d3d11_1.h>
@@ -8,18 +12,157 @@
 #include <atlbase.h>
 
 #include "sdl/SDL.h"
+#include "sdl/SDL_syswm.h"
 
 #include "glm/gtx/rotate_vector.hpp"
 
 #include "UniquePtr.h"
 #include "Engine.h"
 #include "Mesh.h"
+#include "ShaderPermutation.h"
 #include "FileUtils.h"
-#include "imgui/imgui.h"
-#include "imgui/imgui_impl_dx11.h"
+#include "TexturePacker.h"
+#include "TextureUtils.h"
+#include "ThreadPool.h"
+#include "Imgui/imgui.h"
+#include "Imgui/imgui_impl_dx11.h"
+#include "Imgui/imgui_impl_sdl.h"
+
+namespace
+{
+SlotHandle<GPUBuffer> ToHandle(RHIBuffer buffer) { return { static_cast<uint32_t>(reinterpret_cast<uintptr_t>(buffer)) }; }
+SlotHandle<GPUTexture> ToHandle(RHITexture texture) { return { static_cast<uint32_t>(reinterpret_cast<uintptr_t>(texture)) }; }
+RHIBuffer ToRHI(SlotHandle<GPUBuffer> handle) { return reinterpret_cast<RHIBuffer>(static_cast<uintptr_t>(handle.value)); }
+RHITexture ToRHI(SlotHandle<GPUTexture> handle) { return reinterpret_cast<RHITexture>(static_cast<uintptr_t>(handle.value)); }
+
+// Bytes taken by the texture and its mips, for the formats this backend creates.
+uint64_t CalcTextureBytes(const D3D11_TEXTURE2D_DESC& textureDesc)
+{
+	uint64_t numBytes = 0;
+	UINT width = textureDesc.Width;
+	UINT height = textureDesc.Height;
+	for (UINT mip = 0; mip < textureDesc.MipLevels; ++mip)
+	{
+		switch (textureDesc.Format)
+		{
+		case DXGI_FORMAT_BC4_UNORM: numBytes += uint64_t((width + 3) / 4) * ((height + 3) / 4) * 8; break;
+		case DXGI_FORMAT_R16G16B16A16_FLOAT: numBytes += uint64_t(width) * height * 8; break;
+		default: numBytes += uint64_t(width) * height * 4; break;
+		}
+		width = std::max(width / 2, 1u);
+		height = std::max(height / 2, 1u);
+	}
+	return numBytes * textureDesc.ArraySize;
+}
+
+// True once both stages have come back from the cache, whether or not they compiled.
+bool IsShaderCompiled(const GPUShader& shader)
+{
+	return shader.vertexBytecode.wait_for(std::chrono::seconds(0)) == std::future_status::ready &&
+		shader.pixelBytecode.wait_for(std::chrono::seconds(0)) == std::future_status::ready;
+}
+
+const std::vector<D3D11_INPUT_ELEMENT_DESC> GeometryVertexLayout =
+{
+	{ "POSITION",	0,	DXGI_FORMAT_R32G32B32_FLOAT,	0,	0,	D3D11_INPUT_PER_VERTEX_DATA,	0 },
+	{ "NORMAL",		0,	DXGI_FORMAT_R32G32B32_FLOAT,	1,	0,	D3D11_INPUT_PER_VERTEX_DATA,	0 },
+	{ "TEXCOORD",	0,	DXGI_FORMAT_R32G32B32_FLOAT,	2,	0,	D3D11_INPUT_PER_VERTEX_DATA,	0 }
+};
+
+// D3DCompile with includes found next to the including file. It is thread safe, so misses compile in parallel.
+ShaderCompiler CreateShaderCompiler()
+{
+	ShaderCompiler compiler;
+	// The flags passed below go into the version, as changing them has to miss every cached shader.
+	compiler.version = "d3dcompiler " + std::to_string(D3D_COMPILER_VERSION) + " flags 0";
+	compiler.compile = [](const ShaderCompileRequest& request, const std::vector<char>& source, std::vector<char>& bytecode, std::string& errors)
+	{
+		std::vector<D3D_SHADER_MACRO> macros;
+		for (const auto& define : request.defines) macros.push_back({ define.first.c_str(), define.second.c_str() });
+		macros.push_back({ nullptr, nullptr });
+
+		UniqueReleasePtr<ID3DBlob> blob;
+		UniqueReleasePtr<ID3DBlob> errorBlob;
+		HRESULT result = D3DCompile(source.data(), source.size(), request.path.c_str(), macros.data(), D3D_COMPILE_STANDARD_FILE_INCLUDE,
+			request.entryPoint.c_str(), request.target.c_str(), 0, 0, blob.GetRef(), errorBlob.GetRef());
+		if (errorBlob) errors.assign(static_cast<const char*>(errorBlob->GetBufferPointer()), errorBlob->GetBufferSize());
+		if (FAILED(result) || !blob) return false;
+
+		auto data = static_cast<const char*>(blob->GetBufferPointer());
+		bytecode.assign(data, data + blob->GetBufferSize());
+		return true;
+	};
+	return compiler;
+}
+
+// These fill in place rather than return, as copies needn't keep the zeroed padding the state caches hash.
+void FillDepthStencilDesc(bool depthTestAndWrite, D3D11_DEPTH_STENCIL_DESC& depthStencilStateDesc)
+{
+	ZeroMemory(&depthStencilStateDesc, sizeof(depthStencilStateDesc));
+	depthStencilStateDesc.DepthEnable = depthTestAndWrite;
+	depthStencilStateDesc.DepthWriteMask = depthTestAndWrite ? D3D11_DEPTH_WRITE_MASK_ALL : D3D11_DEPTH_WRITE_MASK_ZERO;
+	depthStencilStateDesc.DepthFunc = D3D11_COMPARISON_LESS_EQUAL;
+	depthStencilStateDesc.StencilEnable = false;
+	depthStencilStateDesc.StencilReadMask = D3D11_DEFAULT_STENCIL_READ_MASK;
+	depthStencilStateDesc.StencilWriteMask = D3D11_DEFAULT_STENCIL_WRITE_MASK;
+	depthStencilStateDesc.FrontFace.StencilFunc = D3D11_COMPARISON_ALWAYS;
+	depthStencilStateDesc.BackFace.StencilFunc = D3D11_COMPARISON_ALWAYS;
+	depthStencilStateDesc.FrontFace.StencilDepthFailOp = D3D11_STENCIL_OP_KEEP;
+	depthStencilStateDesc.BackFace.StencilDepthFailOp = D3D11_STENCIL_OP_KEEP;
+	depthStencilStateDesc.FrontFace.StencilPassOp = D3D11_STENCIL_OP_KEEP;
+	depthStencilStateDesc.BackFace.StencilPassOp = D3D11_STENCIL_OP_KEEP;
+	depthStencilStateDesc.FrontFace.StencilFailOp = D3D11_STENCIL_OP_KEEP;
+	depthStencilStateDesc.BackFace.StencilFailOp = D3D11_STENCIL_OP_KEEP;
+}
+
+void FillRasterizerDesc(D3D11_RASTERIZER_DESC& rasterDesc)
+{
+	ZeroMemory(&rasterDesc, sizeof(rasterDesc));
+	rasterDesc.FillMode = D3D11_FILL_SOLID;
+	rasterDesc.CullMode = D3D11_CULL_BACK;
+	rasterDesc.FrontCounterClockwise = false;
+	rasterDesc.DepthBias = 0;
+	rasterDesc.SlopeScaledDepthBias = 0.f;
+	rasterDesc.DepthBiasClamp = 0.f;
+	rasterDesc.DepthClipEnable = true;
+	rasterDesc.ScissorEnable = false;
+	rasterDesc.MultisampleEnable = false;
+	rasterDesc.AntialiasedLineEnable = false;
+}
+
+// Opaque writes, or the additive blending the lights accumulate with.
+void FillBlendDesc(bool additive, D3D11_BLEND_DESC& blendDesc)
+{
+	ZeroMemory(&blendDesc, sizeof(blendDesc));
+	blendDesc.AlphaToCoverageEnable = false;
+	blendDesc.IndependentBlendEnable = false;
+	blendDesc.RenderTarget[0].BlendEnable = additive;
+	blendDesc.RenderTarget[0].SrcBlend = D3D11_BLEND_ONE;
+	blendDesc.RenderTarget[0].DestBlend = additive ? D3D11_BLEND_ONE : D3D11_BLEND_ZERO;
+	blendDesc.RenderTarget[0].BlendOp = D3D11_BLEND_OP_ADD;
+	blendDesc.RenderTarget[0].SrcBlendAlpha = D3D11_BLEND_ONE;
+	blendDesc.RenderTarget[0].DestBlendAlpha = additive ? D3D11_BLEND_ONE : D3D11_BLEND_ZERO;
+	blendDesc.RenderTarget[0].BlendOpAlpha = D3D11_BLEND_OP_ADD;
+	blendDesc.RenderTarget[0].RenderTargetWriteMask = D3D11_COLOR_WRITE_ENABLE_ALL;
+}
+}
 
 bool D3D11RHI::InitRHI(const Window& window)
 {
+	if (!window.sdlWindow)
+	{
+		SDL_Log("The D3D11 RHI needs a window.");
+		return false;
+	}
+
+	SDL_SysWMinfo wmInfo;
+	ZeroMemory(&wmInfo, sizeof(SDL_SysWMinfo));
+	if (!SDL_GetWindowWMInfo(window.sdlWindow.get(), &wmInfo))
+	{
+		SDL_Log("SDL_GetWindowWMInfo failed.");
+		return false;
+	}
+
 #pragma region Adapter
 	UniqueReleasePtr<IDXGIFactory1> pFactory;
 	if (FAILED(CreateDXGIFactory1(__uuidof(IDXGIFactory1), (void**)pFactory.GetRef())))
@@ -75,16 +218,15 @@ bool D3D11RHI::InitRHI(const Window& window)
 	swapChainDesc.BufferDesc.RefreshRate.Numerator = 60;
 	swapChainDesc.BufferDesc.RefreshRate.Denominator = 1;
 	swapChainDesc.BufferUsage = DXGI_USAGE_RENDER_TARGET_OUTPUT;
-	swapChainDesc.OutputWindow = window.m_SdlWindowWMInfo.info.win.window;
+	swapChainDesc.OutputWindow = wmInfo.info.win.window;
 	swapChainDesc.Windowed = true;
 	swapChainDesc.SampleDesc.Count = 1;
 	swapChainDesc.SampleDesc.Quality = 0;
+	// 11_0 at least, as the constant ring below needs 11.1 options that 10.x devices don't offer.
 	D3D_FEATURE_LEVEL featureLevel;
 	D3D_FEATURE_LEVEL featureLevels[] = {
 		D3D_FEATURE_LEVEL_11_1,
-		D3D_FEATURE_LEVEL_11_0,
-		D3D_FEATURE_LEVEL_10_1,
-		D3D_FEATURE_LEVEL_10_0
+		D3D_FEATURE_LEVEL_11_0
 	};
 	UINT numFeatureLevels = ARRAYSIZE(featureLevels);
 	UINT creationFlags = 0;
@@ -101,70 +243,108 @@ bool D3D11RHI::InitRHI(const Window& window)
 	}
 #pragma endregion
 
-	RecreateBackBufferRTAndView(window.width, window.height);
+#pragma region ConstantRing
+	// Binding the ring by offset, and mapping it without renaming, both need the D3D11.1 runtime and a driver
+	// that supports them. This is the backend's minimum, so there is no path without them.
+	D3D11_FEATURE_DATA_D3D11_OPTIONS options;
+	ZeroMemory(&options, sizeof(options));
+	if (FAILED(m_pD3dDevice->CheckFeatureSupport(D3D11_FEATURE_D3D11_OPTIONS, &options, sizeof(options))) ||
+		!options.ConstantBufferOffsetting || !options.MapNoOverwriteOnDynamicConstantBuffer)
+	{
+		SDL_Log("The D3D11 RHI needs constant buffer offsets and no-overwrite maps of constant buffers (D3D11.1).");
+		return false;
+	}
 
-#pragma region DepthStencilState
-	D3D11_DEPTH_STENCIL_DESC depthStencilStateDesc;
-	ZeroMemory(&depthStencilStateDesc, sizeof(depthStencilStateDesc));
-	depthStencilStateDesc.DepthEnable = true;
-	depthStencilStateDesc.DepthWriteMask = D3D11_DEPTH_WRITE_MASK_ALL;
-	depthStencilStateDesc.DepthFunc = D3D11_COMPARISON_LESS_EQUAL;
-	depthStencilStateDesc.StencilEnable = false;
-	depthStencilStateDesc.StencilReadMask = D3D11_DEFAULT_STENCIL_READ_MASK;
-	depthStencilStateDesc.StencilWriteMask = D3D11_DEFAULT_STENCIL_WRITE_MASK;
-	depthStencilStateDesc.FrontFace.StencilFunc = D3D11_COMPARISON_ALWAYS;
-	depthStencilStateDesc.BackFace.StencilFunc = D3D11_COMPARISON_ALWAYS;
-	depthStencilStateDesc.FrontFace.StencilDepthFailOp = D3D11_STENCIL_OP_KEEP;
-	depthStencilStateDesc.BackFace.StencilDepthFailOp = D3D11_STENCIL_OP_KEEP;
-	depthStencilStateDesc.FrontFace.StencilPassOp = D3D11_STENCIL_OP_KEEP;
-	depthStencilStateDesc.BackFace.StencilPassOp = D3D11_STENCIL_OP_KEEP;
-	depthStencilStateDesc.FrontFace.StencilFailOp = D3D11_STENCIL_OP_KEEP;
-	depthStencilStateDesc.BackFace.StencilFailOp = D3D11_STENCIL_OP_KEEP;
-	if (FAILED(m_pD3dDevice->CreateDepthStencilState(&depthStencilStateDesc, m_pDepthStencilState.GetRef())))
+	// Every draw takes a 256 byte block, so the default part holds 16k draws.
+	if (g_Engine->RHIUploadRingMB) m_ConstantRingFrameSize = g_Engine->RHIUploadRingMB * 1024 * 1024;
+	if (!CreateConstantRing(m_ConstantRingFrameSize, m_ConstantRing))
 	{
-		SDL_Log("CreateDepthStencilState failed.");
+		SDL_Log("Creating the constant ring failed.");
 		return false;
 	}
+	m_ConstantRingStaging.resize(m_ConstantRingFrameSize * FramesInFlight);
+	m_ConstantRingAllocator.Init(m_ConstantRingFrameSize, FramesInFlight);
+
+	D3D11_QUERY_DESC fenceDesc;
+	ZeroMemory(&fenceDesc, sizeof(fenceDesc));
+	fenceDesc.Query = D3D11_QUERY_EVENT;
+	for (auto& fence : m_FrameFences)
+	{
+		if (FAILED(m_pD3dDevice->CreateQuery(&fenceDesc, fence.GetRef())))
+		{
+			SDL_Log("Creating the frame fences failed.");
+			return false;
+		}
+	}
 #pragma endregion
 
-#pragma region RasterState
-	// Raster state (defaults currently)
-	D3D11_RASTERIZER_DESC rasterDesc;
-	ZeroMemory(&rasterDesc, sizeof(rasterDesc));
-	rasterDesc.FillMode = D3D11_FILL_SOLID;
-	rasterDesc.CullMode = D3D11_CULL_BACK;
-	rasterDesc.FrontCounterClockwise = false;
-	rasterDesc.DepthBias = 0;
-	rasterDesc.SlopeScaledDepthBias = 0.f;
-	rasterDesc.DepthBiasClamp = 0.f;
-	rasterDesc.DepthClipEnable = true;
-	rasterDesc.ScissorEnable = false;
-	rasterDesc.MultisampleEnable = false;
-	rasterDesc.AntialiasedLineEnable = false;
-	if (FAILED(m_pD3dDevice->CreateRasterizerState(&rasterDesc, m_pRasterState.GetRef())))
+#pragma region RecordThreads
+	UniqueReleasePtr<ID3D11Device1> pDevice1;
+	if (FAILED(m_pD3dDevice->QueryInterface(__uuidof(ID3D11Device1), (void**)pDevice1.GetRef())))
 	{
-		SDL_Log("CreateRasterizerState failed.");
+		SDL_Log("The D3D11 RHI needs an ID3D11Device1.");
 		return false;
 	}
-	m_pD3dContext->RSSetState(m_pRasterState.get());
+
+	m_NumRecordSlots = g_Engine->RHIRecordThreads ? g_Engine->RHIRecordThreads : std::max(std::thread::hardware_concurrency(), 1u);
+	m_DeferredContexts.resize(m_NumRecordSlots);
+	m_RecordStateCaches.resize(m_NumRecordSlots);
+	for (uint32_t slot = 1; slot < m_NumRecordSlots; ++slot)
+	{
+		if (FAILED(pDevice1->CreateDeferredContext1(0, m_DeferredContexts[slot].GetRef())))
+		{
+			SDL_Log("Creating the deferred contexts failed.");
+			return false;
+		}
+	}
+	if (m_NumRecordSlots > 1) m_RecordThreads = std::make_unique<ThreadPool>(m_NumRecordSlots - 1);
+
+	// Drivers without command lists of their own have the runtime build them, which is slower to execute.
+	D3D11_FEATURE_DATA_THREADING threading;
+	ZeroMemory(&threading, sizeof(threading));
+	m_pD3dDevice->CheckFeatureSupport(D3D11_FEATURE_THREADING, &threading, sizeof(threading));
+	SDL_Log("D3D11 recording on %u threads, command lists %s.", m_NumRecordSlots, threading.DriverCommandLists ? "native" : "emulated");
 #pragma endregion
 
+	if (!RecreateBackBufferRTAndView(window.width, window.height)) return false;
+
 	CreateDebugTexture2D();
 	CreateResolveQuadBuffers();
-	RecreateOffscreenRenderTargets(window.width, window.height);
+	m_WindowWidth = window.width;
+	m_WindowHeight = window.height;
+	if (!UpdateFrameGraph())
+	{
+		SDL_Log("Compiling the frame graph failed.");
+		return false;
+	}
+	// Shaders build on the pool while the lighting resources are created, and only the pipelines wait for them.
+	auto shadersStart = std::chrono::steady_clock::now();
+	m_ShaderCache = std::make_unique<ShaderCache>(g_Engine->ShaderCacheDir, CreateShaderCompiler(), &g_Engine->threadPool);
 	LoadVertexShaders();
 	LoadPixelShaders();
 	CreateLightingResources();
+	if (!CreatePipelineStates())
+	{
+		SDL_Log("Creating the pipeline states failed.");
+		return false;
+	}
+	auto shaderStats = m_ShaderCache->GetStats();
+	SDL_Log("D3D11 shaders ready in %.1f ms, %u from cache, %u compiled.",
+		std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - shadersStart).count(), shaderStats.numHits, shaderStats.numMisses);
 
 	ImGui_ImplDX11_CreateDeviceObjects();
 
 	return true;
 }
 
-void D3D11RHI::RecreateBackBufferRTAndView(uint32_t windowWidth, uint32_t windowHeight)
+bool D3D11RHI::RecreateBackBufferRTAndView(uint32_t windowWidth, uint32_t windowHeight)
 {
-	assert(SUCCEEDED(m_pSwapChain->GetBuffer(0, __uuidof(m_pBackBufferRT.get()), (void**)m_pBackBufferRT.GetRef())));
-	assert(SUCCEEDED(m_pD3dDevice->CreateRenderTargetView(m_pBackBufferRT.get(), NULL, m_pBackBufferRTView.GetRef())));
+	if (FAILED(m_pSwapChain->GetBuffer(0, __uuidof(m_pBackBufferRT.get()), (void**)m_pBackBufferRT.GetRef())) ||
+		FAILED(m_pD3dDevice->CreateRenderTargetView(m_pBackBufferRT.get(), NULL, m_pBackBufferRTView.GetRef())))
+	{
+		SDL_Log("Creating the back buffer view failed");
+		return false;
+	}
 
 	// Set up the depth/stencil buffer
 	D3D11_TEXTURE2D_DESC depthStencilDesc;
@@ -184,8 +364,12 @@ void D3D11RHI::RecreateBackBufferRTAndView(uint32_t windowWidth, uint32_t window
 	if (m_pDepthStencilRTView) m_pDepthStencilRTView->Release();
 	if (m_pDepthStencilRT) m_pDepthStencilRT->Release();
 
-	assert(SUCCEEDED(m_pD3dDevice->CreateTexture2D(&depthStencilDesc, 0, m_pDepthStencilRT.GetRef())));
-	assert(SUCCEEDED(m_pD3dDevice->CreateDepthStencilView(m_pDepthStencilRT.get(), 0, m_pDepthStencilRTView.GetRef())));
+	if (FAILED(m_pD3dDevice->CreateTexture2D(&depthStencilDesc, 0, m_pDepthStencilRT.GetRef())) ||
+		FAILED(m_pD3dDevice->CreateDepthStencilView(m_pDepthStencilRT.get(), 0, m_pDepthStencilRTView.GetRef())))
+	{
+		SDL_Log("Creating the depth buffer failed");
+		return false;
+	}
 
 	D3D11_VIEWPORT viewport;
 	ZeroMemory(&viewport, sizeof(viewport));
@@ -196,6 +380,8 @@ void D3D11RHI::RecreateBackBufferRTAndView(uint32_t windowWidth, uint32_t window
 	viewport.TopLeftX = 0.f;
 	viewport.TopLeftY = 0.f;
 	m_pD3dContext->RSSetViewports(1, &viewport);
+	m_Viewport = viewport;
+	return true;
 }
 
 void D3D11RHI::CreateDebugTexture2D()
@@ -220,32 +406,225 @@ void D3D11RHI::HandleWindowResize(uint32_t windowWidth, uint32_t windowHeight)
 	m_pBackBufferRT->Release();
 	m_pSwapChain->ResizeBuffers(0, 0, 0, DXGI_FORMAT_UNKNOWN, 0);
 
-	RecreateBackBufferRTAndView(windowWidth, windowHeight);
-	RecreateOffscreenRenderTargets(windowWidth, windowHeight);
+	if (!RecreateBackBufferRTAndView(windowWidth, windowHeight)) return;
+	// The frame graph follows at the next geometry pass, so a drag's many events cost one swap per frame.
+	m_WindowWidth = windowWidth;
+	m_WindowHeight = windowHeight;
+	// The new views can reuse the old ones' addresses.
+	m_StateCache.Reset();
 
 	//ImGui_ImplDX11_InvalidateDeviceObjects();
 	//ImGui_ImplDX11_CreateDeviceObjects();
 
 }
 
-bool D3D11RHI::UpdateConstantBuffer(ID3D11Buffer* cbHandle, void* data, int numBytes)
+bool D3D11RHI::UpdateConstantBuffer(RHIBuffer cbHandle, const void* data, int numBytes)
+{
+	GPUBuffer* constantBuffer = m_Buffers.Get(ToHandle(cbHandle));
+	assert(constantBuffer && !constantBuffer->buffer);
+	assert(numBytes <= static_cast<int>(constantBuffer->contents.size()));
+
+	// Every update gets a fresh place in the ring, so draws already issued this frame keep their copy.
+	memcpy(constantBuffer->contents.data(), data, numBytes);
+	return WriteConstants(*constantBuffer);
+}
+
+void D3D11RHI::UpdateMaterialTable(const std::vector<GPUMaterial>& materials)
+{
+	if (materials.empty()) return;
+
+	// Rewritten in place each time textures are repacked, the driver keeping the old contents for draws still in
+	// flight. A table that outgrows the buffer gets one twice the size, so a growing scene reallocates rarely.
+	if (materials.size() > m_MaterialCapacity)
+	{
+		uint32_t capacity = std::max(static_cast<uint32_t>(materials.size()), 2 * m_MaterialCapacity);
+		D3D11_BUFFER_DESC bufferDesc;
+		ZeroMemory(&bufferDesc, sizeof(bufferDesc));
+		bufferDesc.Usage = D3D11_USAGE_DEFAULT;
+		bufferDesc.BindFlags = D3D11_BIND_SHADER_RESOURCE;
+		bufferDesc.ByteWidth = static_cast<UINT>(sizeof(GPUMaterial) * capacity);
+		UniqueReleasePtr<ID3D11Buffer> buffer;
+		if (FAILED(m_pD3dDevice->CreateBuffer(&bufferDesc, NULL, buffer.GetRef())))
+		{
+			SDL_Log("UpdateMaterialTable failed");
+			return;
+		}
+
+		D3D11_SHADER_RESOURCE_VIEW_DESC srvDesc;
+		ZeroMemory(&srvDesc, sizeof(srvDesc));
+		srvDesc.Format = DXGI_FORMAT_R32G32B32A32_UINT;
+		srvDesc.ViewDimension = D3D11_SRV_DIMENSION_BUFFER;
+		srvDesc.Buffer.FirstElement = 0;
+		srvDesc.Buffer.NumElements = static_cast<UINT>(capacity * sizeof(GPUMaterial) / sizeof(glm::uvec4));
+		UniqueReleasePtr<ID3D11ShaderResourceView> srv;
+		if (FAILED(m_pD3dDevice->CreateShaderResourceView(buffer.get(), &srvDesc, srv.GetRef())))
+		{
+			SDL_Log("UpdateMaterialTable failed to create the view");
+			return;
+		}
+
+		// Frames in flight may still read the old table.
+		if (m_MaterialTable) m_Resources.OnRetire(GPUResourceKind::Buffer, sizeof(GPUMaterial) * m_MaterialCapacity);
+		DeferRelease(m_MaterialTableSrv.release());
+		DeferRelease(m_MaterialTable.release());
+		m_Resources.OnCreate(GPUResourceKind::Buffer, bufferDesc.ByteWidth);
+		m_MaterialTable = std::move(buffer);
+		m_MaterialTableSrv = std::move(srv);
+		m_MaterialCapacity = capacity;
+	}
+
+	D3D11_BOX box = { 0, 0, 0, static_cast<UINT>(sizeof(GPUMaterial) * materials.size()), 1, 1 };
+	m_pD3dContext->UpdateSubresource(m_MaterialTable.get(), 0, &box, materials.data(), 0, 0);
+}
+
+void D3D11RHI::BeginFrame()
+{
+	if (m_FrameBegun) return;
+	m_FrameBegun = true;
+
+	// Whatever the last frame staged after its final draw goes out before its part stops being current.
+	FlushConstantRing();
+
+	uint32_t frameIndex = static_cast<uint32_t>(m_NumFrames % FramesInFlight);
+	if (m_FrameFenceIssued[frameIndex])
+	{
+		// A frame that has to wait here means the CPU is FramesInFlight frames ahead of the GPU.
+		ID3D11Query* fence = m_FrameFences[frameIndex].get();
+		if (m_pD3dContext->GetData(fence, nullptr, 0, 0) == S_FALSE)
+		{
+			m_ConstantRingAllocator.AddStall();
+			// Polling without D3D11_ASYNC_GETDATA_DONOTFLUSH keeps the queue moving; yield so the driver's
+			// threads get the core in the meantime.
+			while (m_pD3dContext->GetData(fence, nullptr, 0, 0) == S_FALSE) std::this_thread::yield();
+		}
+		m_FrameFenceIssued[frameIndex] = false;
+	}
+	m_FrameReleases[frameIndex].clear();
+	if (m_ConstantRingFull) GrowConstantRing();
+	m_ConstantRingAllocator.BeginFrame(frameIndex);
+}
+
+bool D3D11RHI::CreateConstantRing(uint32_t frameSize, UniqueReleasePtr<ID3D11Buffer>& ring)
+{
+	D3D11_BUFFER_DESC ringDesc;
+	ZeroMemory(&ringDesc, sizeof(ringDesc));
+	ringDesc.ByteWidth = frameSize * FramesInFlight;
+	ringDesc.Usage = D3D11_USAGE_DYNAMIC;
+	ringDesc.BindFlags = D3D11_BIND_CONSTANT_BUFFER;
+	ringDesc.CPUAccessFlags = D3D11_CPU_ACCESS_WRITE;
+	return SUCCEEDED(m_pD3dDevice->CreateBuffer(&ringDesc, NULL, ring.GetRef()));
+}
+
+void D3D11RHI::GrowConstantRing()
+{
+	m_ConstantRingFull = false;
+	if (m_ConstantRingFrameSize >= MaxConstantRingFrameSize) return;
+
+	// Buffers staged in earlier frames write themselves into the new ring when next bound, and the old one stays
+	// alive until the frames in flight that read it are done.
+	uint32_t frameSize = m_ConstantRingFrameSize < MaxConstantRingFrameSize / 2 ? 2 * m_ConstantRingFrameSize : MaxConstantRingFrameSize;
+	UniqueReleasePtr<ID3D11Buffer> ring;
+	if (!CreateConstantRing(frameSize, ring))
+	{
+		SDL_Log("Growing the D3D11 constant ring to %u MB per frame failed, draws that don't fit are still dropped.", frameSize / (1024 * 1024));
+		return;
+	}
+	DeferRelease(m_ConstantRing.release());
+	m_ConstantRing = std::move(ring);
+	m_ConstantRingStaging.assign(frameSize * FramesInFlight, 0);
+	m_ConstantRingAllocator.Resize(frameSize);
+	m_ConstantRingFrameSize = frameSize;
+	m_ConstantRingDiscarded = false;
+	m_ConstantRingDirtyBegin = m_ConstantRingDirtyEnd = 0;
+	SDL_Log("The D3D11 constant ring was full and dropped draws, it now has %u MB per frame%s.", frameSize / (1024 * 1024),
+		frameSize == MaxConstantRingFrameSize ? ", its most" : "");
+}
+
+bool D3D11RHI::WriteConstants(GPUBuffer& buffer)
+{
+	BeginFrame();
+
+	// Offsets and sizes are bound in whole 16 constant (256 byte) blocks.
+	const uint32_t blockSize = 256;
+	uint32_t size = UploadRing::AlignUp(static_cast<uint32_t>(buffer.contents.size()), blockSize);
+	uint32_t offset;
+	if (!m_ConstantRingAllocator.Allocate(size, blockSize, offset))
+	{
+		m_ConstantRingFull = true;
+		return false;
+	}
+
+	memcpy(m_ConstantRingStaging.data() + offset, buffer.contents.data(), buffer.contents.size());
+	if (m_ConstantRingDirtyBegin == m_ConstantRingDirtyEnd)
+	{
+		m_ConstantRingDirtyBegin = offset;
+		m_ConstantRingDirtyEnd = offset + size;
+	}
+	else
+	{
+		m_ConstantRingDirtyBegin = std::min(m_ConstantRingDirtyBegin, offset);
+		m_ConstantRingDirtyEnd = std::max(m_ConstantRingDirtyEnd, offset + size);
+	}
+
+	buffer.ringOffset = offset;
+	buffer.ringFrame = m_NumFrames;
+	return true;
+}
+
+bool D3D11RHI::FlushConstantRing()
 {
-	auto d3dCbHandle = reinterpret_cast<ID3D11Resource*>(cbHandle);
+	if (m_ConstantRingDirtyBegin == m_ConstantRingDirtyEnd) return true;
 
-	D3D11_MAPPED_SUBRESOURCE cBuffer;
-	if (FAILED(m_pD3dContext->Map(d3dCbHandle, 0, D3D11_MAP_WRITE_DISCARD, 0, &cBuffer)))
+	// The fences keep the GPU out of the dirty range, so the ring is never renamed. Only the first map
+	// discards, as a dynamic buffer's contents are undefined until it has been.
+	D3D11_MAP mapType = m_ConstantRingDiscarded ? D3D11_MAP_WRITE_NO_OVERWRITE : D3D11_MAP_WRITE_DISCARD;
+	D3D11_MAPPED_SUBRESOURCE mapped;
+	if (FAILED(m_pD3dContext->Map(m_ConstantRing.get(), 0, mapType, 0, &mapped)))
 	{
-		assert(false);
+		// The range isn't retried, so it can't leak into another frame's part of the ring. Buffers staged
+		// into it this frame write themselves again next frame.
+		SDL_Log("Mapping the D3D11 constant ring failed, draws using constants staged this frame are skipped.");
+		m_ConstantRingDirtyBegin = m_ConstantRingDirtyEnd = 0;
 		return false;
 	}
+	memcpy(static_cast<char*>(mapped.pData) + m_ConstantRingDirtyBegin, m_ConstantRingStaging.data() + m_ConstantRingDirtyBegin,
+		m_ConstantRingDirtyEnd - m_ConstantRingDirtyBegin);
+	m_pD3dContext->Unmap(m_ConstantRing.get(), 0);
+
+	m_ConstantRingDiscarded = true;
+	m_ConstantRingDirtyBegin = m_ConstantRingDirtyEnd = 0;
+	return true;
+}
+
+bool D3D11RHI::StageConstantBuffer(RHIBuffer buffer, UINT& firstConstant, UINT& numConstants)
+{
+	GPUBuffer* constantBuffer = m_Buffers.Get(ToHandle(buffer));
+	assert(constantBuffer && !constantBuffer->buffer);
+
+	// Buffers not updated this frame take their last contents into it.
+	if (constantBuffer->ringFrame != m_NumFrames && !WriteConstants(*constantBuffer)) return false;
 
-	memcpy(cBuffer.pData, data, numBytes);
-	m_pD3dContext->Unmap(d3dCbHandle, 0);
+	firstConstant = constantBuffer->ringOffset / 16;
+	numConstants = UploadRing::AlignUp(static_cast<uint32_t>(constantBuffer->contents.size()), 256) / 16;
+	return true;
+}
+
+bool D3D11RHI::BindConstantBuffer(RHIStateSlot slot, RHIBuffer buffer)
+{
+	UINT firstConstant;
+	UINT numConstants;
+	if (!StageConstantBuffer(buffer, firstConstant, numConstants) || !FlushConstantRing()) return false;
+
+	ID3D11Buffer* ring = m_ConstantRing.get();
+	if (m_StateCache.Set(slot, ring, firstConstant, numConstants))
+	{
+		if (slot == RHIStateSlot::VSConstantBuffer) m_pD3dContext->VSSetConstantBuffers1(0, 1, &ring, &firstConstant, &numConstants);
+		else m_pD3dContext->PSSetConstantBuffers1(0, 1, &ring, &firstConstant, &numConstants);
+	}
 	return true;
 }
 
-template<class T>
-ID3D11Buffer* D3D11RHI::CreateVertexBuffer(const T* data, uint32_t numVertices)
+RHIBuffer D3D11RHI::CreateVertexBuffer(const void* data, uint32_t stride, uint32_t numVertices)
 {
 	assert(data);
 	assert(numVertices > 0);
@@ -254,26 +633,25 @@ ID3D11Buffer* D3D11RHI::CreateVertexBuffer(const T* data, uint32_t numVertices)
 	ZeroMemory(&bufferDesc, sizeof(bufferDesc));
 	bufferDesc.Usage = D3D11_USAGE_DEFAULT;
 	bufferDesc.BindFlags = D3D11_BIND_VERTEX_BUFFER;
-	bufferDesc.ByteWidth = sizeof(T) * numVertices;
+	bufferDesc.ByteWidth = stride * numVertices;
 
 	D3D11_SUBRESOURCE_DATA dataDesc;
 	ZeroMemory(&dataDesc, sizeof(dataDesc));
 	dataDesc.pSysMem = data;
 
-	ID3D11Buffer* vertexBufferHandle;
-	if (FAILED(m_pD3dDevice->CreateBuffer(&bufferDesc, &dataDesc, &vertexBufferHandle)))
+	GPUBuffer vertexBuffer = {};
+	if (FAILED(m_pD3dDevice->CreateBuffer(&bufferDesc, &dataDesc, vertexBuffer.buffer.GetRef())))
 	{
 		SDL_Log("CreateVertexBuffer failed");
 		return NULL;
 	}
 
-	m_ReleasableObjects.push_back(vertexBufferHandle);
-	return vertexBufferHandle;
+	vertexBuffer.numBytes = bufferDesc.ByteWidth;
+	m_Resources.OnCreate(GPUResourceKind::Buffer, vertexBuffer.numBytes);
+	return ToRHI(m_Buffers.Insert(std::move(vertexBuffer)));
 }
-template ID3D11Buffer* D3D11RHI::CreateVertexBuffer(const aiVector3D* data, uint32_t numVertices);
-template ID3D11Buffer* D3D11RHI::CreateVertexBuffer(const glm::vec2* data, uint32_t numVertices);
 
-ID3D11Buffer* D3D11RHI::CreateIndexBuffer(const std::vector<IndexType>& indices)
+RHIBuffer D3D11RHI::CreateIndexBuffer(const std::vector<IndexType>& indices)
 {
 	assert(indices.size() > 0);
 	D3D11_BUFFER_DESC bufferDesc;
@@ -286,80 +664,225 @@ ID3D11Buffer* D3D11RHI::CreateIndexBuffer(const std::vector<IndexType>& indices)
 	ZeroMemory(&dataDesc, sizeof(dataDesc));
 	dataDesc.pSysMem = indices.data();
 
-	ID3D11Buffer* indexBufferHandle;
-	if (FAILED(m_pD3dDevice->CreateBuffer(&bufferDesc, &dataDesc, &indexBufferHandle)))
+	GPUBuffer indexBuffer = {};
+	if (FAILED(m_pD3dDevice->CreateBuffer(&bufferDesc, &dataDesc, indexBuffer.buffer.GetRef())))
 	{
 		SDL_Log("CreateIndexBuffer failed");
 		return NULL;
 	}
 
-	m_ReleasableObjects.push_back(indexBufferHandle);
-	return indexBufferHandle;
+	indexBuffer.numBytes = bufferDesc.ByteWidth;
+	m_Resources.OnCreate(GPUResourceKind::Buffer, indexBuffer.numBytes);
+	return ToRHI(m_Buffers.Insert(std::move(indexBuffer)));
 }
 
-ID3D11Buffer* D3D11RHI::CreateConstantBuffer(int size)
+RHIBuffer D3D11RHI::CreateConstantBuffer(int size)
 {
-	D3D11_BUFFER_DESC constantBufferDesc;
-	ZeroMemory(&constantBufferDesc, sizeof(constantBufferDesc));
-	constantBufferDesc.ByteWidth = size;
-	constantBufferDesc.Usage = D3D11_USAGE_DYNAMIC;
-	constantBufferDesc.BindFlags = D3D11_BIND_CONSTANT_BUFFER;
-	constantBufferDesc.CPUAccessFlags = D3D11_CPU_ACCESS_WRITE;
-
-	ID3D11Buffer* constantBufferHandle;
-	if (FAILED(m_pD3dDevice->CreateBuffer(&constantBufferDesc, NULL, &constantBufferHandle)))
-	{
-		SDL_Log("CreateConstantBuffer failed!");
-		return NULL;
-	}
-
-	m_ReleasableObjects.push_back(constantBufferHandle);
-	return constantBufferHandle;
+	assert(size > 0);
+
+	// No D3D11 buffer of its own, updates are written to the constant ring.
+	GPUBuffer constantBuffer = {};
+	constantBuffer.contents.resize(size);
+	constantBuffer.ringFrame = UINT64_MAX;
+	constantBuffer.numBytes = size;
+	m_Resources.OnCreate(GPUResourceKind::Buffer, constantBuffer.numBytes);
+	return ToRHI(m_Buffers.Insert(std::move(constantBuffer)));
 }
 
-ID3D11Texture2D* D3D11RHI::CreateTexture2D(const CPUTexture& cpuTexture)
+RHITexture D3D11RHI::CreateTexture2D(const CPUTexture& cpuTexture)
 {
 	auto max = glm::max(cpuTexture.width, cpuTexture.height);
 	int mipLevels = 1 + glm::log2(float(max));
 
+	// Mips generated on the CPU (e.g. by the decode workers) are uploaded as initial data,
+	// otherwise the GPU generates them, which needs the texture to be a render target.
+	bool hasCpuMips = !cpuTexture.mips.empty();
+	assert(!hasCpuMips || cpuTexture.mips.size() + 1 == mipLevels);
+	// Block-compressed textures can't be render targets, so they must come with their mips.
+	bool isBlockCompressed = cpuTexture.format == CPUTextureFormat::BC4;
+	assert(hasCpuMips || !isBlockCompressed);
+
 	D3D11_TEXTURE2D_DESC textureDesc;
 	ZeroMemory(&textureDesc, sizeof(textureDesc));
 	textureDesc.Width = cpuTexture.width;
 	textureDesc.Height = cpuTexture.height;
 	textureDesc.MipLevels = mipLevels;
 	textureDesc.ArraySize = 1;
-	textureDesc.Format = DXGI_FORMAT_B8G8R8A8_UNORM;
+	textureDesc.Format = isBlockCompressed ? DXGI_FORMAT_BC4_UNORM : DXGI_FORMAT_B8G8R8A8_UNORM;
 	textureDesc.SampleDesc.Count = 1;
 	textureDesc.SampleDesc.Quality = 0;
 	textureDesc.Usage = D3D11_USAGE_DEFAULT;
-	textureDesc.BindFlags = D3D11_BIND_SHADER_RESOURCE |
-		D3D11_BIND_RENDER_TARGET;
+	textureDesc.BindFlags = hasCpuMips ? D3D11_BIND_SHADER_RESOURCE : D3D11_BIND_SHADER_RESOURCE | D3D11_BIND_RENDER_TARGET;
 	textureDesc.CPUAccessFlags = 0;
-	textureDesc.MiscFlags = D3D11_RESOURCE_MISC_GENERATE_MIPS;
+	textureDesc.MiscFlags = hasCpuMips ? 0 : D3D11_RESOURCE_MISC_GENERATE_MIPS;
 
 	GPUTexture gpuTexture;
-	assert(SUCCEEDED(m_pD3dDevice->CreateTexture2D(&textureDesc, NULL, &gpuTexture.texture)));
-	m_ReleasableObjects.push_back(gpuTexture.texture);
+	if (hasCpuMips)
+	{
+		std::vector<D3D11_SUBRESOURCE_DATA> initialData(mipLevels);
+		int mipWidth = cpuTexture.width;
+		for (int mip = 0; mip < mipLevels; ++mip)
+		{
+			const auto& level = mip == 0 ? cpuTexture.data : cpuTexture.mips[mip - 1];
+			initialData[mip].pSysMem = level.data();
+			initialData[mip].SysMemPitch = TextureUtils::CalcRowPitch(mipWidth, cpuTexture.format);
+			initialData[mip].SysMemSlicePitch = 0;
+			mipWidth = glm::max(mipWidth / 2, 1);
+		}
+		if (FAILED(m_pD3dDevice->CreateTexture2D(&textureDesc, initialData.data(), gpuTexture.texture.GetRef())))
+		{
+			SDL_Log("CreateTexture2D failed");
+			return NULL;
+		}
+	}
+	else
+	{
+		if (FAILED(m_pD3dDevice->CreateTexture2D(&textureDesc, NULL, gpuTexture.texture.GetRef())))
+		{
+			SDL_Log("CreateTexture2D failed");
+			return NULL;
+		}
 
-	UINT destSubresource = D3D11CalcSubresource(0, 0, textureDesc.MipLevels);
-	int rowPitch = cpuTexture.width * 4;
-	int depthPitch = cpuTexture.height * rowPitch;
-	m_pD3dContext->UpdateSubresource(gpuTexture.texture, destSubresource, NULL, cpuTexture.data.data(), rowPitch, depthPitch);
+		UINT destSubresource = D3D11CalcSubresource(0, 0, textureDesc.MipLevels);
+		int rowPitch = cpuTexture.width * 4;
+		int depthPitch = cpuTexture.height * rowPitch;
+		m_pD3dContext->UpdateSubresource(gpuTexture.texture.get(), destSubresource, NULL, cpuTexture.data.data(), rowPitch, depthPitch);
+	}
 
-	assert(SUCCEEDED(m_pD3dDevice->CreateShaderResourceView(gpuTexture.texture, NULL, &gpuTexture.srv)));
-	m_ReleasableObjects.push_back(gpuTexture.srv);
+	// Always viewed as an array so the geometry shader can sample standalone and packed textures alike.
+	D3D11_SHADER_RESOURCE_VIEW_DESC srvDesc;
+	ZeroMemory(&srvDesc, sizeof(srvDesc));
+	srvDesc.Format = textureDesc.Format;
+	srvDesc.ViewDimension = D3D11_SRV_DIMENSION_TEXTURE2DARRAY;
+	srvDesc.Texture2DArray.MostDetailedMip = 0;
+	srvDesc.Texture2DArray.MipLevels = textureDesc.MipLevels;
+	srvDesc.Texture2DArray.FirstArraySlice = 0;
+	srvDesc.Texture2DArray.ArraySize = 1;
+	if (FAILED(m_pD3dDevice->CreateShaderResourceView(gpuTexture.texture.get(), &srvDesc, gpuTexture.srv.GetRef())))
+	{
+		SDL_Log("CreateTexture2D failed to create the view");
+		return NULL;
+	}
 
-	m_pD3dContext->GenerateMips(gpuTexture.srv);
+	if (!hasCpuMips) m_pD3dContext->GenerateMips(gpuTexture.srv.get());
 
-	gpuTexture.sampler = CreateSampler();
+	gpuTexture.sampler = GetDefaultSampler();
+	gpuTexture.numBytes = CalcTextureBytes(textureDesc);
+	m_Resources.OnCreate(GPUResourceKind::Texture, gpuTexture.numBytes);
 
-	m_ReleasableObjects.push_back(gpuTexture.sampler);
-	// store the gpuTexture in the map, and return the texture pointer as the handle;
-	m_GpuTextureMap.insert({ gpuTexture.texture, gpuTexture });
-	return gpuTexture.texture;
+	return ToRHI(m_Textures.Insert(std::move(gpuTexture)));
 }
 
-ID3D11SamplerState* D3D11RHI::CreateSampler()
+RHITexture D3D11RHI::CreateTexture2DArray(const TextureArrayPlan& arrayPlan)
+{
+	assert(!arrayPlan.slices.empty());
+
+	D3D11_TEXTURE2D_DESC textureDesc;
+	ZeroMemory(&textureDesc, sizeof(textureDesc));
+	textureDesc.Width = arrayPlan.width;
+	textureDesc.Height = arrayPlan.height;
+	textureDesc.MipLevels = arrayPlan.mipLevels;
+	textureDesc.ArraySize = static_cast<UINT>(arrayPlan.slices.size());
+	textureDesc.Format = static_cast<DXGI_FORMAT>(arrayPlan.format);
+	textureDesc.SampleDesc.Count = 1;
+	textureDesc.SampleDesc.Quality = 0;
+	textureDesc.Usage = D3D11_USAGE_DEFAULT;
+	textureDesc.BindFlags = D3D11_BIND_SHADER_RESOURCE;
+	textureDesc.CPUAccessFlags = 0;
+	textureDesc.MiscFlags = 0;
+
+	GPUTexture gpuTexture;
+	if (FAILED(m_pD3dDevice->CreateTexture2D(&textureDesc, NULL, gpuTexture.texture.GetRef())))
+	{
+		SDL_Log("CreateTexture2DArray failed");
+		return NULL;
+	}
+
+	// The source textures already have their mips generated, so copy every level across.
+	for (UINT slice = 0; slice < textureDesc.ArraySize; ++slice)
+	{
+		for (UINT mip = 0; mip < textureDesc.MipLevels; ++mip)
+		{
+			m_pD3dContext->CopySubresourceRegion(
+				gpuTexture.texture.get(), D3D11CalcSubresource(mip, slice, textureDesc.MipLevels), 0, 0, 0,
+				GetTexture(arrayPlan.slices[slice]).texture.get(), D3D11CalcSubresource(mip, 0, textureDesc.MipLevels), NULL);
+		}
+	}
+
+	D3D11_SHADER_RESOURCE_VIEW_DESC srvDesc;
+	ZeroMemory(&srvDesc, sizeof(srvDesc));
+	srvDesc.Format = textureDesc.Format;
+	srvDesc.ViewDimension = D3D11_SRV_DIMENSION_TEXTURE2DARRAY;
+	srvDesc.Texture2DArray.MostDetailedMip = 0;
+	srvDesc.Texture2DArray.MipLevels = textureDesc.MipLevels;
+	srvDesc.Texture2DArray.FirstArraySlice = 0;
+	srvDesc.Texture2DArray.ArraySize = textureDesc.ArraySize;
+	if (FAILED(m_pD3dDevice->CreateShaderResourceView(gpuTexture.texture.get(), &srvDesc, gpuTexture.srv.GetRef())))
+	{
+		SDL_Log("CreateTexture2DArray failed to create the view");
+		return NULL;
+	}
+
+	gpuTexture.sampler = GetDefaultSampler();
+	gpuTexture.numBytes = CalcTextureBytes(textureDesc);
+	m_Resources.OnCreate(GPUResourceKind::Texture, gpuTexture.numBytes);
+
+	return ToRHI(m_Textures.Insert(std::move(gpuTexture)));
+}
+
+void D3D11RHI::ReleaseTexture2D(RHITexture texture)
+{
+	GPUTexture* gpuTexture = m_Textures.Get(ToHandle(texture));
+	assert(gpuTexture);
+	assert(texture != m_DebugTexture2D);
+
+	// Frames in flight may still sample it. The sampler is shared through the sampler cache, so only the
+	// texture and its view go.
+	DeferRelease(gpuTexture->srv.release());
+	DeferRelease(gpuTexture->texture.release());
+	m_Resources.OnRetire(GPUResourceKind::Texture, gpuTexture->numBytes);
+	m_Textures.Remove(ToHandle(texture));
+}
+
+void D3D11RHI::DeferRelease(ID3D11DeviceChild* object)
+{
+	if (!object) return;
+
+	// Begun so the frame gets a fence, even if nothing else happens in it.
+	BeginFrame();
+	m_FrameReleases[m_NumFrames % FramesInFlight].emplace_back(object);
+}
+
+TexturePackingInput D3D11RHI::GetTexturePackingInput(RHITexture texture) const
+{
+	D3D11_TEXTURE2D_DESC textureDesc;
+	GetTexture(texture).texture->GetDesc(&textureDesc);
+
+	TexturePackingInput input;
+	input.texture = texture;
+	input.width = textureDesc.Width;
+	input.height = textureDesc.Height;
+	input.mipLevels = textureDesc.MipLevels;
+	input.format = textureDesc.Format;
+	return input;
+}
+
+ID3D11SamplerState* D3D11RHI::GetSampler(const D3D11_SAMPLER_DESC& samplerDesc)
+{
+	auto sampler = m_SamplerCache.Get(samplerDesc, [&](const D3D11_SAMPLER_DESC& desc, ID3D11SamplerState*& object)
+	{
+		if (FAILED(m_pD3dDevice->CreateSamplerState(&desc, &object)))
+		{
+			SDL_Log("CreateSamplerState failed!");
+			return false;
+		}
+		m_ReleasableObjects.push_back(object);
+		return true;
+	});
+	return sampler ? *sampler : NULL;
+}
+
+ID3D11SamplerState* D3D11RHI::GetDefaultSampler()
 {
 	D3D11_SAMPLER_DESC samplerDesc;
 	ZeroMemory(&samplerDesc, sizeof(samplerDesc));
@@ -371,30 +894,123 @@ ID3D11SamplerState* D3D11RHI::CreateSampler()
 	samplerDesc.MinLOD = 0;
 	samplerDesc.MaxLOD = D3D11_FLOAT32_MAX;
 
-	ID3D11SamplerState* sampler;
-	assert(SUCCEEDED(m_pD3dDevice->CreateSamplerState(&samplerDesc, &sampler)));
-	return sampler;
+	return GetSampler(samplerDesc);
 }
 
-ID3D11Texture2D* D3D11RHI::CreateRenderTargetColor(const RenderTargetCreateInfo& rtCreateInfo)
+ID3D11BlendState* D3D11RHI::GetBlendState(const D3D11_BLEND_DESC& blendDesc)
 {
-	GPURenderTarget gpuRt = _CreateRenderTargetColor(rtCreateInfo);
+	auto blendState = m_BlendStateCache.Get(blendDesc, [&](const D3D11_BLEND_DESC& desc, ID3D11BlendState*& object)
+	{
+		if (FAILED(m_pD3dDevice->CreateBlendState(&desc, &object)))
+		{
+			SDL_Log("CreateBlendState failed!");
+			return false;
+		}
+		m_ReleasableObjects.push_back(object);
+		return true;
+	});
+	return blendState ? *blendState : NULL;
+}
+
+ID3D11DepthStencilState* D3D11RHI::GetDepthStencilState(const D3D11_DEPTH_STENCIL_DESC& depthStencilDesc)
+{
+	auto depthStencilState = m_DepthStencilStateCache.Get(depthStencilDesc, [&](const D3D11_DEPTH_STENCIL_DESC& desc, ID3D11DepthStencilState*& object)
+	{
+		if (FAILED(m_pD3dDevice->CreateDepthStencilState(&desc, &object)))
+		{
+			SDL_Log("CreateDepthStencilState failed!");
+			return false;
+		}
+		m_ReleasableObjects.push_back(object);
+		return true;
+	});
+	return depthStencilState ? *depthStencilState : NULL;
+}
 
-	auto ret = gpuRt.texture.get();
-	m_GpuRenderTargetMap.insert({ ret, std::move(gpuRt) });
-	return ret;
+ID3D11RasterizerState* D3D11RHI::GetRasterizerState(const D3D11_RASTERIZER_DESC& rasterizerDesc)
+{
+	auto rasterizerState = m_RasterizerStateCache.Get(rasterizerDesc, [&](const D3D11_RASTERIZER_DESC& desc, ID3D11RasterizerState*& object)
+	{
+		if (FAILED(m_pD3dDevice->CreateRasterizerState(&desc, &object)))
+		{
+			SDL_Log("CreateRasterizerState failed!");
+			return false;
+		}
+		m_ReleasableObjects.push_back(object);
+		return true;
+	});
+	return rasterizerState ? *rasterizerState : NULL;
 }
 
-GPURenderTarget D3D11RHI::_CreateRenderTargetColor(const RenderTargetCreateInfo& rtCreateInfo)
+const GPUPipelineState* D3D11RHI::GetPipelineState(const GPUPipelineStateDesc& pipelineDesc)
+{
+	// Keyed by the objects it resolves to, so pipelines differing only in how their states were described share one.
+	GPUPipelineState pipeline;
+	ZeroMemory(&pipeline, sizeof(pipeline));
+	pipeline.inputLayout = pipelineDesc.shader->inputLayout.get();
+	pipeline.vertexShader = pipelineDesc.shader->vertexShader.get();
+	pipeline.pixelShader = pipelineDesc.shader->pixelShader.get();
+	pipeline.blendState = GetBlendState(pipelineDesc.blend);
+	pipeline.depthStencilState = GetDepthStencilState(pipelineDesc.depthStencil);
+	pipeline.rasterizerState = GetRasterizerState(pipelineDesc.rasterizer);
+	pipeline.topology = pipelineDesc.topology;
+	if (!pipeline.blendState || !pipeline.depthStencilState || !pipeline.rasterizerState) return nullptr;
+
+	return m_PipelineCache.Get(pipeline, [](const GPUPipelineState& desc, GPUPipelineState& object)
+	{
+		memcpy(&object, &desc, sizeof(desc));
+		return true;
+	});
+}
+
+ID3D11Buffer* D3D11RHI::GetBuffer(RHIBuffer buffer) const
+{
+	// Stale handles stop here instead of binding whatever reused the slot.
+	const auto* gpuBuffer = m_Buffers.Get(ToHandle(buffer));
+	assert(gpuBuffer && gpuBuffer->buffer);
+	return gpuBuffer->buffer.get();
+}
+
+const GPUTexture& D3D11RHI::GetTexture(RHITexture texture) const
+{
+	const auto* gpuTexture = m_Textures.Get(ToHandle(texture));
+	assert(gpuTexture);
+	return *gpuTexture;
+}
+
+GPURenderTarget D3D11RHI::AcquireRenderTarget(const RenderTargetCreateInfo& rtCreateInfo)
 {
 	GPURenderTarget gpuRt;
+	m_RenderTargetPool.Acquire(rtCreateInfo, gpuRt, [&](const RenderTargetCreateInfo& info, GPURenderTarget& created)
+	{
+		return _CreateRenderTargetColor(info, created);
+	});
+	return gpuRt;
+}
 
+void D3D11RHI::ReleaseRenderTarget(const RenderTargetCreateInfo& rtCreateInfo, GPURenderTarget& renderTarget)
+{
+	if (!renderTarget.texture) return;
+	m_RenderTargetPool.Release(rtCreateInfo, std::move(renderTarget), m_NumFrames);
+	renderTarget = GPURenderTarget();
+}
+
+void D3D11RHI::RetireRenderTarget(GPURenderTarget& renderTarget)
+{
+	DeferRelease(renderTarget.srv.release());
+	DeferRelease(renderTarget.rtv.release());
+	DeferRelease(renderTarget.texture.release());
+	m_Resources.OnRetire(GPUResourceKind::RenderTarget, renderTarget.numBytes);
+}
+
+bool D3D11RHI::_CreateRenderTargetColor(const RenderTargetCreateInfo& rtCreateInfo, GPURenderTarget& gpuRt)
+{
 	D3D11_TEXTURE2D_DESC textureDesc;
 	ZeroMemory(&textureDesc, sizeof(textureDesc));
 	textureDesc.ArraySize = 1;
 	textureDesc.BindFlags = D3D11_BIND_RENDER_TARGET | D3D11_BIND_SHADER_RESOURCE;
 	textureDesc.CPUAccessFlags = 0;
-	textureDesc.Format = DXGI_FORMAT_R16G16B16A16_FLOAT;
+	textureDesc.Format = rtCreateInfo.format;
 	textureDesc.Width = rtCreateInfo.width;
 	textureDesc.Height = rtCreateInfo.height;
 	textureDesc.MipLevels = 1;
@@ -402,14 +1018,23 @@ GPURenderTarget D3D11RHI::_CreateRenderTargetColor(const RenderTargetCreateInfo&
 	textureDesc.SampleDesc.Count = 1;
 	textureDesc.SampleDesc.Quality = 0;
 	textureDesc.Usage = D3D11_USAGE_DEFAULT;
-	assert(SUCCEEDED(m_pD3dDevice->CreateTexture2D(&textureDesc, 0, gpuRt.texture.GetRef())));
+	if (FAILED(m_pD3dDevice->CreateTexture2D(&textureDesc, 0, gpuRt.texture.GetRef())))
+	{
+		SDL_Log("Creating a %ux%u render target failed", rtCreateInfo.width, rtCreateInfo.height);
+		return false;
+	}
 
 	D3D11_RENDER_TARGET_VIEW_DESC rtvDesc;
 	ZeroMemory(&rtvDesc, sizeof(rtvDesc));
 	rtvDesc.Format = textureDesc.Format;
 	rtvDesc.ViewDimension = D3D11_RTV_DIMENSION_TEXTURE2D;
 	rtvDesc.Texture2D.MipSlice = 0;
-	assert(SUCCEEDED(m_pD3dDevice->CreateRenderTargetView(gpuRt.texture.get(), 0, gpuRt.rtv.GetRef())));
+	if (FAILED(m_pD3dDevice->CreateRenderTargetView(gpuRt.texture.get(), 0, gpuRt.rtv.GetRef())))
+	{
+		SDL_Log("Creating a render target view failed");
+		gpuRt = GPURenderTarget();
+		return false;
+	}
 
 	D3D11_SHADER_RESOURCE_VIEW_DESC srvDesc;
 	ZeroMemory(&srvDesc, sizeof(srvDesc));
@@ -417,105 +1042,69 @@ GPURenderTarget D3D11RHI::_CreateRenderTargetColor(const RenderTargetCreateInfo&
 	srvDesc.ViewDimension = D3D11_SRV_DIMENSION_TEXTURE2D;
 	srvDesc.Texture2D.MostDetailedMip = 0;
 	srvDesc.Texture2D.MipLevels = 1;
-	assert(SUCCEEDED(m_pD3dDevice->CreateShaderResourceView(gpuRt.texture.get(), &srvDesc, gpuRt.srv.GetRef())));
+	if (FAILED(m_pD3dDevice->CreateShaderResourceView(gpuRt.texture.get(), &srvDesc, gpuRt.srv.GetRef())))
+	{
+		SDL_Log("Creating a render target's shader resource view failed");
+		gpuRt = GPURenderTarget();
+		return false;
+	}
 
-	return gpuRt;
+	gpuRt.numBytes = CalcTextureBytes(textureDesc);
+	m_Resources.OnCreate(GPUResourceKind::RenderTarget, gpuRt.numBytes);
+	return true;
 }
 
-//ID3D11Texture2D* D3D11RHI::CreateRenderTargetDepth(const RenderTargetCreateInfo& rtCreateInfo)
-//{
-//	GPURenderTarget gpuRt;
-//
-//	D3D11_TEXTURE2D_DESC textureDesc;
-//	ZeroMemory(&textureDesc, sizeof(textureDesc));
-//	textureDesc.ArraySize = 1;
-//	textureDesc.BindFlags = D3D11_BIND_RENDER_TARGET | D3D11_BIND_SHADER_RESOURCE;
-//	textureDesc.CPUAccessFlags = 0;
-//	textureDesc.Format = DXGI_FORMAT_R16_FLOAT;
-//	textureDesc.Width = rtCreateInfo.width;
-//	textureDesc.Height = rtCreateInfo.height;
-//	textureDesc.MipLevels = 1;
-//	textureDesc.MiscFlags = 0;
-//	textureDesc.SampleDesc.Count = 1;
-//	textureDesc.SampleDesc.Quality = 0;
-//	textureDesc.Usage = D3D11_USAGE_DEFAULT;
-//	assert(SUCCEEDED(m_pD3dDevice->CreateTexture2D(&textureDesc, 0, &gpuRt.texture)));
-//	m_ReleasableObjects.push_back(gpuRt.texture);
-//
-//	D3D11_RENDER_TARGET_VIEW_DESC rtvDesc;
-//	ZeroMemory(&rtvDesc, sizeof(rtvDesc));
-//	rtvDesc.Format = textureDesc.Format;
-//	rtvDesc.ViewDimension = D3D11_RTV_DIMENSION_TEXTURE2D;
-//	rtvDesc.Texture2D.MipSlice = 0;
-//	assert(SUCCEEDED(m_pD3dDevice->CreateRenderTargetView(gpuRt.texture, 0, &gpuRt.rtv)));
-//	m_ReleasableObjects.push_back(gpuRt.rtv);
-//
-//	D3D11_SHADER_RESOURCE_VIEW_DESC srvDesc;
-//	ZeroMemory(&srvDesc, sizeof(srvDesc));
-//	srvDesc.Format = textureDesc.Format;
-//	srvDesc.ViewDimension = D3D11_SRV_DIMENSION_TEXTURE2D;
-//	srvDesc.Texture2D.MostDetailedMip = 0;
-//	srvDesc.Texture2D.MipLevels = 1;
-//	assert(SUCCEEDED(m_pD3dDevice->CreateShaderResourceView(gpuRt.texture, &srvDesc, &gpuRt.srv)));
-//	m_ReleasableObjects.push_back(gpuRt.srv);
-//
-//	m_GpuRenderTargetMap.insert({ gpuRt.texture, gpuRt });
-//	return gpuRt.texture;
-//}
-
-const std::string shaderRelativeDir = "..\\..\\..\\..\\Source\\Shaders\\";
-
-void D3D11RHI::LoadVertexShader(const std::string& name, GPUShader& shader, const std::vector<D3D11_INPUT_ELEMENT_DESC>& vertexLayout) {
-
-	auto vsData = FileUtils::LoadFile(shaderRelativeDir + name + ".hlsl");
-	ID3DBlob* blob = nullptr;
-	assert(SUCCEEDED(D3DCompile(vsData.data(), vsData.size(), NULL, NULL, NULL, "main", "vs_4_0", 0, 0, &blob, NULL)));
-	assert(blob != NULL); // NB: Pass ID3D10Blob* pErrorBlob to D3DCompile() to get error showing in (const char*)pErrorBlob->GetBufferPointer(). Make sure to Release() the blob!
-	assert(SUCCEEDED(m_pD3dDevice->CreateVertexShader(blob->GetBufferPointer(), blob->GetBufferSize(), 0, shader.vertexShader.GetRef())));
-	assert(SUCCEEDED(m_pD3dDevice->CreateInputLayout(vertexLayout.data(), vertexLayout.size(), blob->GetBufferPointer(), blob->GetBufferSize(), shader.inputLayout.GetRef())));
-	blob->Release();
+void D3D11RHI::LoadVertexShader(const std::string& name, GPUShader& shader, const std::vector<D3D11_INPUT_ELEMENT_DESC>& vertexLayout)
+{
+	auto path = FileUtils::Combine(g_Engine->ProjectDir, "Source/Shaders/" + name + ".hlsl");
+	shader.vertexBytecode = m_ShaderCache->Request({ path, "main", "vs_4_0", {} });
+	shader.vertexLayout = vertexLayout;
 }
 
 void D3D11RHI::LoadVertexShaders()
 {
-	const std::vector<D3D11_INPUT_ELEMENT_DESC> pos3norm3tex3Layout =
-	{
-		{ "POSITION",	0,	DXGI_FORMAT_R32G32B32_FLOAT,	0,	0,	D3D11_INPUT_PER_VERTEX_DATA,	0 },
-		{ "NORMAL",		0,	DXGI_FORMAT_R32G32B32_FLOAT,	1,	0,	D3D11_INPUT_PER_VERTEX_DATA,	0 },
-		{ "TEXCOORD",	0,	DXGI_FORMAT_R32G32B32_FLOAT,	2,	0,	D3D11_INPUT_PER_VERTEX_DATA,	0 }
-	};
-
 	const std::vector<D3D11_INPUT_ELEMENT_DESC> pos2tex2Layout =
 	{
 		{ "POSITION",	0,	DXGI_FORMAT_R32G32_FLOAT,	0,	0,	D3D11_INPUT_PER_VERTEX_DATA,	0 },
 		{ "TEXCOORD",	0,	DXGI_FORMAT_R32G32_FLOAT,	1,	0,	D3D11_INPUT_PER_VERTEX_DATA,	0 }
 	};
 
-	LoadVertexShader("GeometryVS", _solidColorShader, pos3norm3tex3Layout);
-	LoadVertexShader("ResolveVS", _resolveShader, pos2tex2Layout);
 	LoadVertexShader("AmbientVS", _ambientShader, pos2tex2Layout);
 	LoadVertexShader("DirectionalVS", _directionalShader, pos2tex2Layout);
 }
 
-void D3D11RHI::LoadPixelShader(const std::string& name, GPUShader& shader) {
-	auto psData = FileUtils::LoadFile(shaderRelativeDir + name + ".hlsl");
-	ID3DBlob* blob = nullptr;
-	ID3DBlob* errorBlob = nullptr;
-	if (FAILED(D3DCompile(psData.data(), psData.size(), NULL, NULL, NULL, "main", "ps_4_0", 0, 0, &blob, &errorBlob)))
+void D3D11RHI::LoadPixelShader(const std::string& name, GPUShader& shader, const std::vector<std::pair<std::string, std::string>>& defines)
+{
+	auto path = FileUtils::Combine(g_Engine->ProjectDir, "Source/Shaders/" + name + ".hlsl");
+	shader.pixelBytecode = m_ShaderCache->Request({ path, "main", "ps_4_0", defines });
+}
+
+bool D3D11RHI::FinishShader(GPUShader& shader)
+{
+	if (shader.vertexShader && shader.pixelShader) return true;
+	assert(shader.vertexBytecode.valid() && shader.pixelBytecode.valid());
+
+	// The cache has already logged why a stage failed.
+	const auto& vertex = shader.vertexBytecode.get()->bytecode;
+	const auto& pixel = shader.pixelBytecode.get()->bytecode;
+	if (vertex.empty() || pixel.empty()) return false;
+
+	if (FAILED(m_pD3dDevice->CreateVertexShader(vertex.data(), vertex.size(), nullptr, shader.vertexShader.GetRef())) ||
+		FAILED(m_pD3dDevice->CreateInputLayout(shader.vertexLayout.data(), static_cast<UINT>(shader.vertexLayout.size()), vertex.data(), vertex.size(), shader.inputLayout.GetRef())) ||
+		FAILED(m_pD3dDevice->CreatePixelShader(pixel.data(), pixel.size(), nullptr, shader.pixelShader.GetRef())))
 	{
-		SDL_Log((const char *)errorBlob->GetBufferPointer());
-		assert(false);
+		SDL_Log("Unable to create shaders from their bytecode.");
+		return false;
 	}
-	assert(blob != NULL); // NB: Pass ID3D10Blob* pErrorBlob to D3DCompile() to get error showing in (const char*)pErrorBlob->GetBufferPointer(). Make sure to Release() the blob!
-	assert(SUCCEEDED(m_pD3dDevice->CreatePixelShader(blob->GetBufferPointer(), blob->GetBufferSize(), 0, shader.pixelShader.GetRef())));
-	blob->Release();
-	if(errorBlob) errorBlob->Release();
+	return true;
 }
 
 void D3D11RHI::LoadPixelShaders()
 {
-	LoadPixelShader("GeometryPS", _solidColorShader);
-	LoadPixelShader("ResolvePS", _resolveShader);
+	// Materials only ever need the base variants, so they build alongside the lighting shaders. The debug views
+	// are requested when first drawn, and draw as their base until the pool has built them.
+	RequestGeometryVariant(0);
+	RequestGeometryVariant(GeometryShaderFeatures::AlphaTest);
 	LoadPixelShader("AmbientPS", _ambientShader);
 	LoadPixelShader("DirectionalPS", _directionalShader);
 }
@@ -531,7 +1120,7 @@ void D3D11RHI::ClearBackBufferDepth()
 	m_pD3dContext->ClearDepthStencilView(m_pDepthStencilRTView.get(), D3D11_CLEAR_DEPTH, 1.f, 0);
 }
 
-ID3D11Texture2D* D3D11RHI::GetDebugTexture2D()
+RHITexture D3D11RHI::GetDebugTexture2D()
 {
 	return m_DebugTexture2D;
 }
@@ -559,132 +1148,387 @@ void D3D11RHI::CreateResolveQuadBuffers()
 	_fullscreenQuadMesh.positionBuffer = CreateVertexBuffer(positions.data(), positions.size());
 	_fullscreenQuadMesh.uvBuffer = CreateVertexBuffer(uvs.data(), uvs.size());
 	_fullscreenQuadMesh.indexBuffer = CreateIndexBuffer(indices);
-	_gbufferSampler = CreateSampler();
+	_gbufferSampler = GetDefaultSampler();
+}
+
+bool D3D11RHI::UpdateFrameGraph()
+{
+	if (m_FrameGraphWidth == m_WindowWidth && m_FrameGraphHeight == m_WindowHeight) return true;
+
+	// The geometry pass fills the G-buffer and the back buffer's depth, the lighting pass adds every light
+	// up from the G-buffer into the back buffer.
+	RenderGraphTextureDesc gbufferDesc = { m_WindowWidth, m_WindowHeight, static_cast<uint32_t>(DXGI_FORMAT_R16G16B16A16_FLOAT), 8 };
+	m_FrameGraph.Reset();
+	m_BackBufferTexture = m_FrameGraph.ImportTexture("backbuffer");
+	RenderGraphTexture depth = m_FrameGraph.ImportTexture("depth");
+	RenderGraphTexture color = m_FrameGraph.CreateTexture("color", gbufferDesc);
+	RenderGraphTexture normal = m_FrameGraph.CreateTexture("normal", gbufferDesc);
+	m_GeometryGraphPass = m_FrameGraph.AddPass("geometry");
+	m_FrameGraph.Write(m_GeometryGraphPass, color);
+	m_FrameGraph.Write(m_GeometryGraphPass, normal);
+	m_FrameGraph.WriteDepth(m_GeometryGraphPass, depth);
+	m_LightingGraphPass = m_FrameGraph.AddPass("lighting");
+	m_FrameGraph.Read(m_LightingGraphPass, color);
+	m_FrameGraph.Read(m_LightingGraphPass, normal);
+	m_FrameGraph.Write(m_LightingGraphPass, m_BackBufferTexture);
+	if (!m_FrameGraph.Compile()) return false;
+
+	// The old size's targets go back to the pool, where dragging back to it finds them.
+	for (size_t physical = 0; physical < m_GraphTargets.size(); ++physical)
+	{
+		ReleaseRenderTarget(m_GraphTargetInfos[physical], m_GraphTargets[physical]);
+	}
+	m_GraphTargets.clear();
+	m_GraphTargetInfos.clear();
+	for (uint32_t physical = 0; physical < m_FrameGraph.GetNumPhysicalTextures(); ++physical)
+	{
+		const RenderGraphTextureDesc& desc = m_FrameGraph.GetPhysicalDesc(physical);
+		RenderTargetCreateInfo rtCreateInfo;
+		ZeroMemory(&rtCreateInfo, sizeof(rtCreateInfo));
+		rtCreateInfo.width = desc.width;
+		rtCreateInfo.height = desc.height;
+		rtCreateInfo.format = static_cast<DXGI_FORMAT>(desc.format);
+		m_GraphTargetInfos.push_back(rtCreateInfo);
+		m_GraphTargets.push_back(AcquireRenderTarget(rtCreateInfo));
+		// Left at the old size, so the next frame tries again.
+		if (!m_GraphTargets.back().texture) return false;
+	}
+
+	m_FrameGraphWidth = m_WindowWidth;
+	m_FrameGraphHeight = m_WindowHeight;
+	return true;
+}
+
+ID3D11RenderTargetView* D3D11RHI::GetGraphRenderTargetView(RenderGraphTexture texture) const
+{
+	if (texture == m_BackBufferTexture) return m_pBackBufferRTView.get();
+	assert(!m_FrameGraph.IsImported(texture));
+	return m_GraphTargets[m_FrameGraph.GetPhysicalTexture(texture)].rtv.get();
 }
 
-void D3D11RHI::RecreateOffscreenRenderTargets(int width, int height)
+ID3D11ShaderResourceView* D3D11RHI::GetGraphShaderResourceView(RenderGraphTexture texture) const
 {
-	RenderTargetCreateInfo rtCreateInfo;
-	rtCreateInfo.width = width;
-	rtCreateInfo.height = height;
+	if (m_FrameGraph.IsImported(texture)) return nullptr;
+	return m_GraphTargets[m_FrameGraph.GetPhysicalTexture(texture)].srv.get();
+}
+
+void D3D11RHI::BindGraphResource(uint32_t slot, ID3D11ShaderResourceView* srv)
+{
+	RHIStateSlot stateSlot = static_cast<RHIStateSlot>(static_cast<uint32_t>(RHIStateSlot::PSResource0) + slot);
+	if (m_StateCache.Set(stateSlot, srv)) m_pD3dContext->PSSetShaderResources(slot, 1, &srv);
+	m_GraphResources[slot] = srv;
+}
+
+bool D3D11RHI::BeginGraphPass(RenderGraphPass pass)
+{
+	if (m_FrameGraph.IsCulled(pass)) return false;
+
+	// Whatever the pass renders to comes off the resource slots first, where an earlier pass, or the last
+	// frame's, may have left it.
+	for (RenderGraphTexture write : m_FrameGraph.GetWrites(pass))
+	{
+		ID3D11ShaderResourceView* srv = GetGraphShaderResourceView(write);
+		for (uint32_t slot = 0; slot < m_GraphResources.size(); ++slot)
+		{
+			if (srv && m_GraphResources[slot] == srv) BindGraphResource(slot, nullptr);
+		}
+	}
+	BindGraphTargets(m_pD3dContext.get(), m_StateCache, pass);
+
+	const auto& reads = m_FrameGraph.GetReads(pass);
+	assert(reads.size() <= m_GraphResources.size());
+	for (uint32_t slot = 0; slot < reads.size(); ++slot) BindGraphResource(slot, GetGraphShaderResourceView(reads[slot]));
+	return true;
+}
 
-	_offscreenColorRT = _CreateRenderTargetColor(rtCreateInfo);
-	_offscreenNormalRT = _CreateRenderTargetColor(rtCreateInfo);
+void D3D11RHI::BindGraphTargets(ID3D11DeviceContext* context, RHIStateCache& stateCache, RenderGraphPass pass) const
+{
+	const auto& writes = m_FrameGraph.GetWrites(pass);
+	std::array<ID3D11RenderTargetView*, 2> rtvs = {};
+	assert(writes.size() <= rtvs.size());
+	for (size_t i = 0; i < writes.size(); ++i) rtvs[i] = GetGraphRenderTargetView(writes[i]);
+	// Only the back buffer's depth is ever written.
+	ID3D11DepthStencilView* dsv = m_FrameGraph.GetDepthWrite(pass) != RenderGraph::Invalid ? m_pDepthStencilRTView.get() : nullptr;
+	if (stateCache.Set(RHIStateSlot::RenderTargets, rtvs[0], rtvs[1], dsv))
+	{
+		context->OMSetRenderTargets(static_cast<UINT>(writes.size()), rtvs.data(), dsv);
+	}
 }
 
 void D3D11RHI::CreateLightingResources() {
 	_ambientCb = CreateConstantBuffer(sizeof(AmbientConstantBufferLayout));
 	_directionalCb = CreateConstantBuffer(sizeof(DirectionalConstantBufferLayout));
 
+}
 
-	// Disable depth test and write
-	D3D11_DEPTH_STENCIL_DESC depthStencilStateDesc;
-	ZeroMemory(&depthStencilStateDesc, sizeof(depthStencilStateDesc));
-	depthStencilStateDesc.DepthEnable = false;
-	depthStencilStateDesc.DepthWriteMask = D3D11_DEPTH_WRITE_MASK_ZERO;
-	depthStencilStateDesc.DepthFunc = D3D11_COMPARISON_LESS_EQUAL;
-	depthStencilStateDesc.StencilEnable = false;
-	depthStencilStateDesc.StencilReadMask = D3D11_DEFAULT_STENCIL_READ_MASK;
-	depthStencilStateDesc.StencilWriteMask = D3D11_DEFAULT_STENCIL_WRITE_MASK;
-	depthStencilStateDesc.FrontFace.StencilFunc = D3D11_COMPARISON_ALWAYS;
-	depthStencilStateDesc.BackFace.StencilFunc = D3D11_COMPARISON_ALWAYS;
-	depthStencilStateDesc.FrontFace.StencilDepthFailOp = D3D11_STENCIL_OP_KEEP;
-	depthStencilStateDesc.BackFace.StencilDepthFailOp = D3D11_STENCIL_OP_KEEP;
-	depthStencilStateDesc.FrontFace.StencilPassOp = D3D11_STENCIL_OP_KEEP;
-	depthStencilStateDesc.BackFace.StencilPassOp = D3D11_STENCIL_OP_KEEP;
-	depthStencilStateDesc.FrontFace.StencilFailOp = D3D11_STENCIL_OP_KEEP;
-	depthStencilStateDesc.BackFace.StencilFailOp = D3D11_STENCIL_OP_KEEP;
-	assert(SUCCEEDED(m_pD3dDevice->CreateDepthStencilState(&depthStencilStateDesc, _depthStateTestDisabledWriteDisabled.GetRef())));
+bool D3D11RHI::CreatePipelineStates()
+{
+	// Only the shaders drawn with are waited for. The rest keep building on the pool.
+	if (!GetGeometryPipeline(0) || !GetGeometryPipeline(GeometryShaderFeatures::AlphaTest)) return false;
+	for (GPUShader* shader : { &_ambientShader, &_directionalShader })
+	{
+		if (!FinishShader(*shader)) return false;
+	}
 
-	// Lighting additive blending
-	D3D11_BLEND_DESC blendDesc;
-	blendDesc.AlphaToCoverageEnable = false;
-	blendDesc.IndependentBlendEnable = false;
-	blendDesc.RenderTarget[0].BlendEnable = true;
-	blendDesc.RenderTarget[0].SrcBlend = D3D11_BLEND_ONE;
-	blendDesc.RenderTarget[0].DestBlend = D3D11_BLEND_ONE;
-	blendDesc.RenderTarget[0].BlendOp = D3D11_BLEND_OP_ADD;
-	blendDesc.RenderTarget[0].SrcBlendAlpha = D3D11_BLEND_ONE;
-	blendDesc.RenderTarget[0].DestBlendAlpha = D3D11_BLEND_ONE;
-	blendDesc.RenderTarget[0].BlendOpAlpha = D3D11_BLEND_OP_ADD;
-	blendDesc.RenderTarget[0].RenderTargetWriteMask = D3D11_COLOR_WRITE_ENABLE_ALL;
-	assert(SUCCEEDED(m_pD3dDevice->CreateBlendState(&blendDesc, _lightingBlendState.GetRef())));
+	GPUPipelineStateDesc pipelineDesc;
+	FillRasterizerDesc(pipelineDesc.rasterizer);
+	pipelineDesc.topology = D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
+
+	// The lights add up over the whole screen, without depth.
+	FillBlendDesc(true, pipelineDesc.blend);
+	FillDepthStencilDesc(false, pipelineDesc.depthStencil);
+	pipelineDesc.shader = &_ambientShader;
+	_ambientPipeline = GetPipelineState(pipelineDesc);
+	pipelineDesc.shader = &_directionalShader;
+	_directionalPipeline = GetPipelineState(pipelineDesc);
+
+	return _ambientPipeline && _directionalPipeline;
+}
+
+D3D11RHI::GeometryVariant& D3D11RHI::RequestGeometryVariant(uint32_t features)
+{
+	auto found = m_GeometryVariants.find(features);
+	if (found != m_GeometryVariants.end()) return found->second;
+
+	GeometryVariant& variant = m_GeometryVariants[features];
+	// Every variant shares the vertex shader, which the cache only builds once.
+	LoadVertexShader("GeometryVS", variant.shader, GeometryVertexLayout);
+	LoadPixelShader("GeometryPS", variant.shader, ShaderPermutations::GetDefines(GeometryShaderFeatureSet, features));
+	return variant;
+}
+
+const GPUPipelineState* D3D11RHI::GetGeometryPipeline(uint32_t features)
+{
+	assert(ShaderPermutations::IsValid(GeometryShaderFeatureSet, features));
+	GeometryVariant& variant = RequestGeometryVariant(features);
+	uint32_t baseFeatures = features & GeometryShaderFeatures::AlphaTest;
+	if (!variant.finished)
+	{
+		// Nothing to draw with but the base variants, so only they are waited for. The others draw as their base
+		// until the pool has built them, rather than stalling the frame that first asks.
+		if (features != baseFeatures && !IsShaderCompiled(variant.shader)) return GetGeometryPipeline(baseFeatures);
+
+		auto start = std::chrono::steady_clock::now();
+		if (FinishShader(variant.shader))
+		{
+			// The geometry passes depth test into the G-buffer.
+			GPUPipelineStateDesc pipelineDesc;
+			pipelineDesc.shader = &variant.shader;
+			FillBlendDesc(false, pipelineDesc.blend);
+			FillDepthStencilDesc(true, pipelineDesc.depthStencil);
+			FillRasterizerDesc(pipelineDesc.rasterizer);
+			pipelineDesc.topology = D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
+			variant.pipeline = GetPipelineState(pipelineDesc);
+		}
+		variant.finished = true;
+		double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+		m_GeometryVariantMs += ms;
+		SDL_Log("D3D11 geometry variant %s %s in %.1f ms.", ShaderPermutations::GetName(GeometryShaderFeatureSet, features).c_str(),
+			variant.pipeline ? "ready" : "failed", ms);
+	}
+
+	if (variant.pipeline || features == baseFeatures) return variant.pipeline;
+	return GetGeometryPipeline(baseFeatures);
 }
 
 void D3D11RHI::BeginGeometryPass() {
+	m_PassCulled = !UpdateFrameGraph() || !BeginGraphPass(m_GeometryGraphPass);
+	if (m_PassCulled) return;
 	ClearBackBufferDepth(); // We reuse the backbuffer depth for now
 
+	// The color target shows through where nothing is drawn, every other target is fully overwritten.
 	std::array<float, 4> clearColor = { 0.f, 0.f, 0.25f, 1.f };
-	m_pD3dContext->ClearRenderTargetView(_offscreenColorRT.rtv.get(), clearColor.data());
-	m_pD3dContext->DiscardView(_offscreenNormalRT.rtv.get());
+	const auto& writes = m_FrameGraph.GetWrites(m_GeometryGraphPass);
+	m_pD3dContext->ClearRenderTargetView(GetGraphRenderTargetView(writes[0]), clearColor.data());
+	for (size_t i = 1; i < writes.size(); ++i) m_pD3dContext->DiscardView(GetGraphRenderTargetView(writes[i]));
 
-	std::vector<ID3D11RenderTargetView*> offscreenRTs{
-		_offscreenColorRT.rtv.get(),
-		_offscreenNormalRT.rtv.get()
-	};
-	m_pD3dContext->OMSetRenderTargets(offscreenRTs.size(), offscreenRTs.data(), m_pDepthStencilRTView.get());
-	m_pD3dContext->OMSetBlendState(nullptr, nullptr, 0xffffffff);
-	m_pD3dContext->OMSetDepthStencilState(m_pDepthStencilState.get(), 0);
+	m_DrawPackets.clear();
+	m_GeometryFeatures = 0;
+	m_CurrentGeometryPipeline = GetGeometryPipeline(m_GeometryFeatures);
+}
+
+void D3D11RHI::BeginMaskedGeometryPass()
+{
+	if (m_PassCulled) return;
+	// Same targets and state as the opaque pass, only the pixel shader alpha tests.
+	m_GeometryFeatures |= GeometryShaderFeatures::AlphaTest;
+	m_CurrentGeometryPipeline = GetGeometryPipeline(m_GeometryFeatures);
+}
+
+void D3D11RHI::SetGeometryShaderFeatures(uint32_t features)
+{
+	if (m_PassCulled) return;
+	m_GeometryFeatures = features;
+	m_CurrentGeometryPipeline = GetGeometryPipeline(m_GeometryFeatures);
+}
+
+void D3D11RHI::DrawMesh(const Mesh& mesh, RHITexture diffuse, RHITexture mask)
+{
+	if (m_PassCulled) return;
+	assert(m_CurrentGeometryPipeline);
+
+	DrawPacket packet;
+	packet.pipeline = m_CurrentGeometryPipeline;
+	packet.vertexBuffers = { GetBuffer(mesh.gpuMesh.positionBuffer), GetBuffer(mesh.gpuMesh.normalBuffer), GetBuffer(mesh.gpuMesh.uvBuffer) };
+	packet.indexBuffer = GetBuffer(mesh.gpuMesh.indexBuffer);
+	if (!StageConstantBuffer(mesh.constantBuffer, packet.firstConstant, packet.numConstants)) return;
+
+	const GPUTexture& diffuseTexture = GetTexture(diffuse);
+	packet.sampler = diffuseTexture.sampler;
+	packet.diffuseSrv = diffuseTexture.srv.get();
+	packet.maskSrv = mask ? GetTexture(mask).srv.get() : nullptr;
+	packet.numIndices = mesh.numFaces * 3;
+	m_DrawPackets.push_back(packet);
+}
+
+void D3D11RHI::RecordDrawPackets(ID3D11DeviceContext1* context, RHIStateCache& stateCache, const DrawPacket* begin, const DrawPacket* end) const
+{
+	const std::array<UINT, 3> strides{ sizeof(aiVector3D), sizeof(aiVector3D), sizeof(aiVector3D) };
+	const std::array<UINT, 3> offsets{ 0, 0, 0 };
+	ID3D11Buffer* ring = m_ConstantRing.get();
 
-	m_pD3dContext->IASetInputLayout(_solidColorShader.inputLayout.get());
-	m_pD3dContext->IASetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
-	m_pD3dContext->VSSetShader(_solidColorShader.vertexShader.get(), 0, 0);
-	m_pD3dContext->PSSetShader(_solidColorShader.pixelShader.get(), 0, 0);
+	// Bound once per context. Draws differ only in the material index in their constants.
+	ID3D11ShaderResourceView* materials = m_MaterialTableSrv.get();
+	if (stateCache.Set(RHIStateSlot::VSResource0, materials)) context->VSSetShaderResources(0, 1, &materials);
+
+	for (auto packet = begin; packet != end; ++packet)
+	{
+		BindPipeline(context, stateCache, *packet->pipeline);
+		if (stateCache.Set(RHIStateSlot::VertexBuffers, packet->vertexBuffers[0], packet->vertexBuffers[1], packet->vertexBuffers[2]))
+		{
+			context->IASetVertexBuffers(0, 3, packet->vertexBuffers.data(), strides.data(), offsets.data());
+		}
+		if (stateCache.Set(RHIStateSlot::IndexBuffer, packet->indexBuffer)) context->IASetIndexBuffer(packet->indexBuffer, DXGI_FORMAT_R16_UINT, 0);
+		if (stateCache.Set(RHIStateSlot::VSConstantBuffer, ring, packet->firstConstant, packet->numConstants))
+		{
+			context->VSSetConstantBuffers1(0, 1, &ring, &packet->firstConstant, &packet->numConstants);
+		}
+		if (stateCache.Set(RHIStateSlot::PSSampler, packet->sampler)) context->PSSetSamplers(0, 1, &packet->sampler);
+		if (stateCache.Set(RHIStateSlot::PSResource0, packet->diffuseSrv)) context->PSSetShaderResources(0, 1, &packet->diffuseSrv);
+		if (packet->maskSrv && stateCache.Set(RHIStateSlot::PSResource1, packet->maskSrv)) context->PSSetShaderResources(1, 1, &packet->maskSrv);
+		context->DrawIndexed(packet->numIndices, 0, 0);
+	}
 }
 
-void D3D11RHI::DrawMesh(const Mesh& mesh)
+void D3D11RHI::RecordGeometryPass()
 {
-	unsigned int stride = sizeof(aiVector3D);
-	unsigned int offset = 0;
+	if (m_DrawPackets.empty()) return;
+	// Chunks only bind offsets into the ring, so every draw's constants go up in one map before any is recorded.
+	if (!FlushConstantRing())
+	{
+		m_DrawPackets.clear();
+		m_CurrentGeometryPipeline = nullptr;
+		return;
+	}
 
-	m_pD3dContext->IASetVertexBuffers(0, 1, &mesh.gpuMesh.positionBuffer, &stride, &offset);
-	m_pD3dContext->IASetVertexBuffers(1, 1, &mesh.gpuMesh.normalBuffer, &stride, &offset);
-	m_pD3dContext->IASetVertexBuffers(2, 1, &mesh.gpuMesh.uvBuffer, &stride, &offset);
-	m_pD3dContext->IASetIndexBuffer(mesh.gpuMesh.indexBuffer, DXGI_FORMAT_R16_UINT, 0);
-	m_pD3dContext->VSSetConstantBuffers(0, 1, &mesh.constantBuffer);
+	// Draws are split into contiguous chunks, one per record slot, so state filtering within a chunk still works.
+	auto recordBegin = std::chrono::steady_clock::now();
+	auto numPackets = static_cast<uint32_t>(m_DrawPackets.size());
+	uint32_t numChunks = std::clamp((numPackets + MinDrawsPerChunk - 1) / MinDrawsPerChunk, 1u, m_NumRecordSlots);
+	auto chunkBegin = [&](uint32_t chunk) { return m_DrawPackets.data() + uint64_t(numPackets) * chunk / numChunks; };
 
-	//Diffuse
-	auto& diffuseTexture = m_GpuTextureMap.at(mesh.diffuseTexture);
-	m_pD3dContext->PSSetSamplers(0, 1, &diffuseTexture.sampler);
-	m_pD3dContext->PSSetShaderResources(0, 1, &diffuseTexture.srv);
+	// Deferred contexts start from cleared state, so each binds the pass's targets and viewport first.
+	std::vector<UniqueReleasePtr<ID3D11CommandList>> commandLists(numChunks);
+	std::vector<std::future<void>> chunksRecorded;
+	for (uint32_t chunk = 1; chunk < numChunks; ++chunk)
+	{
+		ID3D11DeviceContext1* context = m_DeferredContexts[chunk].get();
+		RHIStateCache* stateCache = &m_RecordStateCaches[chunk];
+		ID3D11CommandList** commandList = commandLists[chunk].GetRef();
+		const DrawPacket* begin = chunkBegin(chunk);
+		const DrawPacket* end = chunkBegin(chunk + 1);
+		chunksRecorded.push_back(m_RecordThreads->Submit([this, context, stateCache, commandList, begin, end]() {
+			stateCache->Reset();
+			BindGraphTargets(context, *stateCache, m_GeometryGraphPass);
+			context->RSSetViewports(1, &m_Viewport);
+			RecordDrawPackets(context, *stateCache, begin, end);
+			if (FAILED(context->FinishCommandList(FALSE, commandList))) SDL_Log("FinishCommandList failed, a chunk of draws is skipped");
+		}));
+	}
+	// The immediate context already has the pass's targets bound.
+	RecordDrawPackets(m_pD3dContext.get(), m_StateCache, chunkBegin(0), chunkBegin(1));
+	for (auto& recorded : chunksRecorded) recorded.get();
+
+	for (uint32_t chunk = 1; chunk < numChunks; ++chunk)
+	{
+		if (commandLists[chunk]) m_pD3dContext->ExecuteCommandList(commandLists[chunk].get(), FALSE);
+		m_StateCounts += m_RecordStateCaches[chunk].TakeCounts();
+	}
+	if (numChunks > 1)
+	{
+		// Executing a command list without restoring the immediate context's state leaves it cleared.
+		m_StateCache.Reset();
+		m_GraphResources = {};
+		m_pD3dContext->RSSetViewports(1, &m_Viewport);
+	}
 
-	m_pD3dContext->DrawIndexed(mesh.numFaces * 3, 0, 0);
+	m_RecordMs += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - recordBegin).count();
+	m_NumRecordedChunks += numChunks;
+	m_NumDraws += numPackets;
+	m_DrawPackets.clear();
+	m_CurrentGeometryPipeline = nullptr;
 }
 
 void D3D11RHI::BeginLightingPass()
 {
+	RecordGeometryPass();
+	m_PassCulled = !BeginGraphPass(m_LightingGraphPass);
+	if (m_PassCulled) return;
 	ClearBackBufferColor();
-	m_pD3dContext->OMSetRenderTargets(1, m_pBackBufferRTView.GetRef(), nullptr);
-	m_pD3dContext->OMSetBlendState(_lightingBlendState.get(), nullptr, 0xffffffff);
-	m_pD3dContext->OMSetDepthStencilState(_depthStateTestDisabledWriteDisabled.get(), 0);
 
-	m_pD3dContext->PSSetSamplers(0, 1, _gbufferSampler.GetRef());
-	std::vector<ID3D11ShaderResourceView*> srvs { _offscreenColorRT.srv.get(), _offscreenNormalRT.srv.get() };
-	m_pD3dContext->PSSetShaderResources(0, srvs.size(), srvs.data());
+	if (m_StateCache.Set(RHIStateSlot::PSSampler, _gbufferSampler)) m_pD3dContext->PSSetSamplers(0, 1, &_gbufferSampler);
+}
 
+void D3D11RHI::BindFullscreenQuad()
+{
+	std::array<ID3D11Buffer*, 2> vertexBuffers{ GetBuffer(_fullscreenQuadMesh.positionBuffer), GetBuffer(_fullscreenQuadMesh.uvBuffer) };
+	std::array<UINT, 2> strides{ sizeof(glm::vec2), sizeof(glm::vec2) };
+	std::array<UINT, 2> offsets{ 0, 0 };
+	if (m_StateCache.Set(RHIStateSlot::VertexBuffers, vertexBuffers[0], vertexBuffers[1]))
+	{
+		m_pD3dContext->IASetVertexBuffers(0, 2, vertexBuffers.data(), strides.data(), offsets.data());
+	}
+	ID3D11Buffer* indexBuffer = GetBuffer(_fullscreenQuadMesh.indexBuffer);
+	if (m_StateCache.Set(RHIStateSlot::IndexBuffer, indexBuffer)) m_pD3dContext->IASetIndexBuffer(indexBuffer, DXGI_FORMAT_R16_UINT, 0);
 }
 
-void D3D11RHI::DrawAmbient(glm::vec3 color) {
-	unsigned int stride = sizeof(glm::vec2);
-	unsigned int offset = 0;
-	m_pD3dContext->IASetVertexBuffers(0, 1, &_fullscreenQuadMesh.positionBuffer, &stride, &offset);
-	m_pD3dContext->IASetVertexBuffers(1, 1, &_fullscreenQuadMesh.uvBuffer, &stride, &offset);
-	m_pD3dContext->IASetIndexBuffer(_fullscreenQuadMesh.indexBuffer, DXGI_FORMAT_R16_UINT, 0);
+void D3D11RHI::BindPipeline(const GPUPipelineState& pipeline)
+{
+	BindPipeline(m_pD3dContext.get(), m_StateCache, pipeline);
+}
 
-	m_pD3dContext->IASetInputLayout(_ambientShader.inputLayout.get());
-	m_pD3dContext->IASetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
+void D3D11RHI::BindPipeline(ID3D11DeviceContext* context, RHIStateCache& stateCache, const GPUPipelineState& pipeline) const
+{
+	// Nothing else binds these slots, so rebinding the current pipeline can be dropped whole. Switching
+	// pipelines only issues the parts that differ, the geometry pipelines share everything but the pixel shader.
+	if (!stateCache.Set(RHIStateSlot::Pipeline, &pipeline)) return;
+
+	if (stateCache.Set(RHIStateSlot::InputLayout, pipeline.inputLayout)) context->IASetInputLayout(pipeline.inputLayout);
+	if (stateCache.Set(RHIStateSlot::Topology, pipeline.topology)) context->IASetPrimitiveTopology(pipeline.topology);
+	if (stateCache.Set(RHIStateSlot::VertexShader, pipeline.vertexShader)) context->VSSetShader(pipeline.vertexShader, 0, 0);
+	if (stateCache.Set(RHIStateSlot::PixelShader, pipeline.pixelShader)) context->PSSetShader(pipeline.pixelShader, 0, 0);
+	if (stateCache.Set(RHIStateSlot::RasterizerState, pipeline.rasterizerState)) context->RSSetState(pipeline.rasterizerState);
+	if (stateCache.Set(RHIStateSlot::BlendState, pipeline.blendState)) context->OMSetBlendState(pipeline.blendState, nullptr, 0xffffffff);
+	if (stateCache.Set(RHIStateSlot::DepthStencilState, pipeline.depthStencilState))
+	{
+		context->OMSetDepthStencilState(pipeline.depthStencilState, 0);
+	}
+}
 
-	m_pD3dContext->VSSetShader(_ambientShader.vertexShader.get(), 0, 0);
-	m_pD3dContext->PSSetShader(_ambientShader.pixelShader.get(), 0, 0);
+void D3D11RHI::DrawAmbient(glm::vec3 color) {
+	if (m_PassCulled) return;
+	BindFullscreenQuad();
+	BindPipeline(*_ambientPipeline);
 
 	glm::vec4 amb = glm::vec4(color, 1.0f);
 	UpdateConstantBuffer(_ambientCb, &amb, sizeof(amb));
-	m_pD3dContext->PSSetConstantBuffers(0, 1, &_ambientCb);
+	if (!BindConstantBuffer(RHIStateSlot::PSConstantBuffer, _ambientCb)) return;
 
 	m_pD3dContext->DrawIndexed(6, 0, 0);
 }
 
 void D3D11RHI::DrawDirectionalLight(glm::vec3 color, glm::vec3 angles) {
+	if (m_PassCulled) return;
 
 	auto lightDir = glm::vec3(1.0f, 0.0f, 0.0f);
 
@@ -700,19 +1544,10 @@ void D3D11RHI::DrawDirectionalLight(glm::vec3 color, glm::vec3 angles) {
 	data.color = glm::vec4(color, 1.0f);
 	data.direction = rotMat * glm::vec4(lightDir, 1.0f);
 	UpdateConstantBuffer(_directionalCb, &data, sizeof(data));
-	m_pD3dContext->PSSetConstantBuffers(0, 1, &_directionalCb);
+	if (!BindConstantBuffer(RHIStateSlot::PSConstantBuffer, _directionalCb)) return;
 
-	unsigned int stride = sizeof(glm::vec2);
-	unsigned int offset = 0;
-	m_pD3dContext->IASetVertexBuffers(0, 1, &_fullscreenQuadMesh.positionBuffer, &stride, &offset);
-	m_pD3dContext->IASetVertexBuffers(1, 1, &_fullscreenQuadMesh.uvBuffer, &stride, &offset);
-	m_pD3dContext->IASetIndexBuffer(_fullscreenQuadMesh.indexBuffer, DXGI_FORMAT_R16_UINT, 0);
-
-	m_pD3dContext->IASetInputLayout(_directionalShader.inputLayout.get());
-	m_pD3dContext->IASetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
-
-	m_pD3dContext->VSSetShader(_directionalShader.vertexShader.get(), 0, 0);
-	m_pD3dContext->PSSetShader(_directionalShader.pixelShader.get(), 0, 0);
+	BindFullscreenQuad();
+	BindPipeline(*_directionalPipeline);
 
 	m_pD3dContext->DrawIndexed(6, 0, 0);
 }
@@ -721,7 +1556,80 @@ void D3D11RHI::Present()
 {
 	m_pSwapChain->Present(0, 0);
 
-	// This stops warnings about binding still-bound SRV's as RTV's in the following frame.
-	std::vector<ID3D11ShaderResourceView*> srvs{ nullptr, nullptr };
-	m_pD3dContext->PSSetShaderResources(0, srvs.size(), srvs.data());
+	// Pooled targets nobody has asked for in a while go the way of everything else retired this frame.
+	m_RenderTargetPool.Trim(m_NumFrames, RenderTargetIdleFrames, [&](GPURenderTarget& renderTarget) { RetireRenderTarget(renderTarget); });
+
+	// Fences this frame's part of the constant ring and its retired objects, BeginFrame waits on it before
+	// the part is reused and the objects are released.
+	if (m_FrameBegun)
+	{
+		uint32_t frameIndex = static_cast<uint32_t>(m_NumFrames % FramesInFlight);
+		m_pD3dContext->End(m_FrameFences[frameIndex].get());
+		m_FrameFenceIssued[frameIndex] = true;
+		m_FrameBegun = false;
+	}
+
+	m_StateCounts += m_StateCache.TakeCounts();
+	++m_NumFrames;
+}
+
+void D3D11RHI::InitImGui(const Window& window)
+{
+	ImGui_ImplSDL2_InitForDX11(window.sdlWindow.get());
+	ImGui_ImplDX11_Init(m_pD3dDevice.get(), m_pD3dContext.get());
+}
+
+void D3D11RHI::NewImGuiFrame()
+{
+	ImGui_ImplDX11_NewFrame();
+}
+
+void D3D11RHI::RenderImGui()
+{
+	ImGui_ImplDX11_RenderDrawData(ImGui::GetDrawData());
+	// The UI binds its own state behind the cache's back.
+	m_StateCache.Reset();
+}
+
+void D3D11RHI::ShutdownImGui()
+{
+	ImGui_ImplDX11_Shutdown();
+	ImGui_ImplSDL2_Shutdown();
+}
+
+void D3D11RHI::LogStats() const
+{
+	auto logCache = [](const char* name, uint32_t numRequests, uint32_t numHits, uint32_t numUnique)
+	{
+		SDL_Log("%s: %u requests, %u cache hits, %u unique objects.", name, numRequests, numHits, numUnique);
+	};
+	logCache("Samplers", m_SamplerCache.GetNumRequests(), m_SamplerCache.GetNumHits(), m_SamplerCache.GetNumUnique());
+	logCache("Blend states", m_BlendStateCache.GetNumRequests(), m_BlendStateCache.GetNumHits(), m_BlendStateCache.GetNumUnique());
+	logCache("Depth stencil states", m_DepthStencilStateCache.GetNumRequests(), m_DepthStencilStateCache.GetNumHits(), m_DepthStencilStateCache.GetNumUnique());
+	logCache("Rasterizer states", m_RasterizerStateCache.GetNumRequests(), m_RasterizerStateCache.GetNumHits(), m_RasterizerStateCache.GetNumUnique());
+	logCache("Pipelines", m_PipelineCache.GetNumRequests(), m_PipelineCache.GetNumHits(), m_PipelineCache.GetNumUnique());
+	if (m_NumFrames > 0)
+	{
+		SDL_Log("D3D11 geometry: %.1f draws per frame in %.2f chunks on %u threads, %.3f ms recording per frame.",
+			double(m_NumDraws) / m_NumFrames, double(m_NumRecordedChunks) / m_NumFrames, m_NumRecordSlots, m_RecordMs / m_NumFrames);
+	}
+	m_StateCounts.Log("D3D11", m_NumFrames);
+	m_ConstantRingAllocator.LogStats("D3D11 constant");
+	m_Resources.LogStats("D3D11");
+	m_FrameGraph.LogStats("D3D11");
+	if (m_ShaderCache) m_ShaderCache->LogStats("D3D11");
+	std::string variantNames;
+	uint32_t numFinishedVariants = 0;
+	uint32_t numFailedVariants = 0;
+	for (const auto& variant : m_GeometryVariants)
+	{
+		if (!variant.second.finished) continue;
+		++numFinishedVariants;
+		variantNames += (variantNames.empty() ? "" : ", ") + ShaderPermutations::GetName(GeometryShaderFeatureSet, variant.first);
+		numFailedVariants += variant.second.pipeline ? 0 : 1;
+	}
+	SDL_Log("D3D11 geometry shader variants: %u of %u possible drawn with (%s), %u failed, %.1f ms finishing them.", numFinishedVariants,
+		ShaderPermutations::CountValid(GeometryShaderFeatureSet), variantNames.c_str(), numFailedVariants, m_GeometryVariantMs);
+	SDL_Log("D3D11 render target pool: %u requests, %u reused, %u free, %u trimmed.", m_RenderTargetPool.GetNumAcquires(),
+		m_RenderTargetPool.GetNumReuses(), m_RenderTargetPool.GetNumFree(), m_RenderTargetPool.GetNumTrimmed());
 }
\ No newline at end of file
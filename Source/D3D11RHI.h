@@ -1,23 +1,42 @@
 #pragma once
+#include <array>
+#include <memory>
 #include <vector>
-#include <map>
+#include <unordered_map>
 #include <d3d11_1.h>
 
 #include "glm/glm.hpp"
 #include "assimp/vector3.h"
 
 #include "UniquePtr.h"
+#include "DescriptorCache.h"
 #include "GPUMesh.h"
+#include "GPUResourceTracker.h"
+#include "RenderGraph.h"
+#include "RenderTargetPool.h"
+#include "RHI.h"
+#include "RHIStateCache.h"
+#include "ShaderCache.h"
+#include "SlotMap.h"
+#include "UploadRing.h"
 
-class Window;
-struct CPUTexture;
-class Mesh;
+class ThreadPool;
+
+struct GPUBuffer
+{
+	UniqueReleasePtr<ID3D11Buffer>				buffer;			// Null for constant buffers, which live in the upload ring
+	std::vector<char>							contents;		// Constant buffers: the last update, rewritten into the ring by frames that bind it
+	uint32_t									ringOffset;
+	uint64_t									ringFrame;		// Frame ringOffset was written in
+	uint64_t									numBytes;
+};
 
 struct GPUTexture
 {
-    ID3D11Texture2D* texture;
-    ID3D11ShaderResourceView* srv;
-    ID3D11SamplerState* sampler;
+	UniqueReleasePtr<ID3D11Texture2D>			texture;
+	UniqueReleasePtr<ID3D11ShaderResourceView>	srv;
+	ID3D11SamplerState*							sampler;		// Shared through the sampler cache
+	uint64_t									numBytes;
 };
 
 struct GPURenderTarget
@@ -25,11 +44,7 @@ struct GPURenderTarget
 	UniqueReleasePtr<ID3D11Texture2D> texture;
 	UniqueReleasePtr<ID3D11RenderTargetView> rtv;
 	UniqueReleasePtr<ID3D11ShaderResourceView> srv;
-};
-
-struct GeometryConstantBufferLayout
-{
-	glm::mat4 mvpMatrix;
+	uint64_t numBytes = 0;
 };
 
 struct AmbientConstantBufferLayout
@@ -43,49 +58,106 @@ struct DirectionalConstantBufferLayout
 	glm::vec4 direction;
 };
 
+// The objects are created from the bytecode once a pipeline first needs them.
 struct GPUShader
 {
 	UniqueReleasePtr<ID3D11InputLayout>			inputLayout;
 	UniqueReleasePtr<ID3D11VertexShader>		vertexShader;
 	UniqueReleasePtr<ID3D11PixelShader>			pixelShader;
+	ShaderFuture								vertexBytecode;
+	ShaderFuture								pixelBytecode;
+	std::vector<D3D11_INPUT_ELEMENT_DESC>		vertexLayout;
+};
+
+// What a pipeline is built from. The fixed function descriptors must be zeroed before being filled in.
+struct GPUPipelineStateDesc
+{
+	const GPUShader*							shader;
+	D3D11_BLEND_DESC							blend;
+	D3D11_DEPTH_STENCIL_DESC					depthStencil;
+	D3D11_RASTERIZER_DESC						rasterizer;
+	D3D11_PRIMITIVE_TOPOLOGY					topology;
 };
 
+// Immutable bundle of everything a draw binds besides its resources, bound in one call. The objects are
+// shared with every other pipeline built from the same descriptors.
+struct GPUPipelineState
+{
+	ID3D11InputLayout*							inputLayout;
+	ID3D11VertexShader*							vertexShader;
+	ID3D11PixelShader*							pixelShader;
+	ID3D11BlendState*							blendState;
+	ID3D11DepthStencilState*					depthStencilState;
+	ID3D11RasterizerState*						rasterizerState;
+	D3D11_PRIMITIVE_TOPOLOGY					topology;
+};
+
+// Also the render target pool's key, so zero it before filling it in.
 struct RenderTargetCreateInfo {
 	int width;
 	int height;
+	DXGI_FORMAT format;
 };
 
-typedef uint16_t IndexType;
-
-class D3D11RHI
+// Handles are slot map handles into the backend's buffers and textures, cast. Geometry draws are queued as
+// packets and recorded when the lighting pass begins, split over the immediate context and deferred contexts
+// on worker threads.
+class D3D11RHI : public RHI
 {
 public:
     // Interface stuff
-    bool InitRHI(const Window& window);
-    void HandleWindowResize(uint32_t windowWidth, uint32_t windowHeight);
-
-	template <class T>
-	ID3D11Buffer* CreateVertexBuffer(const T* data, uint32_t numVertices);
-    ID3D11Buffer* CreateIndexBuffer(const std::vector<IndexType>& indices);
-    ID3D11Buffer* CreateConstantBuffer(int size);
-    ID3D11Texture2D* CreateTexture2D(const CPUTexture& cpuTexture);
-	ID3D11SamplerState*	CreateSampler();
-	//ID3D11Texture2D* CreateRenderTargetDepth(const RenderTargetCreateInfo& rtCreateInfo);
+    const char* GetName() const override { return "d3d11"; }
+    bool IsHeadless() const override { return false; }
+    uint32_t GetWindowFlags() const override { return 0; }
+    bool InitRHI(const Window& window) override;
+    void HandleWindowResize(uint32_t windowWidth, uint32_t windowHeight) override;
+
+	using RHI::CreateVertexBuffer;
+	RHIBuffer CreateVertexBuffer(const void* data, uint32_t stride, uint32_t numVertices) override;
+    RHIBuffer CreateIndexBuffer(const std::vector<IndexType>& indices) override;
+    RHIBuffer CreateConstantBuffer(int size) override;
+    bool UpdateConstantBuffer(RHIBuffer cbHandle, const void* data, int numBytes) override;
+	void UpdateMaterialTable(const std::vector<GPUMaterial>& materials) override;
+    RHITexture CreateTexture2D(const CPUTexture& cpuTexture) override;
+	RHITexture CreateTexture2DArray(const TextureArrayPlan& arrayPlan) override;
+	void ReleaseTexture2D(RHITexture texture) override;
+	TexturePackingInput GetTexturePackingInput(RHITexture texture) const override;
+	uint32_t GetMaxTextureArraySlices() const override { return D3D11_REQ_TEXTURE2D_ARRAY_AXIS_DIMENSION; }
+	RHITexture GetDebugTexture2D() override;
+
+	void BeginGeometryPass() override;
+	void BeginMaskedGeometryPass() override;
+	void SetGeometryShaderFeatures(uint32_t features) override;
+	void DrawMesh(const Mesh& mesh, RHITexture diffuseTexture, RHITexture maskTexture) override;
+	void BeginLightingPass() override;
+	void DrawAmbient(glm::vec3 color) override;
+	void DrawDirectionalLight(glm::vec3 color, glm::vec3 angles) override;
+	void Present() override;
+
+	void InitImGui(const Window& window) override;
+	void NewImGuiFrame() override;
+	void RenderImGui() override;
+	void ShutdownImGui() override;
+
+	// The debug layer does the validating for this backend.
+	uint32_t GetNumValidationErrors() const override { return 0; }
+	void LogStats() const override;
+
+	// Fixed function state, created once per unique descriptor. Descriptors must be zeroed before being filled in.
+	ID3D11SamplerState*	GetSampler(const D3D11_SAMPLER_DESC& samplerDesc);
+	ID3D11SamplerState*	GetDefaultSampler();
+	ID3D11BlendState* GetBlendState(const D3D11_BLEND_DESC& blendDesc);
+	ID3D11DepthStencilState* GetDepthStencilState(const D3D11_DEPTH_STENCIL_DESC& depthStencilDesc);
+	ID3D11RasterizerState* GetRasterizerState(const D3D11_RASTERIZER_DESC& rasterizerDesc);
+	const GPUPipelineState* GetPipelineState(const GPUPipelineStateDesc& pipelineDesc);
 	void LoadVertexShaders();
 	void LoadPixelShaders();
 
-	ID3D11Texture2D*  GetDebugTexture2D();
-    bool UpdateConstantBuffer(ID3D11Buffer* cbHandle, void* data, int numBytes);
+	uint32_t GetNumSamplerRequests() const { return m_SamplerCache.GetNumRequests(); }
+	uint32_t GetNumUniqueSamplers() const { return m_SamplerCache.GetNumUnique(); }
 	void ClearBackBufferColor();
 	void ClearBackBufferDepth();
 
-	void BeginGeometryPass();
-	void DrawMesh(const Mesh& mesh);
-	void BeginLightingPass();
-	void DrawAmbient(glm::vec3 color);
-	void DrawDirectionalLight(glm::vec3 color, glm::vec3 angles);
-	void Present();
-
     // Implementation
     ID3D11Device* GetDevice() const { return m_pD3dDevice.get(); }
     ID3D11DeviceContext* GetDeviceContext() const { return m_pD3dContext.get(); }
@@ -93,14 +165,67 @@ public:
 private:
 
 	void LoadVertexShader(const std::string& name, GPUShader& shader, const std::vector<D3D11_INPUT_ELEMENT_DESC>& vertexLayout);
-	void LoadPixelShader(const std::string& name, GPUShader& shader);
-    void RecreateBackBufferRTAndView(uint32_t windowWidth, uint32_t windowHeight);
-	void RecreateOffscreenRenderTargets(int width, int height);
+	void LoadPixelShader(const std::string& name, GPUShader& shader, const std::vector<std::pair<std::string, std::string>>& defines = {});
+	// Waits for the shader's bytecode and creates its objects. False, having logged, if either stage failed.
+	bool FinishShader(GPUShader& shader);
+    bool RecreateBackBufferRTAndView(uint32_t windowWidth, uint32_t windowHeight);
+	// Rebuilds the frame graph and swaps its targets for ones of the window's size if it changed since they were acquired.
+	bool UpdateFrameGraph();
+	// Binds the pass's targets and reads, unbinding any read its targets are still bound as. False for culled passes.
+	bool BeginGraphPass(RenderGraphPass pass);
+	void BindGraphResource(uint32_t slot, ID3D11ShaderResourceView* srv);
+	ID3D11RenderTargetView* GetGraphRenderTargetView(RenderGraphTexture texture) const;
+	// Null for imported textures.
+	ID3D11ShaderResourceView* GetGraphShaderResourceView(RenderGraphTexture texture) const;
+	GPURenderTarget AcquireRenderTarget(const RenderTargetCreateInfo& rtCreateInfo);
+	void ReleaseRenderTarget(const RenderTargetCreateInfo& rtCreateInfo, GPURenderTarget& renderTarget);
+	// Releases the object once the frames in flight that may use it have finished.
+	void DeferRelease(ID3D11DeviceChild* object);
+	void RetireRenderTarget(GPURenderTarget& renderTarget);
 	void CreateLightingResources();
+	bool CreatePipelineStates();
 	void CreateDebugTexture2D();
 	void CreateResolveQuadBuffers();
-	ID3D11Texture2D* CreateRenderTargetColor(const RenderTargetCreateInfo& rtCreateInfo);
-	GPURenderTarget _CreateRenderTargetColor(const RenderTargetCreateInfo& rtCreateInfo);
+	void BindFullscreenQuad();
+	void BindPipeline(const GPUPipelineState& pipeline);
+	void BindPipeline(ID3D11DeviceContext* context, RHIStateCache& stateCache, const GPUPipelineState& pipeline) const;
+	void BindGraphTargets(ID3D11DeviceContext* context, RHIStateCache& stateCache, RenderGraphPass pass) const;
+	ID3D11Buffer* GetBuffer(RHIBuffer buffer) const;
+	// Waits for the GPU to be done with this frame's part of the constant ring. Idempotent within a frame.
+	void BeginFrame();
+	// Copies the constants written since the last flush to the GPU's copy of the ring, in one map. Fails, dropping
+	// them, if the ring can't be mapped.
+	bool FlushConstantRing();
+	bool CreateConstantRing(uint32_t frameSize, UniqueReleasePtr<ID3D11Buffer>& ring);
+	// Doubles the ring after a frame that ran out of it, up to MaxConstantRingFrameSize.
+	void GrowConstantRing();
+	// Bump allocates the buffer's contents a place in this frame's part of the ring and stages them there.
+	bool WriteConstants(GPUBuffer& buffer);
+	// Stages the buffer's contents in this frame's part of the ring unless it was updated this frame, and returns
+	// the range to bind, in constants. False when the ring is full.
+	bool StageConstantBuffer(RHIBuffer buffer, UINT& firstConstant, UINT& numConstants);
+	// Returns false, and binds nothing, when the ring is full.
+	bool BindConstantBuffer(RHIStateSlot slot, RHIBuffer buffer);
+	const GPUTexture& GetTexture(RHITexture texture) const;
+	bool _CreateRenderTargetColor(const RenderTargetCreateInfo& rtCreateInfo, GPURenderTarget& gpuRt);
+
+	// A geometry draw with everything it binds looked up, so recording it touches nothing shared.
+	struct DrawPacket
+	{
+		const GPUPipelineState*					pipeline;
+		std::array<ID3D11Buffer*, 3>			vertexBuffers;
+		ID3D11Buffer*							indexBuffer;
+		UINT									firstConstant;
+		UINT									numConstants;
+		ID3D11SamplerState*						sampler;
+		ID3D11ShaderResourceView*				diffuseSrv;
+		ID3D11ShaderResourceView*				maskSrv;		// Null leaves the slot as it is
+		UINT									numIndices;
+	};
+
+	void RecordDrawPackets(ID3D11DeviceContext1* context, RHIStateCache& stateCache, const DrawPacket* begin, const DrawPacket* end) const;
+	// Records the queued draws and runs them, in order, on the immediate context.
+	void RecordGeometryPass();
 
     UniqueReleasePtr<IDXGIAdapter1>				m_pAdapter;
     UniqueReleasePtr<IDXGISwapChain>			m_pSwapChain;
@@ -110,33 +235,119 @@ private:
     UniqueReleasePtr<ID3D11RenderTargetView>	m_pBackBufferRTView;
     UniqueReleasePtr<ID3D11Texture2D>			m_pDepthStencilRT;
     UniqueReleasePtr<ID3D11DepthStencilView>	m_pDepthStencilRTView;
-    UniqueReleasePtr<ID3D11DepthStencilState>	m_pDepthStencilState;
-    UniqueReleasePtr<ID3D11RasterizerState>		m_pRasterState;
 
-	GPUShader									_solidColorShader;
-	GPUShader									_resolveShader;
+	// Compiles on the engine's thread pool, so shaders build in parallel with each other and with the rest of startup.
+	std::unique_ptr<ShaderCache>				m_ShaderCache;
 	GPUShader									_ambientShader;
 	GPUShader									_directionalShader;
 	
-	ID3D11Texture2D*							m_DebugTexture2D;
+	RHITexture									m_DebugTexture2D;
 
-	GPURenderTarget								_offscreenColorRT;
-	GPURenderTarget								_offscreenNormalRT;
+	// GeometryVS reads each draw's material from here, by the index in its constants, as three uint4s.
+	UniqueReleasePtr<ID3D11Buffer>				m_MaterialTable;
+	UniqueReleasePtr<ID3D11ShaderResourceView>	m_MaterialTableSrv;
+	uint32_t									m_MaterialCapacity = 0;	// In materials
 
-	ID3D11Buffer*								_ambientCb;
-	ID3D11Buffer*								_directionalCb;
+	/* The frame's passes and the textures they read and write. Rebuilt at the start of the first geometry
+	   pass after a resize, so a window drag resizes the targets once per frame instead of once per event. The
+	   physical targets come from the render target pool, where dragging back to a size finds the old ones. */
+	RenderGraph									m_FrameGraph;
+	RenderGraphPass								m_GeometryGraphPass;
+	RenderGraphPass								m_LightingGraphPass;
+	RenderGraphTexture							m_BackBufferTexture;
+	std::vector<RenderTargetCreateInfo>			m_GraphTargetInfos;		// By physical texture
+	std::vector<GPURenderTarget>				m_GraphTargets;
+	std::array<ID3D11ShaderResourceView*, 2>	m_GraphResources = {};	// What BeginGraphPass last bound to each resource slot
+	bool										m_PassCulled = false;
+	uint32_t									m_FrameGraphWidth = 0;
+	uint32_t									m_FrameGraphHeight = 0;
+	uint32_t									m_WindowWidth = 0;
+	uint32_t									m_WindowHeight = 0;
 
-	UniqueReleasePtr<ID3D11SamplerState>		_gbufferSampler;
+	RHIBuffer									_ambientCb;
+	RHIBuffer									_directionalCb;
 
-	UniqueReleasePtr<ID3D11BlendState>			_lightingBlendState;
+	ID3D11SamplerState*							_gbufferSampler;
 
-	UniqueReleasePtr<ID3D11DepthStencilState>	_depthStateTestDisabledWriteDisabled;
+	const GPUPipelineState*						_ambientPipeline;
+	const GPUPipelineState*						_directionalPipeline;
 
 	GPUMesh										_fullscreenQuadMesh;
 
-    /* The RHI ensures these objects get cleaned up upon destruction, or upon a call to Release() */
+	/* GeometryPS is compiled per GeometryShaderFeatures key, and only for the keys draws ask for. The opaque and
+	   masked base variants are requested with the other shaders at startup and waited for, the debug views when
+	   first drawn, and those draw as their base until they have built. */
+	struct GeometryVariant
+	{
+		GPUShader								shader;
+		bool									finished = false;
+		const GPUPipelineState*					pipeline = nullptr;	// Null until finished, and after if it failed to build
+	};
+	// Requests the variant's stages the first time it is asked for, without waiting for them.
+	GeometryVariant& RequestGeometryVariant(uint32_t features);
+	// Falls back to the base variant with the same alpha test while the variant is compiling, or if it failed.
+	// Only the base variants are waited for.
+	const GPUPipelineState* GetGeometryPipeline(uint32_t features);
+	std::unordered_map<uint32_t, GeometryVariant> m_GeometryVariants;
+	uint32_t									m_GeometryFeatures = 0;
+	double										m_GeometryVariantMs = 0.0;	// Waiting for the base variants, and creating every variant's objects
+	D3D11_VIEWPORT								m_Viewport;
+
+	/* The main thread records the first chunk of the geometry pass on the immediate context, the record threads
+	   the rest on their own deferred contexts. Their command lists are then executed in chunk order. */
+	static const uint32_t						MinDrawsPerChunk = 64;
+	std::vector<DrawPacket>						m_DrawPackets;
+	const GPUPipelineState*						m_CurrentGeometryPipeline = nullptr;
+	uint32_t									m_NumRecordSlots = 1;
+	std::unique_ptr<ThreadPool>					m_RecordThreads;
+	std::vector<UniqueReleasePtr<ID3D11DeviceContext1>> m_DeferredContexts;	// By record slot, null for the first
+	std::vector<RHIStateCache>					m_RecordStateCaches;
+	uint64_t									m_NumDraws = 0;
+	uint64_t									m_NumRecordedChunks = 0;
+	double										m_RecordMs = 0.0;
+
+	/* Every constant buffer update is bump allocated from this frame's part of one dynamic buffer and bound by
+	   offset. Updates go to a CPU copy first and reach the GPU in a single no-overwrite map before the next draw,
+	   and an event query per part keeps frames in flight from being overwritten. */
+	static const uint32_t						FramesInFlight = 3;
+	static const uint32_t						DefaultConstantRingFrameSize = 4 * 1024 * 1024;
+	static const uint32_t						MaxConstantRingFrameSize = 32 * 1024 * 1024;
+	UniqueReleasePtr<ID3D11Buffer>				m_ConstantRing;
+	std::vector<char>							m_ConstantRingStaging;
+	UploadRing									m_ConstantRingAllocator;
+	uint32_t									m_ConstantRingFrameSize = DefaultConstantRingFrameSize;
+	uint32_t									m_ConstantRingDirtyBegin = 0;
+	uint32_t									m_ConstantRingDirtyEnd = 0;
+	bool										m_ConstantRingDiscarded = false;
+	bool										m_ConstantRingFull = false;		// An allocation failed this frame, so the next one grows the ring
+	std::array<UniqueReleasePtr<ID3D11Query>, FramesInFlight> m_FrameFences;
+	std::array<bool, FramesInFlight>			m_FrameFenceIssued = {};
+	bool										m_FrameBegun = false;
+	// Objects retired in each frame's part, released once that frame's fence has been waited on.
+	std::array<std::vector<UniqueReleasePtr<ID3D11DeviceChild>>, FramesInFlight> m_FrameReleases;
+
+	// Everything bound on the immediate context goes through this, so repeated binds are dropped before the driver.
+	RHIStateCache								m_StateCache;
+	RHIStateCounts								m_StateCounts;
+	uint64_t									m_NumFrames = 0;
+
+    /* Cached state objects, which live as long as the RHI. */
     std::vector<UniqueReleasePtr<ID3D11DeviceChild>> m_ReleasableObjects;
 
-	std::map<ID3D11Texture2D*, GPUTexture> m_GpuTextureMap;
-	std::map<ID3D11Texture2D*, GPURenderTarget> m_GpuRenderTargetMap;
+	/* What the RHI handles resolve to, so a draw's lookups are array indexing and stale handles are caught.
+	   The records own their objects, and releasing a handle hands them to m_FrameReleases. */
+	SlotMap<GPUBuffer>							m_Buffers;
+	SlotMap<GPUTexture>							m_Textures;
+	GPUResourceTracker							m_Resources;
+
+	/* Render targets nobody is using, by size and format. Ones left unused for RenderTargetIdleFrames are released. */
+	static const uint32_t						RenderTargetIdleFrames = 120;
+	RenderTargetPool<RenderTargetCreateInfo, GPURenderTarget> m_RenderTargetPool;
+
+	/* State objects and pipelines keyed by a hash of their descriptor. The objects are owned via m_ReleasableObjects. */
+	DescriptorCache<D3D11_SAMPLER_DESC, ID3D11SamplerState*>			m_SamplerCache;
+	DescriptorCache<D3D11_BLEND_DESC, ID3D11BlendState*>				m_BlendStateCache;
+	DescriptorCache<D3D11_DEPTH_STENCIL_DESC, ID3D11DepthStencilState*>	m_DepthStencilStateCache;
+	DescriptorCache<D3D11_RASTERIZER_DESC, ID3D11RasterizerState*>		m_RasterizerStateCache;
+	DescriptorCache<GPUPipelineState, GPUPipelineState>					m_PipelineCache;
 };
\ No newline at end of file
@@ -0,0 +1,57 @@
+#pragma once
+#include <cassert>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
+
+#include "Hash.h"
+
+// Deduplicates immutable objects by the descriptor they are created from. The first request for a descriptor
+// creates the object, later requests with the same bytes get that object back. Descriptors are hashed and
+// compared as raw bytes, so callers must zero them before filling them in, padding included. Knows nothing
+// about the API behind the objects, which come from the create callback passed to Get.
+template <class Desc, class Object>
+class DescriptorCache
+{
+	static_assert(std::is_trivially_copyable<Desc>::value, "Descriptors are hashed and compared as bytes");
+
+public:
+	// create is called as bool(const Desc&, Object&) on a miss. Failures aren't cached, and return null.
+	template <class Create>
+	const Object* Get(const Desc& desc, Create create)
+	{
+		++m_NumRequests;
+		auto hash = Hash::HashPod(desc);
+		auto iter = m_Entries.find(hash);
+		if (iter != m_Entries.end())
+		{
+			// A different descriptor sharing the 64-bit hash would get the wrong object back.
+			assert(memcmp(&iter->second.desc, &desc, sizeof(Desc)) == 0);
+			++m_NumHits;
+			return &iter->second.object;
+		}
+
+		// Copied bytewise, as assignment needn't carry the padding the comparison above looks at.
+		Entry entry;
+		memcpy(&entry.desc, &desc, sizeof(Desc));
+		if (!create(desc, entry.object)) return nullptr;
+		return &m_Entries.emplace(hash, std::move(entry)).first->second.object;
+	}
+
+	uint32_t GetNumRequests() const { return m_NumRequests; }
+	uint32_t GetNumHits() const { return m_NumHits; }
+	uint32_t GetNumUnique() const { return static_cast<uint32_t>(m_Entries.size()); }
+
+private:
+	struct Entry
+	{
+		Desc desc;
+		Object object;
+	};
+
+	std::unordered_map<uint64_t, Entry> m_Entries;
+	uint32_t m_NumRequests = 0;
+	uint32_t m_NumHits = 0;
+};
\ No newline at end of file
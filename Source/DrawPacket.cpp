@@ -0,0 +1,131 @@
+#include "DrawPacket.h"
+
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <future>
+
+#include "ThreadPool.h"
+
+namespace
+{
+// Below this the pool's wakeups cost more than the sort, so smaller lists sort on the calling thread.
+const size_t MinPacketsPerChunk = 32 * 1024;
+
+typedef std::array<uint32_t, 256> DigitCounts;
+
+// Calls func(chunk, begin, end) for each of numChunks even slices of [0, count), the first on the calling
+// thread and the rest on the pool, and waits for them all.
+template <class Func>
+void ForEachChunk(uint32_t numChunks, size_t count, ThreadPool* pool, const Func& func)
+{
+	std::vector<std::future<void>> jobs;
+	for (uint32_t chunk = 1; chunk < numChunks; ++chunk)
+	{
+		jobs.push_back(pool->Submit([&func, chunk, numChunks, count]() {
+			func(chunk, count * chunk / numChunks, count * (chunk + 1) / numChunks);
+		}));
+	}
+	func(0, 0, count / numChunks);
+	for (auto& job : jobs) job.get();
+}
+}
+
+uint64_t DrawKeys::Make(uint32_t pass, uint32_t bucket, uint32_t shader, uint32_t diffuseTexture, uint32_t maskTexture, uint32_t depth)
+{
+	auto field = [](uint32_t value, uint32_t bits, uint32_t shift) {
+		return uint64_t(std::min(value, (1u << bits) - 1)) << shift;
+	};
+	return field(pass, PassBits, PassShift) | field(bucket, BucketBits, BucketShift) | field(shader, ShaderBits, ShaderShift) |
+		field(diffuseTexture, TextureBits, DiffuseShift) | field(maskTexture, TextureBits, MaskShift) | field(depth, DepthBits, DepthShift);
+}
+
+uint32_t DrawKeys::QuantizeDepth(float viewDepth, float nearPlane, float farPlane)
+{
+	float t = std::clamp((viewDepth - nearPlane) / (farPlane - nearPlane), 0.f, 1.f);
+	return static_cast<uint32_t>(t * float((1u << DepthBits) - 1));
+}
+
+void DrawPackets::Sort(std::vector<DrawPacket>& packets, std::vector<DrawPacket>& scratch, ThreadPool* pool)
+{
+	const size_t count = packets.size();
+	scratch.resize(count);
+	if (count < 2) return;
+
+	uint32_t numChunks = pool ? static_cast<uint32_t>(std::min<size_t>(pool->GetNumThreads() + 1, count / MinPacketsPerChunk)) : 1;
+	numChunks = std::max(numChunks, 1u);
+
+	// Bytes every key shares can't change the order, and a frame's keys share most of the high ones.
+	std::vector<uint64_t> chunkOr(numChunks, 0);
+	std::vector<uint64_t> chunkAnd(numChunks, ~0ull);
+	ForEachChunk(numChunks, count, pool, [&](uint32_t chunk, size_t begin, size_t end) {
+		for (size_t i = begin; i < end; ++i)
+		{
+			chunkOr[chunk] |= packets[i].key;
+			chunkAnd[chunk] &= packets[i].key;
+		}
+	});
+	uint64_t keyOr = 0;
+	uint64_t keyAnd = ~0ull;
+	for (uint32_t chunk = 0; chunk < numChunks; ++chunk)
+	{
+		keyOr |= chunkOr[chunk];
+		keyAnd &= chunkAnd[chunk];
+	}
+	uint64_t varyingBits = keyOr ^ keyAnd;
+
+	// Each chunk counts its digits, the counts become each chunk's first slot per digit, and each chunk
+	// scatters into its slots in order, which keeps every pass stable.
+	std::vector<DigitCounts> counts(numChunks);
+	DrawPacket* src = packets.data();
+	DrawPacket* dst = scratch.data();
+	for (uint32_t shift = 0; shift < 64; shift += 8)
+	{
+		if (((varyingBits >> shift) & 0xff) == 0) continue;
+
+		ForEachChunk(numChunks, count, pool, [&](uint32_t chunk, size_t begin, size_t end) {
+			DigitCounts& digitCounts = counts[chunk];
+			digitCounts.fill(0);
+			for (size_t i = begin; i < end; ++i) ++digitCounts[(src[i].key >> shift) & 0xff];
+		});
+
+		uint32_t offset = 0;
+		for (uint32_t digit = 0; digit < 256; ++digit)
+		{
+			for (uint32_t chunk = 0; chunk < numChunks; ++chunk)
+			{
+				uint32_t digitCount = counts[chunk][digit];
+				counts[chunk][digit] = offset;
+				offset += digitCount;
+			}
+		}
+
+		ForEachChunk(numChunks, count, pool, [&](uint32_t chunk, size_t begin, size_t end) {
+			DigitCounts& slots = counts[chunk];
+			for (size_t i = begin; i < end; ++i) dst[slots[(src[i].key >> shift) & 0xff]++] = src[i];
+		});
+		std::swap(src, dst);
+	}
+
+	if (src != packets.data()) packets.swap(scratch);
+}
+
+uint32_t DrawPackets::CountStateChanges(const std::vector<DrawPacket>& packets)
+{
+	const std::array<std::pair<uint32_t, uint32_t>, 3> fields = { {
+		{ DrawKeys::ShaderShift, DrawKeys::ShaderBits },
+		{ DrawKeys::DiffuseShift, DrawKeys::TextureBits },
+		{ DrawKeys::MaskShift, DrawKeys::TextureBits },
+	} };
+
+	uint32_t numChanges = 0;
+	for (size_t i = 0; i < packets.size(); ++i)
+	{
+		for (const auto& field : fields)
+		{
+			uint32_t value = DrawKeys::GetField(packets[i].key, field.first, field.second);
+			if (i == 0 || value != DrawKeys::GetField(packets[i - 1].key, field.first, field.second)) ++numChanges;
+		}
+	}
+	return numChanges;
+}
\ No newline at end of file
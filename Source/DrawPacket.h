@@ -0,0 +1,51 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+
+class ThreadPool;
+
+// One draw, submitted in key order. Small and flat so sorting a frame's worth moves as little memory as possible.
+struct DrawPacket
+{
+	uint64_t key;
+	uint32_t meshIndex;		// Into the engine's mesh list
+};
+static_assert(sizeof(DrawPacket) == 16, "Draw packets are sorted by value");
+
+// Draw keys, most significant field first, so ascending order draws pass by pass, opaque before masked, then
+// groups by shader and textures and goes front to back within each group.
+//   pass 4 | bucket 2 | shader 6 | diffuse texture 12 | mask texture 12 | depth 28
+namespace DrawKeys
+{
+	const uint32_t PassBits = 4;
+	const uint32_t BucketBits = 2;
+	const uint32_t ShaderBits = 6;
+	const uint32_t TextureBits = 12;
+	const uint32_t DepthBits = 28;
+
+	const uint32_t DepthShift = 0;
+	const uint32_t MaskShift = DepthShift + DepthBits;
+	const uint32_t DiffuseShift = MaskShift + TextureBits;
+	const uint32_t ShaderShift = DiffuseShift + TextureBits;
+	const uint32_t BucketShift = ShaderShift + ShaderBits;
+	const uint32_t PassShift = BucketShift + BucketBits;
+	static_assert(PassShift + PassBits == 64, "Draw key fields must fill 64 bits");
+
+	// Fields wider than their bits are clamped, which only costs grouping, never correctness.
+	uint64_t Make(uint32_t pass, uint32_t bucket, uint32_t shader, uint32_t diffuseTexture, uint32_t maskTexture, uint32_t depth);
+	// Maps a view depth in [nearPlane, farPlane] onto DepthBits, nearest first.
+	uint32_t QuantizeDepth(float viewDepth, float nearPlane, float farPlane);
+
+	inline uint32_t GetField(uint64_t key, uint32_t shift, uint32_t bits) { return static_cast<uint32_t>(key >> shift) & ((1u << bits) - 1); }
+}
+
+namespace DrawPackets
+{
+	// Sorts ascending by key, keeping equal keys in order, with a least significant digit radix sort over
+	// the key bytes that differ between packets. Enough packets split each pass's counting and scattering
+	// across pool, when given. scratch is resized to match and holds garbage afterwards.
+	void Sort(std::vector<DrawPacket>& packets, std::vector<DrawPacket>& scratch, ThreadPool* pool);
+
+	// Shader, diffuse and mask texture changes between consecutive packets, counting the first packet's binds.
+	uint32_t CountStateChanges(const std::vector<DrawPacket>& packets);
+}
\ No newline at end of file
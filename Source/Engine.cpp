@@ -1,17 +1,22 @@
 #include "Engine.h"
 
+#include <algorithm>
 #include <array>
 #include <cassert>
+#include <cmath>
+#include <cstring>
 #include <filesystem>
+#include <future>
+#include <map>
 #include <memory>
+#include <set>
 #include <sstream>
 #include <string>
 #include <utility>
 
-#include <d3d11_1.h>
-#include <d3d11sdklayers.h>
-#include <d3dcompiler.h>
 #include <sdl/SDL.h>
+#include <assimp/IOStream.hpp>
+#include <assimp/IOSystem.hpp>
 #include <assimp/Importer.hpp>
 #include <assimp/scene.h>
 #include <assimp/postprocess.h>
@@ -19,18 +24,106 @@
 
 #include "ImguiMenus.h"
 #include "Imgui/imgui.h"
-#include "imgui/imgui_impl_sdl.h"
-#include "imgui/imgui_impl_dx11.h"
-#include "imgui/ImGuizmo.h"
+#include "Imgui/imgui_impl_sdl.h"
+#include "Imgui/ImGuizmo.h"
 
-#include "D3D11RHI.h"
 #include "FileUtils.h"
 #include "Mesh.h"
+#include "ShaderPermutation.h"
+#include "TexturePacker.h"
 
-namespace fs = std::experimental::filesystem;
+namespace fs = std::filesystem;
 
 Engine* g_Engine = nullptr;
 
+namespace
+{
+const float CameraNearPlane = 0.01f;
+const float CameraFarPlane = 100.f;
+
+// Draw key pass and bucket values. Every mesh draws in the geometry pass.
+const uint32_t GeometryDrawPass = 0;
+
+// Fewer meshes than this aren't worth handing to another thread.
+const uint32_t MinMeshesPerChunk = 256;
+
+// Draw keys carry the geometry shader variant in their shader field.
+static_assert(GeometryShaderFeatures::NumBits <= DrawKeys::ShaderBits, "Geometry shader variants must fit the draw key");
+
+// The debug view a render mode compiles into the geometry shader, if any.
+uint32_t GetViewFeatures(RenderMode renderMode)
+{
+	switch (renderMode)
+	{
+	case RenderMode::Normals: return GeometryShaderFeatures::ViewNormals;
+	case RenderMode::UV: return GeometryShaderFeatures::ViewUV;
+	case RenderMode::Depth: return GeometryShaderFeatures::ViewDepth;
+	default: return 0;
+	}
+}
+
+// Read-only assimp stream over a mapped file.
+class FileViewIOStream : public Assimp::IOStream
+{
+public:
+	explicit FileViewIOStream(FileUtils::FileView&& view) : m_View(std::move(view)) {}
+
+	size_t Read(void* buffer, size_t size, size_t count) override
+	{
+		if (size == 0) return 0;
+		size_t numItems = std::min(count, (m_View.size() - m_Position) / size);
+		memcpy(buffer, m_View.data() + m_Position, numItems * size);
+		m_Position += numItems * size;
+		return numItems;
+	}
+
+	size_t Write(const void* buffer, size_t size, size_t count) override { return 0; }
+
+	aiReturn Seek(size_t offset, aiOrigin origin) override
+	{
+		size_t base = origin == aiOrigin_SET ? 0 : origin == aiOrigin_CUR ? m_Position : m_View.size();
+		if (base + offset > m_View.size()) return aiReturn_FAILURE;
+		m_Position = base + offset;
+		return aiReturn_SUCCESS;
+	}
+
+	size_t Tell() const override { return m_Position; }
+	size_t FileSize() const override { return m_View.size(); }
+	void Flush() override {}
+
+private:
+	FileUtils::FileView m_View;
+	size_t m_Position = 0;
+};
+
+// Serves every file assimp opens (the scene and its material library) through FileUtils::MapFileAbsolute,
+// which also reports them to the startup trace. The stock IO system isn't exposed by this assimp build.
+class TracingIOSystem : public Assimp::IOSystem
+{
+public:
+	bool Exists(const char* file) const override { return fs::exists(file); }
+
+	char getOsSeparator() const override
+	{
+#ifdef _WIN32
+		return '\\';
+#else
+		return '/';
+#endif
+	}
+
+	Assimp::IOStream* Open(const char* file, const char* mode) override
+	{
+		if (strchr(mode, 'w') || strchr(mode, 'a')) return nullptr;
+		auto view = FileUtils::MapFileAbsolute(file);
+		if (!view.IsValid()) return nullptr;
+		return new FileViewIOStream(std::move(view));
+	}
+
+	void Close(Assimp::IOStream* file) override { delete file; }
+};
+}
+
 Camera::Camera()
 	: viewMatrix(1.f)
 	, projectionMatrix(1.f)
@@ -53,14 +146,17 @@ Engine::Engine(int argc, char** argv)
 	: CommandLineArgs(argv+1, argv+argc)
     , window({1280, 720})
 	, m_RenderMode(RenderMode::Albedo)
+	, m_StartupBegin(std::chrono::steady_clock::now())
 {
     g_Engine = this;
 }
 
 Engine::~Engine()
 {
-	ImGui_ImplDX11_Shutdown();
-	ImGui_ImplSDL2_Shutdown();
+	// Headless runs never create the UI.
+	if (!ImGui::GetCurrentContext()) return;
+
+	rhi->ShutdownImGui();
 	ImGui::DestroyContext();
 }
 
@@ -79,6 +175,62 @@ void Engine::ParseArg(const std::string& key, const std::string& value)
         ScenePath = (fs::path(ProjectDir) / value).string();
         SceneAssetsBaseDir = FileUtils::GetParentDirectory(ScenePath);
     }
+    else if (key == "ioqd")
+    {
+        FileQueueDepth = stoi(value);
+    }
+    else if (key == "rhi")
+    {
+        RHIName = value;
+    }
+    else if (key == "frames")
+    {
+        BenchmarkFrames = stoi(value);
+    }
+    else if (key == "rhithreads")
+    {
+        RHIRecordThreads = stoi(value);
+    }
+    else if (key == "rhioutput")
+    {
+        RHIOutputPath = (fs::path(ProjectDir) / value).string();
+    }
+    else if (key == "capture")
+    {
+        RHICapturePath = (fs::path(ProjectDir) / value).string();
+    }
+    else if (key == "captureframes")
+    {
+        RHICaptureFrames = stoi(value);
+    }
+    else if (key == "replay")
+    {
+        RHIReplayPath = (fs::path(ProjectDir) / value).string();
+    }
+    else if (key == "rhiringmb")
+    {
+        RHIUploadRingMB = stoi(value);
+    }
+    else if (key == "frontendthreads")
+    {
+        FrontEndThreads = stoi(value);
+    }
+    else if (key == "scenecopies")
+    {
+        SceneCopies = std::max(stoi(value), 1);
+    }
+    else if (key == "shadercache")
+    {
+        ShaderCacheDir = value.empty() ? std::string() : (fs::path(ProjectDir) / value).string();
+    }
+    else if (key == "cook")
+    {
+        CookDir = (fs::path(ProjectDir) / value).string();
+    }
+    else if (key == "startuptrace")
+    {
+        UseStartupTrace = stoi(value) != 0;
+    }
     else
     {
         SDL_Log("Unknown argument \"%s\".", key.c_str());
@@ -89,19 +241,30 @@ void Engine::ParseArg(const std::string& key, const std::string& value)
 void Engine::ParseArgs()
 {
 	ProjectDir = fs::canonical(std::string(SDL_GetBasePath()) + "../../../../").string();
+	ShaderCacheDir = (fs::path(ProjectDir) / "ShaderCache").string();
+
+	// Load last run's trace before recording starts, so it doesn't end up in the new one.
+	StartupTracePath = (fs::path(ProjectDir) / "startup.trace").string();
+	if (fs::exists(StartupTracePath) && !FileAccessTrace::Load(StartupTracePath, m_StartupTrace))
+	{
+		SDL_Log("Ignoring malformed startup trace \"%s\".", StartupTracePath.c_str());
+		m_StartupTrace.clear();
+	}
+	FileAccessTrace::Get().Start();
 
 	fs::path ConfigFilename = fs::path(ProjectDir) / "config.txt";
 
     if (fs::exists(ConfigFilename))
     {
-        auto fileData = FileUtils::LoadFileAbsolute(ConfigFilename.string());
+        auto fileData = FileUtils::MapFileAbsolute(ConfigFilename.string());
         std::string config = std::string(fileData.begin(), fileData.end());
         std::stringstream ss(config);
         std::string key;
         while (getline(ss, key, '='))
         {
             std::string value;
-            assert(getline(ss, value));
+            // Not inside the assert, which release builds compile out.
+            if (!getline(ss, value)) break;
             ParseArg(key, value);
         }
     }
@@ -122,37 +285,59 @@ void Engine::ParseArgs()
 
 bool Engine::Init()
 {
-    ParseArgs();
+    fileReader.Init(threadPool, FileQueueDepth);
+    if (UseStartupTrace && !m_StartupTrace.empty())
+    {
+        // Runs in the background while the window, device and scene are set up.
+        auto bytes = FileAccessTrace::Replay(fileReader, m_StartupTrace);
+        SDL_Log("Replaying startup trace: %u ranges, %.1f MB.", static_cast<uint32_t>(m_StartupTrace.size()), bytes / (1024.0 * 1024.0));
+        m_StartupTraceReplayed = true;
+    }
 
-	if (SDL_Init(SDL_INIT_VIDEO) < 0) {
-		SDL_Log("Unable to init Video: %s", SDL_GetError());
+	rhi = CreateRHI(RHIName);
+	if (!rhi) {
+		SDL_Log("Unknown RHI '%s'.", RHIName.c_str());
 		return false;
 	}
+	if (!RHICapturePath.empty())
+	{
+		auto capture = std::make_unique<CaptureRHI>(std::move(rhi), RHICapturePath, RHICaptureFrames);
+		m_Capture = capture.get();
+		rhi = std::move(capture);
+	}
+	window.headless = rhi->IsHeadless();
 
-    // TODO Move this code to the window class
-	window.sdlWindow.reset(SDL_CreateWindow(
-		"Rndr",
-		SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED,
-		window.width, window.height, SDL_WINDOW_SHOWN | SDL_WINDOW_RESIZABLE));
-
-	if (!window.sdlWindow) {
-		SDL_Log("Unable to create SDL Window: %s", SDL_GetError());
+	if (SDL_Init(window.headless ? 0 : SDL_INIT_VIDEO) < 0) {
+		SDL_Log("Unable to init Video: %s", SDL_GetError());
 		return false;
 	}
 
-	ZeroMemory(&window.m_SdlWindowWMInfo, sizeof(SDL_SysWMinfo));
-	if (!SDL_GetWindowWMInfo(window.sdlWindow.get(), &window.m_SdlWindowWMInfo))
+	if (!window.headless)
 	{
-		SDL_Log("SDL_GetWindowWMInfo failed.");
-		return false;
+		// TODO Move this code to the window class
+		window.sdlWindow.reset(SDL_CreateWindow(
+			"Rndr",
+			SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED,
+			window.width, window.height, SDL_WINDOW_SHOWN | SDL_WINDOW_RESIZABLE | rhi->GetWindowFlags()));
+
+		if (!window.sdlWindow) {
+			SDL_Log("Unable to create SDL Window: %s", SDL_GetError());
+			return false;
+		}
 	}
 
-    rhi.InitRHI(window);
+	if (!rhi->InitRHI(window))
+	{
+		SDL_Log("Unable to init the %s RHI.", rhi->GetName());
+		return false;
+	}
 
-	ImGui::CreateContext();
-	ImGui_ImplSDL2_InitForDX11(window.sdlWindow.get());
-	ImGui_ImplDX11_Init(rhi.GetDevice(), rhi.GetDeviceContext());
-	ImGui::StyleColorsDark();
+	if (!window.headless)
+	{
+		ImGui::CreateContext();
+		rhi->InitImGui(window);
+		ImGui::StyleColorsDark();
+	}
 
 	// TODO Feels a bit out of place here.
     UpdateProjectionMatrix();
@@ -162,24 +347,53 @@ bool Engine::Init()
 
 bool Engine::Execute()
 {
+	std::vector<double> frameTimesMs;
+	double frontEndMs = 0.0;
 	while (true)
 	{
-		// Handle events first
-		if (!HandleEvents()) break;
+		// Handle events first. Headless runs have no events and stop on the frame count.
+		if (!window.headless && !HandleEvents()) break;
+
+		auto frameBegin = std::chrono::steady_clock::now();
 
 		// Update state
 		Update(1.f);
 
 		// Render
 		Render();
+
+		// Startup frames are dominated by texture uploads, so only time the ones after it.
+		if (BenchmarkFrames > 0 && m_TexturesPacked)
+		{
+			frameTimesMs.push_back(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - frameBegin).count());
+			frontEndMs += m_FrameStats.frontEndMs;
+			if (frameTimesMs.size() >= BenchmarkFrames) break;
+		}
 	}
 
-	return true;
+	if (!frameTimesMs.empty()) LogFrameTimes(frameTimesMs, frontEndMs);
+	rhi->LogStats();
+	return rhi->GetNumValidationErrors() == 0;
+}
+
+void Engine::LogFrameTimes(std::vector<double>& frameTimesMs, double frontEndMs) const
+{
+	double frontEndMeanMs = frontEndMs / frameTimesMs.size();
+	std::sort(frameTimesMs.begin(), frameTimesMs.end());
+	double totalMs = 0.0;
+	for (auto ms : frameTimesMs) totalMs += ms;
+	auto percentile = [&](double p) { return frameTimesMs[static_cast<size_t>(p * (frameTimesMs.size() - 1))]; };
+
+	SDL_Log("CPU frame time over %u frames (%s RHI, %u meshes): mean %.3f ms (%.1f fps), median %.3f ms, p95 %.3f ms, p99 %.3f ms, max %.3f ms.",
+		static_cast<uint32_t>(frameTimesMs.size()), rhi->GetName(), static_cast<uint32_t>(m_Meshes.size()),
+		totalMs / frameTimesMs.size(), 1000.0 * frameTimesMs.size() / totalMs, percentile(0.5), percentile(0.95), percentile(0.99), frameTimesMs.back());
+	SDL_Log("Front end: mean %.3f ms per frame in %u chunks.", frontEndMeanMs, m_FrameStats.frontEndChunks);
+	SDL_Log("Draw sorting: %u shader and texture changes per frame, %u in load order.", m_FrameStats.stateChanges, m_FrameStats.unsortedStateChanges);
 }
 
 void Engine::UpdateProjectionMatrix()
 {
-	camera.projectionMatrix = glm::perspective(45.f, (float)window.width / window.height, 0.01f, 100.f);
+	camera.projectionMatrix = glm::perspective(45.f, (float)window.width / window.height, CameraNearPlane, CameraFarPlane);
 }
 
 void Engine::ResizeWindow(int width, int height)
@@ -187,7 +401,7 @@ void Engine::ResizeWindow(int width, int height)
 	window.width = width;
 	window.height = height;
 
-    rhi.HandleWindowResize(width, height);
+    rhi->HandleWindowResize(width, height);
 
     UpdateProjectionMatrix();
 }
@@ -259,21 +473,166 @@ bool Engine::LoadContent()
 {
 	// Load the asset with assimp
 	Assimp::Importer assimp;
+	assimp.SetIOHandler(new TracingIOSystem());
 	const aiScene* pScene = assimp.ReadFile(ScenePath,
 		(aiProcess_ConvertToLeftHanded	// Convert to CW for DirectX.
 		| aiProcessPreset_TargetRealtime_MaxQuality)
 	);
 
+	// Queue every texture the meshes will ask for as one batch before building any of them.
+	std::set<unsigned int> usedMaterials;
+	for (uint32_t meshIdx = 0; meshIdx < pScene->mNumMeshes; ++meshIdx)
+	{
+		usedMaterials.insert(pScene->mMeshes[meshIdx]->mMaterialIndex);
+	}
+	std::vector<std::string> diffusePaths;
+	std::vector<std::string> maskPaths;
+	for (auto materialIdx : usedMaterials)
+	{
+		const auto& material = *pScene->mMaterials[materialIdx];
+		aiString texPath;
+		if (material.GetTexture(aiTextureType_DIFFUSE, 0, &texPath) == aiReturn_SUCCESS)
+		{
+			diffusePaths.push_back(FileUtils::Combine(SceneAssetsBaseDir, texPath.C_Str()));
+		}
+		if (material.GetTexture(aiTextureType_OPACITY, 0, &texPath) == aiReturn_SUCCESS)
+		{
+			maskPaths.push_back(FileUtils::Combine(SceneAssetsBaseDir, texPath.C_Str()));
+		}
+	}
+	textureMap.PrefetchTextures(diffusePaths, CPUTextureFormat::BGRA8);
+	textureMap.PrefetchTextures(maskPaths, CPUTextureFormat::BC4);
+
 	for (uint32_t meshIdx = 0; meshIdx < pScene->mNumMeshes; ++meshIdx)
 	{
 		const aiMesh& aimesh = *pScene->mMeshes[meshIdx];
-		SharedDeletePtr<Mesh> mesh = Mesh::LoadMesh(aimesh, *pScene, rhi);
+		SharedDeletePtr<Mesh> mesh = Mesh::LoadMesh(aimesh, *pScene, *rhi);
 		m_Meshes.push_back(mesh);
 	}
 
+	SDL_Log("Materials: %u meshes share %u unique materials.", materials.GetNumAdds(), materials.GetNumMaterials());
+
+	if (SceneCopies > 1) CopyScene();
+
+	// Keep each bucket contiguous, opaque first.
+	std::stable_partition(m_Meshes.begin(), m_Meshes.end(), [](const SharedPtr<Mesh>& mesh) {
+		return mesh->alphaMode == AlphaMode::Opaque;
+	});
+
 	return true;
 }
 
+void Engine::CopyScene()
+{
+	// Spaced by the spread of the meshes' centers, which is the scene's size give or take a mesh.
+	glm::vec3 centerMin = m_Meshes.empty() ? glm::vec3(0.f) : m_Meshes[0]->boundsCenter;
+	glm::vec3 centerMax = centerMin;
+	for (const auto& mesh : m_Meshes)
+	{
+		centerMin = glm::min(centerMin, mesh->boundsCenter);
+		centerMax = glm::max(centerMax, mesh->boundsCenter);
+	}
+	glm::vec3 spacing = glm::max(centerMax - centerMin, glm::vec3(1.f)) * 1.5f;
+
+	// Copies share the original's buffers and textures, only their placement and constants are their own.
+	const auto numOriginals = static_cast<uint32_t>(m_Meshes.size());
+	const auto gridWidth = static_cast<uint32_t>(std::ceil(std::sqrt(float(SceneCopies))));
+	m_Meshes.reserve(size_t(numOriginals) * SceneCopies);
+	for (uint32_t copy = 1; copy < SceneCopies; ++copy)
+	{
+		glm::vec3 offset(float(copy % gridWidth) * spacing.x, 0.f, float(copy / gridWidth) * spacing.z);
+		for (uint32_t meshIdx = 0; meshIdx < numOriginals; ++meshIdx)
+		{
+			SharedDeletePtr<Mesh> mesh(new Mesh(*m_Meshes[meshIdx]));
+			mesh->modelMatrix = glm::translate(glm::mat4(1.f), offset) * mesh->modelMatrix;
+			mesh->constantBuffer = rhi->CreateConstantBuffer(sizeof(GeometryConstantBufferLayout));
+			assert(mesh->constantBuffer);
+			m_Meshes.push_back(mesh);
+		}
+	}
+	SDL_Log("Scene copied %u times, %u meshes.", SceneCopies, static_cast<uint32_t>(m_Meshes.size()));
+}
+
+void Engine::FinishStartup()
+{
+	// Startup counts as done once every texture the scene asked for is on the GPU.
+	auto& trace = FileAccessTrace::Get();
+	trace.Stop();
+	double startupMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - m_StartupBegin).count();
+	SDL_Log("Startup took %.0f ms (readahead replay %s).", startupMs, m_StartupTraceReplayed ? "on" : "off");
+
+	if (UseStartupTrace)
+	{
+		auto accesses = trace.GetAccesses();
+		if (FileAccessTrace::Save(StartupTracePath, accesses))
+		{
+			SDL_Log("Wrote startup trace with %u ranges.", static_cast<uint32_t>(accesses.size()));
+		}
+	}
+}
+
+void Engine::PackTextures()
+{
+	// Gather every unique texture that has been uploaded. The debug texture stays standalone so
+	// meshes without a diffuse map, or loaded later, can keep using it.
+	std::vector<TexturePackingInput> inputs;
+	for (auto texture : textureMap.GetUniqueTextures())
+	{
+		inputs.push_back(rhi->GetTexturePackingInput(texture));
+	}
+
+	std::vector<RHITexture> drawTexturesBefore;
+	for (const auto& mesh : m_Meshes) drawTexturesBefore.push_back(textureMap.Resolve(materials.Get(mesh->materialIndex).diffuseTexture).texture);
+
+	const uint32_t maxSlices = rhi->GetMaxTextureArraySlices();
+	auto plan = TexturePacker::BuildPlan(inputs, maxSlices);
+	if (!TexturePacker::ValidatePlan(plan, inputs, maxSlices))
+	{
+		SDL_Log("Texture packing plan failed validation, drawing unpacked textures.");
+		return;
+	}
+
+	// Create one array at a time and drop its sources straight away to keep the peak footprint down.
+	std::vector<RHITexture> arrayTextures;
+	for (const auto& arrayPlan : plan.arrays)
+	{
+		auto arrayTexture = rhi->CreateTexture2DArray(arrayPlan);
+		assert(arrayTexture);
+		arrayTextures.push_back(arrayTexture);
+		for (auto texture : arrayPlan.slices)
+		{
+			rhi->ReleaseTexture2D(texture);
+		}
+	}
+	textureMap.ApplyPackingPlan(plan, arrayTextures);
+
+	// Draw meshes grouped by array so consecutive draws share their bindings.
+	std::map<RHITexture, size_t> arrayOrder;
+	for (size_t i = 0; i < arrayTextures.size(); ++i) arrayOrder[arrayTextures[i]] = i;
+	auto getOrder = [&](const SharedPtr<Mesh>& mesh) {
+		auto iter = arrayOrder.find(textureMap.Resolve(materials.Get(mesh->materialIndex).diffuseTexture).texture);
+		return iter != arrayOrder.end() ? iter->second : arrayOrder.size();
+	};
+	std::stable_sort(m_Meshes.begin(), m_Meshes.end(), [&](const SharedPtr<Mesh>& a, const SharedPtr<Mesh>& b) {
+		if (a->alphaMode != b->alphaMode) return a->alphaMode < b->alphaMode;
+		return getOrder(a) < getOrder(b);
+	});
+
+	std::vector<RHITexture> drawTexturesAfter;
+	for (const auto& mesh : m_Meshes) drawTexturesAfter.push_back(textureMap.Resolve(materials.Get(mesh->materialIndex).diffuseTexture).texture);
+
+	auto before = TexturePacker::CountBinds(drawTexturesBefore);
+	auto after = TexturePacker::CountBinds(drawTexturesAfter);
+	SDL_Log("Texture packing: %u textures into %u arrays. Diffuse SRV binds per frame: %u draws, %u -> %u.",
+		(uint32_t)plan.slots.size(), (uint32_t)plan.arrays.size(), after.numDraws, before.srvBinds, after.srvBinds);
+
+	const auto& texStats = textureMap.GetStats();
+	SDL_Log("Textures: %u lookups, %u unique paths, %u unique textures, %u content duplicates (%llu KB uploaded, %llu KB saved).",
+		texStats.numPathLookups, texStats.numUniquePaths, texStats.numUniqueTextures, texStats.numContentDuplicates,
+		static_cast<unsigned long long>(texStats.bytesUploaded / 1024), static_cast<unsigned long long>(texStats.bytesSaved / 1024));
+	rhi->LogStats();
+}
+
 bool Engine::UpdateCamera(float deltaTime)
 {
 	// Wrap around/clamp the view angles
@@ -313,45 +672,183 @@ bool Engine::UpdateCamera(float deltaTime)
 
 bool Engine::Update(float deltaTime)
 {
-	ImGui_ImplDX11_NewFrame();
-	ImGui_ImplSDL2_NewFrame(window.sdlWindow.get());
-	ImGui::NewFrame();
-	ImGuizmo::BeginFrame();
+	m_FrameStats = FrameStats();
+
+	if (!window.headless)
+	{
+		rhi->NewImGuiFrame();
+		ImGui_ImplSDL2_NewFrame(window.sdlWindow.get());
+		ImGui::NewFrame();
+		ImGuizmo::BeginFrame();
+	}
+
+	// Create GPU textures for anything the decode workers have finished, and pack them into
+	// arrays once the scene's textures have all arrived.
+	textureMap.ProcessUploads(Globals::TextureUploadsPerFrame);
+	if (!m_TexturesPacked && !textureMap.HasPendingTextures())
+	{
+		PackTextures();
+		m_TexturesPacked = true;
+		FinishStartup();
+		// Startup uploads arrive in a different order every run, so captures begin once they are done.
+		if (m_Capture) m_Capture->BeginCapture();
+	}
 
 	UpdateCamera(deltaTime);
+	RunFrontEnd();
 
-    auto viewProjMatrix = camera.projectionMatrix * camera.viewMatrix;
+	return true;
+}
 
-	for (auto& meshItr : m_Meshes)
+uint32_t Engine::GetDrawTextureId(RHITexture texture)
+{
+	if (!texture) return 0;
+	auto inserted = m_DrawTextureIds.emplace(texture, static_cast<uint32_t>(m_DrawTextureIds.size() + 1));
+	// Ids past the key's field clamp onto its last value, so those textures' draws stop grouping together.
+	const uint32_t maxId = (1u << DrawKeys::TextureBits) - 1;
+	if (inserted.second && inserted.first->second == maxId + 1)
 	{
-		GeometryConstantBufferLayout constBuffer;
-		constBuffer.mvpMatrix =  viewProjMatrix * meshItr->modelMatrix;
+		SDL_Log("More than %u textures are drawn with, draws with the rest no longer group by texture.", maxId);
+	}
+	return inserted.first->second;
+}
+
+void Engine::UpdateMaterialTextures()
+{
+	if (m_MaterialTextures.size() == materials.GetNumMaterials() && m_MaterialTexturesGeneration == textureMap.GetGeneration()) return;
 
-		// Update the constant buffer...
-        rhi.UpdateConstantBuffer(meshItr->constantBuffer, &constBuffer, sizeof(constBuffer));
+	// Ids are handed out afresh with each table, so textures released since, such as those packed into arrays or
+	// a previous scene's, don't keep using up the key's field.
+	m_DrawTextureIds.clear();
+	m_MaterialTextures.resize(materials.GetNumMaterials());
+	for (uint32_t materialIndex = 0; materialIndex < materials.GetNumMaterials(); ++materialIndex)
+	{
+		const Material& material = materials.Get(materialIndex);
+		auto diffuse = textureMap.Resolve(material.diffuseTexture);
+		auto mask = textureMap.Resolve(material.maskTexture);
+		bool masked = material.maskTexture != InvalidTextureHandle;
+		MaterialTextures& textures = m_MaterialTextures[materialIndex];
+		textures.diffuse = diffuse.texture;
+		textures.mask = masked ? mask.texture : nullptr;
+		textures.diffuseId = GetDrawTextureId(diffuse.texture);
+		textures.maskId = masked ? GetDrawTextureId(mask.texture) : 0;
+		textures.diffuseSlice = diffuse.slice;
+		textures.maskSlice = mask.slice;
 	}
+	m_MaterialTexturesGeneration = textureMap.GetGeneration();
 
-	return true;
+	// Slices only change with the texture map, so the table is sent again only as textures arrive and are packed.
+	rhi->UpdateMaterialTable(materials.BuildGPUTable([this](TextureHandle texture) { return textureMap.Resolve(texture).slice; }));
+}
+
+void Engine::RunFrontEnd()
+{
+	auto frontEndBegin = std::chrono::steady_clock::now();
+	UpdateMaterialTextures();
+
+	const auto numMeshes = static_cast<uint32_t>(m_Meshes.size());
+	m_MeshConstants.resize(numMeshes);
+	m_DrawPackets.resize(numMeshes);
+
+	// Contiguous chunks, one per thread, each writing only its own meshes' entries. The main thread builds
+	// the first rather than waiting idle.
+	uint32_t maxChunks = threadPool.GetNumThreads() + 1;
+	if (FrontEndThreads) maxChunks = std::min(maxChunks, FrontEndThreads);
+	uint32_t numChunks = std::clamp((numMeshes + MinMeshesPerChunk - 1) / MinMeshesPerChunk, 1u, maxChunks);
+	auto viewProjMatrix = camera.projectionMatrix * camera.viewMatrix;
+	uint32_t viewFeatures = GetViewFeatures(m_RenderMode);
+	auto buildChunk = [this, viewProjMatrix, viewFeatures, numMeshes, numChunks](uint32_t chunk) {
+		uint32_t end = static_cast<uint32_t>(uint64_t(numMeshes) * (chunk + 1) / numChunks);
+		for (uint32_t meshIndex = static_cast<uint32_t>(uint64_t(numMeshes) * chunk / numChunks); meshIndex < end; ++meshIndex)
+		{
+			const Mesh& mesh = *m_Meshes[meshIndex];
+			const MaterialTextures& textures = m_MaterialTextures[mesh.materialIndex];
+			glm::mat4 mvpMatrix = viewProjMatrix * mesh.modelMatrix;
+
+			GeometryConstantBufferLayout& constants = m_MeshConstants[meshIndex];
+			constants.mvpMatrix = mvpMatrix;
+			constants.textureSlices = glm::uvec4(textures.diffuseSlice, textures.maskSlice, mesh.materialIndex, 0);
+
+			// The shader is the variant the mesh draws with, which alpha tests exactly when the bucket is masked.
+			uint32_t bucket = static_cast<uint32_t>(mesh.alphaMode);
+			uint32_t shader = viewFeatures | (mesh.alphaMode == AlphaMode::Masked ? GeometryShaderFeatures::AlphaTest : 0);
+			float viewDepth = (mvpMatrix * glm::vec4(mesh.boundsCenter, 1.f)).w;
+			DrawPacket& packet = m_DrawPackets[meshIndex];
+			packet.key = DrawKeys::Make(GeometryDrawPass, bucket, shader, textures.diffuseId, textures.maskId,
+				DrawKeys::QuantizeDepth(viewDepth, CameraNearPlane, CameraFarPlane));
+			packet.meshIndex = meshIndex;
+		}
+	};
+
+	std::vector<std::future<void>> chunksBuilt;
+	for (uint32_t chunk = 1; chunk < numChunks; ++chunk)
+	{
+		chunksBuilt.push_back(threadPool.Submit([&buildChunk, chunk]() { buildChunk(chunk); }));
+	}
+	buildChunk(0);
+	for (auto& built : chunksBuilt) built.get();
+
+	// The RHI is only ever called from this thread, and an update is a copy into its upload ring.
+	for (uint32_t meshIndex = 0; meshIndex < numMeshes; ++meshIndex)
+	{
+		rhi->UpdateConstantBuffer(m_Meshes[meshIndex]->constantBuffer, &m_MeshConstants[meshIndex], sizeof(GeometryConstantBufferLayout));
+	}
+
+	m_FrameStats.frontEndMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - frontEndBegin).count();
+	m_FrameStats.frontEndChunks = numChunks;
 }
 
 bool Engine::Render()
 {
-	rhi.BeginGeometryPass();
+	m_FrameStats.unsortedStateChanges = DrawPackets::CountStateChanges(m_DrawPackets);
+	DrawPackets::Sort(m_DrawPackets, m_DrawPacketScratch, &threadPool);
+	m_FrameStats.stateChanges = DrawPackets::CountStateChanges(m_DrawPackets);
+
+	rhi->BeginGeometryPass();
 
-	for (const auto& meshItr : m_Meshes)
+	// Packets come opaque bucket first, then masked, and grouped by shader variant within each.
+	bool inMaskedBucket = false;
+	uint32_t currentShader = ~0u;
+	for (const DrawPacket& packet : m_DrawPackets)
 	{
-        rhi.DrawMesh(*meshItr);
+		const Mesh& mesh = *m_Meshes[packet.meshIndex];
+		const MaterialTextures& textures = m_MaterialTextures[mesh.materialIndex];
+		if (mesh.alphaMode == AlphaMode::Masked && !inMaskedBucket)
+		{
+			rhi->BeginMaskedGeometryPass();
+			inMaskedBucket = true;
+		}
+		uint32_t shader = DrawKeys::GetField(packet.key, DrawKeys::ShaderShift, DrawKeys::ShaderBits);
+		if (shader != currentShader)
+		{
+			rhi->SetGeometryShaderFeatures(shader);
+			currentShader = shader;
+		}
+		if (mesh.alphaMode == AlphaMode::Masked)
+		{
+			rhi->DrawMesh(mesh, textures.diffuse, textures.mask);
+			++m_FrameStats.maskedDraws;
+		}
+		else
+		{
+			assert(!inMaskedBucket);
+			rhi->DrawMesh(mesh, textures.diffuse, nullptr);
+			++m_FrameStats.opaqueDraws;
+		}
 	}
 
-	rhi.BeginLightingPass();
-	rhi.DrawAmbient(Globals::LightingAmbientColor);
-	rhi.DrawDirectionalLight(Globals::LightingDirectionalColor, Globals::LightingDirectionalRot);
+	rhi->BeginLightingPass();
+	rhi->DrawAmbient(Globals::LightingAmbientColor);
+	rhi->DrawDirectionalLight(Globals::LightingDirectionalColor, Globals::LightingDirectionalRot);
 
-	ImGui::Integration::RenderMenus();
-	ImGui::Render();
-	ImGui_ImplDX11_RenderDrawData(ImGui::GetDrawData());
+	if (!window.headless)
+	{
+		ImGui::Integration::RenderMenus();
+		ImGui::Render();
+		rhi->RenderImGui();
+	}
 
-    rhi.Present();
+    rhi->Present();
 
 	return true;
 }
\ No newline at end of file
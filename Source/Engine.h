@@ -1,34 +1,56 @@
 #pragma once
 
+#include <chrono>
+#include <memory>
 #include <string>
+#include <unordered_map>
 #include <vector>
 
 #include <sdl/SDL.h>
-#include <sdl/SDL_syswm.h>
 #include <assimp/scene.h>
 #include <glm/glm.hpp>
 
+#include "AsyncFileReader.h"
+#include "CaptureRHI.h"
+#include "DrawPacket.h"
+#include "FileAccessTrace.h"
+#include "Material.h"
 #include "Mesh.h"
+#include "RHI.h"
 #include "SharedPtr.h"
 #include "TextureMap.h"
+#include "ThreadPool.h"
 #include "UniquePtr.h"
 #include "Window.h"
-#include "D3D11RHI.h"
 
 struct GBuffers {
-	ID3D11Texture2D* color;
-	ID3D11Texture2D* normal;
+	RHITexture color;
+	RHITexture normal;
 };
 
 enum RenderMode {
 	Albedo = 0,
 	Normals,
+	UV,
+	Depth,
 	END_OF_LIST
 };
 
 RenderMode& operator++(RenderMode& rm);
 RenderMode operator++(RenderMode& rm, int);
 
+// Counters gathered while rendering a frame, shown in the Stats window.
+struct FrameStats {
+	uint32_t									opaqueDraws = 0;
+	uint32_t									maskedDraws = 0;
+	// Shader and texture changes between consecutive draws, as submitted and as they were in load order.
+	uint32_t									stateChanges = 0;
+	uint32_t									unsortedStateChanges = 0;
+	// Building the frame's constants and draw packets, and the chunks it was split into.
+	double										frontEndMs = 0.0;
+	uint32_t									frontEndChunks = 0;
+};
+
 struct Camera {
 	glm::mat4									viewMatrix;
 	glm::mat4									projectionMatrix;
@@ -59,27 +81,97 @@ public:
     void ResizeWindow(int width, int height);
     void HandleWindowEvent(const SDL_Event& event);
     void UpdateProjectionMatrix();
+    void PackTextures();
 
 	std::vector<char*> CommandLineArgs;
 
 	std::string	ScenePath;
     std::string SceneAssetsBaseDir;
 	std::string ProjectDir;
+	std::string CookDir;
+	std::string StartupTracePath;
+	bool UseStartupTrace = true;
+	uint32_t FileQueueDepth = 32;
+	std::string RHIName = "d3d11";
+	// When non-zero, Execute stops after this many frames past startup and logs their CPU times.
+	uint32_t BenchmarkFrames = 0;
+	// Threads recording geometry command buffers or deferred contexts, or rasterizing tiles, on RHIs that split their work; 0 uses every core.
+	uint32_t RHIRecordThreads = 0;
+	// Size of each frame's part of the constant upload ring, on RHIs with one. 0 keeps the backend's default.
+	uint32_t RHIUploadRingMB = 0;
+	// Threads the per-mesh work of a frame is split over, the main thread included; 0 uses every core.
+	uint32_t FrontEndThreads = 0;
+	// Copies of the scene laid out side by side, to load the front end and the RHIs with draws.
+	uint32_t SceneCopies = 1;
+	// Where offscreen RHIs write their last presented frame, as a TGA. Empty writes nothing.
+	std::string RHIOutputPath;
+	// Records the RHI calls of this many frames after startup into RHICapturePath, for replay=<path>.
+	std::string RHICapturePath;
+	uint32_t RHICaptureFrames = 1;
+	std::string RHIReplayPath;
+	// Where RHIs that compile shaders keep the bytecode between runs. Empty compiles everything every run.
+	std::string ShaderCacheDir;
 
     Window          window;
 
-    D3D11RHI        rhi;
+    std::unique_ptr<RHI> rhi;
+
+    // Declared ahead of textureMap so in-flight reads and decodes can still finish while it is destroyed.
+    ThreadPool                                  threadPool;
+    AsyncFileReader                             fileReader;
 
 	std::vector<SharedPtr<Mesh>>				m_Meshes;
     TextureMap                                  textureMap;
+    // Every mesh's material, flattened and deduplicated at import.
+    MaterialTable                               materials;
 
 	Camera camera;
 	
 	// Render Stuff
 	RenderMode									m_RenderMode;
+	bool										m_TexturesPacked = false;
+	FrameStats									m_FrameStats;
 
 private:
     void ParseArg(const std::string& key, const std::string& value);
+    void FinishStartup();
+    void LogFrameTimes(std::vector<double>& frameTimesMs, double frontEndMs) const;
+    void CopyScene();
+    // Small dense id for a texture, for draw keys, from a table rebuilt with the material textures. Null is 0.
+    uint32_t GetDrawTextureId(RHITexture texture);
+    // Resolves every material's textures again, and sends the RHI a new material table, if the texture map
+    // changed since the last frame.
+    void UpdateMaterialTextures();
+    // Fills in every mesh's constants and draw packet, split into chunks across the thread pool, and uploads the constants.
+    void RunFrontEnd();
+
+	// Files read during the previous startup, replayed as readahead during this one.
+	std::vector<FileAccess>						m_StartupTrace;
+	std::chrono::steady_clock::time_point		m_StartupBegin;
+	bool										m_StartupTraceReplayed = false;
+
+	// What the front end's threads and Render need of a material's textures, resolved on the main thread so they
+	// never touch the texture map or the id map. By material index.
+	struct MaterialTextures
+	{
+		RHITexture diffuse;
+		RHITexture mask;			// Null unless the material is masked
+		uint32_t diffuseId;
+		uint32_t maskId;
+		uint32_t diffuseSlice;
+		uint32_t maskSlice;
+	};
+	std::vector<MaterialTextures>				m_MaterialTextures;
+	uint32_t									m_MaterialTexturesGeneration = 0;
+
+	// Rebuilt every frame, one per mesh. The packets are sorted by key before submission.
+	std::vector<GeometryConstantBufferLayout>	m_MeshConstants;
+	std::vector<DrawPacket>						m_DrawPackets;
+	std::vector<DrawPacket>						m_DrawPacketScratch;
+	std::unordered_map<RHITexture, uint32_t>	m_DrawTextureIds;
+
+	// Wraps rhi when capturing, null otherwise.
+	CaptureRHI*									m_Capture = nullptr;
 };
 
 extern Engine* g_Engine;
@@ -0,0 +1,124 @@
+#include "FileAccessTrace.h"
+
+#include <algorithm>
+#include <memory>
+#include <set>
+#include <sstream>
+#include <tuple>
+#include <sdl/SDL.h>
+
+#include "AsyncFileReader.h"
+#include "FileUtils.h"
+
+namespace
+{
+// Ranges are split into reads of at most this size, so a big file is spread over the queue.
+const uint64_t ReplayChunkSize = 1024 * 1024;
+}
+
+FileAccessTrace& FileAccessTrace::Get()
+{
+	static FileAccessTrace trace;
+	return trace;
+}
+
+void FileAccessTrace::Start()
+{
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	m_Recording = true;
+	m_Accesses.clear();
+}
+
+void FileAccessTrace::Stop()
+{
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	m_Recording = false;
+}
+
+void FileAccessTrace::Record(const std::string& path, uint64_t offset, uint64_t size)
+{
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	if (!m_Recording) return;
+	m_Accesses.push_back({ path, offset, size });
+}
+
+std::vector<FileAccess> FileAccessTrace::GetAccesses() const
+{
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	std::vector<FileAccess> accesses;
+	std::set<std::tuple<std::string, uint64_t, uint64_t>> seen;
+	for (const auto& access : m_Accesses)
+	{
+		if (seen.insert(std::make_tuple(access.path, access.offset, access.size)).second) accesses.push_back(access);
+	}
+	return accesses;
+}
+
+bool FileAccessTrace::Save(const std::string& absPath, const std::vector<FileAccess>& accesses)
+{
+	std::stringstream ss;
+	for (const auto& access : accesses)
+	{
+		ss << access.offset << ' ' << access.size << ' ' << access.path << '\n';
+	}
+	std::string out = ss.str();
+
+	SDL_RWops* file = SDL_RWFromFile(absPath.c_str(), "wb");
+	if (!file)
+	{
+		SDL_Log("Unable to write \"%s\".", absPath.c_str());
+		return false;
+	}
+	bool ok = out.empty() || SDL_RWwrite(file, out.data(), out.size(), 1) == 1;
+	SDL_RWclose(file);
+	return ok;
+}
+
+bool FileAccessTrace::Load(const std::string& absPath, std::vector<FileAccess>& accesses)
+{
+	auto view = FileUtils::MapFileAbsolute(absPath, FileUtils::AccessHint::Sequential);
+	if (!view.IsValid()) return false;
+
+	std::stringstream ss(std::string(view.begin(), view.end()));
+	std::string line;
+	while (getline(ss, line))
+	{
+		std::stringstream lineStream(line);
+		FileAccess access;
+		if (!(lineStream >> access.offset >> access.size)) return false;
+		lineStream.get();
+		getline(lineStream, access.path);
+		if (access.path.empty()) return false;
+		accesses.push_back(access);
+	}
+	return true;
+}
+
+uint64_t FileAccessTrace::Replay(AsyncFileReader& reader, const std::vector<FileAccess>& accesses)
+{
+	// One scratch buffer per read the queue can have in flight.
+	auto scratch = std::make_shared<std::vector<std::vector<char>>>(reader.GetQueueDepth());
+	for (auto& buffer : *scratch) buffer.resize(ReplayChunkSize);
+
+	std::vector<FileReadRequest> batch;
+	uint64_t totalBytes = 0;
+	for (const auto& access : accesses)
+	{
+		// Files may have shrunk or gone since the trace was written.
+		uint64_t fileSize = FileUtils::GetFileSize(access.path);
+		uint64_t end = std::min(access.offset + access.size, fileSize);
+		for (uint64_t offset = access.offset; offset < end; offset += ReplayChunkSize)
+		{
+			FileReadRequest request;
+			request.path = access.path;
+			request.offset = offset;
+			request.size = std::min(ReplayChunkSize, end - offset);
+			request.buffer = (*scratch)[batch.size() % scratch->size()].data();
+			request.onComplete = [scratch](int64_t) {};
+			totalBytes += request.size;
+			batch.push_back(std::move(request));
+		}
+	}
+	reader.Submit(std::move(batch));
+	return totalBytes;
+}
\ No newline at end of file
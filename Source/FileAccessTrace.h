@@ -0,0 +1,42 @@
+#pragma once
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+
+class AsyncFileReader;
+
+struct FileAccess
+{
+	std::string path;
+	uint64_t offset;
+	uint64_t size;
+};
+
+// Ordered record of the files and byte ranges read while recording. FileUtils reports every file it maps
+// or reads, so the trace of one startup can be replayed as readahead at the beginning of the next.
+class FileAccessTrace
+{
+public:
+	static FileAccessTrace& Get();
+
+	void Start();
+	void Stop();
+	// Thread safe, and a no-op unless recording.
+	void Record(const std::string& path, uint64_t offset, uint64_t size);
+	// Accesses in first-touch order, with repeats of the same range dropped.
+	std::vector<FileAccess> GetAccesses() const;
+
+	// One "offset size path" line per access.
+	static bool Save(const std::string& absPath, const std::vector<FileAccess>& accesses);
+	static bool Load(const std::string& absPath, std::vector<FileAccess>& accesses);
+
+	// Reads every range back through the reader so it is in the OS cache by the time it is needed. Returns
+	// without waiting. The data is thrown away, so the reads share a few scratch buffers.
+	static uint64_t Replay(AsyncFileReader& reader, const std::vector<FileAccess>& accesses);
+
+private:
+	mutable std::mutex		m_Mutex;
+	bool					m_Recording = false;
+	std::vector<FileAccess>	m_Accesses;
+};
\ No newline at end of file
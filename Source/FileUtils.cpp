@@ -1,21 +1,87 @@
+#include <algorithm>
 #include <cassert>
+#include <cstring>
 #include <filesystem>
+#include <memory>
 #include <vector>
-#include <direct.h>
 #include <sdl/SDL.h>
 
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <direct.h>
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
 #include "FileUtils.h"
+#include "AsyncFileReader.h"
+#include "Compression.h"
+#include "FileAccessTrace.h"
+
+FileUtils::FileView::~FileView()
+{
+    Reset();
+}
+
+FileUtils::FileView::FileView(FileView&& other)
+{
+    *this = std::move(other);
+}
+
+FileUtils::FileView& FileUtils::FileView::operator=(FileView&& other)
+{
+    if (this == &other) return *this;
+    Reset();
+    m_Data = other.m_Data;
+    m_Size = other.m_Size;
+    m_IsEmptyFile = other.m_IsEmptyFile;
+    other.m_Data = nullptr;
+    other.m_Size = 0;
+    other.m_IsEmptyFile = false;
+#ifdef _WIN32
+    m_FileHandle = other.m_FileHandle;
+    m_MappingHandle = other.m_MappingHandle;
+    other.m_FileHandle = nullptr;
+    other.m_MappingHandle = nullptr;
+#endif
+    return *this;
+}
+
+void FileUtils::FileView::Reset()
+{
+#ifdef _WIN32
+    if (m_Data) UnmapViewOfFile(m_Data);
+    if (m_MappingHandle) CloseHandle(m_MappingHandle);
+    if (m_FileHandle) CloseHandle(m_FileHandle);
+    m_FileHandle = nullptr;
+    m_MappingHandle = nullptr;
+#else
+    if (m_Data) munmap(const_cast<char*>(m_Data), m_Size);
+#endif
+    m_Data = nullptr;
+    m_Size = 0;
+    m_IsEmptyFile = false;
+}
 
 std::string FileUtils::Combine(const std::string& path1, const std::string& path2)
 {
-    std::experimental::filesystem::path left(path1);
-    std::experimental::filesystem::path right(path2);
+    std::filesystem::path left(path1);
+    std::filesystem::path right(path2);
     return (left / right).string();
 }
 
 std::string FileUtils::GetProcessWorkingDir()
 {
+#ifdef _WIN32
     char* cwd = _getcwd(0, 0);
+#else
+    char* cwd = getcwd(nullptr, 0);
+#endif
     std::string ret(cwd);
     std::free(cwd);
     return ret;
@@ -23,10 +89,99 @@ std::string FileUtils::GetProcessWorkingDir()
 
 std::string FileUtils::GetParentDirectory(const std::string& path)
 {
-    std::experimental::filesystem::path stdPath = path;
+    std::filesystem::path stdPath = path;
     return stdPath.parent_path().string();
 }
 
+FileUtils::FileView FileUtils::MapFile(const std::string& filename, AccessHint hint)
+{
+    auto fullpath = std::string(SDL_GetBasePath()) + filename;
+    return MapFileAbsolute(fullpath, hint);
+}
+
+FileUtils::FileView FileUtils::MapFileAbsolute(const std::string& absPath, AccessHint hint)
+{
+    FileView view;
+
+#ifdef _WIN32
+    DWORD flags = FILE_ATTRIBUTE_NORMAL;
+    if (hint == AccessHint::Sequential) flags |= FILE_FLAG_SEQUENTIAL_SCAN;
+    else if (hint == AccessHint::Random) flags |= FILE_FLAG_RANDOM_ACCESS;
+
+    HANDLE file = CreateFileA(absPath.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, flags, NULL);
+    if (file == INVALID_HANDLE_VALUE)
+    {
+        SDL_Log("Unable to open \"%s\".", absPath.c_str());
+        return view;
+    }
+    view.m_FileHandle = file;
+
+    LARGE_INTEGER fileSize;
+    GetFileSizeEx(file, &fileSize);
+    if (fileSize.QuadPart == 0)
+    {
+        // Zero-length files can't be mapped.
+        view.m_IsEmptyFile = true;
+        return view;
+    }
+
+    view.m_MappingHandle = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (!view.m_MappingHandle)
+    {
+        SDL_Log("CreateFileMapping failed for \"%s\".", absPath.c_str());
+        return FileView();
+    }
+
+    view.m_Data = static_cast<const char*>(MapViewOfFile(view.m_MappingHandle, FILE_MAP_READ, 0, 0, 0));
+    if (!view.m_Data)
+    {
+        SDL_Log("MapViewOfFile failed for \"%s\".", absPath.c_str());
+        return FileView();
+    }
+    view.m_Size = static_cast<size_t>(fileSize.QuadPart);
+#else
+    int fd = open(absPath.c_str(), O_RDONLY);
+    if (fd < 0)
+    {
+        SDL_Log("Unable to open \"%s\".", absPath.c_str());
+        return view;
+    }
+
+    struct stat fileStat;
+    fstat(fd, &fileStat);
+    if (fileStat.st_size == 0)
+    {
+        close(fd);
+        view.m_IsEmptyFile = true;
+        return view;
+    }
+
+    // The mapping keeps its own reference to the file, so the descriptor can go straight away.
+    void* mapped = mmap(nullptr, fileStat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapped == MAP_FAILED)
+    {
+        SDL_Log("mmap failed for \"%s\".", absPath.c_str());
+        return view;
+    }
+    view.m_Data = static_cast<const char*>(mapped);
+    view.m_Size = static_cast<size_t>(fileStat.st_size);
+
+    if (hint == AccessHint::Sequential)
+    {
+        madvise(mapped, view.m_Size, MADV_SEQUENTIAL);
+        madvise(mapped, view.m_Size, MADV_WILLNEED);
+    }
+    else if (hint == AccessHint::Random)
+    {
+        madvise(mapped, view.m_Size, MADV_RANDOM);
+    }
+#endif
+
+    FileAccessTrace::Get().Record(absPath, 0, view.m_Size);
+    return view;
+}
+
 std::vector<char> FileUtils::LoadFile(const std::string& filename)
 {
     auto fullpath = std::string(SDL_GetBasePath()) + filename;
@@ -35,33 +190,73 @@ std::vector<char> FileUtils::LoadFile(const std::string& filename)
 
 std::vector<char> FileUtils::LoadFileAbsolute(const std::string& absPath)
 {
-    SDL_RWops* psFile;
-    psFile = SDL_RWFromFile(absPath.c_str(), "rb");
+    auto view = MapFileAbsolute(absPath);
+    assert(view.IsValid());
+    if (Compression::IsContainer(view.data(), view.size()))
+    {
+        return Compression::DecompressContainer(view.data(), view.size());
+    }
+    return std::vector<char>(view.begin(), view.end());
+}
 
-    assert(psFile);
-	size_t psDataSize = SDL_RWsize(psFile);
-    std::vector<char> ret(0);
-    ret.resize(psDataSize);
-	SDL_RWread(psFile, ret.data(), psDataSize, 1);
-	SDL_RWclose(psFile);
+uint64_t FileUtils::GetFileSize(const std::string& absPath)
+{
+    std::error_code error;
+    auto size = std::filesystem::file_size(absPath, error);
+    return error ? 0 : static_cast<uint64_t>(size);
+}
 
-	return ret;
+std::string FileUtils::GetCookedPath(const std::string& absPath)
+{
+    auto cookedPath = absPath + Compression::CookedExtension;
+    return std::filesystem::exists(cookedPath) ? cookedPath : absPath;
 }
 
-CPUTexture FileUtils::LoadUncompressedTGA(const std::string& absolutePath)
+void FileUtils::ReadFilesAsync(AsyncFileReader& reader, const std::vector<std::string>& absPaths,
+    std::function<void(size_t index, std::vector<char>&& data)> onLoaded)
 {
-    auto fileData = LoadFileAbsolute(absolutePath);
-    assert(fileData[2] == 2); // uncompressed RGB/RGBA
+    auto sharedOnLoaded = std::make_shared<std::function<void(size_t, std::vector<char>&&)>>(std::move(onLoaded));
+
+    std::vector<FileReadRequest> batch(absPaths.size());
+    for (size_t i = 0; i < absPaths.size(); ++i)
+    {
+        auto buffer = std::make_shared<std::vector<char>>(GetFileSize(absPaths[i]));
+        FileAccessTrace::Get().Record(absPaths[i], 0, buffer->size());
+        batch[i].path = absPaths[i];
+        batch[i].size = buffer->size();
+        batch[i].buffer = buffer->data();
+        batch[i].onComplete = [i, buffer, sharedOnLoaded](int64_t bytesRead) {
+            // Failed reads hand over an empty buffer, short ones just what was read.
+            buffer->resize(static_cast<size_t>(std::max<int64_t>(bytesRead, 0)));
+            if (Compression::IsContainer(buffer->data(), buffer->size()))
+            {
+                // Already on a worker, and other files are decoding alongside, so the blocks decode inline.
+                *buffer = Compression::DecompressContainer(buffer->data(), buffer->size());
+            }
+            (*sharedOnLoaded)(i, std::move(*buffer));
+        };
+    }
+    reader.Submit(std::move(batch));
+}
+
+CPUTexture FileUtils::LoadUncompressedTGA(const char* data, size_t size)
+{
+    assert(size >= 18);
+    assert(data[2] == 2); // uncompressed RGB/RGBA
     CPUTexture texture;
 
-    texture.width = *(reinterpret_cast<uint16_t*>(fileData.data() + 12));
-    texture.height = *(reinterpret_cast<uint16_t*>(fileData.data() + 14));
-    auto colorChannels = *(fileData.data() + 16) / 8;
+    uint16_t width, height;
+    memcpy(&width, data + 12, sizeof(width));
+    memcpy(&height, data + 14, sizeof(height));
+    texture.width = width;
+    texture.height = height;
+    auto colorChannels = *(data + 16) / 8;
     assert(colorChannels == 3 || colorChannels == 4);
 
     auto srcImageDataLength = texture.width * texture.height * colorChannels;
-    auto srcImageDataBegin = fileData.data() + 18;
+    auto srcImageDataBegin = data + 18;
     auto srcImageDataEnd = srcImageDataBegin + srcImageDataLength;
+    assert(srcImageDataEnd <= data + size);
 
     if (colorChannels == 4)
     {
@@ -87,4 +282,43 @@ CPUTexture FileUtils::LoadUncompressedTGA(const std::string& absolutePath)
     }
 
     return texture;
+}
+
+CPUTexture FileUtils::LoadUncompressedTGA(const std::string& absolutePath)
+{
+    // Straight from the mapped pages into the texture, without an intermediate copy of the file.
+    auto view = MapFileAbsolute(absolutePath, AccessHint::Sequential);
+    assert(view.IsValid());
+    if (Compression::IsContainer(view.data(), view.size()))
+    {
+        auto fileData = Compression::DecompressContainer(view.data(), view.size());
+        return LoadUncompressedTGA(fileData.data(), fileData.size());
+    }
+    return LoadUncompressedTGA(view.data(), view.size());
+}
+
+bool FileUtils::SaveUncompressedTGA(const CPUTexture& texture, const std::string& absPath)
+{
+    assert(texture.format == CPUTextureFormat::BGRA8);
+    assert(texture.data.size() == size_t(texture.width) * texture.height * 4);
+
+    char header[18] = {};
+    header[2] = 2; // uncompressed RGB/RGBA
+    uint16_t width = uint16_t(texture.width);
+    uint16_t height = uint16_t(texture.height);
+    memcpy(header + 12, &width, sizeof(width));
+    memcpy(header + 14, &height, sizeof(height));
+    header[16] = 32;
+    header[17] = 0x28; // 8 alpha bits, first row at the top
+
+    SDL_RWops* file = SDL_RWFromFile(absPath.c_str(), "wb");
+    if (!file)
+    {
+        SDL_Log("Unable to write \"%s\".", absPath.c_str());
+        return false;
+    }
+    bool ok = SDL_RWwrite(file, header, sizeof(header), 1) == 1
+        && SDL_RWwrite(file, texture.data.data(), texture.data.size(), 1) == 1;
+    SDL_RWclose(file);
+    return ok;
 }
\ No newline at end of file
@@ -1,17 +1,74 @@
 #pragma once
 
+#include <cstddef>
+#include <cstdint>
+#include <functional>
 #include <string>
 #include <vector>
 
 #include "CPUTexture.h"
 
+class AsyncFileReader;
+
 namespace FileUtils
 {
+enum class AccessHint
+{
+	Normal,
+	Sequential,		// Read front to back once, so aggressive readahead pays off.
+	Random,			// Scattered reads, readahead would be wasted.
+};
+
+// Read-only view of a memory-mapped file. Unmapped when destroyed.
+class FileView
+{
+public:
+	FileView() = default;
+	~FileView();
+	FileView(FileView&& other);
+	FileView& operator=(FileView&& other);
+	FileView(const FileView&) = delete;
+	FileView& operator=(const FileView&) = delete;
+
+	const char* data() const { return m_Data; }
+	size_t size() const { return m_Size; }
+	const char* begin() const { return m_Data; }
+	const char* end() const { return m_Data + m_Size; }
+	bool IsValid() const { return m_Data != nullptr || m_IsEmptyFile; }
+
+private:
+	friend FileView MapFileAbsolute(const std::string& absPath, AccessHint hint);
+	void Reset();
+
+	const char*	m_Data = nullptr;
+	size_t		m_Size = 0;
+	bool		m_IsEmptyFile = false;
+#ifdef _WIN32
+	void*		m_FileHandle = nullptr;
+	void*		m_MappingHandle = nullptr;
+#endif
+};
+
 std::string Combine(const std::string& path1, const std::string& path2);
 std::string GetProcessWorkingDir();
 std::string GetParentDirectory(const std::string& path);
 
+FileView MapFile(const std::string& filename, AccessHint hint = AccessHint::Sequential);
+FileView MapFileAbsolute(const std::string& absPath, AccessHint hint = AccessHint::Sequential);
+// The loaders below hand back decompressed contents when the file is a Compression container.
 std::vector<char> LoadFile(const std::string& filename);
 std::vector<char> LoadFileAbsolute(const std::string& absPath);
+uint64_t GetFileSize(const std::string& absPath);
+// The cooked (compressed) sibling of absPath if one has been written, otherwise absPath itself.
+std::string GetCookedPath(const std::string& absPath);
+
+// Reads every file whole as one batch on the reader. onLoaded runs on a worker thread as each read lands,
+// with the file's index in absPaths and its contents, which are empty if the file couldn't be read.
+void ReadFilesAsync(AsyncFileReader& reader, const std::vector<std::string>& absPaths,
+	std::function<void(size_t index, std::vector<char>&& data)> onLoaded);
+
+CPUTexture LoadUncompressedTGA(const char* data, size_t size);
 CPUTexture LoadUncompressedTGA(const std::string& filename);
-}
\ No newline at end of file
+// Writes a BGRA8 texture's top level as an uncompressed 32-bit TGA with a top-left origin.
+bool SaveUncompressedTGA(const CPUTexture& texture, const std::string& absPath);
+}
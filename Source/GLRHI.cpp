@@ -0,0 +1,1015 @@
+#include "GLRHI.h"
+
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+#include <cstring>
+#include <tuple>
+
+#ifndef _WIN32
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#endif
+
+#include "glm/gtx/rotate_vector.hpp"
+
+#include "CPUTexture.h"
+#include "Engine.h"
+#include "FileUtils.h"
+#include "Mesh.h"
+#include "TexturePacker.h"
+#include "Window.h"
+#include "Imgui/imgui.h"
+#include "Imgui/imgui_impl_sdl.h"
+
+// GL 4.5 entry points and tokens, newer than the glext.h SDL ships.
+#ifndef GL_VERSION_4_5
+#define GL_ZERO_TO_ONE 0x935F
+typedef void (APIENTRYP PFNGLCLIPCONTROLPROC) (GLenum origin, GLenum depth);
+typedef void (APIENTRYP PFNGLCREATEBUFFERSPROC) (GLsizei n, GLuint *buffers);
+typedef void (APIENTRYP PFNGLNAMEDBUFFERSTORAGEPROC) (GLuint buffer, GLsizeiptr size, const void *data, GLbitfield flags);
+typedef void (APIENTRYP PFNGLNAMEDBUFFERSUBDATAPROC) (GLuint buffer, GLintptr offset, GLsizeiptr size, const void *data);
+typedef void (APIENTRYP PFNGLCOPYNAMEDBUFFERSUBDATAPROC) (GLuint readBuffer, GLuint writeBuffer, GLintptr readOffset, GLintptr writeOffset, GLsizeiptr size);
+typedef void *(APIENTRYP PFNGLMAPNAMEDBUFFERRANGEPROC) (GLuint buffer, GLintptr offset, GLsizeiptr length, GLbitfield access);
+typedef void (APIENTRYP PFNGLCREATETEXTURESPROC) (GLenum target, GLsizei n, GLuint *textures);
+typedef void (APIENTRYP PFNGLTEXTURESTORAGE2DPROC) (GLuint texture, GLsizei levels, GLenum internalformat, GLsizei width, GLsizei height);
+typedef void (APIENTRYP PFNGLTEXTURESTORAGE3DPROC) (GLuint texture, GLsizei levels, GLenum internalformat, GLsizei width, GLsizei height, GLsizei depth);
+typedef void (APIENTRYP PFNGLTEXTURESUBIMAGE3DPROC) (GLuint texture, GLint level, GLint xoffset, GLint yoffset, GLint zoffset, GLsizei width, GLsizei height, GLsizei depth, GLenum format, GLenum type, const void *pixels);
+typedef void (APIENTRYP PFNGLCOMPRESSEDTEXTURESUBIMAGE3DPROC) (GLuint texture, GLint level, GLint xoffset, GLint yoffset, GLint zoffset, GLsizei width, GLsizei height, GLsizei depth, GLenum format, GLsizei imageSize, const void *data);
+typedef void (APIENTRYP PFNGLGENERATETEXTUREMIPMAPPROC) (GLuint texture);
+typedef void (APIENTRYP PFNGLBINDTEXTUREUNITPROC) (GLuint unit, GLuint texture);
+typedef void (APIENTRYP PFNGLCREATEFRAMEBUFFERSPROC) (GLsizei n, GLuint *framebuffers);
+typedef void (APIENTRYP PFNGLNAMEDFRAMEBUFFERTEXTUREPROC) (GLuint framebuffer, GLenum attachment, GLuint texture, GLint level);
+typedef void (APIENTRYP PFNGLNAMEDFRAMEBUFFERDRAWBUFFERSPROC) (GLuint framebuffer, GLsizei n, const GLenum *bufs);
+typedef GLenum (APIENTRYP PFNGLCHECKNAMEDFRAMEBUFFERSTATUSPROC) (GLuint framebuffer, GLenum target);
+typedef void (APIENTRYP PFNGLCLEARNAMEDFRAMEBUFFERFVPROC) (GLuint framebuffer, GLenum buffer, GLint drawbuffer, const GLfloat *value);
+typedef void (APIENTRYP PFNGLINVALIDATENAMEDFRAMEBUFFERDATAPROC) (GLuint framebuffer, GLsizei numAttachments, const GLenum *attachments);
+typedef void (APIENTRYP PFNGLCREATEVERTEXARRAYSPROC) (GLsizei n, GLuint *arrays);
+typedef void (APIENTRYP PFNGLVERTEXARRAYVERTEXBUFFERPROC) (GLuint vaobj, GLuint bindingindex, GLuint buffer, GLintptr offset, GLsizei stride);
+typedef void (APIENTRYP PFNGLVERTEXARRAYELEMENTBUFFERPROC) (GLuint vaobj, GLuint buffer);
+typedef void (APIENTRYP PFNGLVERTEXARRAYATTRIBFORMATPROC) (GLuint vaobj, GLuint attribindex, GLint size, GLenum type, GLboolean normalized, GLuint relativeoffset);
+typedef void (APIENTRYP PFNGLVERTEXARRAYATTRIBIFORMATPROC) (GLuint vaobj, GLuint attribindex, GLint size, GLenum type, GLuint relativeoffset);
+typedef void (APIENTRYP PFNGLVERTEXARRAYATTRIBBINDINGPROC) (GLuint vaobj, GLuint attribindex, GLuint bindingindex);
+typedef void (APIENTRYP PFNGLVERTEXARRAYBINDINGDIVISORPROC) (GLuint vaobj, GLuint bindingindex, GLuint divisor);
+typedef void (APIENTRYP PFNGLENABLEVERTEXARRAYATTRIBPROC) (GLuint vaobj, GLuint index);
+typedef void (APIENTRYP PFNGLCREATESAMPLERSPROC) (GLsizei n, GLuint *samplers);
+typedef void (APIENTRYP PFNGLCREATEQUERIESPROC) (GLenum target, GLsizei n, GLuint *ids);
+#endif
+
+namespace
+{
+#define GLRHI_FUNCTIONS(X) \
+	X(PFNGLCLIPCONTROLPROC, glClipControl) \
+	X(PFNGLCREATEBUFFERSPROC, glCreateBuffers) \
+	X(PFNGLNAMEDBUFFERSTORAGEPROC, glNamedBufferStorage) \
+	X(PFNGLNAMEDBUFFERSUBDATAPROC, glNamedBufferSubData) \
+	X(PFNGLCOPYNAMEDBUFFERSUBDATAPROC, glCopyNamedBufferSubData) \
+	X(PFNGLMAPNAMEDBUFFERRANGEPROC, glMapNamedBufferRange) \
+	X(PFNGLDELETEBUFFERSPROC, glDeleteBuffers) \
+	X(PFNGLBINDBUFFERPROC, glBindBuffer) \
+	X(PFNGLBINDBUFFERBASEPROC, glBindBufferBase) \
+	X(PFNGLBINDBUFFERRANGEPROC, glBindBufferRange) \
+	X(PFNGLCREATETEXTURESPROC, glCreateTextures) \
+	X(PFNGLTEXTURESTORAGE2DPROC, glTextureStorage2D) \
+	X(PFNGLTEXTURESTORAGE3DPROC, glTextureStorage3D) \
+	X(PFNGLTEXTURESUBIMAGE3DPROC, glTextureSubImage3D) \
+	X(PFNGLCOMPRESSEDTEXTURESUBIMAGE3DPROC, glCompressedTextureSubImage3D) \
+	X(PFNGLGENERATETEXTUREMIPMAPPROC, glGenerateTextureMipmap) \
+	X(PFNGLCOPYIMAGESUBDATAPROC, glCopyImageSubData) \
+	X(PFNGLBINDTEXTUREUNITPROC, glBindTextureUnit) \
+	X(PFNGLCREATESAMPLERSPROC, glCreateSamplers) \
+	X(PFNGLSAMPLERPARAMETERIPROC, glSamplerParameteri) \
+	X(PFNGLBINDSAMPLERPROC, glBindSampler) \
+	X(PFNGLDELETESAMPLERSPROC, glDeleteSamplers) \
+	X(PFNGLCREATEFRAMEBUFFERSPROC, glCreateFramebuffers) \
+	X(PFNGLNAMEDFRAMEBUFFERTEXTUREPROC, glNamedFramebufferTexture) \
+	X(PFNGLNAMEDFRAMEBUFFERDRAWBUFFERSPROC, glNamedFramebufferDrawBuffers) \
+	X(PFNGLCHECKNAMEDFRAMEBUFFERSTATUSPROC, glCheckNamedFramebufferStatus) \
+	X(PFNGLCLEARNAMEDFRAMEBUFFERFVPROC, glClearNamedFramebufferfv) \
+	X(PFNGLINVALIDATENAMEDFRAMEBUFFERDATAPROC, glInvalidateNamedFramebufferData) \
+	X(PFNGLBINDFRAMEBUFFERPROC, glBindFramebuffer) \
+	X(PFNGLDELETEFRAMEBUFFERSPROC, glDeleteFramebuffers) \
+	X(PFNGLCREATEVERTEXARRAYSPROC, glCreateVertexArrays) \
+	X(PFNGLVERTEXARRAYVERTEXBUFFERPROC, glVertexArrayVertexBuffer) \
+	X(PFNGLVERTEXARRAYELEMENTBUFFERPROC, glVertexArrayElementBuffer) \
+	X(PFNGLVERTEXARRAYATTRIBFORMATPROC, glVertexArrayAttribFormat) \
+	X(PFNGLVERTEXARRAYATTRIBIFORMATPROC, glVertexArrayAttribIFormat) \
+	X(PFNGLVERTEXARRAYATTRIBBINDINGPROC, glVertexArrayAttribBinding) \
+	X(PFNGLVERTEXARRAYBINDINGDIVISORPROC, glVertexArrayBindingDivisor) \
+	X(PFNGLENABLEVERTEXARRAYATTRIBPROC, glEnableVertexArrayAttrib) \
+	X(PFNGLBINDVERTEXARRAYPROC, glBindVertexArray) \
+	X(PFNGLDELETEVERTEXARRAYSPROC, glDeleteVertexArrays) \
+	X(PFNGLCREATESHADERPROC, glCreateShader) \
+	X(PFNGLSHADERSOURCEPROC, glShaderSource) \
+	X(PFNGLCOMPILESHADERPROC, glCompileShader) \
+	X(PFNGLGETSHADERIVPROC, glGetShaderiv) \
+	X(PFNGLGETSHADERINFOLOGPROC, glGetShaderInfoLog) \
+	X(PFNGLDELETESHADERPROC, glDeleteShader) \
+	X(PFNGLCREATEPROGRAMPROC, glCreateProgram) \
+	X(PFNGLATTACHSHADERPROC, glAttachShader) \
+	X(PFNGLLINKPROGRAMPROC, glLinkProgram) \
+	X(PFNGLGETPROGRAMIVPROC, glGetProgramiv) \
+	X(PFNGLGETPROGRAMINFOLOGPROC, glGetProgramInfoLog) \
+	X(PFNGLUSEPROGRAMPROC, glUseProgram) \
+	X(PFNGLDELETEPROGRAMPROC, glDeleteProgram) \
+	X(PFNGLMULTIDRAWELEMENTSINDIRECTPROC, glMultiDrawElementsIndirect) \
+	X(PFNGLFENCESYNCPROC, glFenceSync) \
+	X(PFNGLCLIENTWAITSYNCPROC, glClientWaitSync) \
+	X(PFNGLDELETESYNCPROC, glDeleteSync) \
+	X(PFNGLCREATEQUERIESPROC, glCreateQueries) \
+	X(PFNGLQUERYCOUNTERPROC, glQueryCounter) \
+	X(PFNGLGETQUERYOBJECTUI64VPROC, glGetQueryObjectui64v) \
+	X(PFNGLDELETEQUERIESPROC, glDeleteQueries)
+
+#define GLRHI_DECLARE_FUNCTION(type, name) type name = nullptr;
+GLRHI_FUNCTIONS(GLRHI_DECLARE_FUNCTION)
+#undef GLRHI_DECLARE_FUNCTION
+
+// Only the first few are logged, a broken frame loop would otherwise drown everything else.
+const uint32_t MaxLoggedGLErrors = 32;
+
+struct DirectionalConstants
+{
+	glm::vec4 color;
+	glm::vec4 direction;
+};
+
+uint32_t CalcMipLevels(uint32_t width, uint32_t height)
+{
+	uint32_t mipLevels = 1;
+	for (uint32_t size = width > height ? width : height; size > 1; size /= 2) ++mipLevels;
+	return mipLevels;
+}
+
+void SetContextAttributes()
+{
+	SDL_GL_SetAttribute(SDL_GL_CONTEXT_MAJOR_VERSION, 4);
+	SDL_GL_SetAttribute(SDL_GL_CONTEXT_MINOR_VERSION, 5);
+	SDL_GL_SetAttribute(SDL_GL_CONTEXT_PROFILE_MASK, SDL_GL_CONTEXT_PROFILE_CORE);
+}
+
+}
+
+GLRHI::GLRHI(bool headless)
+	: m_Headless(headless)
+{
+}
+
+GLRHI::~GLRHI()
+{
+	if (!glCreateBuffers || (!m_SDLContext && !m_EGLContext))
+	{
+		DestroyContext();
+		return;
+	}
+
+	for (auto& frame : m_Frames)
+	{
+		if (frame.fence) glDeleteSync(frame.fence);
+		if (frame.timestamps[0]) glDeleteQueries(static_cast<GLsizei>(frame.timestamps.size()), frame.timestamps.data());
+	}
+	for (auto program : { m_GeometryProgram, m_MaskedGeometryProgram, m_AmbientProgram, m_DirectionalProgram })
+	{
+		if (program) glDeleteProgram(program);
+	}
+	if (m_Sampler) glDeleteSamplers(1, &m_Sampler);
+
+	for (auto& texture : m_Textures) glDeleteTextures(1, &texture.second->texture);
+	DestroyRenderTargets();
+
+	for (auto vertexArray : { m_GeometryVertexArray, m_FullscreenQuadVertexArray })
+	{
+		if (vertexArray) glDeleteVertexArrays(1, &vertexArray);
+	}
+	// Deleting the ring unmaps it.
+	for (auto buffer : { m_VertexArena.buffer, m_IndexArena.buffer, m_DrawIndexBuffer, m_FullscreenQuadBuffer, m_Ring })
+	{
+		if (buffer) glDeleteBuffers(1, &buffer);
+	}
+
+	DestroyContext();
+}
+
+bool GLRHI::InitRHI(const Window& window)
+{
+	m_Width = window.width;
+	m_Height = window.height;
+
+	if (!CreateContext(window) || !LoadFunctions()) return false;
+
+	m_RendererName = reinterpret_cast<const char*>(glGetString(GL_RENDERER));
+	GLint maxArrayLayers;
+	glGetIntegerv(GL_MAX_ARRAY_TEXTURE_LAYERS, &maxArrayLayers);
+	m_MaxTextureArraySlices = static_cast<uint32_t>(maxArrayLayers);
+	glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &m_UniformAlignment);
+	glGetIntegerv(GL_SHADER_STORAGE_BUFFER_OFFSET_ALIGNMENT, &m_StorageAlignment);
+
+	m_GeometryProgram = LoadProgram("GeometryMultiDraw.vert", "Geometry.frag");
+	m_MaskedGeometryProgram = LoadProgram("GeometryMultiDraw.vert", "GeometryMasked.frag");
+	m_AmbientProgram = LoadProgram("Fullscreen.vert", "Ambient.frag");
+	m_DirectionalProgram = LoadProgram("Fullscreen.vert", "Directional.frag");
+	if (!m_GeometryProgram || !m_MaskedGeometryProgram || !m_AmbientProgram || !m_DirectionalProgram) return false;
+
+	// Same as the D3D11 default: trilinear, wrapping in U and V.
+	glCreateSamplers(1, &m_Sampler);
+	glSamplerParameteri(m_Sampler, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+	glSamplerParameteri(m_Sampler, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glSamplerParameteri(m_Sampler, GL_TEXTURE_WRAP_S, GL_REPEAT);
+	glSamplerParameteri(m_Sampler, GL_TEXTURE_WRAP_T, GL_REPEAT);
+	glSamplerParameteri(m_Sampler, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+
+	for (auto& frame : m_Frames)
+	{
+		glCreateQueries(GL_TIMESTAMP, static_cast<GLsizei>(frame.timestamps.size()), frame.timestamps.data());
+	}
+
+	CreateRenderTargets(m_Width, m_Height);
+	CreateStaticBuffers();
+	CreateDebugTexture2D();
+
+	// Geometry passes render upside down into their targets, so they read back with D3D's top-left UV origin
+	// the shaders assume. The origin flips winding along with Y, so front faces stay clockwise.
+	glEnable(GL_CULL_FACE);
+	glCullFace(GL_BACK);
+	glFrontFace(GL_CW);
+
+	CheckErrors();
+	return m_NumGLErrors == 0;
+}
+
+bool GLRHI::CreateContext(const Window& window)
+{
+	if (!m_Headless)
+	{
+		if (!window.sdlWindow)
+		{
+			SDL_Log("The OpenGL RHI needs a window, use gl-headless without one.");
+			return false;
+		}
+		m_SDLWindow = window.sdlWindow.get();
+		SetContextAttributes();
+		m_SDLContext = SDL_GL_CreateContext(m_SDLWindow);
+		if (!m_SDLContext)
+		{
+			SDL_Log("Unable to create an OpenGL 4.5 core context: %s", SDL_GetError());
+			return false;
+		}
+		// D3D11 presents without waiting for vblank, and so does this.
+		SDL_GL_SetSwapInterval(0);
+		return true;
+	}
+
+#ifdef _WIN32
+	// No EGL here, so the context lives on a window that is never shown.
+	if (SDL_InitSubSystem(SDL_INIT_VIDEO) < 0)
+	{
+		SDL_Log("Unable to init Video for a hidden GL window: %s", SDL_GetError());
+		return false;
+	}
+	SetContextAttributes();
+	m_HiddenWindow = SDL_CreateWindow("Rndr", SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED, 1, 1, SDL_WINDOW_OPENGL | SDL_WINDOW_HIDDEN);
+	m_SDLContext = m_HiddenWindow ? SDL_GL_CreateContext(m_HiddenWindow) : nullptr;
+	if (!m_SDLContext)
+	{
+		SDL_Log("Unable to create an OpenGL 4.5 core context: %s", SDL_GetError());
+		return false;
+	}
+	return true;
+#else
+	// Mesa's surfaceless platform needs no display server at all. Anything else gets the default display.
+	EGLDisplay display = EGL_NO_DISPLAY;
+	auto getPlatformDisplay = reinterpret_cast<PFNEGLGETPLATFORMDISPLAYEXTPROC>(eglGetProcAddress("eglGetPlatformDisplayEXT"));
+	if (getPlatformDisplay) display = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, nullptr);
+	if (display == EGL_NO_DISPLAY) display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+	if (display == EGL_NO_DISPLAY || !eglInitialize(display, nullptr, nullptr))
+	{
+		SDL_Log("Unable to initialize an EGL display.");
+		return false;
+	}
+	m_EGLDisplay = display;
+
+	const EGLint configAttribs[] = { EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT, EGL_SURFACE_TYPE, EGL_PBUFFER_BIT, EGL_NONE };
+	EGLConfig config;
+	EGLint numConfigs = 0;
+	if (!eglBindAPI(EGL_OPENGL_API) || !eglChooseConfig(display, configAttribs, &config, 1, &numConfigs) || numConfigs == 0)
+	{
+		SDL_Log("No EGL config supports desktop OpenGL.");
+		return false;
+	}
+
+	const EGLint contextAttribs[] = {
+		EGL_CONTEXT_MAJOR_VERSION_KHR, 4,
+		EGL_CONTEXT_MINOR_VERSION_KHR, 5,
+		EGL_CONTEXT_OPENGL_PROFILE_MASK_KHR, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT_KHR,
+		EGL_NONE };
+	EGLContext context = eglCreateContext(display, config, EGL_NO_CONTEXT, contextAttribs);
+	if (context == EGL_NO_CONTEXT)
+	{
+		SDL_Log("Unable to create an OpenGL 4.5 core context (EGL error 0x%x).", eglGetError());
+		return false;
+	}
+	m_EGLContext = context;
+
+	// Everything renders into framebuffer objects, so the context needs no surface (EGL_KHR_surfaceless_context).
+	if (!eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, context))
+	{
+		SDL_Log("Unable to make the EGL context current without a surface (EGL error 0x%x).", eglGetError());
+		return false;
+	}
+	return true;
+#endif
+}
+
+void GLRHI::DestroyContext()
+{
+	if (m_SDLContext) SDL_GL_DeleteContext(m_SDLContext);
+	m_SDLContext = nullptr;
+	if (m_HiddenWindow)
+	{
+		SDL_DestroyWindow(m_HiddenWindow);
+		SDL_QuitSubSystem(SDL_INIT_VIDEO);
+		m_HiddenWindow = nullptr;
+	}
+#ifndef _WIN32
+	if (m_EGLDisplay)
+	{
+		eglMakeCurrent(m_EGLDisplay, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+		if (m_EGLContext) eglDestroyContext(m_EGLDisplay, m_EGLContext);
+		eglTerminate(m_EGLDisplay);
+	}
+#endif
+	m_EGLContext = nullptr;
+	m_EGLDisplay = nullptr;
+}
+
+bool GLRHI::LoadFunctions()
+{
+	bool complete = true;
+	auto getProcAddress = [this](const char* name) -> void*
+	{
+#ifndef _WIN32
+		if (m_EGLContext) return reinterpret_cast<void*>(eglGetProcAddress(name));
+#endif
+		return SDL_GL_GetProcAddress(name);
+	};
+
+#define GLRHI_LOAD_FUNCTION(type, name) \
+	name = reinterpret_cast<type>(getProcAddress(#name)); \
+	if (!name) \
+	{ \
+		SDL_Log("Missing GL entry point %s.", #name); \
+		complete = false; \
+	}
+	GLRHI_FUNCTIONS(GLRHI_LOAD_FUNCTION)
+#undef GLRHI_LOAD_FUNCTION
+
+	return complete;
+}
+
+GLuint GLRHI::CompileShader(GLenum type, const std::string& name)
+{
+	auto path = FileUtils::Combine(g_Engine->ProjectDir, "Source/Shaders/GLSL/" + name);
+	auto source = FileUtils::MapFileAbsolute(path);
+	if (!source.IsValid() || source.size() == 0)
+	{
+		SDL_Log("Missing shader %s.", path.c_str());
+		return 0;
+	}
+
+	GLuint shader = glCreateShader(type);
+	const GLchar* text = source.data();
+	GLint length = static_cast<GLint>(source.size());
+	glShaderSource(shader, 1, &text, &length);
+	glCompileShader(shader);
+
+	GLint compiled;
+	glGetShaderiv(shader, GL_COMPILE_STATUS, &compiled);
+	if (!compiled)
+	{
+		std::array<char, 4096> log;
+		glGetShaderInfoLog(shader, static_cast<GLsizei>(log.size()), nullptr, log.data());
+		SDL_Log("Compiling %s failed: %s", name.c_str(), log.data());
+		glDeleteShader(shader);
+		return 0;
+	}
+	return shader;
+}
+
+GLuint GLRHI::LoadProgram(const std::string& vertexShader, const std::string& fragmentShader)
+{
+	GLuint vertex = CompileShader(GL_VERTEX_SHADER, vertexShader);
+	GLuint fragment = CompileShader(GL_FRAGMENT_SHADER, fragmentShader);
+	GLuint program = 0;
+	if (vertex && fragment)
+	{
+		program = glCreateProgram();
+		glAttachShader(program, vertex);
+		glAttachShader(program, fragment);
+		glLinkProgram(program);
+
+		GLint linked;
+		glGetProgramiv(program, GL_LINK_STATUS, &linked);
+		if (!linked)
+		{
+			std::array<char, 4096> log;
+			glGetProgramInfoLog(program, static_cast<GLsizei>(log.size()), nullptr, log.data());
+			SDL_Log("Linking %s with %s failed: %s", vertexShader.c_str(), fragmentShader.c_str(), log.data());
+			glDeleteProgram(program);
+			program = 0;
+		}
+	}
+	// The program keeps what it needs.
+	if (vertex) glDeleteShader(vertex);
+	if (fragment) glDeleteShader(fragment);
+	return program;
+}
+
+void GLRHI::CreateRenderTargets(uint32_t width, uint32_t height)
+{
+	glCreateTextures(GL_TEXTURE_2D, 1, &m_ColorRT);
+	glTextureStorage2D(m_ColorRT, 1, GL_RGBA16F, width, height);
+	glCreateTextures(GL_TEXTURE_2D, 1, &m_NormalRT);
+	glTextureStorage2D(m_NormalRT, 1, GL_RGBA16F, width, height);
+	glCreateTextures(GL_TEXTURE_2D, 1, &m_DepthRT);
+	glTextureStorage2D(m_DepthRT, 1, GL_DEPTH_COMPONENT32F, width, height);
+
+	glCreateFramebuffers(1, &m_GeometryFramebuffer);
+	glNamedFramebufferTexture(m_GeometryFramebuffer, GL_COLOR_ATTACHMENT0, m_ColorRT, 0);
+	glNamedFramebufferTexture(m_GeometryFramebuffer, GL_COLOR_ATTACHMENT1, m_NormalRT, 0);
+	glNamedFramebufferTexture(m_GeometryFramebuffer, GL_DEPTH_ATTACHMENT, m_DepthRT, 0);
+	const std::array<GLenum, 2> drawBuffers = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1 };
+	glNamedFramebufferDrawBuffers(m_GeometryFramebuffer, static_cast<GLsizei>(drawBuffers.size()), drawBuffers.data());
+	assert(glCheckNamedFramebufferStatus(m_GeometryFramebuffer, GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE);
+
+	// Windowed, the lighting pass draws straight into the back buffer of framebuffer 0.
+	m_OutputFramebuffer = 0;
+	if (m_Headless)
+	{
+		glCreateTextures(GL_TEXTURE_2D, 1, &m_OffscreenOutput);
+		glTextureStorage2D(m_OffscreenOutput, 1, GL_RGBA8, width, height);
+		glCreateFramebuffers(1, &m_OutputFramebuffer);
+		glNamedFramebufferTexture(m_OutputFramebuffer, GL_COLOR_ATTACHMENT0, m_OffscreenOutput, 0);
+		assert(glCheckNamedFramebufferStatus(m_OutputFramebuffer, GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE);
+	}
+}
+
+void GLRHI::DestroyRenderTargets()
+{
+	for (auto framebuffer : { m_GeometryFramebuffer, m_OutputFramebuffer })
+	{
+		if (framebuffer) glDeleteFramebuffers(1, &framebuffer);
+	}
+	for (auto texture : { m_ColorRT, m_NormalRT, m_DepthRT, m_OffscreenOutput })
+	{
+		if (texture) glDeleteTextures(1, &texture);
+	}
+	m_GeometryFramebuffer = m_OutputFramebuffer = 0;
+	m_ColorRT = m_NormalRT = m_DepthRT = m_OffscreenOutput = 0;
+}
+
+void GLRHI::CreateStaticBuffers()
+{
+	// One ring for every frame in flight, mapped for good. Coherent, so writes need no flush before the draws read them.
+	const GLbitfield ringFlags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+	if (g_Engine->RHIUploadRingMB) m_RingFrameSize = g_Engine->RHIUploadRingMB * 1024 * 1024;
+	glCreateBuffers(1, &m_Ring);
+	glNamedBufferStorage(m_Ring, GLsizeiptr(m_RingFrameSize) * FramesInFlight, nullptr, ringFlags);
+	m_RingMapped = static_cast<char*>(glMapNamedBufferRange(m_Ring, 0, GLsizeiptr(m_RingFrameSize) * FramesInFlight, ringFlags));
+	assert(m_RingMapped);
+	m_RingAllocator.Init(m_RingFrameSize, FramesInFlight);
+
+	for (auto arena : { &m_VertexArena, &m_IndexArena })
+	{
+		glCreateBuffers(1, &arena->buffer);
+		glNamedBufferStorage(arena->buffer, InitialArenaSize, nullptr, GL_DYNAMIC_STORAGE_BIT);
+		arena->size = InitialArenaSize;
+	}
+
+	// Element i holds i, so a command's baseInstance comes through as the index of its draw.
+	std::vector<uint32_t> drawIndices(m_RingFrameSize / sizeof(DrawConstants));
+	for (uint32_t i = 0; i < drawIndices.size(); ++i) drawIndices[i] = i;
+	glCreateBuffers(1, &m_DrawIndexBuffer);
+	glNamedBufferStorage(m_DrawIndexBuffer, drawIndices.size() * sizeof(uint32_t), drawIndices.data(), 0);
+
+	glCreateVertexArrays(1, &m_GeometryVertexArray);
+	glVertexArrayVertexBuffer(m_GeometryVertexArray, 0, m_DrawIndexBuffer, 0, sizeof(uint32_t));
+	glVertexArrayBindingDivisor(m_GeometryVertexArray, 0, 1);
+	glVertexArrayAttribIFormat(m_GeometryVertexArray, 3, 1, GL_UNSIGNED_INT, 0);
+	glVertexArrayAttribBinding(m_GeometryVertexArray, 3, 0);
+	glEnableVertexArrayAttrib(m_GeometryVertexArray, 3);
+	glVertexArrayElementBuffer(m_GeometryVertexArray, m_IndexArena.buffer);
+
+	// Positions and UVs interleaved, then the indices.
+	const std::array<glm::vec4, 4> vertices = {
+		glm::vec4(-1.f, -1.f, 0.f, 1.f),
+		glm::vec4(-1.f, 1.f, 0.f, 0.f),
+		glm::vec4(1.f, -1.f, 1.f, 1.f),
+		glm::vec4(1.f, 1.f, 1.f, 0.f)
+	};
+	const std::array<IndexType, 6> indices = { 0, 1, 2, 2, 1, 3 };
+	glCreateBuffers(1, &m_FullscreenQuadBuffer);
+	glNamedBufferStorage(m_FullscreenQuadBuffer, sizeof(vertices) + sizeof(indices), nullptr, GL_DYNAMIC_STORAGE_BIT);
+	glNamedBufferSubData(m_FullscreenQuadBuffer, 0, sizeof(vertices), vertices.data());
+	glNamedBufferSubData(m_FullscreenQuadBuffer, sizeof(vertices), sizeof(indices), indices.data());
+
+	glCreateVertexArrays(1, &m_FullscreenQuadVertexArray);
+	glVertexArrayVertexBuffer(m_FullscreenQuadVertexArray, 0, m_FullscreenQuadBuffer, 0, sizeof(glm::vec4));
+	glVertexArrayAttribFormat(m_FullscreenQuadVertexArray, 0, 2, GL_FLOAT, GL_FALSE, 0);
+	glVertexArrayAttribFormat(m_FullscreenQuadVertexArray, 1, 2, GL_FLOAT, GL_FALSE, sizeof(glm::vec2));
+	glVertexArrayAttribBinding(m_FullscreenQuadVertexArray, 0, 0);
+	glVertexArrayAttribBinding(m_FullscreenQuadVertexArray, 1, 0);
+	glEnableVertexArrayAttrib(m_FullscreenQuadVertexArray, 0);
+	glEnableVertexArrayAttrib(m_FullscreenQuadVertexArray, 1);
+	glVertexArrayElementBuffer(m_FullscreenQuadVertexArray, m_FullscreenQuadBuffer);
+}
+
+void GLRHI::HandleWindowResize(uint32_t windowWidth, uint32_t windowHeight)
+{
+	if (windowWidth == 0 || windowHeight == 0) return;
+
+	// GL keeps the old targets alive for whatever is still in flight.
+	DestroyRenderTargets();
+	CreateRenderTargets(windowWidth, windowHeight);
+	m_Width = windowWidth;
+	m_Height = windowHeight;
+}
+
+uint32_t GLRHI::AppendToArena(ArenaBuffer& arena, const void* data, uint32_t size)
+{
+	if (arena.used + size > arena.size)
+	{
+		uint32_t newSize = std::max(arena.size * 2, arena.used + size);
+		GLuint newBuffer;
+		glCreateBuffers(1, &newBuffer);
+		glNamedBufferStorage(newBuffer, newSize, nullptr, GL_DYNAMIC_STORAGE_BIT);
+		glCopyNamedBufferSubData(arena.buffer, newBuffer, 0, 0, arena.used);
+		glDeleteBuffers(1, &arena.buffer);
+		arena.buffer = newBuffer;
+		arena.size = newSize;
+	}
+
+	uint32_t offset = arena.used;
+	glNamedBufferSubData(arena.buffer, offset, size, data);
+	arena.used += size;
+	return offset;
+}
+
+RHIBuffer GLRHI::CreateVertexBuffer(const void* data, uint32_t stride, uint32_t numVertices)
+{
+	// Streams are fetched a float at a time, starting from a whole float.
+	assert(stride % sizeof(float) == 0);
+
+	auto record = std::make_unique<BufferRecord>();
+	record->kind = BufferKind::Vertex;
+	record->size = stride * numVertices;
+	record->stride = stride;
+	record->offset = AppendToArena(m_VertexArena, data, record->size);
+	m_Buffers.push_back(std::move(record));
+	return reinterpret_cast<RHIBuffer>(m_Buffers.back().get());
+}
+
+RHIBuffer GLRHI::CreateIndexBuffer(const std::vector<IndexType>& indices)
+{
+	auto record = std::make_unique<BufferRecord>();
+	record->kind = BufferKind::Index;
+	record->size = static_cast<uint32_t>(indices.size() * sizeof(IndexType));
+	record->stride = sizeof(IndexType);
+	record->offset = AppendToArena(m_IndexArena, indices.data(), record->size);
+	// The arena may have moved.
+	glVertexArrayElementBuffer(m_GeometryVertexArray, m_IndexArena.buffer);
+	m_Buffers.push_back(std::move(record));
+	return reinterpret_cast<RHIBuffer>(m_Buffers.back().get());
+}
+
+RHIBuffer GLRHI::CreateConstantBuffer(int size)
+{
+	auto record = std::make_unique<BufferRecord>();
+	record->kind = BufferKind::Constant;
+	record->offset = 0;
+	record->size = static_cast<uint32_t>(size);
+	record->stride = 0;
+	record->contents.resize(size);
+	m_Buffers.push_back(std::move(record));
+	return reinterpret_cast<RHIBuffer>(m_Buffers.back().get());
+}
+
+bool GLRHI::UpdateConstantBuffer(RHIBuffer buffer, const void* data, int numBytes)
+{
+	auto record = reinterpret_cast<BufferRecord*>(buffer);
+	assert(record->kind == BufferKind::Constant);
+	if (numBytes <= 0 || static_cast<uint32_t>(numBytes) > record->size) return false;
+
+	memcpy(record->contents.data(), data, numBytes);
+	return true;
+}
+
+void GLRHI::UpdateMaterialTable(const std::vector<GPUMaterial>& materials)
+{
+	// The GLSL programs take their slices from the draw constants and shade from the diffuse texture alone.
+}
+
+GLRHI::TextureRecord* GLRHI::CreateTextureRecord(uint32_t width, uint32_t height, uint32_t mipLevels, uint32_t arrayLayers, GLenum format)
+{
+	auto record = std::make_unique<TextureRecord>();
+	record->format = format;
+	record->width = width;
+	record->height = height;
+	record->mipLevels = mipLevels;
+	record->arrayLayers = arrayLayers;
+
+	// Always an array, as the shaders sample every texture as one.
+	glCreateTextures(GL_TEXTURE_2D_ARRAY, 1, &record->texture);
+	glTextureStorage3D(record->texture, mipLevels, format, width, height, arrayLayers);
+
+	auto raw = record.get();
+	m_Textures[raw] = std::move(record);
+	return raw;
+}
+
+RHITexture GLRHI::CreateTexture2D(const CPUTexture& cpuTexture)
+{
+	uint32_t mipLevels = CalcMipLevels(cpuTexture.width, cpuTexture.height);
+
+	// Mips generated on the CPU (e.g. by the decode workers) are uploaded with the top level, otherwise the driver makes them.
+	bool hasCpuMips = !cpuTexture.mips.empty();
+	assert(!hasCpuMips || cpuTexture.mips.size() + 1 == mipLevels);
+	// Block-compressed textures can't have their mips generated, so they must come with them.
+	bool isBlockCompressed = cpuTexture.format == CPUTextureFormat::BC4;
+	assert(hasCpuMips || !isBlockCompressed);
+
+	// RGTC1 is BC4 under its GL name.
+	auto record = CreateTextureRecord(cpuTexture.width, cpuTexture.height, mipLevels, 1, isBlockCompressed ? GL_COMPRESSED_RED_RGTC1 : GL_RGBA8);
+
+	uint32_t numUploadedLevels = hasCpuMips ? mipLevels : 1;
+	GLsizei mipWidth = cpuTexture.width;
+	GLsizei mipHeight = cpuTexture.height;
+	for (uint32_t mip = 0; mip < numUploadedLevels; ++mip)
+	{
+		const auto& level = mip == 0 ? cpuTexture.data : cpuTexture.mips[mip - 1];
+		if (isBlockCompressed)
+		{
+			glCompressedTextureSubImage3D(record->texture, mip, 0, 0, 0, mipWidth, mipHeight, 1, record->format, static_cast<GLsizei>(level.size()), level.data());
+		}
+		else
+		{
+			glTextureSubImage3D(record->texture, mip, 0, 0, 0, mipWidth, mipHeight, 1, GL_BGRA, GL_UNSIGNED_BYTE, level.data());
+		}
+		mipWidth = std::max(mipWidth / 2, 1);
+		mipHeight = std::max(mipHeight / 2, 1);
+	}
+	if (!hasCpuMips) glGenerateTextureMipmap(record->texture);
+
+	return reinterpret_cast<RHITexture>(record);
+}
+
+RHITexture GLRHI::CreateTexture2DArray(const TextureArrayPlan& arrayPlan)
+{
+	assert(!arrayPlan.slices.empty());
+
+	auto numSlices = static_cast<uint32_t>(arrayPlan.slices.size());
+	auto record = CreateTextureRecord(arrayPlan.width, arrayPlan.height, arrayPlan.mipLevels, numSlices, static_cast<GLenum>(arrayPlan.format));
+
+	// The source textures already have their mips, so copy every level across.
+	for (uint32_t slice = 0; slice < numSlices; ++slice)
+	{
+		auto source = reinterpret_cast<const TextureRecord*>(arrayPlan.slices[slice]);
+		assert(source->width == arrayPlan.width && source->height == arrayPlan.height && source->mipLevels == arrayPlan.mipLevels && source->format == record->format);
+
+		GLsizei mipWidth = arrayPlan.width;
+		GLsizei mipHeight = arrayPlan.height;
+		for (uint32_t mip = 0; mip < arrayPlan.mipLevels; ++mip)
+		{
+			glCopyImageSubData(source->texture, GL_TEXTURE_2D_ARRAY, mip, 0, 0, 0, record->texture, GL_TEXTURE_2D_ARRAY, mip, 0, 0, slice, mipWidth, mipHeight, 1);
+			mipWidth = std::max(mipWidth / 2, 1);
+			mipHeight = std::max(mipHeight / 2, 1);
+		}
+	}
+
+	return reinterpret_cast<RHITexture>(record);
+}
+
+void GLRHI::ReleaseTexture2D(RHITexture texture)
+{
+	auto iter = m_Textures.find(reinterpret_cast<TextureRecord*>(texture));
+	assert(iter != m_Textures.end());
+	assert(texture != m_DebugTexture);
+
+	// GL defers the delete until frames in flight are done sampling it.
+	glDeleteTextures(1, &iter->second->texture);
+	m_Textures.erase(iter);
+}
+
+TexturePackingInput GLRHI::GetTexturePackingInput(RHITexture texture) const
+{
+	auto record = reinterpret_cast<const TextureRecord*>(texture);
+
+	TexturePackingInput input;
+	input.texture = texture;
+	input.width = record->width;
+	input.height = record->height;
+	input.mipLevels = record->mipLevels;
+	input.format = record->format;
+	return input;
+}
+
+void GLRHI::CreateDebugTexture2D()
+{
+	CPUTexture debugTex;
+	debugTex.height = 2;
+	debugTex.width = 2;
+	for (int i = 0; i < debugTex.height * debugTex.width; i++)
+	{
+		debugTex.data.push_back(char(255));
+		debugTex.data.push_back(0);
+		debugTex.data.push_back(char(255));
+		debugTex.data.push_back(char(255));
+	}
+
+	m_DebugTexture = CreateTexture2D(debugTex);
+}
+
+char* GLRHI::AllocateRing(uint32_t size, uint32_t alignment, uint32_t& offset)
+{
+	if (!m_RingAllocator.Allocate(size, alignment, offset)) return nullptr;
+	return m_RingMapped + offset;
+}
+
+void GLRHI::BeginFrame()
+{
+	if (m_FrameBegun) return;
+	m_FrameBegun = true;
+
+	FrameResources& frame = m_Frames[m_FrameIndex];
+	if (frame.fence)
+	{
+		// A frame that has to wait here means the CPU is FramesInFlight frames ahead of the GPU.
+		GLenum status = glClientWaitSync(frame.fence, GL_SYNC_FLUSH_COMMANDS_BIT, 0);
+		if (status == GL_TIMEOUT_EXPIRED)
+		{
+			m_RingAllocator.AddStall();
+			while (status == GL_TIMEOUT_EXPIRED) status = glClientWaitSync(frame.fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000 * 1000 * 1000);
+		}
+		glDeleteSync(frame.fence);
+		frame.fence = nullptr;
+	}
+
+	// The fence covers the timestamps too, so reading them doesn't block.
+	if (frame.timed)
+	{
+		std::array<GLuint64, 3> times;
+		for (size_t i = 0; i < times.size(); ++i) glGetQueryObjectui64v(frame.timestamps[i], GL_QUERY_RESULT, &times[i]);
+		m_Stats.gpuGeometryMs += (times[1] - times[0]) * 1e-6;
+		m_Stats.gpuLightingMs += (times[2] - times[1]) * 1e-6;
+		++m_Stats.numTimedFrames;
+		frame.timed = false;
+	}
+
+	m_RingAllocator.BeginFrame(m_FrameIndex);
+	glQueryCounter(frame.timestamps[0], GL_TIMESTAMP);
+}
+
+void GLRHI::BeginGeometryPass()
+{
+	BeginFrame();
+
+	glBindFramebuffer(GL_FRAMEBUFFER, m_GeometryFramebuffer);
+	glClipControl(GL_UPPER_LEFT, GL_ZERO_TO_ONE);
+	glViewport(0, 0, m_Width, m_Height);
+
+	const std::array<GLfloat, 4> clearColor = { 0.f, 0.f, 0.25f, 1.f };
+	const GLfloat clearDepth = 1.f;
+	glClearNamedFramebufferfv(m_GeometryFramebuffer, GL_COLOR, 0, clearColor.data());
+	const GLenum normalAttachment = GL_COLOR_ATTACHMENT1;
+	glInvalidateNamedFramebufferData(m_GeometryFramebuffer, 1, &normalAttachment);
+	glDepthMask(GL_TRUE);
+	glClearNamedFramebufferfv(m_GeometryFramebuffer, GL_DEPTH, 0, &clearDepth);
+
+	glDisable(GL_BLEND);
+	glEnable(GL_DEPTH_TEST);
+	glDepthFunc(GL_LEQUAL);
+	glBindSampler(1, m_Sampler);
+	glBindSampler(2, m_Sampler);
+
+	m_CurrentGeometryProgram = m_GeometryProgram;
+}
+
+void GLRHI::BeginMaskedGeometryPass()
+{
+	// Same targets and state as the opaque pass, only the fragment shader alpha tests.
+	FlushDrawPackets();
+	m_CurrentGeometryProgram = m_MaskedGeometryProgram;
+}
+
+void GLRHI::SetGeometryShaderFeatures(uint32_t features)
+{
+	// The GLSL programs have no variants, so debug views draw as the scene.
+}
+
+void GLRHI::DrawMesh(const Mesh& mesh, RHITexture diffuseTexture, RHITexture maskTexture)
+{
+	auto position = reinterpret_cast<const BufferRecord*>(mesh.gpuMesh.positionBuffer);
+	auto normal = reinterpret_cast<const BufferRecord*>(mesh.gpuMesh.normalBuffer);
+	auto uv = reinterpret_cast<const BufferRecord*>(mesh.gpuMesh.uvBuffer);
+	auto index = reinterpret_cast<const BufferRecord*>(mesh.gpuMesh.indexBuffer);
+	auto constants = reinterpret_cast<const BufferRecord*>(mesh.constantBuffer);
+	assert(position->kind == BufferKind::Vertex && normal->kind == BufferKind::Vertex && uv->kind == BufferKind::Vertex);
+	assert(index->kind == BufferKind::Index && constants->kind == BufferKind::Constant);
+
+	// The constants of one flush are contiguous, so they bind as a single range.
+	uint32_t offset;
+	char* mapped = AllocateRing(sizeof(DrawConstants), m_DrawPackets.empty() ? m_StorageAlignment : alignof(glm::vec4), offset);
+	if (!mapped) return;
+	if (m_DrawPackets.empty()) m_DrawConstantsOffset = offset;
+
+	// Built locally and copied once, as the ring may be write-combined.
+	DrawConstants draw;
+	memcpy(&draw.geometry, constants->contents.data(), sizeof(draw.geometry));
+	draw.streamOffsets = glm::uvec4(position->offset, normal->offset, uv->offset, 0) / uint32_t(sizeof(float));
+	draw.streamStrides = glm::uvec4(position->stride, normal->stride, uv->stride, 0) / uint32_t(sizeof(float));
+	memcpy(mapped, &draw, sizeof(draw));
+
+	DrawPacket packet;
+	packet.diffuseTexture = reinterpret_cast<const TextureRecord*>(diffuseTexture)->texture;
+	packet.maskTexture = maskTexture ? reinterpret_cast<const TextureRecord*>(maskTexture)->texture : 0;
+	packet.command.count = mesh.numFaces * 3;
+	packet.command.instanceCount = 1;
+	packet.command.firstIndex = index->offset / sizeof(IndexType);
+	packet.command.baseVertex = 0;
+	packet.command.baseInstance = (offset - m_DrawConstantsOffset) / sizeof(DrawConstants);
+	m_DrawPackets.push_back(packet);
+}
+
+void GLRHI::FlushDrawPackets()
+{
+	if (m_DrawPackets.empty()) return;
+	auto submitBegin = std::chrono::steady_clock::now();
+
+	// Each run of draws sharing textures becomes one multi-draw. Stable, so coplanar surfaces keep the engine's order.
+	std::stable_sort(m_DrawPackets.begin(), m_DrawPackets.end(), [](const DrawPacket& a, const DrawPacket& b)
+	{
+		return std::tie(a.diffuseTexture, a.maskTexture) < std::tie(b.diffuseTexture, b.maskTexture);
+	});
+
+	auto numPackets = static_cast<uint32_t>(m_DrawPackets.size());
+	uint32_t commandsOffset;
+	char* commands = AllocateRing(numPackets * sizeof(DrawElementsIndirectCommand), alignof(DrawElementsIndirectCommand), commandsOffset);
+	if (commands)
+	{
+		for (uint32_t i = 0; i < numPackets; ++i)
+		{
+			memcpy(commands + i * sizeof(DrawElementsIndirectCommand), &m_DrawPackets[i].command, sizeof(DrawElementsIndirectCommand));
+		}
+
+		glUseProgram(m_CurrentGeometryProgram);
+		glBindVertexArray(m_GeometryVertexArray);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, m_VertexArena.buffer);
+		glBindBufferRange(GL_SHADER_STORAGE_BUFFER, 1, m_Ring, m_DrawConstantsOffset, numPackets * sizeof(DrawConstants));
+		glBindBuffer(GL_DRAW_INDIRECT_BUFFER, m_Ring);
+
+		uint32_t runBegin = 0;
+		while (runBegin < numPackets)
+		{
+			const DrawPacket& first = m_DrawPackets[runBegin];
+			uint32_t runEnd = runBegin + 1;
+			while (runEnd < numPackets && m_DrawPackets[runEnd].diffuseTexture == first.diffuseTexture && m_DrawPackets[runEnd].maskTexture == first.maskTexture) ++runEnd;
+
+			glBindTextureUnit(1, first.diffuseTexture);
+			if (first.maskTexture) glBindTextureUnit(2, first.maskTexture);
+			auto indirect = reinterpret_cast<const void*>(uintptr_t(commandsOffset) + runBegin * sizeof(DrawElementsIndirectCommand));
+			glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_SHORT, indirect, runEnd - runBegin, 0);
+
+			++m_Stats.numMultiDraws;
+			runBegin = runEnd;
+		}
+		m_Stats.numDraws += numPackets;
+	}
+
+	m_DrawPackets.clear();
+	m_Stats.submitMs += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - submitBegin).count();
+}
+
+void GLRHI::BeginLightingPass()
+{
+	FlushDrawPackets();
+	glQueryCounter(m_Frames[m_FrameIndex].timestamps[1], GL_TIMESTAMP);
+
+	// The lighting pass writes the window the right way up, reading the G-buffer top row first.
+	glBindFramebuffer(GL_FRAMEBUFFER, m_OutputFramebuffer);
+	glClipControl(GL_LOWER_LEFT, GL_ZERO_TO_ONE);
+	glViewport(0, 0, m_Width, m_Height);
+	const std::array<GLfloat, 4> clearColor = { 0.f, 0.f, 0.f, 1.f };
+	glClearNamedFramebufferfv(m_OutputFramebuffer, GL_COLOR, 0, clearColor.data());
+
+	glDisable(GL_DEPTH_TEST);
+	glEnable(GL_BLEND);
+	glBlendFunc(GL_ONE, GL_ONE);
+
+	glBindVertexArray(m_FullscreenQuadVertexArray);
+	glBindTextureUnit(1, m_ColorRT);
+	glBindTextureUnit(2, m_NormalRT);
+}
+
+void GLRHI::DrawAmbient(glm::vec3 color)
+{
+	uint32_t offset;
+	char* mapped = AllocateRing(sizeof(glm::vec4), m_UniformAlignment, offset);
+	if (!mapped) return;
+	glm::vec4 amb = glm::vec4(color, 1.0f);
+	memcpy(mapped, &amb, sizeof(amb));
+
+	glUseProgram(m_AmbientProgram);
+	glBindBufferRange(GL_UNIFORM_BUFFER, 0, m_Ring, offset, sizeof(amb));
+	glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_SHORT, reinterpret_cast<const void*>(4 * sizeof(glm::vec4)));
+}
+
+void GLRHI::DrawDirectionalLight(glm::vec3 color, glm::vec3 angles)
+{
+	uint32_t offset;
+	char* mapped = AllocateRing(sizeof(DirectionalConstants), m_UniformAlignment, offset);
+	if (!mapped) return;
+
+	auto lightDir = glm::vec3(1.0f, 0.0f, 0.0f);
+
+	const auto xDir = glm::vec3(1.0f, 0.0f, 0.0f);
+	const auto yDir = glm::vec3(0.0f, 1.0f, 0.0f);
+	const auto zDir = glm::vec3(0.0f, 0.0f, 1.0f);
+	glm::mat4 xRotMat = glm::rotate(glm::radians(angles.x), xDir);
+	glm::mat4 yRotMat = glm::rotate(glm::radians(angles.y), yDir);
+	glm::mat4 zRotMat = glm::rotate(glm::radians(angles.z), zDir);
+	glm::mat4 rotMat = xRotMat * yRotMat * zRotMat;
+
+	DirectionalConstants data;
+	data.color = glm::vec4(color, 1.0f);
+	data.direction = rotMat * glm::vec4(lightDir, 1.0f);
+	memcpy(mapped, &data, sizeof(data));
+
+	glUseProgram(m_DirectionalProgram);
+	glBindBufferRange(GL_UNIFORM_BUFFER, 0, m_Ring, offset, sizeof(data));
+	glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_SHORT, reinterpret_cast<const void*>(4 * sizeof(glm::vec4)));
+}
+
+void GLRHI::Present()
+{
+	BeginFrame();
+	FlushDrawPackets();
+
+	FrameResources& frame = m_Frames[m_FrameIndex];
+	glQueryCounter(frame.timestamps[2], GL_TIMESTAMP);
+	frame.timed = true;
+	frame.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+
+	if (m_Headless)
+	{
+		// Nothing swaps, so hand the frame over explicitly.
+		glFlush();
+	}
+	else
+	{
+		SDL_GL_SwapWindow(m_SDLWindow);
+	}
+	CheckErrors();
+
+	++m_Stats.numFrames;
+	m_FrameBegun = false;
+	m_FrameIndex = (m_FrameIndex + 1) % FramesInFlight;
+}
+
+void GLRHI::CheckErrors()
+{
+	for (GLenum error = glGetError(); error != GL_NO_ERROR; error = glGetError())
+	{
+		if (m_NumGLErrors++ < MaxLoggedGLErrors) SDL_Log("GL error 0x%04x.", error);
+	}
+}
+
+void GLRHI::InitImGui(const Window& window)
+{
+	ImGui_ImplSDL2_InitForOpenGL(window.sdlWindow.get(), m_SDLContext);
+
+	// NewFrame needs a built font atlas even though nothing uploads it.
+	unsigned char* pixels;
+	int width, height;
+	ImGui::GetIO().Fonts->GetTexDataAsRGBA32(&pixels, &width, &height);
+}
+
+void GLRHI::ShutdownImGui()
+{
+	ImGui_ImplSDL2_Shutdown();
+}
+
+void GLRHI::LogStats() const
+{
+	if (m_Stats.numFrames == 0) return;
+
+	double numFrames = static_cast<double>(m_Stats.numFrames);
+	SDL_Log("OpenGL (%s): %llu frames, %.1f draws per frame in %.1f multi-draws, %.3f ms submitting per frame.",
+		m_RendererName.c_str(), static_cast<unsigned long long>(m_Stats.numFrames), m_Stats.numDraws / numFrames, m_Stats.numMultiDraws / numFrames,
+		m_Stats.submitMs / numFrames);
+	m_RingAllocator.LogStats("OpenGL constant");
+	if (m_Stats.numTimedFrames > 0)
+	{
+		SDL_Log("OpenGL GPU time per frame over %llu frames: geometry %.3f ms, lighting %.3f ms.",
+			static_cast<unsigned long long>(m_Stats.numTimedFrames),
+			m_Stats.gpuGeometryMs / m_Stats.numTimedFrames, m_Stats.gpuLightingMs / m_Stats.numTimedFrames);
+	}
+}
\ No newline at end of file
@@ -0,0 +1,225 @@
+#pragma once
+#include <array>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "sdl/SDL.h"
+#include "sdl/SDL_opengl.h"
+
+#include "RHI.h"
+#include "UploadRing.h"
+
+struct GLRHIStats
+{
+	uint64_t numFrames = 0;
+	uint64_t numDraws = 0;
+	uint64_t numMultiDraws = 0;			// glMultiDrawElementsIndirect calls the draws were collapsed into
+	double submitMs = 0.0;				// CPU time spent issuing the geometry passes
+	uint64_t numTimedFrames = 0;
+	double gpuGeometryMs = 0.0;
+	double gpuLightingMs = 0.0;
+};
+
+// OpenGL 4.5 core implementation of the same passes as D3D11RHI, written against direct state access only.
+// Per-draw constants are written straight into a persistently mapped, coherent ring split between the frames
+// in flight, each part fenced. Vertex and index data live in two arenas, so a geometry pass needs no rebinding
+// between meshes: draws are sorted by texture and each run goes out as one glMultiDrawElementsIndirect, the
+// vertex shader fetching its streams and constants by draw index. Headless, it renders offscreen on an EGL
+// surfaceless context, which is how it runs on llvmpipe. Shaders are compiled at startup from Source/Shaders/GLSL.
+class GLRHI : public RHI
+{
+public:
+	explicit GLRHI(bool headless);
+	~GLRHI();
+
+	const char* GetName() const override { return m_Headless ? "gl-headless" : "gl"; }
+	bool IsHeadless() const override { return m_Headless; }
+	uint32_t GetWindowFlags() const override { return SDL_WINDOW_OPENGL; }
+	bool InitRHI(const Window& window) override;
+	void HandleWindowResize(uint32_t windowWidth, uint32_t windowHeight) override;
+
+	using RHI::CreateVertexBuffer;
+	RHIBuffer CreateVertexBuffer(const void* data, uint32_t stride, uint32_t numVertices) override;
+	RHIBuffer CreateIndexBuffer(const std::vector<IndexType>& indices) override;
+	RHIBuffer CreateConstantBuffer(int size) override;
+	bool UpdateConstantBuffer(RHIBuffer buffer, const void* data, int numBytes) override;
+	void UpdateMaterialTable(const std::vector<GPUMaterial>& materials) override;
+
+	RHITexture CreateTexture2D(const CPUTexture& cpuTexture) override;
+	RHITexture CreateTexture2DArray(const TextureArrayPlan& arrayPlan) override;
+	void ReleaseTexture2D(RHITexture texture) override;
+	TexturePackingInput GetTexturePackingInput(RHITexture texture) const override;
+	uint32_t GetMaxTextureArraySlices() const override { return m_MaxTextureArraySlices; }
+	RHITexture GetDebugTexture2D() override { return m_DebugTexture; }
+
+	void BeginGeometryPass() override;
+	void BeginMaskedGeometryPass() override;
+	void SetGeometryShaderFeatures(uint32_t features) override;
+	void DrawMesh(const Mesh& mesh, RHITexture diffuseTexture, RHITexture maskTexture) override;
+	void BeginLightingPass() override;
+	void DrawAmbient(glm::vec3 color) override;
+	void DrawDirectionalLight(glm::vec3 color, glm::vec3 angles) override;
+	void Present() override;
+
+	// The vendored ImGui has no OpenGL 3 renderer, so only the platform half runs and the UI isn't drawn.
+	void InitImGui(const Window& window) override;
+	void NewImGuiFrame() override {}
+	void RenderImGui() override {}
+	void ShutdownImGui() override;
+
+	// GL errors raised since startup, drained once per frame.
+	uint32_t GetNumValidationErrors() const override { return m_NumGLErrors; }
+	void LogStats() const override;
+	const GLRHIStats& GetStats() const { return m_Stats; }
+
+private:
+	static const uint32_t FramesInFlight = 3;
+	// Each frame's part of the constant ring, unless the engine asks for another size. Draw constants are
+	// 112 bytes, so this is ~75k draws.
+	static const uint32_t DefaultRingFrameSize = 8 * 1024 * 1024;
+	static const uint32_t InitialArenaSize = 4 * 1024 * 1024;
+
+	enum class BufferKind
+	{
+		Vertex,
+		Index,
+		Constant,
+	};
+
+	struct BufferRecord
+	{
+		BufferKind kind;
+		uint32_t offset;			// Into the vertex or index arena, in bytes
+		uint32_t size;
+		uint32_t stride;
+		std::vector<char> contents;	// Constant buffers only, copied into the ring by each draw
+	};
+
+	struct TextureRecord
+	{
+		GLuint texture;
+		GLenum format;
+		uint32_t width;
+		uint32_t height;
+		uint32_t mipLevels;
+		uint32_t arrayLayers;
+	};
+
+	// Grows by reallocating, so records hold offsets rather than buffer names.
+	struct ArenaBuffer
+	{
+		GLuint buffer = 0;
+		uint32_t size = 0;
+		uint32_t used = 0;
+	};
+
+	// Same layout as DrawConstants in GeometryMultiDraw.vert.
+	struct DrawConstants
+	{
+		GeometryConstantBufferLayout geometry;
+		glm::uvec4 streamOffsets;
+		glm::uvec4 streamStrides;
+	};
+
+	struct DrawElementsIndirectCommand
+	{
+		uint32_t count;
+		uint32_t instanceCount;
+		uint32_t firstIndex;
+		int32_t baseVertex;
+		uint32_t baseInstance;		// Index of the draw's constants, read back through the draw index attribute
+	};
+
+	struct DrawPacket
+	{
+		GLuint diffuseTexture;
+		GLuint maskTexture;
+		DrawElementsIndirectCommand command;
+	};
+
+	struct FrameResources
+	{
+		GLsync fence = nullptr;
+		std::array<GLuint, 3> timestamps = {};
+		bool timed = false;
+	};
+
+	bool CreateContext(const Window& window);
+	void DestroyContext();
+	bool LoadFunctions();
+	GLuint LoadProgram(const std::string& vertexShader, const std::string& fragmentShader);
+	GLuint CompileShader(GLenum type, const std::string& name);
+	void CreateRenderTargets(uint32_t width, uint32_t height);
+	void DestroyRenderTargets();
+	void CreateStaticBuffers();
+	void CreateDebugTexture2D();
+
+	uint32_t AppendToArena(ArenaBuffer& arena, const void* data, uint32_t size);
+	TextureRecord* CreateTextureRecord(uint32_t width, uint32_t height, uint32_t mipLevels, uint32_t arrayLayers, GLenum format);
+	// Bump allocates from this frame's part of the ring. Returns null when it is full.
+	char* AllocateRing(uint32_t size, uint32_t alignment, uint32_t& offset);
+
+	// Waits until the GPU is done with this frame slot's part of the ring. Idempotent within a frame.
+	void BeginFrame();
+	void FlushDrawPackets();
+	void CheckErrors();
+
+	bool								m_Headless;
+	uint32_t							m_Width = 0;
+	uint32_t							m_Height = 0;
+
+	SDL_Window*							m_SDLWindow = nullptr;
+	SDL_GLContext						m_SDLContext = nullptr;
+	SDL_Window*							m_HiddenWindow = nullptr;	// Carries the context when headless on platforms without EGL
+	void*								m_EGLDisplay = nullptr;
+	void*								m_EGLContext = nullptr;
+
+	std::string							m_RendererName;
+	uint32_t							m_MaxTextureArraySlices = 256;
+	GLint								m_UniformAlignment = 256;
+	GLint								m_StorageAlignment = 256;
+
+	GLuint								m_GeometryProgram = 0;
+	GLuint								m_MaskedGeometryProgram = 0;
+	GLuint								m_AmbientProgram = 0;
+	GLuint								m_DirectionalProgram = 0;
+	GLuint								m_Sampler = 0;
+
+	GLuint								m_ColorRT = 0;
+	GLuint								m_NormalRT = 0;
+	GLuint								m_DepthRT = 0;
+	GLuint								m_GeometryFramebuffer = 0;
+	GLuint								m_OffscreenOutput = 0;				// Stands in for the window's back buffer when headless
+	GLuint								m_OutputFramebuffer = 0;
+
+	ArenaBuffer							m_VertexArena;
+	ArenaBuffer							m_IndexArena;
+	GLuint								m_GeometryVertexArray = 0;		// Draw index attribute and the index arena
+	GLuint								m_DrawIndexBuffer = 0;
+	GLuint								m_FullscreenQuadVertexArray = 0;
+	GLuint								m_FullscreenQuadBuffer = 0;
+
+	GLuint								m_Ring = 0;
+	uint32_t							m_RingFrameSize = DefaultRingFrameSize;
+	char*								m_RingMapped = nullptr;
+	UploadRing							m_RingAllocator;
+
+	std::vector<std::unique_ptr<BufferRecord>> m_Buffers;
+	std::map<TextureRecord*, std::unique_ptr<TextureRecord>> m_Textures;
+	RHITexture							m_DebugTexture = nullptr;
+
+	std::array<FrameResources, FramesInFlight> m_Frames;
+	uint32_t							m_FrameIndex = 0;
+	bool								m_FrameBegun = false;
+
+	// Draws since the last flush, and the ring range their constants went to.
+	std::vector<DrawPacket>				m_DrawPackets;
+	uint32_t							m_DrawConstantsOffset = 0;
+	GLuint								m_CurrentGeometryProgram = 0;
+
+	uint32_t							m_NumGLErrors = 0;
+	GLRHIStats							m_Stats;
+};
\ No newline at end of file
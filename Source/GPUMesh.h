@@ -1,10 +1,10 @@
 #pragma once
 
-struct ID3D11Buffer;
+#include "RHI.h"
 
 struct GPUMesh {
-	ID3D11Buffer*	positionBuffer;
-	ID3D11Buffer*	indexBuffer;
-	ID3D11Buffer*	normalBuffer;
-	ID3D11Buffer*	uvBuffer;
+	RHIBuffer	positionBuffer;
+	RHIBuffer	indexBuffer;
+	RHIBuffer	normalBuffer;
+	RHIBuffer	uvBuffer;
 };
\ No newline at end of file
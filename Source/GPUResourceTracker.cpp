@@ -0,0 +1,36 @@
+#include "GPUResourceTracker.h"
+
+#include <algorithm>
+#include <cassert>
+
+#include "sdl/SDL.h"
+
+void GPUResourceTracker::OnCreate(GPUResourceKind kind, uint64_t numBytes)
+{
+	KindStats& stats = m_Kinds[static_cast<size_t>(kind)];
+	++stats.numLive;
+	++stats.numCreated;
+	stats.liveBytes += numBytes;
+	stats.peakBytes = std::max(stats.peakBytes, stats.liveBytes);
+}
+
+void GPUResourceTracker::OnRetire(GPUResourceKind kind, uint64_t numBytes)
+{
+	KindStats& stats = m_Kinds[static_cast<size_t>(kind)];
+	assert(stats.numLive > 0 && stats.liveBytes >= numBytes);
+	--stats.numLive;
+	stats.liveBytes -= numBytes;
+}
+
+void GPUResourceTracker::LogStats(const char* name) const
+{
+	const char* kindNames[] = { "buffers", "textures", "render targets" };
+	static_assert(sizeof(kindNames) / sizeof(kindNames[0]) == static_cast<size_t>(GPUResourceKind::Count), "A name per kind");
+
+	for (size_t kind = 0; kind < m_Kinds.size(); ++kind)
+	{
+		const KindStats& stats = m_Kinds[kind];
+		SDL_Log("%s %s: %u live (%.1f MB, peak %.1f MB), %u created.", name, kindNames[kind], stats.numLive,
+			stats.liveBytes / (1024.0 * 1024.0), stats.peakBytes / (1024.0 * 1024.0), stats.numCreated);
+	}
+}
\ No newline at end of file
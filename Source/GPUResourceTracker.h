@@ -0,0 +1,38 @@
+#pragma once
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+enum class GPUResourceKind
+{
+	Buffer,
+	Texture,
+	RenderTarget,
+	Count
+};
+
+// Live counts and bytes of a backend's resources, by kind. Resources count from creation until the backend
+// retires them, which may be a few frames before the API object is actually released.
+class GPUResourceTracker
+{
+public:
+	void OnCreate(GPUResourceKind kind, uint64_t numBytes);
+	void OnRetire(GPUResourceKind kind, uint64_t numBytes);
+
+	uint32_t GetNumLive(GPUResourceKind kind) const { return m_Kinds[static_cast<size_t>(kind)].numLive; }
+	uint64_t GetLiveBytes(GPUResourceKind kind) const { return m_Kinds[static_cast<size_t>(kind)].liveBytes; }
+
+	// One line per kind, prefixed with the name.
+	void LogStats(const char* name) const;
+
+private:
+	struct KindStats
+	{
+		uint32_t numLive = 0;
+		uint32_t numCreated = 0;
+		uint64_t liveBytes = 0;
+		uint64_t peakBytes = 0;
+	};
+
+	std::array<KindStats, static_cast<size_t>(GPUResourceKind::Count)> m_Kinds;
+};
\ No newline at end of file
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+
+namespace Hash
+{
+
+// 64-bit MurmurHash2 (64A variant). Consumes 8 bytes per step, which is plenty fast
+// for hashing whole texture payloads at load time.
+inline uint64_t HashBytes(const void* data, size_t size, uint64_t seed = 0)
+{
+	const uint64_t m = 0xc6a4a7935bd1e995ULL;
+	const int r = 47;
+
+	uint64_t h = seed ^ (size * m);
+
+	auto bytes = static_cast<const uint8_t*>(data);
+	auto end = bytes + (size & ~size_t(7));
+	for (; bytes != end; bytes += 8)
+	{
+		uint64_t k;
+		memcpy(&k, bytes, sizeof(k));
+
+		k *= m;
+		k ^= k >> r;
+		k *= m;
+
+		h ^= k;
+		h *= m;
+	}
+
+	switch (size & 7)
+	{
+	case 7: h ^= uint64_t(bytes[6]) << 48;
+	case 6: h ^= uint64_t(bytes[5]) << 40;
+	case 5: h ^= uint64_t(bytes[4]) << 32;
+	case 4: h ^= uint64_t(bytes[3]) << 24;
+	case 3: h ^= uint64_t(bytes[2]) << 16;
+	case 2: h ^= uint64_t(bytes[1]) << 8;
+	case 1: h ^= uint64_t(bytes[0]);
+		h *= m;
+	};
+
+	h ^= h >> r;
+	h *= m;
+	h ^= h >> r;
+
+	return h;
+}
+
+// Hashes a POD value (e.g. a zeroed D3D descriptor) by its bytes.
+template <typename T>
+inline uint64_t HashPod(const T& value, uint64_t seed = 0)
+{
+	return HashBytes(&value, sizeof(T), seed);
+}
+
+inline uint64_t Combine(uint64_t seed, uint64_t value)
+{
+	return seed ^ (value + 0x9e3779b97f4a7c15ULL + (seed << 6) + (seed >> 2));
+}
+
+} // namespace Hash
@@ -4,8 +4,8 @@
 #include "glm/gtx/matrix_decompose.hpp"
 #include "glm/gtx/quaternion.hpp"
 
-#include "imgui/imgui.h"
-#include "imgui/ImGuizmo.h"
+#include "Imgui/imgui.h"
+#include "Imgui/ImGuizmo.h"
 #include "Engine.h"
 
 namespace Globals
@@ -15,6 +15,7 @@ namespace Globals
 	glm::vec3 LightingAmbientColor = glm::vec3(0.2f);
 	glm::vec3 LightingDirectionalColor = glm::vec3(0.8f);
 	glm::vec3 LightingDirectionalRot = glm::vec3(0.f);
+	uint32_t TextureUploadsPerFrame = 4;
 }
 
 namespace ImGui::Integration
@@ -72,8 +73,31 @@ void RenderLightingWindow(bool* pOpen) {
 	ImGui::End();
 }
 
+void RenderStatsWindow(bool* pOpen)
+{
+	ImGui::SetNextWindowSize(ImVec2(300, 200), ImGuiSetCond_FirstUseEver);
+
+	if (ImGui::Begin("Stats", pOpen))
+	{
+		const auto& stats = g_Engine->m_FrameStats;
+		ImGui::Text("Opaque draws: %u", stats.opaqueDraws);
+		ImGui::Text("Masked draws: %u", stats.maskedDraws);
+		ImGui::Text("State changes: %u (%u unsorted)", stats.stateChanges, stats.unsortedStateChanges);
+		ImGui::Text("Front end: %.3f ms in %u chunks", stats.frontEndMs, stats.frontEndChunks);
+
+		const auto ioStats = g_Engine->fileReader.GetStats();
+		ImGui::Separator();
+		ImGui::Text("File reads (%s, qd %u): %llu", g_Engine->fileReader.GetBackendName(), g_Engine->fileReader.GetQueueDepth(),
+			static_cast<unsigned long long>(ioStats.numRequests));
+		ImGui::Text("Bytes read: %.1f MB", ioStats.bytesRead / (1024.0 * 1024.0));
+		ImGui::Text("Max reads in flight: %u", ioStats.maxInFlight);
+	}
+	ImGui::End();
+}
+
 static bool g_cameraWindowOpen = false;
 static bool g_lightingWindowOpen = false;
+static bool g_statsWindowOpen = false;
 
 void RenderMainMenu()
 {
@@ -83,6 +107,7 @@ void RenderMainMenu()
 		{
 			ImGui::MenuItem("Camera", NULL, &g_cameraWindowOpen);
 			ImGui::MenuItem("Lighting", NULL, &g_lightingWindowOpen);
+			ImGui::MenuItem("Stats", NULL, &g_statsWindowOpen);
 			ImGui::EndMenu();
 		}
 	}
@@ -95,6 +120,7 @@ void RenderMenus()
 
 	if(g_cameraWindowOpen) RenderCameraMenu(&g_cameraWindowOpen);
 	if (g_lightingWindowOpen) RenderLightingWindow(&g_lightingWindowOpen);
+	if (g_statsWindowOpen) RenderStatsWindow(&g_statsWindowOpen);
 }
 
 } // namespace ImGui::Integration
\ No newline at end of file
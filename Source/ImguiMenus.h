@@ -1,4 +1,5 @@
 #pragma once
+#include <cstdint>
 #include "glm/glm.hpp"
 
 namespace Globals
@@ -11,6 +12,9 @@ namespace Globals
 	extern glm::vec3 LightingAmbientColor;
 	extern glm::vec3 LightingDirectionalColor;
 	extern glm::vec3 LightingDirectionalRot;
+
+	// Streaming
+	extern uint32_t TextureUploadsPerFrame;
 }
 
 namespace ImGui::Integration
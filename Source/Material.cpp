@@ -0,0 +1,69 @@
+#include "Material.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include <assimp/material.h>
+
+#include "Hash.h"
+
+uint32_t MaterialTable::Add(const Material& material)
+{
+	++m_NumAdds;
+	uint64_t hash = Hash::HashPod(material);
+	auto range = m_IndicesByHash.equal_range(hash);
+	for (auto it = range.first; it != range.second; ++it)
+	{
+		if (memcmp(&m_Materials[it->second], &material, sizeof(Material)) == 0) return it->second;
+	}
+
+	auto index = static_cast<uint32_t>(m_Materials.size());
+	m_Materials.push_back(material);
+	m_IndicesByHash.emplace(hash, index);
+	return index;
+}
+
+std::vector<GPUMaterial> MaterialTable::BuildGPUTable(const std::function<uint32_t(TextureHandle texture)>& getSlice) const
+{
+	std::vector<GPUMaterial> table(m_Materials.size());
+	for (size_t i = 0; i < m_Materials.size(); ++i)
+	{
+		const Material& material = m_Materials[i];
+		GPUMaterial& entry = table[i];
+		entry.diffuse = glm::vec4(material.diffuseColor, material.opacity);
+		entry.specular = glm::vec4(material.specularColor, material.specularPower);
+		bool hasDiffuse = material.diffuseTexture != InvalidTextureHandle;
+		entry.textures = glm::uvec4(hasDiffuse ? getSlice(material.diffuseTexture) : 0,
+			material.maskTexture != InvalidTextureHandle ? getSlice(material.maskTexture) : 0, hasDiffuse ? 1 : 0, 0);
+	}
+	return table;
+}
+
+MaterialSource Materials::Read(const aiMaterial& material)
+{
+	MaterialSource source;
+	aiColor3D color;
+	if (material.Get(AI_MATKEY_COLOR_DIFFUSE, color) == aiReturn_SUCCESS) source.diffuseColor = glm::vec3(color.r, color.g, color.b);
+	if (material.Get(AI_MATKEY_COLOR_SPECULAR, color) == aiReturn_SUCCESS) source.specularColor = glm::vec3(color.r, color.g, color.b);
+	material.Get(AI_MATKEY_OPACITY, source.opacity);
+	material.Get(AI_MATKEY_SHININESS, source.specularPower);
+
+	// map_d in the MTL comes through as the opacity texture.
+	aiString path;
+	if (material.GetTexture(aiTextureType_DIFFUSE, 0, &path) == aiReturn_SUCCESS) source.diffusePath = path.C_Str();
+	if (material.GetTexture(aiTextureType_OPACITY, 0, &path) == aiReturn_SUCCESS) source.maskPath = path.C_Str();
+	return source;
+}
+
+Material Materials::Flatten(const MaterialSource& source, const TextureLookup& getDiffuse, const TextureLookup& getMask)
+{
+	// Value-initialized, and with no padding every byte that is compared is set.
+	Material material{};
+	material.diffuseColor = glm::clamp(source.diffuseColor, 0.f, 1.f);
+	material.opacity = std::clamp(source.opacity, 0.f, 1.f);
+	material.specularColor = glm::clamp(source.specularColor, 0.f, 1.f);
+	material.specularPower = std::max(source.specularPower, 0.f);
+	material.diffuseTexture = source.diffusePath.empty() ? InvalidTextureHandle : getDiffuse(source.diffusePath);
+	material.maskTexture = source.maskPath.empty() ? InvalidTextureHandle : getMask(source.maskPath);
+	return material;
+}
\ No newline at end of file
@@ -0,0 +1,68 @@
+#pragma once
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "glm/glm.hpp"
+
+#include "RHI.h"
+#include "TextureMap.h"
+
+struct aiMaterial;
+
+// A scene material as its MTL entry describes it, texture paths as written.
+struct MaterialSource
+{
+	glm::vec3 diffuseColor = glm::vec3(1.f);		// Kd
+	float opacity = 1.f;							// d
+	glm::vec3 specularColor = glm::vec3(0.f);		// Ks
+	float specularPower = 0.f;						// Ns
+	std::string diffusePath;						// map_Kd, empty if none
+	std::string maskPath;							// map_d, empty if none
+};
+
+// What the renderer keeps of a material. Compared and hashed by its bytes, so it must stay free of padding.
+struct Material
+{
+	glm::vec3 diffuseColor;
+	float opacity;
+	glm::vec3 specularColor;
+	float specularPower;
+	TextureHandle diffuseTexture;					// InvalidTextureHandle if the material has none
+	TextureHandle maskTexture;						// Ditto, and masked materials are exactly those with one
+};
+static_assert(sizeof(Material) == 40, "Materials are hashed by their bytes");
+
+// Every material in the scene once, however many meshes or scene materials share it. Meshes keep an index.
+class MaterialTable
+{
+public:
+	// The index of an equal material already in the table, or of this one, added at the end.
+	uint32_t Add(const Material& material);
+
+	const Material& Get(uint32_t index) const { return m_Materials[index]; }
+	uint32_t GetNumMaterials() const { return static_cast<uint32_t>(m_Materials.size()); }
+	// Calls to Add, so the duplicates are the difference.
+	uint32_t GetNumAdds() const { return m_NumAdds; }
+
+	// The table in index order, as the shaders read it, with each texture's slice as getSlice has it now.
+	std::vector<GPUMaterial> BuildGPUTable(const std::function<uint32_t(TextureHandle texture)>& getSlice) const;
+
+private:
+	std::vector<Material>						m_Materials;
+	std::unordered_multimap<uint64_t, uint32_t>	m_IndicesByHash;
+	uint32_t									m_NumAdds = 0;
+};
+
+namespace Materials
+{
+	typedef std::function<TextureHandle(const std::string& path)> TextureLookup;
+
+	// Kd, d, Ks, Ns and the map_Kd and map_d paths. Values the material doesn't have keep MaterialSource's defaults.
+	MaterialSource Read(const aiMaterial& material);
+	// Looks the textures up, by path relative to the scene, and keeps only what the renderer uses, so
+	// materials that differ in nothing else (ambient, bump maps, names) come out equal.
+	Material Flatten(const MaterialSource& source, const TextureLookup& getDiffuse, const TextureLookup& getMask);
+}
\ No newline at end of file
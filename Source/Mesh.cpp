@@ -10,9 +10,10 @@
 
 #include "Engine.h"
 #include "FileUtils.h"
-#include "D3D11RHI.h"
+#include "Material.h"
+#include "RHI.h"
 
-SharedDeletePtr<Mesh> Mesh::LoadMesh(const aiMesh& aimesh, const aiScene& aiscene, D3D11RHI& rhi)
+SharedDeletePtr<Mesh> Mesh::LoadMesh(const aiMesh& aimesh, const aiScene& aiscene, RHI& rhi)
 {
 	SharedDeletePtr<Mesh> mesh(new Mesh());
 	mesh->numFaces = aimesh.mNumFaces;
@@ -39,6 +40,17 @@ SharedDeletePtr<Mesh> Mesh::LoadMesh(const aiMesh& aimesh, const aiScene& aiscen
 		aimesh.mVertices[i] /= 1000;
 	}
 
+	aiVector3D boundsMin = aimesh.mNumVertices ? aimesh.mVertices[0] : aiVector3D();
+	aiVector3D boundsMax = boundsMin;
+	for (uint32_t i = 1; i < aimesh.mNumVertices; ++i)
+	{
+		const aiVector3D& vertex = aimesh.mVertices[i];
+		boundsMin = aiVector3D(std::min(boundsMin.x, vertex.x), std::min(boundsMin.y, vertex.y), std::min(boundsMin.z, vertex.z));
+		boundsMax = aiVector3D(std::max(boundsMax.x, vertex.x), std::max(boundsMax.y, vertex.y), std::max(boundsMax.z, vertex.z));
+	}
+	aiVector3D center = (boundsMin + boundsMax) * 0.5f;
+	mesh->boundsCenter = glm::vec3(center.x, center.y, center.z);
+
 	assert(aimesh.GetNumUVChannels() == 1);
 	assert(aimesh.mTextureCoords[0]);
 
@@ -56,20 +68,17 @@ SharedDeletePtr<Mesh> Mesh::LoadMesh(const aiMesh& aimesh, const aiScene& aiscen
     assert(aiscene.HasMaterials());
     assert(aimesh.mMaterialIndex == std::clamp<unsigned int>(aimesh.mMaterialIndex, 0, aiscene.mNumMaterials - 1));
     const auto& material = *aiscene.mMaterials[aimesh.mMaterialIndex];
-    auto numDiffuseTexture = material.GetTextureCount(aiTextureType_DIFFUSE);
-    if (numDiffuseTexture)
-    {
-        assert(numDiffuseTexture == 1);
-        aiString texPath;
-        auto airet = material.GetTexture(aiTextureType_DIFFUSE, 0, &texPath, NULL, NULL, NULL, NULL, NULL);
-        assert(airet == aiReturn_SUCCESS);
-        auto absoluteTexturePath = FileUtils::Combine(g_Engine->SceneAssetsBaseDir, texPath.C_Str());
-        mesh->diffuseTexture = g_Engine->textureMap.GetTexture2DFromPath(absoluteTexturePath);
-    }
-    else
-    {
-        mesh->diffuseTexture = rhi.GetDebugTexture2D();
-    }
+    assert(material.GetTextureCount(aiTextureType_DIFFUSE) <= 1);
+    assert(material.GetTextureCount(aiTextureType_OPACITY) <= 1);
+    auto getDiffuse = [](const std::string& path) {
+        return g_Engine->textureMap.GetTexture2DFromPath(FileUtils::Combine(g_Engine->SceneAssetsBaseDir, path));
+    };
+    auto getMask = [](const std::string& path) {
+        return g_Engine->textureMap.GetMaskTextureFromPath(FileUtils::Combine(g_Engine->SceneAssetsBaseDir, path));
+    };
+    mesh->materialIndex = g_Engine->materials.Add(Materials::Flatten(Materials::Read(material), getDiffuse, getMask));
+    bool masked = g_Engine->materials.Get(mesh->materialIndex).maskTexture != InvalidTextureHandle;
+    mesh->alphaMode = masked ? AlphaMode::Masked : AlphaMode::Opaque;
 
 	return mesh;
 }
\ No newline at end of file
@@ -1,24 +1,33 @@
 #pragma once
-#include <d3d11_1.h>
 #include <assimp/scene.h>
 #include <glm/glm.hpp>
 
 #include "UniquePtr.h"
 #include "SharedPtr.h"
 #include "GPUMesh.h"
+#include "RHI.h"
+#include "TextureMap.h"
 
-class D3D11RHI;
+// Render bucket, decided at import. Opaque meshes are all drawn before masked ones so the
+// alpha test doesn't get in the way of early-Z for the bulk of the scene.
+enum class AlphaMode
+{
+	Opaque,
+	Masked,
+};
 
 class Mesh
 {
 public:
-	static SharedDeletePtr<Mesh>				LoadMesh(const aiMesh& aiMesh, const aiScene& aiscene, D3D11RHI& d3dDevice);
+	static SharedDeletePtr<Mesh>				LoadMesh(const aiMesh& aiMesh, const aiScene& aiscene, RHI& rhi);
 
 	glm::mat4									modelMatrix;
+	glm::vec3									boundsCenter;	// Object space, for sorting draws by depth
 
 	GPUMesh										gpuMesh;
-	ID3D11Buffer*								constantBuffer;
-    ID3D11Texture2D*							diffuseTexture;
+	RHIBuffer									constantBuffer;
+	uint32_t									materialIndex;	// Into Engine::materials
+	AlphaMode									alphaMode;		// Masked exactly when the material has a mask texture
 
 	uint32_t									numFaces;
 };
\ No newline at end of file
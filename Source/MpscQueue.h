@@ -0,0 +1,59 @@
+#pragma once
+#include <atomic>
+#include <utility>
+
+// Unbounded lock-free multi-producer, single-consumer queue (Vyukov). Producers never block,
+// so workers can always hand results back even while the consumer isn't pumping.
+template <typename T>
+class MpscQueue
+{
+public:
+	MpscQueue()
+	{
+		Node* stub = new Node();
+		m_Head.store(stub, std::memory_order_relaxed);
+		m_Tail = stub;
+	}
+
+	~MpscQueue()
+	{
+		T discard;
+		while (Pop(discard)) {}
+		delete m_Tail;
+	}
+
+	MpscQueue(const MpscQueue&) = delete;
+	MpscQueue& operator=(const MpscQueue&) = delete;
+
+	// Safe to call from any thread.
+	void Push(T value)
+	{
+		Node* node = new Node();
+		node->value = std::move(value);
+		Node* prev = m_Head.exchange(node, std::memory_order_acq_rel);
+		prev->next.store(node, std::memory_order_release);
+	}
+
+	// Consumer thread only. May briefly miss an item whose Push is still in flight.
+	bool Pop(T& out)
+	{
+		Node* tail = m_Tail;
+		Node* next = tail->next.load(std::memory_order_acquire);
+		if (!next) return false;
+
+		out = std::move(next->value);
+		m_Tail = next;
+		delete tail;
+		return true;
+	}
+
+private:
+	struct Node
+	{
+		std::atomic<Node*> next{ nullptr };
+		T value;
+	};
+
+	std::atomic<Node*>	m_Head;
+	Node*				m_Tail;
+};
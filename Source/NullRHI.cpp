@@ -0,0 +1,415 @@
+#include "NullRHI.h"
+
+#include <cstdarg>
+#include <cstdio>
+#include <cstring>
+
+#include "sdl/SDL.h"
+
+#include "CPUTexture.h"
+#include "Mesh.h"
+#include "ShaderPermutation.h"
+#include "TexturePacker.h"
+#include "TextureUtils.h"
+#include "Window.h"
+
+namespace
+{
+// Only the first few are logged, a broken frame loop would otherwise drown everything else.
+const uint32_t MaxLoggedValidationErrors = 32;
+
+uint32_t CalcMipLevels(uint32_t width, uint32_t height)
+{
+	uint32_t mipLevels = 1;
+	for (uint32_t size = width > height ? width : height; size > 1; size /= 2) ++mipLevels;
+	return mipLevels;
+}
+
+uint32_t CalcNumRows(uint32_t height, CPUTextureFormat format)
+{
+	return format == CPUTextureFormat::BC4 ? (height + 3) / 4 : height;
+}
+}
+
+void NullRHI::ValidationError(const char* format, ...) const
+{
+	if (m_Stats.numValidationErrors++ >= MaxLoggedValidationErrors) return;
+
+	char message[512];
+	va_list args;
+	va_start(args, format);
+	vsnprintf(message, sizeof(message), format, args);
+	va_end(args);
+	SDL_Log("Null RHI validation error: %s", message);
+}
+
+NullRHI::BufferRecord* NullRHI::FindBuffer(RHIBuffer buffer, BufferKind kind, const char* caller)
+{
+	auto index = reinterpret_cast<uintptr_t>(buffer) - 1;
+	if (!buffer || index >= m_Buffers.size())
+	{
+		ValidationError("%s: unknown buffer handle.", caller);
+		return nullptr;
+	}
+	auto& record = m_Buffers[index];
+	if (!record.alive)
+	{
+		ValidationError("%s: buffer has been released.", caller);
+		return nullptr;
+	}
+	if (record.kind != kind)
+	{
+		ValidationError("%s: buffer is bound as the wrong kind.", caller);
+		return nullptr;
+	}
+	return &record;
+}
+
+const NullRHI::TextureRecord* NullRHI::FindTexture(RHITexture texture, const char* caller) const
+{
+	auto index = reinterpret_cast<uintptr_t>(texture) - 1;
+	if (!texture || index >= m_Textures.size())
+	{
+		ValidationError("%s: unknown texture handle.", caller);
+		return nullptr;
+	}
+	if (!m_Textures[index].alive)
+	{
+		ValidationError("%s: texture has been released.", caller);
+		return nullptr;
+	}
+	return &m_Textures[index];
+}
+
+RHIBuffer NullRHI::AddBuffer(BufferKind kind, uint32_t size)
+{
+	BufferRecord record;
+	record.kind = kind;
+	record.size = size;
+	record.alive = true;
+	if (kind == BufferKind::Constant) record.contents.resize(size);
+	m_Buffers.push_back(std::move(record));
+
+	++m_Stats.numBuffers;
+	m_Stats.bufferBytes += size;
+	return reinterpret_cast<RHIBuffer>(static_cast<uintptr_t>(m_Buffers.size()));
+}
+
+RHITexture NullRHI::AddTexture(const TextureRecord& record)
+{
+	m_Textures.push_back(record);
+
+	++m_Stats.numTextures;
+	m_Stats.textureBytes += record.bytes;
+	return reinterpret_cast<RHITexture>(static_cast<uintptr_t>(m_Textures.size()));
+}
+
+void NullRHI::CheckPass(bool allowed, const char* caller)
+{
+	static const char* passNames[] = { "no pass", "the geometry pass", "the masked geometry pass", "the lighting pass" };
+	if (!allowed) ValidationError("%s: not allowed in %s.", caller, passNames[static_cast<int>(m_Pass)]);
+}
+
+bool NullRHI::InitRHI(const Window& window)
+{
+	if (window.width == 0 || window.height == 0)
+	{
+		SDL_Log("Null RHI needs a non-zero back buffer size.");
+		return false;
+	}
+	m_Width = window.width;
+	m_Height = window.height;
+
+	// Same magenta placeholder as the real backends, with its mips left to the "GPU".
+	CPUTexture debugTex;
+	debugTex.width = 2;
+	debugTex.height = 2;
+	for (int i = 0; i < debugTex.width * debugTex.height; ++i)
+	{
+		debugTex.data.push_back(static_cast<char>(255));
+		debugTex.data.push_back(0);
+		debugTex.data.push_back(static_cast<char>(255));
+		debugTex.data.push_back(static_cast<char>(255));
+	}
+	m_DebugTexture = CreateTexture2D(debugTex);
+	return m_DebugTexture != nullptr;
+}
+
+void NullRHI::HandleWindowResize(uint32_t windowWidth, uint32_t windowHeight)
+{
+	if (windowWidth == 0 || windowHeight == 0)
+	{
+		ValidationError("HandleWindowResize: zero sized back buffer.");
+		return;
+	}
+	m_Width = windowWidth;
+	m_Height = windowHeight;
+}
+
+RHIBuffer NullRHI::CreateVertexBuffer(const void* data, uint32_t stride, uint32_t numVertices)
+{
+	if (!data || stride == 0 || numVertices == 0)
+	{
+		ValidationError("CreateVertexBuffer: empty vertex buffer.");
+		return nullptr;
+	}
+	return AddBuffer(BufferKind::Vertex, stride * numVertices);
+}
+
+RHIBuffer NullRHI::CreateIndexBuffer(const std::vector<IndexType>& indices)
+{
+	if (indices.empty())
+	{
+		ValidationError("CreateIndexBuffer: empty index buffer.");
+		return nullptr;
+	}
+	return AddBuffer(BufferKind::Index, static_cast<uint32_t>(indices.size() * sizeof(IndexType)));
+}
+
+RHIBuffer NullRHI::CreateConstantBuffer(int size)
+{
+	// D3D11 requires constant buffers in whole 16 byte registers.
+	if (size <= 0 || size % 16 != 0)
+	{
+		ValidationError("CreateConstantBuffer: size %d is not a positive multiple of 16.", size);
+		return nullptr;
+	}
+	return AddBuffer(BufferKind::Constant, static_cast<uint32_t>(size));
+}
+
+bool NullRHI::UpdateConstantBuffer(RHIBuffer buffer, const void* data, int numBytes)
+{
+	auto record = FindBuffer(buffer, BufferKind::Constant, "UpdateConstantBuffer");
+	if (!record) return false;
+	if (!data || numBytes <= 0 || static_cast<uint32_t>(numBytes) > record->size)
+	{
+		ValidationError("UpdateConstantBuffer: %d bytes into a %u byte buffer.", numBytes, record->size);
+		return false;
+	}
+
+	memcpy(record->contents.data(), data, numBytes);
+	++m_Stats.numConstantUpdates;
+	m_Stats.constantBytes += numBytes;
+	return true;
+}
+
+void NullRHI::UpdateMaterialTable(const std::vector<GPUMaterial>& materials)
+{
+	for (size_t i = 0; i < materials.size(); ++i)
+	{
+		if (materials[i].textures.z > 1)
+		{
+			ValidationError("UpdateMaterialTable: material %zu has diffuse texture flag %u.", i, materials[i].textures.z);
+		}
+	}
+	m_NumMaterials = static_cast<uint32_t>(materials.size());
+}
+
+RHITexture NullRHI::CreateTexture2D(const CPUTexture& cpuTexture)
+{
+	if (cpuTexture.width <= 0 || cpuTexture.height <= 0)
+	{
+		ValidationError("CreateTexture2D: %dx%d texture.", cpuTexture.width, cpuTexture.height);
+		return nullptr;
+	}
+
+	TextureRecord record;
+	record.width = cpuTexture.width;
+	record.height = cpuTexture.height;
+	record.mipLevels = CalcMipLevels(record.width, record.height);
+	record.format = static_cast<uint32_t>(cpuTexture.format);
+	record.arraySize = 1;
+	record.bytes = TextureUtils::CalcTextureBytes(cpuTexture.width, cpuTexture.height, cpuTexture.format);
+	record.alive = true;
+
+	// Same rules as D3D11: CPU mips must be the full chain, and block-compressed textures can't have theirs generated.
+	bool hasCpuMips = !cpuTexture.mips.empty();
+	if (hasCpuMips && cpuTexture.mips.size() + 1 != record.mipLevels)
+	{
+		ValidationError("CreateTexture2D: %u mips given for a %dx%d texture, expected %u.",
+			static_cast<uint32_t>(cpuTexture.mips.size()), cpuTexture.width, cpuTexture.height, record.mipLevels - 1);
+		return nullptr;
+	}
+	if (!hasCpuMips && cpuTexture.format == CPUTextureFormat::BC4)
+	{
+		ValidationError("CreateTexture2D: block-compressed texture without mips.");
+		return nullptr;
+	}
+
+	uint32_t mipWidth = record.width;
+	uint32_t mipHeight = record.height;
+	uint32_t numLevels = hasCpuMips ? record.mipLevels : 1;
+	for (uint32_t mip = 0; mip < numLevels; ++mip)
+	{
+		const auto& level = mip == 0 ? cpuTexture.data : cpuTexture.mips[mip - 1];
+		size_t expected = size_t(TextureUtils::CalcRowPitch(mipWidth, cpuTexture.format)) * CalcNumRows(mipHeight, cpuTexture.format);
+		if (level.size() != expected)
+		{
+			ValidationError("CreateTexture2D: mip %u holds %u bytes, expected %u.", mip, static_cast<uint32_t>(level.size()), static_cast<uint32_t>(expected));
+			return nullptr;
+		}
+		mipWidth = mipWidth > 1 ? mipWidth / 2 : 1;
+		mipHeight = mipHeight > 1 ? mipHeight / 2 : 1;
+	}
+
+	return AddTexture(record);
+}
+
+RHITexture NullRHI::CreateTexture2DArray(const TextureArrayPlan& arrayPlan)
+{
+	if (arrayPlan.slices.empty() || arrayPlan.slices.size() > MaxTextureArraySlices)
+	{
+		ValidationError("CreateTexture2DArray: %u slices.", static_cast<uint32_t>(arrayPlan.slices.size()));
+		return nullptr;
+	}
+
+	for (auto slice : arrayPlan.slices)
+	{
+		auto source = FindTexture(slice, "CreateTexture2DArray");
+		if (!source) return nullptr;
+		if (source->arraySize != 1 || source->width != arrayPlan.width || source->height != arrayPlan.height
+			|| source->mipLevels != arrayPlan.mipLevels || source->format != arrayPlan.format)
+		{
+			ValidationError("CreateTexture2DArray: slice doesn't match the array's size, mips or format.");
+			return nullptr;
+		}
+	}
+
+	TextureRecord record;
+	record.width = arrayPlan.width;
+	record.height = arrayPlan.height;
+	record.mipLevels = arrayPlan.mipLevels;
+	record.format = arrayPlan.format;
+	record.arraySize = static_cast<uint32_t>(arrayPlan.slices.size());
+	record.bytes = record.arraySize * TextureUtils::CalcTextureBytes(record.width, record.height, static_cast<CPUTextureFormat>(record.format));
+	record.alive = true;
+	return AddTexture(record);
+}
+
+void NullRHI::ReleaseTexture2D(RHITexture texture)
+{
+	if (!FindTexture(texture, "ReleaseTexture2D")) return;
+	if (texture == m_DebugTexture)
+	{
+		ValidationError("ReleaseTexture2D: the debug texture is owned by the RHI.");
+		return;
+	}
+
+	auto& record = m_Textures[reinterpret_cast<uintptr_t>(texture) - 1];
+	record.alive = false;
+	--m_Stats.numTextures;
+	m_Stats.textureBytes -= record.bytes;
+}
+
+TexturePackingInput NullRHI::GetTexturePackingInput(RHITexture texture) const
+{
+	TexturePackingInput input = {};
+	input.texture = texture;
+	if (auto record = FindTexture(texture, "GetTexturePackingInput"))
+	{
+		input.width = record->width;
+		input.height = record->height;
+		input.mipLevels = record->mipLevels;
+		input.format = record->format;
+	}
+	return input;
+}
+
+void NullRHI::BeginGeometryPass()
+{
+	CheckPass(m_Pass == Pass::None, "BeginGeometryPass");
+	m_Pass = Pass::Geometry;
+	++m_Stats.numPasses;
+}
+
+void NullRHI::BeginMaskedGeometryPass()
+{
+	CheckPass(m_Pass == Pass::Geometry, "BeginMaskedGeometryPass");
+	m_Pass = Pass::MaskedGeometry;
+}
+
+void NullRHI::SetGeometryShaderFeatures(uint32_t features)
+{
+	bool alphaTest = (features & GeometryShaderFeatures::AlphaTest) != 0;
+	CheckPass(m_Pass == (alphaTest ? Pass::MaskedGeometry : Pass::Geometry), "SetGeometryShaderFeatures");
+	if (!ShaderPermutations::IsValid(GeometryShaderFeatureSet, features))
+	{
+		ValidationError("SetGeometryShaderFeatures: 0x%x combines features that exclude each other.", features);
+	}
+}
+
+void NullRHI::DrawMesh(const Mesh& mesh, RHITexture diffuseTexture, RHITexture maskTexture)
+{
+	bool masked = mesh.alphaMode == AlphaMode::Masked;
+	CheckPass(m_Pass == (masked ? Pass::MaskedGeometry : Pass::Geometry), "DrawMesh");
+
+	FindBuffer(mesh.gpuMesh.positionBuffer, BufferKind::Vertex, "DrawMesh");
+	FindBuffer(mesh.gpuMesh.normalBuffer, BufferKind::Vertex, "DrawMesh");
+	FindBuffer(mesh.gpuMesh.uvBuffer, BufferKind::Vertex, "DrawMesh");
+	auto indexBuffer = FindBuffer(mesh.gpuMesh.indexBuffer, BufferKind::Index, "DrawMesh");
+	if (indexBuffer && indexBuffer->size < mesh.numFaces * 3 * sizeof(IndexType))
+	{
+		ValidationError("DrawMesh: %u faces read past the end of a %u byte index buffer.", mesh.numFaces, indexBuffer->size);
+	}
+	auto constantBuffer = FindBuffer(mesh.constantBuffer, BufferKind::Constant, "DrawMesh");
+	if (constantBuffer && constantBuffer->size < sizeof(GeometryConstantBufferLayout))
+	{
+		ValidationError("DrawMesh: constant buffer is smaller than the geometry layout.");
+	}
+	else if (constantBuffer)
+	{
+		// Draws shade from the material their constants point at, which has to be in the last table sent.
+		GeometryConstantBufferLayout constants;
+		memcpy(&constants, constantBuffer->contents.data(), sizeof(constants));
+		if (constants.textureSlices.z >= m_NumMaterials)
+		{
+			ValidationError("DrawMesh: material %u is past the end of a %u material table.", constants.textureSlices.z, m_NumMaterials);
+		}
+	}
+
+	FindTexture(diffuseTexture, "DrawMesh");
+	if (masked) FindTexture(maskTexture, "DrawMesh");
+
+	++m_Stats.numDraws;
+	m_Stats.numTriangles += mesh.numFaces;
+}
+
+void NullRHI::BeginLightingPass()
+{
+	CheckPass(m_Pass == Pass::Geometry || m_Pass == Pass::MaskedGeometry, "BeginLightingPass");
+	m_Pass = Pass::Lighting;
+	++m_Stats.numPasses;
+}
+
+void NullRHI::DrawAmbient(glm::vec3)
+{
+	CheckPass(m_Pass == Pass::Lighting, "DrawAmbient");
+	++m_Stats.numDraws;
+	m_Stats.numTriangles += 2;
+}
+
+void NullRHI::DrawDirectionalLight(glm::vec3, glm::vec3)
+{
+	CheckPass(m_Pass == Pass::Lighting, "DrawDirectionalLight");
+	++m_Stats.numDraws;
+	m_Stats.numTriangles += 2;
+}
+
+void NullRHI::Present()
+{
+	m_Pass = Pass::None;
+	++m_Stats.numFrames;
+}
+
+void NullRHI::LogStats() const
+{
+	SDL_Log("Null RHI: %llu buffers (%llu KB), %llu live textures (%llu KB), %u validation errors.",
+		static_cast<unsigned long long>(m_Stats.numBuffers), static_cast<unsigned long long>(m_Stats.bufferBytes / 1024),
+		static_cast<unsigned long long>(m_Stats.numTextures), static_cast<unsigned long long>(m_Stats.textureBytes / 1024), m_Stats.numValidationErrors);
+
+	if (m_Stats.numFrames == 0) return;
+	double frames = static_cast<double>(m_Stats.numFrames);
+	SDL_Log("Null RHI: %llu frames at %ux%u. Per frame: %.1f passes, %.1f draws, %.0f triangles, %.1f constant updates (%.1f KB).",
+		static_cast<unsigned long long>(m_Stats.numFrames), m_Width, m_Height, m_Stats.numPasses / frames, m_Stats.numDraws / frames, m_Stats.numTriangles / frames,
+		m_Stats.numConstantUpdates / frames, m_Stats.constantBytes / frames / 1024.0);
+}
\ No newline at end of file
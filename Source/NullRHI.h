@@ -0,0 +1,120 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+
+#include "RHI.h"
+
+struct NullRHIStats
+{
+	uint64_t numBuffers = 0;
+	uint64_t bufferBytes = 0;
+	uint64_t numTextures = 0;
+	uint64_t textureBytes = 0;
+	uint64_t numFrames = 0;
+	uint64_t numPasses = 0;
+	uint64_t numDraws = 0;
+	uint64_t numTriangles = 0;
+	uint64_t numConstantUpdates = 0;
+	uint64_t constantBytes = 0;
+	uint32_t numValidationErrors = 0;
+};
+
+// Backend with no device behind it. It checks every call the way a debug layer would (live handles of the
+// right kind, sizes, formats and pass order) and counts the work it was given, so the engine's CPU side can
+// run and be timed on machines without a GPU. Handles are indices into records that are never reused,
+// so a released handle stays detectably stale.
+class NullRHI : public RHI
+{
+public:
+	const char* GetName() const override { return "null"; }
+	bool IsHeadless() const override { return true; }
+	uint32_t GetWindowFlags() const override { return 0; }
+	bool InitRHI(const Window& window) override;
+	void HandleWindowResize(uint32_t windowWidth, uint32_t windowHeight) override;
+
+	using RHI::CreateVertexBuffer;
+	RHIBuffer CreateVertexBuffer(const void* data, uint32_t stride, uint32_t numVertices) override;
+	RHIBuffer CreateIndexBuffer(const std::vector<IndexType>& indices) override;
+	RHIBuffer CreateConstantBuffer(int size) override;
+	bool UpdateConstantBuffer(RHIBuffer buffer, const void* data, int numBytes) override;
+	void UpdateMaterialTable(const std::vector<GPUMaterial>& materials) override;
+
+	RHITexture CreateTexture2D(const CPUTexture& cpuTexture) override;
+	RHITexture CreateTexture2DArray(const TextureArrayPlan& arrayPlan) override;
+	void ReleaseTexture2D(RHITexture texture) override;
+	TexturePackingInput GetTexturePackingInput(RHITexture texture) const override;
+	uint32_t GetMaxTextureArraySlices() const override { return MaxTextureArraySlices; }
+	RHITexture GetDebugTexture2D() override { return m_DebugTexture; }
+
+	void BeginGeometryPass() override;
+	void BeginMaskedGeometryPass() override;
+	void SetGeometryShaderFeatures(uint32_t features) override;
+	void DrawMesh(const Mesh& mesh, RHITexture diffuseTexture, RHITexture maskTexture) override;
+	void BeginLightingPass() override;
+	void DrawAmbient(glm::vec3 color) override;
+	void DrawDirectionalLight(glm::vec3 color, glm::vec3 angles) override;
+	void Present() override;
+
+	void InitImGui(const Window&) override {}
+	void NewImGuiFrame() override {}
+	void RenderImGui() override {}
+	void ShutdownImGui() override {}
+
+	uint32_t GetNumValidationErrors() const override { return m_Stats.numValidationErrors; }
+	void LogStats() const override;
+	const NullRHIStats& GetStats() const { return m_Stats; }
+
+private:
+	// Matches D3D11, so packing plans come out the same as on the real backend.
+	static const uint32_t MaxTextureArraySlices = 2048;
+
+	enum class BufferKind
+	{
+		Vertex,
+		Index,
+		Constant,
+	};
+
+	enum class Pass
+	{
+		None,
+		Geometry,
+		MaskedGeometry,
+		Lighting,
+	};
+
+	struct BufferRecord
+	{
+		BufferKind kind;
+		uint32_t size;
+		bool alive;
+		std::vector<char> contents;		// Constant buffers only, so updates cost the copy they would on a device.
+	};
+
+	struct TextureRecord
+	{
+		uint32_t width;
+		uint32_t height;
+		uint32_t mipLevels;
+		uint32_t format;
+		uint32_t arraySize;
+		uint64_t bytes;
+		bool alive;
+	};
+
+	void ValidationError(const char* format, ...) const;
+	BufferRecord* FindBuffer(RHIBuffer buffer, BufferKind kind, const char* caller);
+	const TextureRecord* FindTexture(RHITexture texture, const char* caller) const;
+	RHIBuffer AddBuffer(BufferKind kind, uint32_t size);
+	RHITexture AddTexture(const TextureRecord& record);
+	void CheckPass(bool allowed, const char* caller);
+
+	std::vector<BufferRecord>	m_Buffers;
+	std::vector<TextureRecord>	m_Textures;
+	RHITexture					m_DebugTexture = nullptr;
+	uint32_t					m_NumMaterials = 0;
+	Pass						m_Pass = Pass::None;
+	uint32_t					m_Width = 0;
+	uint32_t					m_Height = 0;
+	mutable NullRHIStats		m_Stats;
+};
\ No newline at end of file
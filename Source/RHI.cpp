@@ -0,0 +1,31 @@
+#include "RHI.h"
+
+#include "NullRHI.h"
+#include "SoftwareRHI.h"
+#ifdef _WIN32
+#include "D3D11RHI.h"
+#endif
+#ifdef RHI_GL
+#include "GLRHI.h"
+#endif
+#ifdef RHI_VULKAN
+#include "VulkanRHI.h"
+#endif
+
+std::unique_ptr<RHI> CreateRHI(const std::string& name)
+{
+#ifdef _WIN32
+	if (name == "d3d11") return std::make_unique<D3D11RHI>();
+#endif
+#ifdef RHI_VULKAN
+	if (name == "vulkan") return std::make_unique<VulkanRHI>(false);
+	if (name == "vulkan-headless") return std::make_unique<VulkanRHI>(true);
+#endif
+#ifdef RHI_GL
+	if (name == "gl") return std::make_unique<GLRHI>(false);
+	if (name == "gl-headless") return std::make_unique<GLRHI>(true);
+#endif
+	if (name == "software") return std::make_unique<SoftwareRHI>();
+	if (name == "null") return std::make_unique<NullRHI>();
+	return nullptr;
+}
\ No newline at end of file
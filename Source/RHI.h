@@ -0,0 +1,93 @@
+#pragma once
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "glm/glm.hpp"
+
+class Window;
+struct CPUTexture;
+class Mesh;
+struct TexturePackingInput;
+struct TextureArrayPlan;
+
+// Opaque GPU object handles. Only the backend that created one knows what is behind it, and null is never a live object.
+typedef struct RHIBuffer_T* RHIBuffer;
+typedef struct RHITexture_T* RHITexture;
+
+typedef uint16_t IndexType;
+
+struct GeometryConstantBufferLayout
+{
+	glm::mat4 mvpMatrix;
+	glm::uvec4 textureSlices;	// x: diffuse, y: mask, z: material
+};
+
+// One entry of the material table, read by shaders as three uint4s, the first two holding floats.
+struct GPUMaterial
+{
+	glm::vec4 diffuse;			// Kd, d
+	glm::vec4 specular;			// Ks, Ns
+	glm::uvec4 textures;		// x: diffuse slice, y: mask slice, z: 1 if the material has a diffuse texture
+};
+static_assert(sizeof(GPUMaterial) == 48, "Shaders index the material table in uint4s");
+
+// Everything the engine asks of a graphics API. Backends own every object they hand out a handle for
+// and release them all on destruction. All calls are made from the main thread.
+class RHI
+{
+public:
+	virtual ~RHI() {}
+
+	virtual const char* GetName() const = 0;
+	// Headless backends run without a window, an SDL video subsystem or the UI.
+	virtual bool IsHeadless() const = 0;
+	// SDL_CreateWindow flags the backend needs on the engine's window.
+	virtual uint32_t GetWindowFlags() const = 0;
+
+	virtual bool InitRHI(const Window& window) = 0;
+	virtual void HandleWindowResize(uint32_t windowWidth, uint32_t windowHeight) = 0;
+
+	template <class T>
+	RHIBuffer CreateVertexBuffer(const T* data, uint32_t numVertices) { return CreateVertexBuffer(data, sizeof(T), numVertices); }
+	virtual RHIBuffer CreateVertexBuffer(const void* data, uint32_t stride, uint32_t numVertices) = 0;
+	virtual RHIBuffer CreateIndexBuffer(const std::vector<IndexType>& indices) = 0;
+	virtual RHIBuffer CreateConstantBuffer(int size) = 0;
+	virtual bool UpdateConstantBuffer(RHIBuffer buffer, const void* data, int numBytes) = 0;
+	// Replaces the table the draws' material indices point into. Sent again only when textures move between
+	// slices. Backends that shade from the slices in the draw constants ignore it.
+	virtual void UpdateMaterialTable(const std::vector<GPUMaterial>& materials) = 0;
+
+	virtual RHITexture CreateTexture2D(const CPUTexture& cpuTexture) = 0;
+	virtual RHITexture CreateTexture2DArray(const TextureArrayPlan& arrayPlan) = 0;
+	virtual void ReleaseTexture2D(RHITexture texture) = 0;
+	// The format in the result is backend specific, and only meaningful for comparing and passing back in.
+	virtual TexturePackingInput GetTexturePackingInput(RHITexture texture) const = 0;
+	virtual uint32_t GetMaxTextureArraySlices() const = 0;
+	virtual RHITexture GetDebugTexture2D() = 0;
+
+	virtual void BeginGeometryPass() = 0;
+	virtual void BeginMaskedGeometryPass() = 0;
+	// Picks the geometry shader variant, a GeometryShaderFeatures key, for the draws that follow. Keys with AlphaTest
+	// belong in the masked pass. Backends without shader permutations keep their fixed opaque and masked shaders.
+	virtual void SetGeometryShaderFeatures(uint32_t features) = 0;
+	virtual void DrawMesh(const Mesh& mesh, RHITexture diffuseTexture, RHITexture maskTexture) = 0;
+	virtual void BeginLightingPass() = 0;
+	virtual void DrawAmbient(glm::vec3 color) = 0;
+	virtual void DrawDirectionalLight(glm::vec3 color, glm::vec3 angles) = 0;
+	virtual void Present() = 0;
+
+	// Platform and renderer halves of the ImGui integration. The engine owns the context itself.
+	virtual void InitImGui(const Window& window) = 0;
+	virtual void NewImGuiFrame() = 0;
+	virtual void RenderImGui() = 0;
+	virtual void ShutdownImGui() = 0;
+
+	// Calls the backend rejected. Only backends that validate report any.
+	virtual uint32_t GetNumValidationErrors() const = 0;
+	virtual void LogStats() const = 0;
+};
+
+// Creates the backend registered under the name ("d3d11", "vulkan", "vulkan-headless", "gl", "gl-headless", "software", "null"), or null if this build doesn't have it.
+std::unique_ptr<RHI> CreateRHI(const std::string& name);
\ No newline at end of file
@@ -0,0 +1,120 @@
+#include "RHIStateCache.h"
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "sdl/SDL.h"
+
+namespace
+{
+const char* const StateSlotNames[] = {
+	"render targets",
+	"blend state",
+	"depth stencil state",
+	"rasterizer state",
+	"input layout",
+	"topology",
+	"vertex shader",
+	"pixel shader",
+	"pipeline",
+	"descriptor set",
+	"vertex buffers",
+	"index buffer",
+	"VS constant buffer",
+	"PS constant buffer",
+	"PS sampler",
+	"PS resource 0",
+	"PS resource 1",
+	"VS resource 0",
+};
+static_assert(sizeof(StateSlotNames) / sizeof(StateSlotNames[0]) == static_cast<size_t>(RHIStateSlot::Count), "Every slot needs a name");
+
+// Slots listed after the totals, most filtered first.
+const size_t MaxLoggedSlots = 4;
+}
+
+const char* GetStateSlotName(RHIStateSlot slot)
+{
+	return StateSlotNames[static_cast<size_t>(slot)];
+}
+
+uint64_t RHIStateCounts::GetTotalIssued() const
+{
+	uint64_t total = 0;
+	for (auto count : issued) total += count;
+	return total;
+}
+
+uint64_t RHIStateCounts::GetTotalFiltered() const
+{
+	uint64_t total = 0;
+	for (auto count : filtered) total += count;
+	return total;
+}
+
+RHIStateCounts& RHIStateCounts::operator+=(const RHIStateCounts& other)
+{
+	for (size_t slot = 0; slot < issued.size(); ++slot)
+	{
+		issued[slot] += other.issued[slot];
+		filtered[slot] += other.filtered[slot];
+	}
+	return *this;
+}
+
+void RHIStateCounts::Log(const char* backend, uint64_t numFrames) const
+{
+	if (numFrames == 0) return;
+
+	std::vector<size_t> slots;
+	for (size_t slot = 0; slot < filtered.size(); ++slot)
+	{
+		if (filtered[slot] > 0) slots.push_back(slot);
+	}
+	std::stable_sort(slots.begin(), slots.end(), [&](size_t a, size_t b) { return filtered[a] > filtered[b]; });
+	slots.resize(std::min(slots.size(), MaxLoggedSlots));
+
+	std::string mostFiltered;
+	char entry[64];
+	for (auto slot : slots)
+	{
+		snprintf(entry, sizeof(entry), "%s%s %.1f", mostFiltered.empty() ? "" : ", ", StateSlotNames[slot], filtered[slot] / double(numFrames));
+		mostFiltered += entry;
+	}
+
+	double totalIssued = static_cast<double>(GetTotalIssued());
+	double totalFiltered = static_cast<double>(GetTotalFiltered());
+	double total = totalIssued + totalFiltered;
+	SDL_Log("%s state binds per frame: %.1f issued, %.1f filtered (%.0f%%)%s%s.", backend, totalIssued / numFrames,
+		totalFiltered / numFrames, total > 0.0 ? 100.0 * totalFiltered / total : 0.0, mostFiltered.empty() ? "" : ". Filtered: ",
+		mostFiltered.c_str());
+}
+
+void RHIStateCache::Reset()
+{
+	m_Valid.fill(false);
+}
+
+RHIStateCounts RHIStateCache::TakeCounts()
+{
+	RHIStateCounts counts = m_Counts;
+	m_Counts = RHIStateCounts();
+	return counts;
+}
+
+bool RHIStateCache::SetValues(RHIStateSlot slot, const SlotValues& values)
+{
+	auto index = static_cast<size_t>(slot);
+	auto& shadow = m_Slots[index];
+	if (m_Valid[index] && shadow.count == values.count && std::equal(values.values.begin(), values.values.begin() + values.count, shadow.values.begin()))
+	{
+		++m_Counts.filtered[index];
+		return false;
+	}
+
+	shadow = values;
+	m_Valid[index] = true;
+	++m_Counts.issued[index];
+	return true;
+}
\ No newline at end of file
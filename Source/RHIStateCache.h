@@ -0,0 +1,88 @@
+#pragma once
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <type_traits>
+
+// Bind points the backends route through the state cache. Each shadows the last values issued to it.
+enum class RHIStateSlot : uint32_t
+{
+	RenderTargets,
+	BlendState,
+	DepthStencilState,
+	RasterizerState,
+	InputLayout,
+	Topology,
+	VertexShader,
+	PixelShader,
+	Pipeline,
+	DescriptorSet,
+	VertexBuffers,
+	IndexBuffer,
+	VSConstantBuffer,
+	PSConstantBuffer,
+	PSSampler,
+	PSResource0,
+	PSResource1,
+	VSResource0,
+	Count,
+};
+
+const char* GetStateSlotName(RHIStateSlot slot);
+
+// Binds a cache let through to the driver and binds it dropped, per slot.
+struct RHIStateCounts
+{
+	std::array<uint64_t, static_cast<size_t>(RHIStateSlot::Count)> issued = {};
+	std::array<uint64_t, static_cast<size_t>(RHIStateSlot::Count)> filtered = {};
+
+	uint64_t GetTotalIssued() const;
+	uint64_t GetTotalFiltered() const;
+	RHIStateCounts& operator+=(const RHIStateCounts& other);
+	// One line of per frame totals and the slots that filtered the most, prefixed with the backend name.
+	void Log(const char* backend, uint64_t numFrames) const;
+};
+
+// Shadow copy of the state a backend last bound. Every bind goes through Set and is only issued when it
+// returns true, so binds repeating what is already bound never reach the driver. Values are object
+// identities and plain parameters, which keeps the cache independent of the API behind it. Reset must be
+// called whenever the bound state changes without going through the cache, and for each new command buffer
+// on APIs where state doesn't carry over. Not thread safe, each context or command buffer gets its own.
+class RHIStateCache
+{
+public:
+	static const uint32_t MaxValues = 4;
+
+	// Returns true, and remembers the values, if they differ from what the slot holds.
+	template <class... Args>
+	bool Set(RHIStateSlot slot, const Args&... args)
+	{
+		static_assert(sizeof...(Args) <= MaxValues, "Too many values for one slot");
+		SlotValues values = { { ToValue(args)... }, sizeof...(Args) };
+		return SetValues(slot, values);
+	}
+
+	// Forgets everything, the next bind to every slot is issued.
+	void Reset();
+	// Returns the counts since the last call and clears them.
+	RHIStateCounts TakeCounts();
+
+private:
+	struct SlotValues
+	{
+		std::array<uint64_t, MaxValues> values;
+		uint32_t count;
+	};
+
+	static uint64_t ToValue(std::nullptr_t) { return 0; }
+	template <class T>
+	static typename std::enable_if<std::is_pointer<T>::value, uint64_t>::type ToValue(T value) { return reinterpret_cast<uintptr_t>(value); }
+	template <class T>
+	static typename std::enable_if<!std::is_pointer<T>::value, uint64_t>::type ToValue(T value) { return static_cast<uint64_t>(value); }
+
+	bool SetValues(RHIStateSlot slot, const SlotValues& values);
+
+	std::array<SlotValues, static_cast<size_t>(RHIStateSlot::Count)> m_Slots = {};
+	std::array<bool, static_cast<size_t>(RHIStateSlot::Count)> m_Valid = {};
+	RHIStateCounts m_Counts;
+};
\ No newline at end of file
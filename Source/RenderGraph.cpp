@@ -0,0 +1,164 @@
+#include "RenderGraph.h"
+
+#include <algorithm>
+#include <cassert>
+
+#include "sdl/SDL.h"
+
+void RenderGraph::Reset()
+{
+	m_Textures.clear();
+	m_Passes.clear();
+	m_Physical.clear();
+	m_TransientBytes = 0;
+	m_PhysicalBytes = 0;
+}
+
+RenderGraphTexture RenderGraph::CreateTexture(const char* name, const RenderGraphTextureDesc& desc)
+{
+	assert(desc.width > 0 && desc.height > 0 && desc.bytesPerTexel > 0);
+	m_Textures.push_back({ name, desc, false, { Invalid, Invalid }, Invalid });
+	return static_cast<RenderGraphTexture>(m_Textures.size() - 1);
+}
+
+RenderGraphTexture RenderGraph::ImportTexture(const char* name)
+{
+	m_Textures.push_back({ name, RenderGraphTextureDesc(), true, { Invalid, Invalid }, Invalid });
+	return static_cast<RenderGraphTexture>(m_Textures.size() - 1);
+}
+
+RenderGraphPass RenderGraph::AddPass(const char* name)
+{
+	m_Passes.push_back({ name, {}, {}, Invalid, false });
+	return static_cast<RenderGraphPass>(m_Passes.size() - 1);
+}
+
+void RenderGraph::Read(RenderGraphPass pass, RenderGraphTexture texture)
+{
+	assert(pass < m_Passes.size() && texture < m_Textures.size());
+	m_Passes[pass].reads.push_back(texture);
+}
+
+void RenderGraph::Write(RenderGraphPass pass, RenderGraphTexture texture)
+{
+	assert(pass < m_Passes.size() && texture < m_Textures.size());
+	m_Passes[pass].writes.push_back(texture);
+}
+
+void RenderGraph::WriteDepth(RenderGraphPass pass, RenderGraphTexture texture)
+{
+	assert(pass < m_Passes.size() && texture < m_Textures.size());
+	assert(m_Passes[pass].depthWrite == Invalid);
+	m_Passes[pass].depthWrite = texture;
+}
+
+void RenderGraph::Touch(RenderGraphTexture texture, RenderGraphPass pass)
+{
+	RenderGraphLifetime& lifetime = m_Textures[texture].lifetime;
+	if (lifetime.firstPass == Invalid) lifetime.firstPass = pass;
+	lifetime.lastPass = pass;
+}
+
+bool RenderGraph::Compile()
+{
+	m_Physical.clear();
+	m_TransientBytes = 0;
+	m_PhysicalBytes = 0;
+
+	// Walking back from the end, a pass is needed if it writes an imported texture or one a needed pass
+	// after it reads. Its own reads then become needed in turn.
+	std::vector<bool> needed(m_Textures.size(), false);
+	for (size_t i = m_Passes.size(); i-- > 0;)
+	{
+		Pass& pass = m_Passes[i];
+		auto isNeeded = [&](RenderGraphTexture texture) { return m_Textures[texture].imported || needed[texture]; };
+		pass.culled = std::none_of(pass.writes.begin(), pass.writes.end(), isNeeded) &&
+			(pass.depthWrite == Invalid || !isNeeded(pass.depthWrite));
+		if (pass.culled) continue;
+		for (RenderGraphTexture texture : pass.reads) needed[texture] = true;
+	}
+
+	for (Texture& texture : m_Textures)
+	{
+		texture.lifetime = { Invalid, Invalid };
+		texture.physical = Invalid;
+	}
+	std::vector<bool> written(m_Textures.size(), false);
+	for (RenderGraphPass passIndex = 0; passIndex < m_Passes.size(); ++passIndex)
+	{
+		const Pass& pass = m_Passes[passIndex];
+		if (pass.culled) continue;
+		for (RenderGraphTexture texture : pass.reads)
+		{
+			if (!m_Textures[texture].imported && !written[texture])
+			{
+				SDL_Log("Render graph pass %s reads %s before anything writes it.", pass.name.c_str(), m_Textures[texture].name.c_str());
+				return false;
+			}
+			Touch(texture, passIndex);
+		}
+		for (RenderGraphTexture texture : pass.writes)
+		{
+			written[texture] = true;
+			Touch(texture, passIndex);
+		}
+		if (pass.depthWrite != Invalid)
+		{
+			written[pass.depthWrite] = true;
+			Touch(pass.depthWrite, passIndex);
+		}
+	}
+
+	// In order of first use, each transient takes the first physical texture of its description that is
+	// free by then, or a new one. Lifetimes are inclusive, so a pass never reads and writes the same memory.
+	std::vector<RenderGraphTexture> transients;
+	for (RenderGraphTexture texture = 0; texture < m_Textures.size(); ++texture)
+	{
+		if (!m_Textures[texture].imported && m_Textures[texture].lifetime.firstPass != Invalid) transients.push_back(texture);
+	}
+	std::stable_sort(transients.begin(), transients.end(), [&](RenderGraphTexture a, RenderGraphTexture b) {
+		return m_Textures[a].lifetime.firstPass < m_Textures[b].lifetime.firstPass;
+	});
+	for (RenderGraphTexture textureIndex : transients)
+	{
+		Texture& texture = m_Textures[textureIndex];
+		m_TransientBytes += CalcBytes(texture.desc);
+		for (uint32_t physical = 0; physical < m_Physical.size(); ++physical)
+		{
+			const RenderGraphTextureDesc& desc = m_Physical[physical].desc;
+			if (m_Physical[physical].lastPass < texture.lifetime.firstPass && desc.width == texture.desc.width &&
+				desc.height == texture.desc.height && desc.format == texture.desc.format)
+			{
+				texture.physical = physical;
+				break;
+			}
+		}
+		if (texture.physical == Invalid)
+		{
+			texture.physical = static_cast<uint32_t>(m_Physical.size());
+			m_Physical.push_back({ texture.desc, 0 });
+			m_PhysicalBytes += CalcBytes(texture.desc);
+		}
+		m_Physical[texture.physical].lastPass = texture.lifetime.lastPass;
+	}
+	return true;
+}
+
+void RenderGraph::LogStats(const char* name) const
+{
+	uint32_t numCulled = static_cast<uint32_t>(std::count_if(m_Passes.begin(), m_Passes.end(), [](const Pass& pass) { return pass.culled; }));
+	SDL_Log("%s render graph: %u passes (%u culled), %u textures in %u physical, %.1f MB of transients in %.1f MB (%.1f MB saved by aliasing).",
+		name, GetNumPasses(), numCulled, GetNumTextures(), GetNumPhysicalTextures(), m_TransientBytes / (1024.0 * 1024.0),
+		m_PhysicalBytes / (1024.0 * 1024.0), (m_TransientBytes - m_PhysicalBytes) / (1024.0 * 1024.0));
+	for (const Pass& pass : m_Passes)
+	{
+		std::string targets;
+		for (RenderGraphTexture texture : pass.writes)
+		{
+			const Texture& written = m_Textures[texture];
+			targets += " " + written.name;
+			if (written.physical != Invalid) targets += "@" + std::to_string(written.physical);
+		}
+		SDL_Log("  %-12s%s ->%s", pass.name.c_str(), pass.culled ? " (culled)" : "", targets.c_str());
+	}
+}
\ No newline at end of file
@@ -0,0 +1,110 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Indices into a RenderGraph, valid until it is reset.
+typedef uint32_t RenderGraphTexture;
+typedef uint32_t RenderGraphPass;
+
+struct RenderGraphTextureDesc
+{
+	uint32_t width;
+	uint32_t height;
+	uint32_t format;			// Backend specific, only compared
+	uint32_t bytesPerTexel;
+};
+
+// First and last pass, in declaration order, that touch a texture once culling is done.
+struct RenderGraphLifetime
+{
+	uint32_t firstPass;
+	uint32_t lastPass;
+};
+
+// A frame as passes declaring the textures they read and write, in the order they run. Compiling culls
+// the passes nothing presented depends on, works out when each transient texture is first and last used
+// and packs transients whose lifetimes don't overlap into the same physical texture. Knows nothing about
+// the API: backends create the physical textures and bind each pass's reads and writes from the results.
+class RenderGraph
+{
+public:
+	static const uint32_t Invalid = ~0u;
+
+	void Reset();
+
+	// Transient textures only live within the frame, so the graph may alias them.
+	RenderGraphTexture CreateTexture(const char* name, const RenderGraphTextureDesc& desc);
+	// Imported textures belong to the backend (the back buffer, its depth) and outlive the frame, so they
+	// are never aliased and passes writing them are never culled.
+	RenderGraphTexture ImportTexture(const char* name);
+
+	RenderGraphPass AddPass(const char* name);
+	// Reads are bound to shader resource slots, and writes to render targets, in the order declared.
+	void Read(RenderGraphPass pass, RenderGraphTexture texture);
+	void Write(RenderGraphPass pass, RenderGraphTexture texture);
+	void WriteDepth(RenderGraphPass pass, RenderGraphTexture texture);
+
+	// Returns false, and logs, if a pass that survives culling reads a transient texture before anything wrote it.
+	bool Compile();
+
+	const char* GetPassName(RenderGraphPass pass) const { return m_Passes[pass].name.c_str(); }
+	const std::vector<RenderGraphTexture>& GetReads(RenderGraphPass pass) const { return m_Passes[pass].reads; }
+	const std::vector<RenderGraphTexture>& GetWrites(RenderGraphPass pass) const { return m_Passes[pass].writes; }
+	// Invalid if the pass writes no depth.
+	RenderGraphTexture GetDepthWrite(RenderGraphPass pass) const { return m_Passes[pass].depthWrite; }
+	bool IsCulled(RenderGraphPass pass) const { return m_Passes[pass].culled; }
+
+	bool IsImported(RenderGraphTexture texture) const { return m_Textures[texture].imported; }
+	const RenderGraphTextureDesc& GetDesc(RenderGraphTexture texture) const { return m_Textures[texture].desc; }
+	// Invalid passes for textures no surviving pass touches.
+	RenderGraphLifetime GetLifetime(RenderGraphTexture texture) const { return m_Textures[texture].lifetime; }
+	// Index of the physical texture a transient lives in, Invalid for imported and unused textures.
+	uint32_t GetPhysicalTexture(RenderGraphTexture texture) const { return m_Textures[texture].physical; }
+	uint32_t GetNumPhysicalTextures() const { return static_cast<uint32_t>(m_Physical.size()); }
+	const RenderGraphTextureDesc& GetPhysicalDesc(uint32_t physical) const { return m_Physical[physical].desc; }
+
+	uint32_t GetNumPasses() const { return static_cast<uint32_t>(m_Passes.size()); }
+	uint32_t GetNumTextures() const { return static_cast<uint32_t>(m_Textures.size()); }
+	// Bytes the used transients would take each in their own texture, and after aliasing.
+	uint64_t GetTransientBytes() const { return m_TransientBytes; }
+	uint64_t GetPhysicalBytes() const { return m_PhysicalBytes; }
+
+	// One line of totals and one per pass, prefixed with the name.
+	void LogStats(const char* name) const;
+
+	static uint64_t CalcBytes(const RenderGraphTextureDesc& desc) { return uint64_t(desc.width) * desc.height * desc.bytesPerTexel; }
+
+private:
+	struct Texture
+	{
+		std::string name;
+		RenderGraphTextureDesc desc;
+		bool imported;
+		RenderGraphLifetime lifetime;
+		uint32_t physical;
+	};
+
+	struct Pass
+	{
+		std::string name;
+		std::vector<RenderGraphTexture> reads;
+		std::vector<RenderGraphTexture> writes;
+		RenderGraphTexture depthWrite;
+		bool culled;
+	};
+
+	struct Physical
+	{
+		RenderGraphTextureDesc desc;
+		uint32_t lastPass;
+	};
+
+	void Touch(RenderGraphTexture texture, RenderGraphPass pass);
+
+	std::vector<Texture>	m_Textures;
+	std::vector<Pass>		m_Passes;
+	std::vector<Physical>	m_Physical;
+	uint64_t				m_TransientBytes = 0;
+	uint64_t				m_PhysicalBytes = 0;
+};
\ No newline at end of file
@@ -0,0 +1,102 @@
+#pragma once
+#include <cassert>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "Hash.h"
+
+// Render targets that are no longer needed, kept by the descriptor they were created from so the next
+// request for the same size and format reuses one instead of creating it. Targets left unused for long
+// enough are handed back by Trim to be destroyed. Descriptors are hashed and compared as raw bytes, so
+// callers must zero them before filling them in. Knows nothing about the API behind the targets.
+template <class Desc, class Target>
+class RenderTargetPool
+{
+	static_assert(std::is_trivially_copyable<Desc>::value, "Descriptors are hashed and compared as bytes");
+
+public:
+	// Moves a free target matching desc into target, or calls create as bool(const Desc&, Target&) if there
+	// is none. Returns false if creation failed.
+	template <class Create>
+	bool Acquire(const Desc& desc, Target& target, Create create)
+	{
+		++m_NumAcquires;
+		auto iter = m_FreeTargets.find(Hash::HashPod(desc));
+		if (iter != m_FreeTargets.end() && !iter->second.empty())
+		{
+			Entry& entry = iter->second.back();
+			// A different descriptor sharing the 64-bit hash would get the wrong target back.
+			assert(memcmp(&entry.desc, &desc, sizeof(Desc)) == 0);
+			target = std::move(entry.target);
+			iter->second.pop_back();
+			--m_NumFree;
+			++m_NumReuses;
+			return true;
+		}
+		return create(desc, target);
+	}
+
+	// Keeps target for reuse. frame is the last frame it was used in.
+	void Release(const Desc& desc, Target target, uint64_t frame)
+	{
+		Entry entry;
+		memcpy(&entry.desc, &desc, sizeof(Desc));
+		entry.target = std::move(target);
+		entry.lastUsedFrame = frame;
+		m_FreeTargets[Hash::HashPod(desc)].push_back(std::move(entry));
+		++m_NumFree;
+	}
+
+	// Calls retire as void(Target&) on every free target unused since more than maxIdleFrames before frame,
+	// and forgets them. Returns how many went.
+	template <class Retire>
+	uint32_t Trim(uint64_t frame, uint64_t maxIdleFrames, Retire retire)
+	{
+		uint32_t numTrimmed = 0;
+		for (auto iter = m_FreeTargets.begin(); iter != m_FreeTargets.end();)
+		{
+			auto& entries = iter->second;
+			for (size_t i = 0; i < entries.size();)
+			{
+				if (entries[i].lastUsedFrame + maxIdleFrames < frame)
+				{
+					retire(entries[i].target);
+					entries[i] = std::move(entries.back());
+					entries.pop_back();
+					++numTrimmed;
+				}
+				else
+				{
+					++i;
+				}
+			}
+			iter = entries.empty() ? m_FreeTargets.erase(iter) : std::next(iter);
+		}
+		m_NumFree -= numTrimmed;
+		m_NumTrimmed += numTrimmed;
+		return numTrimmed;
+	}
+
+	uint32_t GetNumAcquires() const { return m_NumAcquires; }
+	uint32_t GetNumReuses() const { return m_NumReuses; }
+	uint32_t GetNumTrimmed() const { return m_NumTrimmed; }
+	uint32_t GetNumFree() const { return m_NumFree; }
+
+private:
+	struct Entry
+	{
+		Desc desc;
+		Target target;
+		uint64_t lastUsedFrame;
+	};
+
+	std::unordered_map<uint64_t, std::vector<Entry>> m_FreeTargets;
+	uint32_t m_NumAcquires = 0;
+	uint32_t m_NumReuses = 0;
+	uint32_t m_NumTrimmed = 0;
+	uint32_t m_NumFree = 0;
+};
\ No newline at end of file
@@ -0,0 +1,273 @@
+#include "ShaderCache.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+#include <set>
+
+#include "sdl/SDL.h"
+#include "FileUtils.h"
+#include "Hash.h"
+#include "ThreadPool.h"
+
+namespace fs = std::filesystem;
+
+namespace
+{
+const uint32_t EntryMagic = 0x43444853;		// "SHDC"
+// Bump when the entry layout or what goes into a key changes.
+const uint32_t EntryVersion = 1;
+
+struct EntryHeader
+{
+	uint32_t magic;
+	uint32_t version;
+	uint64_t key;
+	uint64_t size;
+	uint64_t bytecodeHash;
+};
+
+bool ReadSource(const std::string& absPath, std::vector<char>& source)
+{
+	// Checked first, as mapping logs every file it can't open.
+	std::error_code error;
+	if (!fs::is_regular_file(absPath, error)) return false;
+	auto view = FileUtils::MapFileAbsolute(absPath);
+	if (!view.IsValid()) return false;
+	source.assign(view.begin(), view.end());
+	return true;
+}
+
+// Names in the #include "name" lines of source. Lines that are commented out or compiled out are still
+// listed, which at worst makes a key depend on a file the shader doesn't.
+std::vector<std::string> FindIncludes(const std::vector<char>& source)
+{
+	std::vector<std::string> includes;
+	const char directive[] = "#include";
+	auto it = source.begin();
+	while ((it = std::search(it, source.end(), directive, directive + sizeof(directive) - 1)) != source.end())
+	{
+		it += sizeof(directive) - 1;
+		while (it != source.end() && (*it == ' ' || *it == '\t')) ++it;
+		if (it == source.end() || *it != '"') continue;
+		auto nameEnd = std::find(it + 1, source.end(), '"');
+		if (nameEnd == source.end()) break;
+		includes.emplace_back(it + 1, nameEnd);
+		it = nameEnd;
+	}
+	return includes;
+}
+
+uint64_t HashString(const std::string& text, uint64_t seed)
+{
+	return Hash::Combine(seed, Hash::HashBytes(text.data(), text.size()));
+}
+
+std::string RequestName(const ShaderCompileRequest& request)
+{
+	std::string name = request.path + "|" + request.entryPoint + "|" + request.target;
+	for (const auto& define : request.defines) name += "|" + define.first + "=" + define.second;
+	return name;
+}
+}
+
+ShaderCache::ShaderCache(const std::string& cacheDir, const ShaderCompiler& compiler, ThreadPool* pool)
+	: m_CacheDir(cacheDir)
+	, m_Compiler(compiler)
+	, m_Pool(pool)
+{
+	if (!m_CacheDir.empty())
+	{
+		std::error_code error;
+		fs::create_directories(m_CacheDir, error);
+		if (error)
+		{
+			SDL_Log("Unable to create shader cache \"%s\", shaders will be compiled every run.", m_CacheDir.c_str());
+			m_CacheDir.clear();
+		}
+	}
+}
+
+ShaderCache::~ShaderCache()
+{
+	// Jobs still on the pool point at this cache.
+	for (auto& request : m_Requests) request.second.wait();
+}
+
+ShaderFuture ShaderCache::Request(const ShaderCompileRequest& request)
+{
+	auto name = RequestName(request);
+	auto found = m_Requests.find(name);
+	if (found != m_Requests.end()) return found->second;
+
+	{
+		std::lock_guard<std::mutex> lock(m_StatsMutex);
+		++m_Stats.numRequests;
+	}
+
+	ShaderFuture future;
+	if (m_Pool)
+	{
+		future = m_Pool->Submit([this, request]() { return Build(request); }).share();
+	}
+	else
+	{
+		std::promise<ShaderBinaryPtr> built;
+		built.set_value(Build(request));
+		future = built.get_future().share();
+	}
+	m_Requests.emplace(name, future);
+	return future;
+}
+
+ShaderCacheStats ShaderCache::GetStats() const
+{
+	std::lock_guard<std::mutex> lock(m_StatsMutex);
+	return m_Stats;
+}
+
+void ShaderCache::LogStats(const char* name) const
+{
+	auto stats = GetStats();
+	SDL_Log("%s shader cache: %u stages, %u from cache, %u compiled (%u failed) in %.1f ms of compile time%s.",
+		name, stats.numRequests, stats.numHits, stats.numMisses, stats.numFailures, stats.compileMs, m_CacheDir.empty() ? ", not kept on disk" : "");
+}
+
+bool ShaderCache::CalcKey(const ShaderCompileRequest& request, std::vector<char>& source, uint64_t& key, std::string& errors) const
+{
+	if (!ReadSource(request.path, source))
+	{
+		errors = "Unable to read \"" + request.path + "\".";
+		return false;
+	}
+
+	key = HashString(m_Compiler.version, EntryVersion);
+	key = HashString(request.entryPoint, key);
+	key = HashString(request.target, key);
+	auto defines = request.defines;
+	std::sort(defines.begin(), defines.end());
+	for (const auto& define : defines)
+	{
+		key = HashString(define.first, key);
+		key = HashString(define.second, key);
+	}
+	key = Hash::Combine(key, Hash::HashBytes(source.data(), source.size()));
+
+	// Every file reachable through includes, each once, by the path it resolved to. A missing include
+	// still changes the key, so it compiles and reports the error rather than hitting an older entry.
+	std::set<std::string> visited;
+	std::vector<std::pair<std::string, std::vector<std::string>>> pending;
+	pending.emplace_back(FileUtils::GetParentDirectory(request.path), FindIncludes(source));
+	while (!pending.empty())
+	{
+		auto directory = std::move(pending.back().first);
+		auto includes = std::move(pending.back().second);
+		pending.pop_back();
+		for (const auto& include : includes)
+		{
+			auto includePath = FileUtils::Combine(directory, include);
+			std::error_code error;
+			auto canonicalPath = fs::canonical(includePath, error);
+			if (!error) includePath = canonicalPath.string();
+			if (!visited.insert(includePath).second) continue;
+
+			std::vector<char> includeSource;
+			bool found = ReadSource(includePath, includeSource);
+			key = HashString(include, key);
+			key = Hash::Combine(key, found ? Hash::HashBytes(includeSource.data(), includeSource.size()) : 0);
+			if (found) pending.emplace_back(FileUtils::GetParentDirectory(includePath), FindIncludes(includeSource));
+		}
+	}
+	return true;
+}
+
+std::string ShaderCache::GetEntryPath(uint64_t key) const
+{
+	char name[32];
+	snprintf(name, sizeof(name), "%016llx.shader", static_cast<unsigned long long>(key));
+	return FileUtils::Combine(m_CacheDir, name);
+}
+
+ShaderBinaryPtr ShaderCache::Build(const ShaderCompileRequest& request)
+{
+	auto binary = std::make_shared<ShaderBinary>();
+	std::vector<char> source;
+	uint64_t key = 0;
+	if (!CalcKey(request, source, key, binary->errors))
+	{
+		SDL_Log("%s", binary->errors.c_str());
+		std::lock_guard<std::mutex> lock(m_StatsMutex);
+		++m_Stats.numFailures;
+		return binary;
+	}
+
+	if (ReadEntry(key, binary->bytecode))
+	{
+		binary->fromCache = true;
+		std::lock_guard<std::mutex> lock(m_StatsMutex);
+		++m_Stats.numHits;
+		return binary;
+	}
+
+	auto start = std::chrono::steady_clock::now();
+	bool compiled = m_Compiler.compile(request, source, binary->bytecode, binary->errors);
+	double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+	if (compiled && !binary->bytecode.empty())
+	{
+		WriteEntry(key, binary->bytecode);
+	}
+	else
+	{
+		// Failures aren't kept, so fixing the source (or whatever the compiler couldn't find) retries.
+		binary->bytecode.clear();
+		SDL_Log("Unable to compile %s (%s, %s):\n%s", request.path.c_str(), request.entryPoint.c_str(), request.target.c_str(), binary->errors.c_str());
+	}
+
+	std::lock_guard<std::mutex> lock(m_StatsMutex);
+	++m_Stats.numMisses;
+	m_Stats.numFailures += binary->bytecode.empty() ? 1 : 0;
+	m_Stats.compileMs += ms;
+	return binary;
+}
+
+bool ShaderCache::ReadEntry(uint64_t key, std::vector<char>& bytecode) const
+{
+	if (m_CacheDir.empty()) return false;
+
+	std::vector<char> entry;
+	if (!ReadSource(GetEntryPath(key), entry)) return false;
+
+	// Anything that doesn't check out, from a different version or cut short by a crash, is a miss and gets
+	// written over.
+	EntryHeader header;
+	if (entry.size() < sizeof(header)) return false;
+	memcpy(&header, entry.data(), sizeof(header));
+	if (header.magic != EntryMagic || header.version != EntryVersion || header.key != key || header.size != entry.size() - sizeof(header)) return false;
+	if (Hash::HashBytes(entry.data() + sizeof(header), header.size) != header.bytecodeHash) return false;
+
+	bytecode.assign(entry.begin() + sizeof(header), entry.end());
+	return true;
+}
+
+void ShaderCache::WriteEntry(uint64_t key, const std::vector<char>& bytecode) const
+{
+	if (m_CacheDir.empty()) return;
+
+	EntryHeader header = { EntryMagic, EntryVersion, key, bytecode.size(), Hash::HashBytes(bytecode.data(), bytecode.size()) };
+	auto path = GetEntryPath(key);
+	auto tempPath = path + ".tmp";
+
+	// Written aside and renamed into place, so another run never reads half an entry.
+	SDL_RWops* file = SDL_RWFromFile(tempPath.c_str(), "wb");
+	bool ok = file && SDL_RWwrite(file, &header, sizeof(header), 1) == 1 && SDL_RWwrite(file, bytecode.data(), bytecode.size(), 1) == 1;
+	if (file) SDL_RWclose(file);
+
+	std::error_code error;
+	if (ok) fs::rename(tempPath, path, error);
+	if (!ok || error)
+	{
+		SDL_Log("Unable to write \"%s\".", path.c_str());
+		fs::remove(tempPath, error);
+	}
+}
\ No newline at end of file
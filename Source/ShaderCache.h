@@ -0,0 +1,87 @@
+#pragma once
+#include <cstdint>
+#include <functional>
+#include <future>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+class ThreadPool;
+
+// One shader stage to build: the source file, its entry point, profile and macros.
+struct ShaderCompileRequest
+{
+	std::string path;			// Absolute. Includes are found relative to the file including them.
+	std::string entryPoint;
+	std::string target;			// Profile, such as vs_4_0
+	std::vector<std::pair<std::string, std::string>> defines;
+};
+
+// What a request built to. Empty bytecode means it failed, and errors say why.
+struct ShaderBinary
+{
+	std::vector<char> bytecode;
+	std::string errors;
+	bool fromCache = false;
+};
+typedef std::shared_ptr<const ShaderBinary> ShaderBinaryPtr;
+typedef std::shared_future<ShaderBinaryPtr> ShaderFuture;
+
+// Turns source into bytecode, on the pool's threads, so compile must be thread safe. version is part of every
+// key, so changing it, say along with the compile flags, misses every entry written before.
+struct ShaderCompiler
+{
+	std::string version;
+	std::function<bool(const ShaderCompileRequest& request, const std::vector<char>& source, std::vector<char>& bytecode, std::string& errors)> compile;
+};
+
+struct ShaderCacheStats
+{
+	uint32_t numRequests = 0;		// Unique stages asked for
+	uint32_t numHits = 0;
+	uint32_t numMisses = 0;
+	uint32_t numFailures = 0;		// Misses that didn't compile, or whose source couldn't be read
+	double compileMs = 0.0;			// Summed over the threads that compiled
+};
+
+// Compiled shaders kept on disk, a file per key. Keys hash the source, everything it includes, the defines,
+// entry point, target and compiler version, so any change to them misses. Lookups, and compiles on a miss, run
+// on the thread pool, and a caller only waits when it needs a stage's bytecode. Knows nothing about the API:
+// the backend supplies the compiler and creates its shader objects from the bytecode.
+class ShaderCache
+{
+public:
+	// An empty cacheDir keeps nothing on disk. Without a pool, requests are built on the calling thread.
+	ShaderCache(const std::string& cacheDir, const ShaderCompiler& compiler, ThreadPool* pool);
+	// Waits for requests still building.
+	~ShaderCache();
+
+	// Returns at once. Requests for the same stage share one result. Failures log their errors.
+	ShaderFuture Request(const ShaderCompileRequest& request);
+
+	ShaderCacheStats GetStats() const;
+	// One line of totals, prefixed with the name.
+	void LogStats(const char* name) const;
+
+	// Hashes the request and the current contents of its source and includes, which it returns the source of.
+	// False, with errors set, if a file can't be read.
+	bool CalcKey(const ShaderCompileRequest& request, std::vector<char>& source, uint64_t& key, std::string& errors) const;
+	std::string GetEntryPath(uint64_t key) const;
+
+private:
+	ShaderBinaryPtr Build(const ShaderCompileRequest& request);
+	bool ReadEntry(uint64_t key, std::vector<char>& bytecode) const;
+	void WriteEntry(uint64_t key, const std::vector<char>& bytecode) const;
+
+	std::string							m_CacheDir;
+	ShaderCompiler						m_Compiler;
+	ThreadPool*							m_Pool;
+	// By request, only touched on the thread making requests.
+	std::map<std::string, ShaderFuture>	m_Requests;
+
+	mutable std::mutex					m_StatsMutex;
+	ShaderCacheStats					m_Stats;
+};
\ No newline at end of file
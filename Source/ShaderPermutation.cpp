@@ -0,0 +1,58 @@
+#include "ShaderPermutation.h"
+
+namespace
+{
+const ShaderFeature GeometryFeatures[] = {
+	{ "ALPHA_TEST", "alpha test", 0 },
+	{ "VIEW_NORMALS", "normals", 1 },
+	{ "VIEW_UV", "uv", 1 },
+	{ "VIEW_DEPTH", "depth", 1 },
+};
+static_assert(sizeof(GeometryFeatures) / sizeof(GeometryFeatures[0]) == GeometryShaderFeatures::NumBits, "Every geometry feature bit needs a define");
+}
+
+const ShaderFeatureSet GeometryShaderFeatureSet = { GeometryFeatures, GeometryShaderFeatures::NumBits };
+
+bool ShaderPermutations::IsValid(const ShaderFeatureSet& featureSet, uint32_t key)
+{
+	if (key >> featureSet.numFeatures) return false;
+
+	uint32_t groupsUsed = 0;
+	for (uint32_t feature = 0; feature < featureSet.numFeatures; ++feature)
+	{
+		uint32_t group = featureSet.features[feature].exclusiveGroup;
+		if (!(key & (1u << feature)) || group == 0) continue;
+		if (groupsUsed & (1u << group)) return false;
+		groupsUsed |= 1u << group;
+	}
+	return true;
+}
+
+uint32_t ShaderPermutations::CountValid(const ShaderFeatureSet& featureSet)
+{
+	uint32_t numValid = 0;
+	for (uint32_t key = 0; key < (1u << featureSet.numFeatures); ++key) numValid += IsValid(featureSet, key) ? 1 : 0;
+	return numValid;
+}
+
+std::vector<std::pair<std::string, std::string>> ShaderPermutations::GetDefines(const ShaderFeatureSet& featureSet, uint32_t key)
+{
+	std::vector<std::pair<std::string, std::string>> defines;
+	for (uint32_t feature = 0; feature < featureSet.numFeatures; ++feature)
+	{
+		defines.emplace_back(featureSet.features[feature].define, key & (1u << feature) ? "1" : "0");
+	}
+	return defines;
+}
+
+std::string ShaderPermutations::GetName(const ShaderFeatureSet& featureSet, uint32_t key)
+{
+	std::string name;
+	for (uint32_t feature = 0; feature < featureSet.numFeatures; ++feature)
+	{
+		if (!(key & (1u << feature))) continue;
+		if (!name.empty()) name += "+";
+		name += featureSet.features[feature].name;
+	}
+	return name.empty() ? "base" : name;
+}
\ No newline at end of file
@@ -0,0 +1,44 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+// A compile time feature of a shader. Each is one bit of a variant's key and a define its source tests with
+// #if, always defined, to 0 or 1, so a variant pays nothing for the features it doesn't have.
+struct ShaderFeature
+{
+	const char* define;
+	const char* name;			// For logs
+	uint32_t exclusiveGroup;	// Features sharing a non-zero group can't be combined
+};
+
+struct ShaderFeatureSet
+{
+	const ShaderFeature* features;
+	uint32_t numFeatures;
+};
+
+// Bits of the geometry pass's variant keys, in GeometryShaderFeatureSet order. The debug views replace the
+// color output, so only one can be on at a time.
+namespace GeometryShaderFeatures
+{
+	const uint32_t AlphaTest = 1 << 0;		// Clips by the mask texture, for the masked bucket
+	const uint32_t ViewNormals = 1 << 1;
+	const uint32_t ViewUV = 1 << 2;
+	const uint32_t ViewDepth = 1 << 3;
+	const uint32_t NumBits = 4;
+}
+
+extern const ShaderFeatureSet GeometryShaderFeatureSet;
+
+namespace ShaderPermutations
+{
+	// False for keys with bits past the set's features, or with two features of one group.
+	bool IsValid(const ShaderFeatureSet& featureSet, uint32_t key);
+	// Keys IsValid accepts, which is how many variants a shader could ever need compiling.
+	uint32_t CountValid(const ShaderFeatureSet& featureSet);
+	std::vector<std::pair<std::string, std::string>> GetDefines(const ShaderFeatureSet& featureSet, uint32_t key);
+	// The names of the features on, joined with '+', or "base" for none.
+	std::string GetName(const ShaderFeatureSet& featureSet, uint32_t key);
+}
\ No newline at end of file
@@ -0,0 +1,17 @@
+#version 450
+
+layout(std140, binding = 0) uniform AmbientConstants
+{
+	vec4 ambientColor;
+};
+
+layout(binding = 1) uniform sampler2D diffuseTexture;
+
+layout(location = 0) in vec2 inUV;
+
+layout(location = 0) out vec4 outColor;
+
+void main()
+{
+	outColor = texture(diffuseTexture, inUV) * ambientColor;
+}
\ No newline at end of file
@@ -0,0 +1,22 @@
+#version 450
+
+layout(std140, binding = 0) uniform DirectionalConstants
+{
+	vec4 lightColor;
+	vec4 lightDirection;
+};
+
+layout(binding = 1) uniform sampler2D diffuseTexture;
+layout(binding = 2) uniform sampler2D normalTexture;
+
+layout(location = 0) in vec2 inUV;
+
+layout(location = 0) out vec4 outColor;
+
+void main()
+{
+	vec3 diffuse = texture(diffuseTexture, inUV).rgb;
+	vec3 normal = texture(normalTexture, inUV).xyz;
+	float nDotL = clamp(dot(normal, -lightDirection.xyz), 0.0, 1.0);
+	outColor = vec4(diffuse * lightColor.rgb * nDotL, 1.0);
+}
\ No newline at end of file
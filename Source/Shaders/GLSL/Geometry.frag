@@ -0,0 +1,15 @@
+#version 450
+
+layout(binding = 1) uniform sampler2DArray diffuseTexture;
+
+layout(location = 0) in vec4 inNormal;
+layout(location = 1) in vec4 inUV;
+
+layout(location = 0) out vec4 outColor;
+layout(location = 1) out vec4 outNormal;
+
+void main()
+{
+	outColor = texture(diffuseTexture, inUV.xyz);
+	outNormal = vec4(normalize(inNormal.xyz), 1.0);
+}
\ No newline at end of file
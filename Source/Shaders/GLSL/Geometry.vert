@@ -0,0 +1,24 @@
+#version 450
+
+layout(std140, binding = 0) uniform GeometryConstants
+{
+	mat4 mvpMatrix;
+	uvec4 textureSlices;	// x: diffuse, y: mask
+};
+
+layout(location = 0) in vec4 inPosition;
+layout(location = 1) in vec4 inNormal;
+layout(location = 2) in vec4 inUV;
+
+layout(location = 0) out vec4 outNormal;
+layout(location = 1) out vec4 outUV;
+
+void main()
+{
+	gl_Position = mvpMatrix * inPosition;
+	outNormal = inNormal;
+	outUV = inUV;
+	outUV.y = 1.0 - outUV.y;
+	outUV.z = textureSlices.x;
+	outUV.w = textureSlices.y;
+}
\ No newline at end of file
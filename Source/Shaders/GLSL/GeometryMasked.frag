@@ -0,0 +1,19 @@
+#version 450
+
+layout(binding = 1) uniform sampler2DArray diffuseTexture;
+layout(binding = 2) uniform sampler2DArray maskTexture;
+
+layout(location = 0) in vec4 inNormal;
+layout(location = 1) in vec4 inUV;
+
+layout(location = 0) out vec4 outColor;
+layout(location = 1) out vec4 outNormal;
+
+void main()
+{
+	// BC4 coverage mask, slice in UV.w
+	if (texture(maskTexture, inUV.xyw).r < 0.5) discard;
+
+	outColor = texture(diffuseTexture, inUV.xyz);
+	outNormal = vec4(normalize(inNormal.xyz), 1.0);
+}
\ No newline at end of file
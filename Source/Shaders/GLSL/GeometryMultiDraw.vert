@@ -0,0 +1,45 @@
+#version 450
+
+// Geometry.vert for multi-draw indirect: a batch shares one set of bindings, so each draw's constants and vertex
+// streams are looked up by its index rather than bound. The index arrives as an instanced attribute (one instance,
+// the command's baseInstance picks the element), which needs nothing past GL 4.2.
+
+struct DrawConstants
+{
+	mat4 mvpMatrix;
+	uvec4 textureSlices;	// x: diffuse, y: mask
+	uvec4 streamOffsets;	// x: position, y: normal, z: uv, in floats into vertexData
+	uvec4 streamStrides;	// Same order, in floats
+};
+
+layout(std430, binding = 0) readonly buffer VertexData
+{
+	float vertexData[];
+};
+
+layout(std430, binding = 1) readonly buffer Draws
+{
+	DrawConstants draws[];
+};
+
+layout(location = 3) in uint inDrawIndex;
+
+layout(location = 0) out vec4 outNormal;
+layout(location = 1) out vec4 outUV;
+
+vec4 FetchStream(uint offset, uint stride)
+{
+	uint first = offset + uint(gl_VertexID) * stride;
+	return vec4(vertexData[first], vertexData[first + 1], vertexData[first + 2], 1.0);
+}
+
+void main()
+{
+	DrawConstants draw = draws[inDrawIndex];
+	gl_Position = draw.mvpMatrix * FetchStream(draw.streamOffsets.x, draw.streamStrides.x);
+	outNormal = FetchStream(draw.streamOffsets.y, draw.streamStrides.y);
+	outUV = FetchStream(draw.streamOffsets.z, draw.streamStrides.z);
+	outUV.y = 1.0 - outUV.y;
+	outUV.z = draw.textureSlices.x;
+	outUV.w = draw.textureSlices.y;
+}
\ No newline at end of file
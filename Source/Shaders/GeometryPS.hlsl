@@ -1,8 +1,11 @@
+// Compiled per variant, with every feature in ShaderPermutation.h defined to 0 or 1.
 struct PSIn
 {
 	float4 Position	: SV_POSITION;
 	float4 Normal	: NORMAL;
 	float4 UV		: TEXCOORD0;
+	nointerpolation float4 Diffuse : COLOR0;
+	nointerpolation uint HasDiffuseTexture : TEXCOORD1;
 };
 
 struct PSOut
@@ -11,38 +14,33 @@ struct PSOut
 	float4 Normal: SV_Target1;
 };
 
-Texture2D diffuseTex;
+Texture2DArray diffuseTex : register(t0);
+#if ALPHA_TEST
+Texture2DArray maskTex : register(t1);
+#endif
 SamplerState diffuseSampler;
 
 PSOut main(PSIn input)
 {
 	PSOut output;
 
-	output.Color = diffuseTex.Sample(diffuseSampler, input.UV.xy);
-	//output.Normal = float4(normalize(input.Normal.xyz) * 0.5 + 0.5, 1);
+#if ALPHA_TEST
+	// BC4 coverage mask, slice in UV.w
+	clip(maskTex.Sample(diffuseSampler, input.UV.xyw).r - 0.5);
+#endif
+
+#if VIEW_NORMALS
+	output.Color = float4(normalize(input.Normal.xyz) * 0.5 + 0.5, 1);
+#elif VIEW_UV
+	output.Color = float4(frac(input.UV.xy), 0, 1);
+#elif VIEW_DEPTH
+	float3 sRGB = input.Position.zzz;
+	float3 RGB = sRGB * (sRGB * (sRGB * 0.305306011 + 0.682171111) + 0.012522878);
+	output.Color = float4(RGB, 1);
+#else
+	// Materials without a diffuse map are drawn in their Kd.
+	output.Color = input.HasDiffuseTexture ? diffuseTex.Sample(diffuseSampler, input.UV.xyz) : float4(input.Diffuse.rgb, 1);
+#endif
 	output.Normal = float4(normalize(input.Normal.xyz), 1);
 	return output;
-}
-
-////Diffuse
-//if (RenderMode.x == 0)
-//{
-//	output.Color = diffuseTex.Sample(diffuseSampler, input.UV.xy);
-//}
-////Normals
-//else if (RenderMode.x == 1)
-//{
-//	output.Color = float4(normalize(input.Normal.xyz) * 0.5 + 0.5, 1);
-//}
-////UV
-//else if (RenderMode.x == 2)
-//{
-//	output.Color = float4(frac(input.UV.xy), 0, 1);
-//}
-////Depth
-//else //(RenderMode.x == 3)
-//{
-//	float3 sRGB = input.Position.zzz;
-//	float3 RGB = sRGB * (sRGB * (sRGB * 0.305306011 + 0.682171111) + 0.012522878);
-//	output.Color = float4(RGB, 1);
-//}
\ No newline at end of file
+}
\ No newline at end of file
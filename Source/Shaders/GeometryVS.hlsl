@@ -10,13 +10,19 @@ struct VSOut
 	float4 Position	: SV_POSITION;
 	float4 Normal	: NORMAL;
 	float4 UV		: TEXCOORD0;
+	nointerpolation float4 Diffuse : COLOR0;			// Kd, d
+	nointerpolation uint HasDiffuseTexture : TEXCOORD1;
 };
 
 cbuffer VSConstantBuffer : register(b0)
 {
 	matrix MvpMatrix;
+	uint4 TextureSlices; // x: diffuse, y: mask, z: material
 };
 
+// GPUMaterial in RHI.h, three uint4s per material: Kd and d, Ks and Ns, then the texture slices.
+Buffer<uint4> Materials : register(t0);
+
 VSOut main(VSIn input)
 {
 	VSOut output;
@@ -24,5 +30,11 @@ VSOut main(VSIn input)
 	output.Normal = input.Normal;
 	output.UV = input.UV;
     output.UV.g = 1 - output.UV.g;
+	uint material = TextureSlices.z * 3;
+	uint4 textures = Materials[material + 2];
+	output.UV.z = textures.x;
+	output.UV.w = textures.y;
+	output.Diffuse = asfloat(Materials[material]);
+	output.HasDiffuseTexture = textures.z;
 	return output;
 }
\ No newline at end of file
@@ -17,5 +17,5 @@ public:
 	SharedDeletePtr() : SharedPtr<T>([](T* ptr) { delete ptr; }) {}
 
 	// Construct with a pointer
-	SharedDeletePtr(T* ptr) : SharedPtr<T>([](T* ptr) { delete ptr; }) { reset(ptr); }
+	SharedDeletePtr(T* ptr) : SharedPtr<T>([](T* ptr) { delete ptr; }) { this->reset(ptr); }
 };
\ No newline at end of file
@@ -0,0 +1,117 @@
+#pragma once
+#include <cassert>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+// 32-bit handle to an object in a SlotMap<T>, typed by what it refers to so handles to different kinds of
+// object don't mix. The low bits index a slot and the high bits hold the generation the slot had when the
+// object went in, so a handle outliving its object stops resolving instead of finding whatever reused the
+// slot. Zero is never issued, which leaves it free to mean null.
+template <class T>
+struct SlotHandle
+{
+	uint32_t value = 0;
+
+	explicit operator bool() const { return value != 0; }
+	bool operator==(SlotHandle other) const { return value == other.value; }
+	bool operator!=(SlotHandle other) const { return value != other.value; }
+};
+
+// Objects in a flat array addressed by generational handles. Lookups are an index and a generation compare,
+// with no hashing or pointer chasing, and freed slots are reused through a free list so the array stays as
+// dense as the peak object count. A slot's generation wraps after 4095 reuses, past which a stale handle
+// could resolve again.
+template <class T>
+class SlotMap
+{
+public:
+	typedef SlotHandle<T> Handle;
+
+	static const uint32_t IndexBits = 20;
+	static const uint32_t MaxSlots = 1u << IndexBits;
+	static const uint32_t GenerationMask = (1u << (32 - IndexBits)) - 1;
+
+	Handle Insert(T value)
+	{
+		uint32_t index;
+		if (!m_FreeSlots.empty())
+		{
+			index = m_FreeSlots.back();
+			m_FreeSlots.pop_back();
+			m_Values[index] = std::move(value);
+		}
+		else
+		{
+			index = static_cast<uint32_t>(m_Values.size());
+			assert(index < MaxSlots);
+			m_Values.push_back(std::move(value));
+			m_Generations.push_back(1);
+		}
+		++m_Size;
+		return MakeHandle(index, m_Generations[index]);
+	}
+
+	// Null for handles that were never issued or whose object has been removed.
+	T* Get(Handle handle)
+	{
+		uint32_t index = GetIndex(handle);
+		return IsCurrent(index, handle) ? &m_Values[index] : nullptr;
+	}
+	const T* Get(Handle handle) const
+	{
+		uint32_t index = GetIndex(handle);
+		return IsCurrent(index, handle) ? &m_Values[index] : nullptr;
+	}
+
+	// For handles the caller knows are live.
+	T& operator[](Handle handle)
+	{
+		assert(IsValid(handle));
+		return m_Values[GetIndex(handle)];
+	}
+	const T& operator[](Handle handle) const
+	{
+		assert(IsValid(handle));
+		return m_Values[GetIndex(handle)];
+	}
+
+	bool IsValid(Handle handle) const { return IsCurrent(GetIndex(handle), handle); }
+
+	// Destroys the object and retires every handle to it. Returns false, and does nothing, for stale handles.
+	bool Remove(Handle handle)
+	{
+		uint32_t index = GetIndex(handle);
+		if (!IsCurrent(index, handle)) return false;
+
+		m_Values[index] = T();
+		// Generation 0 is skipped so no handle ever comes out as 0.
+		uint32_t generation = (m_Generations[index] + 1) & GenerationMask;
+		m_Generations[index] = generation == 0 ? 1 : generation;
+		m_FreeSlots.push_back(index);
+		--m_Size;
+		return true;
+	}
+
+	uint32_t GetSize() const { return m_Size; }
+	uint32_t GetCapacity() const { return static_cast<uint32_t>(m_Values.size()); }
+
+private:
+	static Handle MakeHandle(uint32_t index, uint32_t generation)
+	{
+		Handle handle;
+		handle.value = (generation << IndexBits) | index;
+		return handle;
+	}
+	static uint32_t GetIndex(Handle handle) { return handle.value & (MaxSlots - 1); }
+
+	bool IsCurrent(uint32_t index, Handle handle) const
+	{
+		return index < m_Generations.size() && m_Generations[index] == handle.value >> IndexBits;
+	}
+
+	std::vector<T>			m_Values;
+	std::vector<uint32_t>	m_Generations;		// Bumped on removal, so a free slot matches no outstanding handle
+	std::vector<uint32_t>	m_FreeSlots;
+	uint32_t				m_Size = 0;
+};
\ No newline at end of file
@@ -0,0 +1,900 @@
+#include "SoftwareRHI.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <future>
+#include <thread>
+
+#include <emmintrin.h>
+
+#include "glm/gtx/rotate_vector.hpp"
+
+#include "Engine.h"
+#include "FileUtils.h"
+#include "Mesh.h"
+#include "TexturePacker.h"
+#include "TextureUtils.h"
+#include "Window.h"
+
+namespace
+{
+// Triangles are clipped to this many times the viewport in x and y, which keeps screen coordinates small enough
+// for float edge functions. Anything beyond the viewport itself is cut by the bounding box.
+const float GuardBand = 8.0f;
+const uint32_t MaxClippedVertices = 9;
+const uint32_t ChunksPerWorker = 4;
+
+struct ClipVertex
+{
+	glm::vec4 position;
+	glm::vec3 normal;
+	glm::vec2 uv;
+};
+
+// Distances to the planes triangles are actually clipped against, positive inside: near, far and the guard band.
+float ClipDistance(const glm::vec4& p, uint32_t plane)
+{
+	switch (plane)
+	{
+	case 0: return p.z;
+	case 1: return p.w - p.z;
+	case 2: return GuardBand * p.w + p.x;
+	case 3: return GuardBand * p.w - p.x;
+	case 4: return GuardBand * p.w + p.y;
+	default: return GuardBand * p.w - p.y;
+	}
+}
+
+uint32_t ClipFlags(const glm::vec4& p)
+{
+	uint32_t flags = 0;
+	for (uint32_t plane = 0; plane < 6; ++plane)
+	{
+		if (ClipDistance(p, plane) < 0.0f) flags |= 1 << plane;
+	}
+	return flags;
+}
+
+// Sides of the view frustum itself, for rejecting triangles wholly outside one of them.
+uint32_t FrustumOutcode(const glm::vec4& p)
+{
+	return (p.x < -p.w ? 1 : 0) | (p.x > p.w ? 2 : 0) | (p.y < -p.w ? 4 : 0) | (p.y > p.w ? 8 : 0) | (p.z < 0.0f ? 16 : 0) | (p.z > p.w ? 32 : 0);
+}
+
+ClipVertex Lerp(const ClipVertex& a, const ClipVertex& b, float t)
+{
+	ClipVertex result;
+	result.position = a.position + (b.position - a.position) * t;
+	result.normal = a.normal + (b.normal - a.normal) * t;
+	result.uv = a.uv + (b.uv - a.uv) * t;
+	return result;
+}
+
+// Sutherland-Hodgman against one plane. Returns the new vertex count.
+uint32_t ClipPolygon(const ClipVertex* in, uint32_t numIn, ClipVertex* out, uint32_t plane)
+{
+	uint32_t numOut = 0;
+	for (uint32_t i = 0; i < numIn; ++i)
+	{
+		const ClipVertex& current = in[i];
+		const ClipVertex& next = in[(i + 1) % numIn];
+		float currentDistance = ClipDistance(current.position, plane);
+		float nextDistance = ClipDistance(next.position, plane);
+		if (currentDistance >= 0.0f) out[numOut++] = current;
+		if ((currentDistance >= 0.0f) != (nextDistance >= 0.0f))
+		{
+			out[numOut++] = Lerp(current, next, currentDistance / (currentDistance - nextDistance));
+		}
+	}
+	return numOut;
+}
+
+glm::vec3 ReadStream(const std::vector<char>& contents, uint32_t stride, uint32_t vertex)
+{
+	// Streams are float3 at most; the shader's fourth component is the D3D input assembler's default.
+	glm::vec3 value(0.0f);
+	memcpy(&value, &contents[size_t(vertex) * stride], std::min<size_t>(stride, sizeof(value)));
+	return value;
+}
+
+uint32_t CalcMipLevels(uint32_t width, uint32_t height)
+{
+	uint32_t mipLevels = 1;
+	for (uint32_t size = width > height ? width : height; size > 1; size /= 2) ++mipLevels;
+	return mipLevels;
+}
+
+// Texel (x, y) of one level as RGBA, for both the BGRA8 layout and decoded single-channel BC4.
+glm::vec4 FetchTexel(const uint8_t* texels, uint32_t bytesPerTexel, uint32_t width, uint32_t x, uint32_t y)
+{
+	const uint8_t* texel = texels + (size_t(y) * width + x) * bytesPerTexel;
+	if (bytesPerTexel == 1) return glm::vec4(texel[0] / 255.0f, 0.0f, 0.0f, 1.0f);
+	return glm::vec4(texel[2], texel[1], texel[0], texel[3]) * (1.0f / 255.0f);
+}
+
+// Wraps like D3D11_TEXTURE_ADDRESS_WRAP and filters linearly between the four nearest texels.
+glm::vec4 SampleBilinear(const uint8_t* texels, uint32_t bytesPerTexel, uint32_t width, uint32_t height, float u, float v)
+{
+	u -= std::floor(u);
+	v -= std::floor(v);
+	if (!(u >= 0.0f && u < 1.0f)) u = 0.0f;
+	if (!(v >= 0.0f && v < 1.0f)) v = 0.0f;
+
+	float x = u * width - 0.5f;
+	float y = v * height - 0.5f;
+	float floorX = std::floor(x);
+	float floorY = std::floor(y);
+	float fracX = x - floorX;
+	float fracY = y - floorY;
+	uint32_t x0 = floorX < 0.0f ? width - 1 : uint32_t(floorX);
+	uint32_t y0 = floorY < 0.0f ? height - 1 : uint32_t(floorY);
+	uint32_t x1 = x0 + 1 == width ? 0 : x0 + 1;
+	uint32_t y1 = y0 + 1 == height ? 0 : y0 + 1;
+
+	glm::vec4 top = glm::mix(FetchTexel(texels, bytesPerTexel, width, x0, y0), FetchTexel(texels, bytesPerTexel, width, x1, y0), fracX);
+	glm::vec4 bottom = glm::mix(FetchTexel(texels, bytesPerTexel, width, x0, y1), FetchTexel(texels, bytesPerTexel, width, x1, y1), fracX);
+	return glm::mix(top, bottom, fracY);
+}
+}
+
+SoftwareRHI::SoftwareRHI()
+{
+}
+
+SoftwareRHI::~SoftwareRHI()
+{
+	if (m_OutputPath.empty() || m_Stats.numFrames == 0) return;
+
+	if (FileUtils::SaveUncompressedTGA(m_Output, m_OutputPath))
+	{
+		SDL_Log("Software RHI wrote its last frame to \"%s\".", m_OutputPath.c_str());
+	}
+}
+
+bool SoftwareRHI::InitRHI(const Window& window)
+{
+	if (window.width == 0 || window.height == 0)
+	{
+		SDL_Log("Software RHI needs a non-zero back buffer size.");
+		return false;
+	}
+
+	if (g_Engine)
+	{
+		m_OutputPath = g_Engine->RHIOutputPath;
+		m_NumWorkers = g_Engine->RHIRecordThreads;
+	}
+	if (m_NumWorkers == 0) m_NumWorkers = std::max(std::thread::hardware_concurrency(), 1u);
+	if (m_NumWorkers > 1) m_Workers = std::make_unique<ThreadPool>(m_NumWorkers - 1);
+	m_Counters.resize(m_NumWorkers);
+
+	CreateFrameBuffers(window.width, window.height);
+
+	CPUTexture debugTex;
+	debugTex.width = 2;
+	debugTex.height = 2;
+	for (int i = 0; i < debugTex.width * debugTex.height; ++i)
+	{
+		debugTex.data.push_back(static_cast<char>(255));
+		debugTex.data.push_back(0);
+		debugTex.data.push_back(static_cast<char>(255));
+		debugTex.data.push_back(static_cast<char>(255));
+	}
+	m_DebugTexture = CreateTexture2D(debugTex);
+
+	SDL_Log("Software RHI rasterizing %ux%u on %u threads.", m_Width, m_Height, m_NumWorkers);
+	return true;
+}
+
+void SoftwareRHI::CreateFrameBuffers(uint32_t width, uint32_t height)
+{
+	m_Width = width;
+	m_Height = height;
+	m_TilesX = (width + TileSize - 1) / TileSize;
+	m_TilesY = (height + TileSize - 1) / TileSize;
+
+	size_t numPixels = size_t(width) * height;
+	m_Color.assign(numPixels, glm::vec4(0.0f));
+	m_Normal.assign(numPixels, glm::vec4(0.0f));
+	// Padded so four-wide loads at the end of the last row stay inside the allocation.
+	m_Depth.assign(numPixels + 4, 1.0f);
+
+	m_Output.width = width;
+	m_Output.height = height;
+	m_Output.format = CPUTextureFormat::BGRA8;
+	m_Output.data.assign(numPixels * 4, 0);
+}
+
+void SoftwareRHI::HandleWindowResize(uint32_t windowWidth, uint32_t windowHeight)
+{
+	if (windowWidth == 0 || windowHeight == 0) return;
+	CreateFrameBuffers(windowWidth, windowHeight);
+}
+
+void SoftwareRHI::ParallelFor(uint32_t count, const std::function<void(uint32_t index, uint32_t worker)>& func)
+{
+	std::atomic<uint32_t> next(0);
+	auto work = [&](uint32_t worker)
+	{
+		for (uint32_t index = next++; index < count; index = next++) func(index, worker);
+	};
+
+	std::vector<std::future<void>> done;
+	for (uint32_t worker = 1; worker < m_NumWorkers && worker < count; ++worker)
+	{
+		done.push_back(m_Workers->Submit([&work, worker]() { work(worker); }));
+	}
+	work(0);
+	for (auto& future : done) future.wait();
+}
+
+RHIBuffer SoftwareRHI::CreateVertexBuffer(const void* data, uint32_t stride, uint32_t numVertices)
+{
+	auto record = std::make_unique<BufferRecord>();
+	record->kind = BufferKind::Vertex;
+	record->stride = stride;
+	record->contents.assign(static_cast<const char*>(data), static_cast<const char*>(data) + stride * numVertices);
+	m_Buffers.push_back(std::move(record));
+	return reinterpret_cast<RHIBuffer>(m_Buffers.back().get());
+}
+
+RHIBuffer SoftwareRHI::CreateIndexBuffer(const std::vector<IndexType>& indices)
+{
+	auto record = std::make_unique<BufferRecord>();
+	record->kind = BufferKind::Index;
+	record->stride = sizeof(IndexType);
+	record->contents.assign(reinterpret_cast<const char*>(indices.data()), reinterpret_cast<const char*>(indices.data() + indices.size()));
+	m_Buffers.push_back(std::move(record));
+	return reinterpret_cast<RHIBuffer>(m_Buffers.back().get());
+}
+
+RHIBuffer SoftwareRHI::CreateConstantBuffer(int size)
+{
+	auto record = std::make_unique<BufferRecord>();
+	record->kind = BufferKind::Constant;
+	record->stride = 0;
+	record->contents.resize(size);
+	m_Buffers.push_back(std::move(record));
+	return reinterpret_cast<RHIBuffer>(m_Buffers.back().get());
+}
+
+bool SoftwareRHI::UpdateConstantBuffer(RHIBuffer buffer, const void* data, int numBytes)
+{
+	auto record = reinterpret_cast<BufferRecord*>(buffer);
+	assert(record->kind == BufferKind::Constant);
+	if (numBytes <= 0 || static_cast<size_t>(numBytes) > record->contents.size()) return false;
+
+	memcpy(record->contents.data(), data, numBytes);
+	return true;
+}
+
+void SoftwareRHI::UpdateMaterialTable(const std::vector<GPUMaterial>&)
+{
+	// The rasterizer takes its slices from the draw constants and shades from the diffuse texture alone.
+}
+
+RHITexture SoftwareRHI::AddTexture(std::unique_ptr<TextureRecord> record)
+{
+	auto raw = record.get();
+	m_Textures[raw] = std::move(record);
+	return reinterpret_cast<RHITexture>(raw);
+}
+
+RHITexture SoftwareRHI::CreateTexture2D(const CPUTexture& cpuTexture)
+{
+	auto record = std::make_unique<TextureRecord>();
+	record->format = cpuTexture.format;
+	record->width = cpuTexture.width;
+	record->height = cpuTexture.height;
+	record->mipLevels = CalcMipLevels(cpuTexture.width, cpuTexture.height);
+	record->arraySize = 1;
+
+	// Block-compressed textures can't have their mips generated, so they must come with them.
+	bool hasCpuMips = !cpuTexture.mips.empty();
+	assert(!hasCpuMips || cpuTexture.mips.size() + 1 == record->mipLevels);
+	assert(hasCpuMips || cpuTexture.format == CPUTextureFormat::BGRA8);
+
+	if (cpuTexture.format == CPUTextureFormat::BC4)
+	{
+		uint32_t width = cpuTexture.width;
+		uint32_t height = cpuTexture.height;
+		for (uint32_t mip = 0; mip < record->mipLevels; ++mip)
+		{
+			record->levels.push_back(TextureUtils::DecodeBC4(mip == 0 ? cpuTexture.data : cpuTexture.mips[mip - 1], width, height));
+			width = std::max(width / 2, 1u);
+			height = std::max(height / 2, 1u);
+		}
+	}
+	else
+	{
+		// Where a GPU backend would have the driver make the mips, this makes them here.
+		CPUTexture generated;
+		const CPUTexture* source = &cpuTexture;
+		if (!hasCpuMips)
+		{
+			generated = cpuTexture;
+			TextureUtils::GenerateMips(generated);
+			source = &generated;
+		}
+		record->levels.emplace_back(source->data.begin(), source->data.end());
+		for (const auto& mip : source->mips) record->levels.emplace_back(mip.begin(), mip.end());
+	}
+
+	return AddTexture(std::move(record));
+}
+
+RHITexture SoftwareRHI::CreateTexture2DArray(const TextureArrayPlan& arrayPlan)
+{
+	assert(!arrayPlan.slices.empty());
+
+	auto record = std::make_unique<TextureRecord>();
+	record->format = static_cast<CPUTextureFormat>(arrayPlan.format);
+	record->width = arrayPlan.width;
+	record->height = arrayPlan.height;
+	record->mipLevels = arrayPlan.mipLevels;
+	record->arraySize = static_cast<uint32_t>(arrayPlan.slices.size());
+	record->levels.resize(arrayPlan.mipLevels);
+
+	for (auto slice : arrayPlan.slices)
+	{
+		auto source = reinterpret_cast<const TextureRecord*>(slice);
+		assert(source->width == record->width && source->height == record->height && source->mipLevels == record->mipLevels && source->format == record->format);
+		for (uint32_t mip = 0; mip < record->mipLevels; ++mip)
+		{
+			record->levels[mip].insert(record->levels[mip].end(), source->levels[mip].begin(), source->levels[mip].end());
+		}
+	}
+
+	return AddTexture(std::move(record));
+}
+
+void SoftwareRHI::ReleaseTexture2D(RHITexture texture)
+{
+	auto iter = m_Textures.find(reinterpret_cast<TextureRecord*>(texture));
+	assert(iter != m_Textures.end());
+	assert(texture != m_DebugTexture);
+	m_Textures.erase(iter);
+}
+
+TexturePackingInput SoftwareRHI::GetTexturePackingInput(RHITexture texture) const
+{
+	auto record = reinterpret_cast<const TextureRecord*>(texture);
+
+	TexturePackingInput input;
+	input.texture = texture;
+	input.width = record->width;
+	input.height = record->height;
+	input.mipLevels = record->mipLevels;
+	input.format = static_cast<uint32_t>(record->format);
+	return input;
+}
+
+void SoftwareRHI::BeginGeometryPass()
+{
+	m_Draws.clear();
+	m_Lights.clear();
+	m_MaskedPass = false;
+}
+
+void SoftwareRHI::BeginMaskedGeometryPass()
+{
+	m_MaskedPass = true;
+}
+
+void SoftwareRHI::SetGeometryShaderFeatures(uint32_t)
+{
+	// Only the alpha test is emulated, and the masked pass already implies it.
+}
+
+void SoftwareRHI::DrawMesh(const Mesh& mesh, RHITexture diffuseTexture, RHITexture maskTexture)
+{
+	DrawCommand draw;
+	draw.position = reinterpret_cast<const BufferRecord*>(mesh.gpuMesh.positionBuffer);
+	draw.normal = reinterpret_cast<const BufferRecord*>(mesh.gpuMesh.normalBuffer);
+	draw.uv = reinterpret_cast<const BufferRecord*>(mesh.gpuMesh.uvBuffer);
+	draw.index = reinterpret_cast<const BufferRecord*>(mesh.gpuMesh.indexBuffer);
+	draw.numIndices = std::min<uint32_t>(mesh.numFaces * 3, static_cast<uint32_t>(draw.index->contents.size() / sizeof(IndexType)));
+	draw.diffuse = reinterpret_cast<const TextureRecord*>(diffuseTexture);
+	// Only the masked pass alpha tests, as with the pixel shaders of the GPU backends.
+	draw.mask = m_MaskedPass ? reinterpret_cast<const TextureRecord*>(maskTexture) : nullptr;
+
+	// Constants are read when the draw is made, like a GPU backend's copy into its command stream.
+	auto constants = reinterpret_cast<const BufferRecord*>(mesh.constantBuffer);
+	assert(constants->kind == BufferKind::Constant && constants->contents.size() >= sizeof(draw.constants));
+	memcpy(&draw.constants, constants->contents.data(), sizeof(draw.constants));
+
+	m_Draws.push_back(draw);
+	++m_Stats.numDraws;
+	m_Stats.numTriangles += draw.numIndices / 3;
+}
+
+void SoftwareRHI::RenderGeometry()
+{
+	auto geometryBegin = std::chrono::steady_clock::now();
+	uint32_t numTiles = m_TilesX * m_TilesY;
+
+	// Chunks hold about the same number of triangles, a few per worker so a heavy one doesn't hold up the rest.
+	uint64_t totalIndices = 0;
+	for (const auto& draw : m_Draws) totalIndices += draw.numIndices;
+	uint32_t numChunks = std::max(1u, std::min<uint32_t>(static_cast<uint32_t>(m_Draws.size()), m_NumWorkers * ChunksPerWorker));
+	uint64_t indicesPerChunk = totalIndices / numChunks + 1;
+
+	m_Chunks.resize(numChunks);
+	uint32_t chunkIndex = 0;
+	uint64_t chunkIndices = 0;
+	m_Chunks[0].firstDraw = 0;
+	for (uint32_t i = 0; i < m_Draws.size(); ++i)
+	{
+		chunkIndices += m_Draws[i].numIndices;
+		if (chunkIndices >= indicesPerChunk && chunkIndex + 1 < numChunks)
+		{
+			m_Chunks[chunkIndex].endDraw = i + 1;
+			m_Chunks[++chunkIndex].firstDraw = i + 1;
+			chunkIndices = 0;
+		}
+	}
+	m_Chunks[chunkIndex].endDraw = static_cast<uint32_t>(m_Draws.size());
+	m_Chunks.resize(chunkIndex + 1);
+	for (auto& chunk : m_Chunks) chunk.bins.resize(numTiles);
+
+	ParallelFor(static_cast<uint32_t>(m_Chunks.size()), [this](uint32_t index, uint32_t worker) { SetupChunk(m_Chunks[index], m_Counters[worker]); });
+	auto rasterBegin = std::chrono::steady_clock::now();
+
+	ParallelFor(numTiles, [this](uint32_t tile, uint32_t worker) { RasterizeTile(tile, m_Counters[worker]); });
+	auto rasterEnd = std::chrono::steady_clock::now();
+
+	for (auto& counters : m_Counters)
+	{
+		m_Stats.numSetupTriangles += counters.numSetupTriangles;
+		m_Stats.numBinnedTiles += counters.numBinnedTiles;
+		m_Stats.numRejectedBlocks += counters.numRejectedBlocks;
+		m_Stats.numCoveredBlocks += counters.numCoveredBlocks;
+		m_Stats.numPartialBlocks += counters.numPartialBlocks;
+		m_Stats.numShadedPixels += counters.numShadedPixels;
+		counters = WorkerCounters();
+	}
+	m_Stats.geometryMs += std::chrono::duration<double, std::milli>(rasterBegin - geometryBegin).count();
+	m_Stats.rasterMs += std::chrono::duration<double, std::milli>(rasterEnd - rasterBegin).count();
+	m_Draws.clear();
+}
+
+void SoftwareRHI::SetupChunk(GeometryChunk& chunk, WorkerCounters& counters)
+{
+	chunk.triangles.clear();
+	for (auto& bin : chunk.bins) bin.clear();
+
+	std::vector<glm::vec4> clip;
+	std::vector<glm::vec3> normals;
+	std::vector<glm::vec2> uvs;
+	for (uint32_t drawIndex = chunk.firstDraw; drawIndex < chunk.endDraw; ++drawIndex)
+	{
+		const DrawCommand& draw = m_Draws[drawIndex];
+
+		// The vertex shader, once per vertex.
+		auto numVertices = static_cast<uint32_t>(draw.position->contents.size() / draw.position->stride);
+		clip.resize(numVertices);
+		normals.resize(numVertices);
+		uvs.resize(numVertices);
+		for (uint32_t i = 0; i < numVertices; ++i)
+		{
+			clip[i] = draw.constants.mvpMatrix * glm::vec4(ReadStream(draw.position->contents, draw.position->stride, i), 1.0f);
+			normals[i] = ReadStream(draw.normal->contents, draw.normal->stride, i);
+			glm::vec3 uv = ReadStream(draw.uv->contents, draw.uv->stride, i);
+			uvs[i] = glm::vec2(uv.x, 1.0f - uv.y);
+		}
+
+		auto indices = reinterpret_cast<const IndexType*>(draw.index->contents.data());
+		for (uint32_t i = 0; i + 2 < draw.numIndices; i += 3)
+		{
+			IndexType i0 = indices[i], i1 = indices[i + 1], i2 = indices[i + 2];
+			assert(i0 < numVertices && i1 < numVertices && i2 < numVertices);
+			const glm::vec4 triangleClip[3] = { clip[i0], clip[i1], clip[i2] };
+			const glm::vec3 triangleNormals[3] = { normals[i0], normals[i1], normals[i2] };
+			const glm::vec2 triangleUVs[3] = { uvs[i0], uvs[i1], uvs[i2] };
+			SetupTriangle(chunk, draw, triangleClip, triangleNormals, triangleUVs, counters);
+		}
+	}
+}
+
+void SoftwareRHI::SetupTriangle(GeometryChunk& chunk, const DrawCommand& draw, const glm::vec4* clip, const glm::vec3* normals, const glm::vec2* uvs, WorkerCounters& counters)
+{
+	if (FrustumOutcode(clip[0]) & FrustumOutcode(clip[1]) & FrustumOutcode(clip[2])) return;
+
+	ClipVertex polygons[2][MaxClippedVertices];
+	for (uint32_t i = 0; i < 3; ++i) polygons[0][i] = { clip[i], normals[i], uvs[i] };
+	uint32_t numVertices = 3;
+	uint32_t current = 0;
+
+	uint32_t clipFlags = ClipFlags(clip[0]) | ClipFlags(clip[1]) | ClipFlags(clip[2]);
+	for (uint32_t plane = 0; plane < 6 && numVertices >= 3; ++plane)
+	{
+		if (!(clipFlags & (1 << plane))) continue;
+		numVertices = ClipPolygon(polygons[current], numVertices, polygons[current ^ 1], plane);
+		current ^= 1;
+	}
+	if (numVertices < 3) return;
+
+	// Viewport transform, D3D style: y down, depth straight from z/w.
+	struct ScreenVertex
+	{
+		float x, y, z, invW;
+		glm::vec2 uv;
+		glm::vec3 normal;
+	};
+	ScreenVertex screen[MaxClippedVertices];
+	for (uint32_t i = 0; i < numVertices; ++i)
+	{
+		const ClipVertex& vertex = polygons[current][i];
+		float invW = 1.0f / vertex.position.w;
+		screen[i].x = (vertex.position.x * invW * 0.5f + 0.5f) * m_Width;
+		screen[i].y = (0.5f - vertex.position.y * invW * 0.5f) * m_Height;
+		screen[i].z = vertex.position.z * invW;
+		screen[i].invW = invW;
+		screen[i].uv = vertex.uv * invW;
+		screen[i].normal = vertex.normal * invW;
+	}
+
+	for (uint32_t fan = 1; fan + 1 < numVertices; ++fan)
+	{
+		const ScreenVertex* v[3] = { &screen[0], &screen[fan], &screen[fan + 1] };
+
+		// Clockwise on screen faces the camera. Back faces and slivers with no area go here.
+		float edge1X = v[1]->x - v[0]->x, edge1Y = v[1]->y - v[0]->y;
+		float edge2X = v[2]->x - v[0]->x, edge2Y = v[2]->y - v[0]->y;
+		float area = edge1X * edge2Y - edge2X * edge1Y;
+		if (!(area > 0.0f)) continue;
+
+		RasterTriangle triangle;
+		float minX = std::min({ v[0]->x, v[1]->x, v[2]->x }), maxX = std::max({ v[0]->x, v[1]->x, v[2]->x });
+		float minY = std::min({ v[0]->y, v[1]->y, v[2]->y }), maxY = std::max({ v[0]->y, v[1]->y, v[2]->y });
+		// Pixels whose centres can fall inside.
+		triangle.minX = std::max(0, static_cast<int32_t>(std::ceil(minX - 0.5f)));
+		triangle.minY = std::max(0, static_cast<int32_t>(std::ceil(minY - 0.5f)));
+		triangle.maxX = std::min(static_cast<int32_t>(m_Width) - 1, static_cast<int32_t>(std::floor(maxX - 0.5f)));
+		triangle.maxY = std::min(static_cast<int32_t>(m_Height) - 1, static_cast<int32_t>(std::floor(maxY - 0.5f)));
+		if (triangle.minX > triangle.maxX || triangle.minY > triangle.maxY) continue;
+
+		triangle.topLeftEdges = 0;
+		for (uint32_t edge = 0; edge < 3; ++edge)
+		{
+			const ScreenVertex* from = v[edge];
+			const ScreenVertex* to = v[(edge + 1) % 3];
+			triangle.edgeA[edge] = from->y - to->y;
+			triangle.edgeB[edge] = to->x - from->x;
+			triangle.edgeC[edge] = from->x * to->y - to->x * from->y;
+			// With y down and clockwise winding, left edges go up and top edges go right.
+			if (triangle.edgeA[edge] > 0.0f || (triangle.edgeA[edge] == 0.0f && triangle.edgeB[edge] > 0.0f))
+			{
+				triangle.topLeftEdges |= 1 << edge;
+			}
+		}
+
+		float invArea = 1.0f / area;
+		auto makePlane = [&](float a0, float a1, float a2)
+		{
+			Plane plane;
+			plane.value = a0;
+			plane.dx = ((a1 - a0) * edge2Y - (a2 - a0) * edge1Y) * invArea;
+			plane.dy = ((a2 - a0) * edge1X - (a1 - a0) * edge2X) * invArea;
+			return plane;
+		};
+		triangle.originX = v[0]->x;
+		triangle.originY = v[0]->y;
+		triangle.z = makePlane(v[0]->z, v[1]->z, v[2]->z);
+		triangle.invW = makePlane(v[0]->invW, v[1]->invW, v[2]->invW);
+		triangle.u = makePlane(v[0]->uv.x, v[1]->uv.x, v[2]->uv.x);
+		triangle.v = makePlane(v[0]->uv.y, v[1]->uv.y, v[2]->uv.y);
+		for (uint32_t i = 0; i < 3; ++i) triangle.normal[i] = makePlane(v[0]->normal[i], v[1]->normal[i], v[2]->normal[i]);
+
+		// Out of range slices clamp, as D3D11 does for array indices.
+		triangle.diffuse = draw.diffuse;
+		triangle.mask = draw.mask;
+		triangle.diffuseSlice = std::min(draw.constants.textureSlices.x, draw.diffuse->arraySize - 1);
+		triangle.maskSlice = draw.mask ? std::min(draw.constants.textureSlices.y, draw.mask->arraySize - 1) : 0;
+
+		chunk.triangles.push_back(triangle);
+		++counters.numSetupTriangles;
+		BinTriangle(chunk, static_cast<uint32_t>(chunk.triangles.size() - 1), counters);
+	}
+}
+
+void SoftwareRHI::BinTriangle(GeometryChunk& chunk, uint32_t triangleIndex, WorkerCounters& counters)
+{
+	const RasterTriangle& triangle = chunk.triangles[triangleIndex];
+	int32_t tileMinX = triangle.minX / TileSize, tileMaxX = triangle.maxX / TileSize;
+	int32_t tileMinY = triangle.minY / TileSize, tileMaxY = triangle.maxY / TileSize;
+
+	for (int32_t tileY = tileMinY; tileY <= tileMaxY; ++tileY)
+	{
+		for (int32_t tileX = tileMinX; tileX <= tileMaxX; ++tileX)
+		{
+			// Large triangles overlap tiles in their bounding box they don't touch. Edge functions are linear, so a tile
+			// is outside an edge if the pixel centres at its corners all are.
+			if (tileMinX != tileMaxX || tileMinY != tileMaxY)
+			{
+				float x0 = std::max<int32_t>(tileX * TileSize, triangle.minX) + 0.5f;
+				float x1 = std::min<int32_t>(tileX * TileSize + TileSize - 1, triangle.maxX) + 0.5f;
+				float y0 = std::max<int32_t>(tileY * TileSize, triangle.minY) + 0.5f;
+				float y1 = std::min<int32_t>(tileY * TileSize + TileSize - 1, triangle.maxY) + 0.5f;
+				bool outside = false;
+				for (uint32_t edge = 0; edge < 3 && !outside; ++edge)
+				{
+					float x = triangle.edgeA[edge] > 0.0f ? x1 : x0;
+					float y = triangle.edgeB[edge] > 0.0f ? y1 : y0;
+					outside = triangle.edgeA[edge] * x + (triangle.edgeB[edge] * y + triangle.edgeC[edge]) < 0.0f;
+				}
+				if (outside) continue;
+			}
+
+			chunk.bins[tileY * m_TilesX + tileX].push_back(triangleIndex);
+			++counters.numBinnedTiles;
+		}
+	}
+}
+
+void SoftwareRHI::RasterizeTile(uint32_t tile, WorkerCounters& counters)
+{
+	int32_t tileMinX = (tile % m_TilesX) * TileSize;
+	int32_t tileMinY = (tile / m_TilesX) * TileSize;
+	int32_t tileMaxX = std::min<int32_t>(tileMinX + TileSize, m_Width) - 1;
+	int32_t tileMaxY = std::min<int32_t>(tileMinY + TileSize, m_Height) - 1;
+
+	// Same clear as the D3D11 G-buffer. The normal target is discarded there, zero makes unlit pixels get no light.
+	for (int32_t y = tileMinY; y <= tileMaxY; ++y)
+	{
+		size_t row = size_t(y) * m_Width;
+		std::fill(&m_Color[row + tileMinX], &m_Color[row + tileMaxX] + 1, glm::vec4(0.0f, 0.0f, 0.25f, 1.0f));
+		std::fill(&m_Normal[row + tileMinX], &m_Normal[row + tileMaxX] + 1, glm::vec4(0.0f));
+		std::fill(&m_Depth[row + tileMinX], &m_Depth[row + tileMaxX] + 1, 1.0f);
+	}
+
+	// Chunks are in draw order, so every tile sees its triangles in submission order.
+	for (const auto& chunk : m_Chunks)
+	{
+		for (uint32_t triangleIndex : chunk.bins[tile])
+		{
+			RasterizeTriangle(chunk.triangles[triangleIndex], tileMinX, tileMinY, tileMaxX, tileMaxY, counters);
+		}
+	}
+}
+
+void SoftwareRHI::RasterizeTriangle(const RasterTriangle& triangle, int32_t tileMinX, int32_t tileMinY, int32_t tileMaxX, int32_t tileMaxY, WorkerCounters& counters)
+{
+	int32_t minX = std::max(triangle.minX, tileMinX), maxX = std::min(triangle.maxX, tileMaxX);
+	int32_t minY = std::max(triangle.minY, tileMinY), maxY = std::min(triangle.maxY, tileMaxY);
+
+	const __m128 zero = _mm_setzero_ps();
+	const __m128 laneOffsets = _mm_setr_ps(0.0f, 1.0f, 2.0f, 3.0f);
+	__m128 edgeA[3], edgeB[3], edgeC[3];
+	for (uint32_t edge = 0; edge < 3; ++edge)
+	{
+		edgeA[edge] = _mm_set1_ps(triangle.edgeA[edge]);
+		edgeB[edge] = _mm_set1_ps(triangle.edgeB[edge]);
+		edgeC[edge] = _mm_set1_ps(triangle.edgeC[edge]);
+	}
+	const __m128 zValue = _mm_set1_ps(triangle.z.value);
+	const __m128 zDx = _mm_set1_ps(triangle.z.dx);
+	const __m128 zDy = _mm_set1_ps(triangle.z.dy);
+	const __m128 originX = _mm_set1_ps(triangle.originX);
+
+	for (int32_t blockY = minY & ~int32_t(BlockSize - 1); blockY <= maxY; blockY += BlockSize)
+	{
+		for (int32_t blockX = minX & ~int32_t(BlockSize - 1); blockX <= maxX; blockX += BlockSize)
+		{
+			int32_t x0 = std::max(blockX, minX), x1 = std::min<int32_t>(blockX + BlockSize - 1, maxX);
+			int32_t y0 = std::max(blockY, minY), y1 = std::min<int32_t>(blockY + BlockSize - 1, maxY);
+
+			// The block's pixel centres are all outside an edge if the nearest corner is, and all inside every
+			// edge if each one's farthest corner is.
+			bool rejected = false;
+			bool covered = true;
+			for (uint32_t edge = 0; edge < 3; ++edge)
+			{
+				float a = triangle.edgeA[edge], b = triangle.edgeB[edge], c = triangle.edgeC[edge];
+				float maxValue = a * ((a > 0.0f ? x1 : x0) + 0.5f) + (b * ((b > 0.0f ? y1 : y0) + 0.5f) + c);
+				float minValue = a * ((a > 0.0f ? x0 : x1) + 0.5f) + (b * ((b > 0.0f ? y0 : y1) + 0.5f) + c);
+				if (maxValue < 0.0f) rejected = true;
+				if (!(minValue > 0.0f)) covered = false;
+			}
+			if (rejected)
+			{
+				++counters.numRejectedBlocks;
+				continue;
+			}
+			++(covered ? counters.numCoveredBlocks : counters.numPartialBlocks);
+
+			for (int32_t y = y0; y <= y1; ++y)
+			{
+				float pixelY = y + 0.5f;
+				const __m128 py = _mm_set1_ps(pixelY);
+				const __m128 zRow = _mm_add_ps(zValue, _mm_mul_ps(zDy, _mm_set1_ps(pixelY - triangle.originY)));
+				for (int32_t x = x0; x <= x1; x += 4)
+				{
+					const __m128 px = _mm_add_ps(_mm_set1_ps(x + 0.5f), laneOffsets);
+					__m128 mask = _mm_cmple_ps(laneOffsets, _mm_set1_ps(float(x1 - x)));
+
+					if (!covered)
+					{
+						for (uint32_t edge = 0; edge < 3; ++edge)
+						{
+							// Same operation order for every triangle, so a shared edge evaluates to exactly opposite values.
+							__m128 value = _mm_add_ps(_mm_mul_ps(edgeA[edge], px), _mm_add_ps(_mm_mul_ps(edgeB[edge], py), edgeC[edge]));
+							__m128 inside = (triangle.topLeftEdges & (1 << edge)) ? _mm_cmpge_ps(value, zero) : _mm_cmpgt_ps(value, zero);
+							mask = _mm_and_ps(mask, inside);
+						}
+						if (!_mm_movemask_ps(mask)) continue;
+					}
+
+					size_t pixel = size_t(y) * m_Width + x;
+					__m128 z = _mm_add_ps(zRow, _mm_mul_ps(zDx, _mm_sub_ps(px, originX)));
+					mask = _mm_and_ps(mask, _mm_cmple_ps(z, _mm_loadu_ps(&m_Depth[pixel])));
+					int lanes = _mm_movemask_ps(mask);
+					if (!lanes) continue;
+
+					alignas(16) float zLanes[4];
+					_mm_store_ps(zLanes, z);
+					for (int lane = 0; lane < 4; ++lane)
+					{
+						if (!(lanes & (1 << lane))) continue;
+						++counters.numShadedPixels;
+						ShadePixel(triangle, static_cast<uint32_t>(pixel + lane), x + lane + 0.5f, pixelY, zLanes[lane]);
+					}
+				}
+			}
+		}
+	}
+}
+
+void SoftwareRHI::ShadePixel(const RasterTriangle& triangle, uint32_t pixel, float x, float y, float z)
+{
+	float dx = x - triangle.originX;
+	float dy = y - triangle.originY;
+	auto evaluate = [dx, dy](const Plane& plane) { return plane.value + plane.dx * dx + plane.dy * dy; };
+
+	// Perspective-correct UVs and their screen-space derivatives, for picking the mip as the GPU does per quad.
+	float w = 1.0f / evaluate(triangle.invW);
+	float u = evaluate(triangle.u) * w;
+	float v = evaluate(triangle.v) * w;
+	float dudx = (triangle.u.dx - u * triangle.invW.dx) * w;
+	float dudy = (triangle.u.dy - u * triangle.invW.dy) * w;
+	float dvdx = (triangle.v.dx - v * triangle.invW.dx) * w;
+	float dvdy = (triangle.v.dy - v * triangle.invW.dy) * w;
+
+	auto sample = [&](const TextureRecord& texture, uint32_t slice)
+	{
+		float scaleX = float(texture.width), scaleY = float(texture.height);
+		float lengthX = std::sqrt(dudx * dudx * scaleX * scaleX + dvdx * dvdx * scaleY * scaleY);
+		float lengthY = std::sqrt(dudy * dudy * scaleX * scaleX + dvdy * dvdy * scaleY * scaleY);
+		float lod = std::log2(std::max(lengthX, lengthY));
+		if (!(lod > 0.0f)) lod = 0.0f;
+		lod = std::min(lod, float(texture.mipLevels - 1));
+
+		// Trilinear, like D3D11_FILTER_MIN_MAG_MIP_LINEAR.
+		uint32_t bytesPerTexel = texture.format == CPUTextureFormat::BC4 ? 1 : 4;
+		auto sampleLevel = [&](uint32_t mip)
+		{
+			uint32_t width = std::max(texture.width >> mip, 1u);
+			uint32_t height = std::max(texture.height >> mip, 1u);
+			const uint8_t* texels = texture.levels[mip].data() + size_t(slice) * width * height * bytesPerTexel;
+			return SampleBilinear(texels, bytesPerTexel, width, height, u, v);
+		};
+		uint32_t mip = static_cast<uint32_t>(lod);
+		float blend = lod - mip;
+		if (blend == 0.0f || mip + 1 >= texture.mipLevels) return sampleLevel(mip);
+		return glm::mix(sampleLevel(mip), sampleLevel(mip + 1), blend);
+	};
+
+	// clip(mask - 0.5) in GeometryPS with ALPHA_TEST.
+	if (triangle.mask && sample(*triangle.mask, triangle.maskSlice).r < 0.5f) return;
+
+	glm::vec3 normal(evaluate(triangle.normal[0]), evaluate(triangle.normal[1]), evaluate(triangle.normal[2]));
+	m_Depth[pixel] = z;
+	m_Color[pixel] = sample(*triangle.diffuse, triangle.diffuseSlice);
+	m_Normal[pixel] = glm::vec4(glm::normalize(normal * w), 1.0f);
+}
+
+void SoftwareRHI::BeginLightingPass()
+{
+	RenderGeometry();
+}
+
+void SoftwareRHI::DrawAmbient(glm::vec3 color)
+{
+	LightCommand light;
+	light.color = color;
+	light.direction = glm::vec3(0.0f);
+	light.ambient = true;
+	m_Lights.push_back(light);
+}
+
+void SoftwareRHI::DrawDirectionalLight(glm::vec3 color, glm::vec3 angles)
+{
+	auto lightDir = glm::vec3(1.0f, 0.0f, 0.0f);
+
+	const auto xDir = glm::vec3(1.0f, 0.0f, 0.0f);
+	const auto yDir = glm::vec3(0.0f, 1.0f, 0.0f);
+	const auto zDir = glm::vec3(0.0f, 0.0f, 1.0f);
+	glm::mat4 xRotMat = glm::rotate(glm::radians(angles.x), xDir);
+	glm::mat4 yRotMat = glm::rotate(glm::radians(angles.y), yDir);
+	glm::mat4 zRotMat = glm::rotate(glm::radians(angles.z), zDir);
+	glm::mat4 rotMat = xRotMat * yRotMat * zRotMat;
+
+	LightCommand light;
+	light.color = color;
+	light.direction = glm::vec3(rotMat * glm::vec4(lightDir, 1.0f));
+	light.ambient = false;
+	m_Lights.push_back(light);
+}
+
+void SoftwareRHI::LightTile(uint32_t tile)
+{
+	uint32_t tileMinX = (tile % m_TilesX) * TileSize;
+	uint32_t tileMinY = (tile / m_TilesX) * TileSize;
+	uint32_t tileEndX = std::min(tileMinX + TileSize, m_Width);
+	uint32_t tileEndY = std::min(tileMinY + TileSize, m_Height);
+
+	for (uint32_t y = tileMinY; y < tileEndY; ++y)
+	{
+		for (uint32_t x = tileMinX; x < tileEndX; ++x)
+		{
+			size_t pixel = size_t(y) * m_Width + x;
+			const glm::vec4& diffuse = m_Color[pixel];
+			const glm::vec3 normal = glm::vec3(m_Normal[pixel]);
+
+			// AmbientPS and DirectionalPS, blended ONE/ONE into a UNORM target, so each is clamped before it adds.
+			glm::vec4 result(0.0f);
+			for (const auto& light : m_Lights)
+			{
+				glm::vec4 contribution;
+				if (light.ambient)
+				{
+					contribution = diffuse * glm::vec4(light.color, 1.0f);
+				}
+				else
+				{
+					float clampedAngle = glm::clamp(glm::dot(normal, -light.direction), 0.0f, 1.0f);
+					contribution = glm::vec4(glm::vec3(diffuse) * light.color * clampedAngle, 1.0f);
+				}
+				result = glm::clamp(result + glm::clamp(contribution, 0.0f, 1.0f), 0.0f, 1.0f);
+			}
+
+			char* out = &m_Output.data[pixel * 4];
+			out[0] = static_cast<char>(static_cast<uint8_t>(result.b * 255.0f + 0.5f));
+			out[1] = static_cast<char>(static_cast<uint8_t>(result.g * 255.0f + 0.5f));
+			out[2] = static_cast<char>(static_cast<uint8_t>(result.r * 255.0f + 0.5f));
+			out[3] = static_cast<char>(static_cast<uint8_t>(result.a * 255.0f + 0.5f));
+		}
+	}
+}
+
+void SoftwareRHI::Present()
+{
+	// Draws made without a lighting pass still reach the G-buffer.
+	if (!m_Draws.empty()) RenderGeometry();
+
+	auto lightingBegin = std::chrono::steady_clock::now();
+	ParallelFor(m_TilesX * m_TilesY, [this](uint32_t tile, uint32_t) { LightTile(tile); });
+	m_Stats.lightingMs += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - lightingBegin).count();
+
+	m_Lights.clear();
+	++m_Stats.numFrames;
+}
+
+void SoftwareRHI::LogStats() const
+{
+	if (m_Stats.numFrames == 0) return;
+
+	double numFrames = static_cast<double>(m_Stats.numFrames);
+	double numBlocks = static_cast<double>(std::max<uint64_t>(m_Stats.numRejectedBlocks + m_Stats.numCoveredBlocks + m_Stats.numPartialBlocks, 1));
+	double frameMs = (m_Stats.geometryMs + m_Stats.rasterMs + m_Stats.lightingMs) / numFrames;
+	SDL_Log("Software RHI on %u threads, per frame over %llu frames: %.0f draws, %.0f triangles (%.0f after clipping and culling, in %.0f tile bins), %.0f pixels shaded.",
+		m_NumWorkers, static_cast<unsigned long long>(m_Stats.numFrames), m_Stats.numDraws / numFrames, m_Stats.numTriangles / numFrames,
+		m_Stats.numSetupTriangles / numFrames, m_Stats.numBinnedTiles / numFrames, m_Stats.numShadedPixels / numFrames);
+	SDL_Log("Software RHI 8x8 blocks: %.1f%% rejected, %.1f%% fully covered, %.1f%% edge tested. Geometry %.3f ms, raster %.3f ms, lighting %.3f ms (%.1f fps rendering).",
+		100.0 * m_Stats.numRejectedBlocks / numBlocks, 100.0 * m_Stats.numCoveredBlocks / numBlocks, 100.0 * m_Stats.numPartialBlocks / numBlocks,
+		m_Stats.geometryMs / numFrames, m_Stats.rasterMs / numFrames, m_Stats.lightingMs / numFrames, 1000.0 / frameMs);
+}
\ No newline at end of file
@@ -0,0 +1,226 @@
+#pragma once
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "CPUTexture.h"
+#include "RHI.h"
+#include "ThreadPool.h"
+
+struct SoftwareRHIStats
+{
+	uint64_t numFrames = 0;
+	uint64_t numDraws = 0;
+	uint64_t numTriangles = 0;			// Submitted
+	uint64_t numSetupTriangles = 0;		// Left after frustum and back-face culling, clipped ones counted per piece
+	uint64_t numBinnedTiles = 0;		// Triangle and tile pairs the binner kept
+	uint64_t numRejectedBlocks = 0;		// 8x8 blocks dropped by their corners without testing a pixel
+	uint64_t numCoveredBlocks = 0;		// 8x8 blocks entirely inside their triangle, drawn without edge tests
+	uint64_t numPartialBlocks = 0;
+	uint64_t numShadedPixels = 0;		// Passed coverage and depth, before the alpha test
+	double geometryMs = 0.0;			// Transform, clip, setup and binning
+	double rasterMs = 0.0;
+	double lightingMs = 0.0;
+};
+
+// Renders the deferred pipeline on the CPU, for machines without a GPU. Geometry is transformed, clipped and
+// set up in parallel chunks of draws that bin their triangles into 64x64 screen tiles. Each tile is then
+// rasterized by one worker, in submission order: 8x8 blocks are rejected or accepted whole from their corners
+// and the rest is tested four pixels at a time with SSE edge functions. Lighting runs per tile over the
+// G-buffer. The output stays in memory and is written to Engine::RHIOutputPath on destruction.
+class SoftwareRHI : public RHI
+{
+public:
+	SoftwareRHI();
+	~SoftwareRHI();
+
+	const char* GetName() const override { return "software"; }
+	bool IsHeadless() const override { return true; }
+	uint32_t GetWindowFlags() const override { return 0; }
+	bool InitRHI(const Window& window) override;
+	void HandleWindowResize(uint32_t windowWidth, uint32_t windowHeight) override;
+
+	using RHI::CreateVertexBuffer;
+	RHIBuffer CreateVertexBuffer(const void* data, uint32_t stride, uint32_t numVertices) override;
+	RHIBuffer CreateIndexBuffer(const std::vector<IndexType>& indices) override;
+	RHIBuffer CreateConstantBuffer(int size) override;
+	bool UpdateConstantBuffer(RHIBuffer buffer, const void* data, int numBytes) override;
+	void UpdateMaterialTable(const std::vector<GPUMaterial>& materials) override;
+
+	RHITexture CreateTexture2D(const CPUTexture& cpuTexture) override;
+	RHITexture CreateTexture2DArray(const TextureArrayPlan& arrayPlan) override;
+	void ReleaseTexture2D(RHITexture texture) override;
+	TexturePackingInput GetTexturePackingInput(RHITexture texture) const override;
+	uint32_t GetMaxTextureArraySlices() const override { return MaxTextureArraySlices; }
+	RHITexture GetDebugTexture2D() override { return m_DebugTexture; }
+
+	void BeginGeometryPass() override;
+	void BeginMaskedGeometryPass() override;
+	void SetGeometryShaderFeatures(uint32_t features) override;
+	void DrawMesh(const Mesh& mesh, RHITexture diffuseTexture, RHITexture maskTexture) override;
+	void BeginLightingPass() override;
+	void DrawAmbient(glm::vec3 color) override;
+	void DrawDirectionalLight(glm::vec3 color, glm::vec3 angles) override;
+	void Present() override;
+
+	void InitImGui(const Window&) override {}
+	void NewImGuiFrame() override {}
+	void RenderImGui() override {}
+	void ShutdownImGui() override {}
+
+	uint32_t GetNumValidationErrors() const override { return 0; }
+	void LogStats() const override;
+	const SoftwareRHIStats& GetStats() const { return m_Stats; }
+	// BGRA8, top row first.
+	const CPUTexture& GetOutput() const { return m_Output; }
+
+private:
+	// Matches D3D11, so packing plans come out the same as on the real backends.
+	static const uint32_t MaxTextureArraySlices = 2048;
+	static const uint32_t TileSize = 64;
+	static const uint32_t BlockSize = 8;
+
+	enum class BufferKind
+	{
+		Vertex,
+		Index,
+		Constant,
+	};
+
+	struct BufferRecord
+	{
+		BufferKind kind;
+		uint32_t stride;
+		std::vector<char> contents;
+	};
+
+	// Levels hold every slice back to back. BC4 is decoded to one byte per texel, BGRA8 is kept as is.
+	struct TextureRecord
+	{
+		CPUTextureFormat format;
+		uint32_t width;
+		uint32_t height;
+		uint32_t mipLevels;
+		uint32_t arraySize;
+		std::vector<std::vector<uint8_t>> levels;
+	};
+
+	struct DrawCommand
+	{
+		const BufferRecord* position;
+		const BufferRecord* normal;
+		const BufferRecord* uv;
+		const BufferRecord* index;
+		uint32_t numIndices;
+		GeometryConstantBufferLayout constants;
+		const TextureRecord* diffuse;
+		const TextureRecord* mask;
+	};
+
+	// value + dx * (x - originX) + dy * (y - originY), in pixels.
+	struct Plane
+	{
+		float value;
+		float dx;
+		float dy;
+	};
+
+	struct RasterTriangle
+	{
+		// Edge i is A * x + B * y + C, positive inside. Shared edges come out exactly negated, so no pixel is
+		// drawn twice or missed, and the top-left rule settles pixel centres on an edge.
+		float edgeA[3];
+		float edgeB[3];
+		float edgeC[3];
+		uint32_t topLeftEdges;
+		float originX;
+		float originY;
+		// Depth, and 1/w with the perspective-divided attributes, linear in screen space.
+		Plane z;
+		Plane invW;
+		Plane u;
+		Plane v;
+		Plane normal[3];
+		int32_t minX;
+		int32_t minY;
+		int32_t maxX;
+		int32_t maxY;
+		const TextureRecord* diffuse;
+		const TextureRecord* mask;
+		uint32_t diffuseSlice;
+		uint32_t maskSlice;
+	};
+
+	// A contiguous run of draws set up by one worker, with its triangles binned per tile.
+	struct GeometryChunk
+	{
+		uint32_t firstDraw;
+		uint32_t endDraw;
+		std::vector<RasterTriangle> triangles;
+		std::vector<std::vector<uint32_t>> bins;
+	};
+
+	struct LightCommand
+	{
+		glm::vec3 color;
+		glm::vec3 direction;
+		bool ambient;
+	};
+
+	// Per worker, summed into m_Stats after each phase so the hot loops don't share cache lines.
+	struct alignas(64) WorkerCounters
+	{
+		uint64_t numSetupTriangles = 0;
+		uint64_t numBinnedTiles = 0;
+		uint64_t numRejectedBlocks = 0;
+		uint64_t numCoveredBlocks = 0;
+		uint64_t numPartialBlocks = 0;
+		uint64_t numShadedPixels = 0;
+	};
+
+	RHITexture AddTexture(std::unique_ptr<TextureRecord> record);
+	void CreateFrameBuffers(uint32_t width, uint32_t height);
+	// Runs func(index, worker) for every index below count, on the pool and the calling thread.
+	void ParallelFor(uint32_t count, const std::function<void(uint32_t index, uint32_t worker)>& func);
+
+	void RenderGeometry();
+	void SetupChunk(GeometryChunk& chunk, WorkerCounters& counters);
+	void SetupTriangle(GeometryChunk& chunk, const DrawCommand& draw, const glm::vec4* clip, const glm::vec3* normals, const glm::vec2* uvs, WorkerCounters& counters);
+	void BinTriangle(GeometryChunk& chunk, uint32_t triangleIndex, WorkerCounters& counters);
+	void RasterizeTile(uint32_t tile, WorkerCounters& counters);
+	void RasterizeTriangle(const RasterTriangle& triangle, int32_t tileMinX, int32_t tileMinY, int32_t tileMaxX, int32_t tileMaxY, WorkerCounters& counters);
+	void ShadePixel(const RasterTriangle& triangle, uint32_t pixel, float x, float y, float z);
+	void LightTile(uint32_t tile);
+
+	uint32_t							m_Width = 0;
+	uint32_t							m_Height = 0;
+	uint32_t							m_TilesX = 0;
+	uint32_t							m_TilesY = 0;
+	std::string							m_OutputPath;
+
+	std::unique_ptr<ThreadPool>			m_Workers;			// The calling thread works too, so this has one thread less
+	uint32_t							m_NumWorkers = 1;
+
+	std::vector<std::unique_ptr<BufferRecord>> m_Buffers;
+	std::map<TextureRecord*, std::unique_ptr<TextureRecord>> m_Textures;
+	RHITexture							m_DebugTexture = nullptr;
+
+	// G-buffer, row-major at full resolution.
+	std::vector<glm::vec4>				m_Color;
+	std::vector<glm::vec4>				m_Normal;
+	std::vector<float>					m_Depth;
+	CPUTexture							m_Output;
+
+	bool								m_MaskedPass = false;
+	std::vector<DrawCommand>			m_Draws;
+	std::vector<GeometryChunk>			m_Chunks;
+	std::vector<LightCommand>			m_Lights;
+	std::vector<WorkerCounters>			m_Counters;
+
+	SoftwareRHIStats					m_Stats;
+};
\ No newline at end of file
@@ -1,16 +1,175 @@
 #include "TextureMap.h"
 
+#include <algorithm>
+#include <set>
+
 #include "Engine.h"
 #include "FileUtils.h"
-#include "D3D11RHI.h"
+#include "Hash.h"
+#include "TexturePacker.h"
+#include "TextureUtils.h"
+
+TextureMap::~TextureMap()
+{
+    // Decode jobs push into uploadQueue, so they must all be done before it goes away.
+    for (auto& entry : map)
+    {
+        if (entry.second.decode.valid()) entry.second.decode.wait();
+    }
+}
+
+TextureHandle TextureMap::GetTexture2DFromPath(const std::string& path)
+{
+    return RequestTextures({ path }, CPUTextureFormat::BGRA8)[0];
+}
+
+TextureHandle TextureMap::GetMaskTextureFromPath(const std::string& path)
+{
+    return RequestTextures({ path }, CPUTextureFormat::BC4)[0];
+}
+
+std::vector<TextureHandle> TextureMap::PrefetchTextures(const std::vector<std::string>& paths, CPUTextureFormat format)
+{
+    return RequestTextures(paths, format);
+}
+
+std::vector<TextureHandle> TextureMap::RequestTextures(const std::vector<std::string>& paths, CPUTextureFormat format)
+{
+    std::vector<TextureHandle> handles;
+    std::vector<std::string> readPaths;
+    std::vector<TextureHandle> readHandles;
+    std::vector<PathEntry*> readEntries;
+    std::vector<std::shared_ptr<std::promise<void>>> readPromises;
+
+    for (const auto& path : paths)
+    {
+        ++stats.numPathLookups;
+        auto key = std::make_pair(path, format);
+        auto iter = map.find(key);
+        if (iter != map.end())
+        {
+            handles.push_back(iter->second.handle);
+            continue;
+        }
+        ++stats.numUniquePaths;
+
+        TextureHandle handle = static_cast<TextureHandle>(slots.size());
+        slots.push_back(Slot());
+        ++numPending;
 
-ID3D11Texture2D* TextureMap::GetTexture2DFromPath(const std::string& path)
+        auto promise = std::make_shared<std::promise<void>>();
+        auto inserted = map.insert({ key, { handle, promise->get_future().share() } });
+        handles.push_back(handle);
+        readPaths.push_back(FileUtils::GetCookedPath(path));
+        readHandles.push_back(handle);
+        readEntries.push_back(&inserted.first->second);
+        readPromises.push_back(promise);
+    }
+    if (readPaths.empty()) return handles;
+
+    // Decoding runs in the read's completion callback, which is already on a pool thread.
+    auto queue = &uploadQueue;
+    FileUtils::ReadFilesAsync(g_Engine->fileReader, readPaths,
+        [format, readPaths, readHandles, readEntries, readPromises, queue](size_t index, std::vector<char>&& fileData) {
+        UploadRequest request;
+        request.handle = readHandles[index];
+        request.path = readEntries[index];
+        if (fileData.empty())
+        {
+            // Still goes through the queue so the pending count drops; the handle keeps resolving to the debug texture.
+            SDL_Log("Failed to read texture \"%s\".", readPaths[index].c_str());
+            queue->Push(request);
+            readPromises[index]->set_value();
+            return;
+        }
+
+        auto cpuTexture = std::make_shared<CPUTexture>(FileUtils::LoadUncompressedTGA(fileData.data(), fileData.size()));
+        fileData = std::vector<char>();
+        TextureUtils::GenerateMips(*cpuTexture);
+        if (format == CPUTextureFormat::BC4)
+        {
+            // Masks are greyscale, so any colour channel will do.
+            TextureUtils::ConvertToBC4Mask(*cpuTexture, 0);
+        }
+
+        request.cpuTexture = cpuTexture;
+        request.contentHash = Hash::HashBytes(cpuTexture->data.data(), cpuTexture->data.size());
+        request.contentHash = Hash::Combine(request.contentHash, (uint64_t(cpuTexture->width) << 32) | uint32_t(cpuTexture->height));
+        request.contentHash = Hash::Combine(request.contentHash, uint64_t(format));
+        queue->Push(request);
+        readPromises[index]->set_value();
+    });
+
+    return handles;
+}
+
+void TextureMap::ProcessUploads(uint32_t maxUploads)
 {
-    auto iter = map.find(path);
-    if (iter != map.end()) return iter->second;
+    UploadRequest request;
+    for (uint32_t uploads = 0; uploads < maxUploads && uploadQueue.Pop(request); ++uploads)
+    {
+        --numPending;
+        // Push is the job's last use of the queue, so the destructor no longer needs to wait for it.
+        request.path->decode = std::shared_future<void>();
+        if (!request.cpuTexture) continue;
+        ++generation;
+        const auto& cpuTexture = *request.cpuTexture;
+        auto& slot = slots[request.handle];
+
+        // A hash match alone could hand one texture's slot to another that only collides with it.
+        auto range = contentMap.equal_range(request.contentHash);
+        auto contentIter = std::find_if(range.first, range.second, [&cpuTexture](const std::pair<const uint64_t, ContentEntry>& entry) {
+            const auto& other = *entry.second.cpuTexture;
+            return other.width == cpuTexture.width && other.height == cpuTexture.height && other.format == cpuTexture.format &&
+                other.data == cpuTexture.data && other.mips == cpuTexture.mips;
+        });
+        if (contentIter != range.second)
+        {
+            ++stats.numContentDuplicates;
+            stats.bytesSaved += TextureUtils::CalcTextureBytes(cpuTexture.width, cpuTexture.height, cpuTexture.format);
+            slot = slots[contentIter->second.handle];
+            continue;
+        }
+
+        slot.texture = g_Engine->rhi->CreateTexture2D(cpuTexture);
+        slot.slice = 0;
+        ++stats.numUniqueTextures;
+        stats.bytesUploaded += TextureUtils::CalcTextureBytes(cpuTexture.width, cpuTexture.height, cpuTexture.format);
+        contentMap.insert({ request.contentHash, { request.handle, request.cpuTexture } });
+    }
 
-    auto cpuTexture = FileUtils::LoadUncompressedTGA(path);
-    auto rhiHandle = g_Engine->rhi.CreateTexture2D(cpuTexture);
-    map.insert({ path, rhiHandle });
-    return rhiHandle;
-}
\ No newline at end of file
+    // No decode left to compare against, so nothing needs the texels any more.
+    if (numPending == 0) contentMap.clear();
+}
+
+ResolvedTexture TextureMap::Resolve(TextureHandle handle) const
+{
+    if (handle == InvalidTextureHandle || !slots[handle].texture)
+    {
+        return { g_Engine->rhi->GetDebugTexture2D(), 0 };
+    }
+    return { slots[handle].texture, slots[handle].slice };
+}
+
+std::vector<RHITexture> TextureMap::GetUniqueTextures() const
+{
+    std::vector<RHITexture> textures;
+    std::set<RHITexture> seen;
+    for (const auto& slot : slots)
+    {
+        if (slot.texture && seen.insert(slot.texture).second) textures.push_back(slot.texture);
+    }
+    return textures;
+}
+
+void TextureMap::ApplyPackingPlan(const TexturePackingPlan& plan, const std::vector<RHITexture>& arrayTextures)
+{
+    ++generation;
+    for (auto& slot : slots)
+    {
+        auto slotIter = plan.slots.find(slot.texture);
+        if (slotIter == plan.slots.end()) continue;
+        slot.texture = arrayTextures[slotIter->second.arrayIndex];
+        slot.slice = slotIter->second.slice;
+    }
+}
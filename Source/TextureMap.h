@@ -1,14 +1,112 @@
 #pragma once
+#include <cstdint>
+#include <future>
+#include <memory>
 #include <string>
 #include <map>
+#include <unordered_map>
+#include <vector>
 
-struct ID3D11Texture2D;
+#include "CPUTexture.h"
+#include "MpscQueue.h"
+#include "RHI.h"
+
+struct TexturePackingPlan;
+
+// Index into the TextureMap's slots. Stays valid while the texture behind it is decoded,
+// uploaded or packed into an array.
+typedef uint32_t TextureHandle;
+const TextureHandle InvalidTextureHandle = 0xFFFFFFFF;
+
+struct ResolvedTexture
+{
+	RHITexture texture;
+	uint32_t slice;
+};
+
+struct TextureMapStats
+{
+	uint32_t numPathLookups = 0;
+	uint32_t numUniquePaths = 0;
+	uint32_t numUniqueTextures = 0;
+	uint32_t numContentDuplicates = 0;
+	uint64_t bytesUploaded = 0;
+	uint64_t bytesSaved = 0;
+};
 
 class TextureMap
 {
 public:
-    ID3D11Texture2D* GetTexture2DFromPath(const std::string& path);
+    ~TextureMap();
+
+    // Returns immediately. The TGA is read on the engine's file reader, then decoded and its mips generated
+    // on the thread pool, and the handle resolves to the debug texture until ProcessUploads has created the real one.
+    TextureHandle GetTexture2DFromPath(const std::string& path);
+    // Same as GetTexture2DFromPath, but keeps only the first channel as a BC4 coverage mask.
+    TextureHandle GetMaskTextureFromPath(const std::string& path);
+    // Requests all the paths in one read batch, so the disk sees the whole scene at once rather than
+    // one texture per mesh. Later lookups of the same paths return the handles issued here.
+    std::vector<TextureHandle> PrefetchTextures(const std::vector<std::string>& paths, CPUTextureFormat format);
+
+    // Creates GPU textures for finished decodes. Must be called on the thread that owns the device.
+    void ProcessUploads(uint32_t maxUploads = UINT32_MAX);
+    bool HasPendingTextures() const { return numPending > 0; }
+
+    ResolvedTexture Resolve(TextureHandle handle) const;
+    // Moves on whenever a handle may start resolving to a different texture or slice.
+    uint32_t GetGeneration() const { return generation; }
+
+    // Unique uploaded textures, for packing into arrays.
+    std::vector<RHITexture> GetUniqueTextures() const;
+    // Points every slot whose texture was packed at its array and slice.
+    void ApplyPackingPlan(const TexturePackingPlan& plan, const std::vector<RHITexture>& arrayTextures);
+
+    const TextureMapStats& GetStats() const { return stats; }
 
 private:
-    std::map<std::string, ID3D11Texture2D*> map;
-};
\ No newline at end of file
+    typedef std::shared_ptr<const CPUTexture> DecodedTexture;
+
+    std::vector<TextureHandle> RequestTextures(const std::vector<std::string>& paths, CPUTextureFormat format);
+
+    struct PathEntry
+    {
+        TextureHandle handle;
+        // Ready once the decode job is done with the upload queue. Holds no texels, and is dropped when
+        // ProcessUploads takes the job's result, after which the handle's slot is all that is left of the path.
+        std::shared_future<void> decode;
+    };
+
+    struct Slot
+    {
+        RHITexture texture = nullptr;
+        uint32_t slice = 0;
+    };
+
+    struct ContentEntry
+    {
+        TextureHandle handle;
+        DecodedTexture cpuTexture;
+    };
+
+    struct UploadRequest
+    {
+        TextureHandle handle = InvalidTextureHandle;
+        PathEntry* path = nullptr;          // Only touched on the device thread
+        DecodedTexture cpuTexture;          // Null if the file couldn't be read
+        uint64_t contentHash = 0;
+    };
+
+    // Keyed by the exact path string and format, so each path is decoded once.
+    std::map<std::pair<std::string, CPUTextureFormat>, PathEntry> map;
+    // Textures uploaded while other decodes are still pending, by a hash of their texels. A later decode with the
+    // same hash and bytes shares the earlier slot. Emptied, texels and all, once nothing is pending.
+    std::unordered_multimap<uint64_t, ContentEntry> contentMap;
+    std::vector<Slot> slots;
+
+    // Filled by decode workers, drained on the device thread.
+    MpscQueue<UploadRequest> uploadQueue;
+    uint32_t numPending = 0;
+    uint32_t generation = 0;
+
+    TextureMapStats stats;
+};
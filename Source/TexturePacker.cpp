@@ -0,0 +1,106 @@
+#include "TexturePacker.h"
+
+#include <algorithm>
+#include <set>
+#include <tuple>
+
+#include "sdl/SDL.h"
+
+namespace TexturePacker
+{
+
+TexturePackingPlan BuildPlan(const std::vector<TexturePackingInput>& inputs, uint32_t maxSlices)
+{
+	TexturePackingPlan plan;
+
+	// Index of the array currently accepting slices for each size/mips/format bucket.
+	std::map<std::tuple<uint32_t, uint32_t, uint32_t, uint32_t>, uint32_t> openArrays;
+
+	for (const auto& input : inputs)
+	{
+		if (plan.slots.count(input.texture)) continue;
+
+		auto key = std::make_tuple(input.width, input.height, input.mipLevels, input.format);
+		auto iter = openArrays.find(key);
+		if (iter == openArrays.end() || plan.arrays[iter->second].slices.size() >= maxSlices)
+		{
+			TextureArrayPlan arrayPlan;
+			arrayPlan.width = input.width;
+			arrayPlan.height = input.height;
+			arrayPlan.mipLevels = input.mipLevels;
+			arrayPlan.format = input.format;
+			plan.arrays.push_back(arrayPlan);
+			openArrays[key] = static_cast<uint32_t>(plan.arrays.size() - 1);
+			iter = openArrays.find(key);
+		}
+
+		auto& arrayPlan = plan.arrays[iter->second];
+		plan.slots[input.texture] = { iter->second, static_cast<uint32_t>(arrayPlan.slices.size()) };
+		arrayPlan.slices.push_back(input.texture);
+	}
+
+	return plan;
+}
+
+bool ValidatePlan(const TexturePackingPlan& plan, const std::vector<TexturePackingInput>& inputs, uint32_t maxSlices)
+{
+	std::set<RHITexture> seen;
+	for (uint32_t arrayIndex = 0; arrayIndex < plan.arrays.size(); ++arrayIndex)
+	{
+		const auto& arrayPlan = plan.arrays[arrayIndex];
+		if (arrayPlan.slices.empty() || arrayPlan.slices.size() > maxSlices)
+		{
+			SDL_Log("Texture array %u has %u slices (max %u).", arrayIndex, (uint32_t)arrayPlan.slices.size(), maxSlices);
+			return false;
+		}
+		for (uint32_t slice = 0; slice < arrayPlan.slices.size(); ++slice)
+		{
+			auto texture = arrayPlan.slices[slice];
+			if (!seen.insert(texture).second)
+			{
+				SDL_Log("Texture packed into more than one slice.");
+				return false;
+			}
+			auto slotIter = plan.slots.find(texture);
+			if (slotIter == plan.slots.end() || slotIter->second.arrayIndex != arrayIndex || slotIter->second.slice != slice)
+			{
+				SDL_Log("Texture array %u slice %u does not match its slot.", arrayIndex, slice);
+				return false;
+			}
+		}
+	}
+
+	for (const auto& input : inputs)
+	{
+		auto slotIter = plan.slots.find(input.texture);
+		if (slotIter == plan.slots.end())
+		{
+			SDL_Log("Texture missing from packing plan.");
+			return false;
+		}
+		const auto& arrayPlan = plan.arrays[slotIter->second.arrayIndex];
+		if (arrayPlan.width != input.width || arrayPlan.height != input.height
+			|| arrayPlan.mipLevels != input.mipLevels || arrayPlan.format != input.format)
+		{
+			SDL_Log("Texture packed into an array of a different size or format.");
+			return false;
+		}
+	}
+
+	return seen.size() == plan.slots.size();
+}
+
+TextureBindStats CountBinds(const std::vector<RHITexture>& drawTextures)
+{
+	TextureBindStats stats;
+	RHITexture lastTexture = nullptr;
+	for (auto texture : drawTextures)
+	{
+		++stats.numDraws;
+		if (texture != lastTexture) ++stats.srvBinds;
+		lastTexture = texture;
+	}
+	return stats;
+}
+
+} // namespace TexturePacker
@@ -0,0 +1,56 @@
+#pragma once
+#include <cstdint>
+#include <map>
+#include <vector>
+
+#include "RHI.h"
+
+// Describes a source texture as far as array packing is concerned.
+struct TexturePackingInput
+{
+	RHITexture			texture;
+	uint32_t			width;
+	uint32_t			height;
+	uint32_t			mipLevels;
+	uint32_t			format;		// Backend specific
+};
+
+struct TextureArraySlot
+{
+	uint32_t arrayIndex;
+	uint32_t slice;
+};
+
+struct TextureArrayPlan
+{
+	uint32_t width;
+	uint32_t height;
+	uint32_t mipLevels;
+	uint32_t format;
+	std::vector<RHITexture> slices;
+};
+
+struct TexturePackingPlan
+{
+	std::vector<TextureArrayPlan> arrays;
+	std::map<RHITexture, TextureArraySlot> slots;
+};
+
+struct TextureBindStats
+{
+	uint32_t numDraws = 0;
+	uint32_t srvBinds = 0;
+};
+
+namespace TexturePacker
+{
+// Groups textures with identical size, mip count and format into arrays of at most maxSlices.
+TexturePackingPlan BuildPlan(const std::vector<TexturePackingInput>& inputs, uint32_t maxSlices);
+
+// Checks every input has exactly one slot, and every array is homogeneous and within maxSlices.
+bool ValidatePlan(const TexturePackingPlan& plan, const std::vector<TexturePackingInput>& inputs, uint32_t maxSlices);
+
+// Counts the SRV binds needed for the given per-draw textures when a bind is only issued
+// if the texture changes between consecutive draws.
+TextureBindStats CountBinds(const std::vector<RHITexture>& drawTextures);
+}
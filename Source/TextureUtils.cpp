@@ -0,0 +1,197 @@
+#include "TextureUtils.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cstdlib>
+
+#include "CPUTexture.h"
+
+namespace TextureUtils
+{
+
+std::vector<char> Downsample(const std::vector<char>& src, uint32_t srcWidth, uint32_t srcHeight, uint32_t dstWidth, uint32_t dstHeight)
+{
+	std::vector<char> dst(dstWidth * dstHeight * 4);
+	for (uint32_t y = 0; y < dstHeight; ++y)
+	{
+		uint32_t y0 = std::min(y * 2, srcHeight - 1);
+		uint32_t y1 = std::min(y * 2 + 1, srcHeight - 1);
+		for (uint32_t x = 0; x < dstWidth; ++x)
+		{
+			uint32_t x0 = std::min(x * 2, srcWidth - 1);
+			uint32_t x1 = std::min(x * 2 + 1, srcWidth - 1);
+			for (uint32_t c = 0; c < 4; ++c)
+			{
+				uint32_t sum = uint8_t(src[(y0 * srcWidth + x0) * 4 + c]) + uint8_t(src[(y0 * srcWidth + x1) * 4 + c])
+					+ uint8_t(src[(y1 * srcWidth + x0) * 4 + c]) + uint8_t(src[(y1 * srcWidth + x1) * 4 + c]);
+				dst[(y * dstWidth + x) * 4 + c] = char((sum + 2) / 4);
+			}
+		}
+	}
+	return dst;
+}
+
+void GenerateMips(CPUTexture& texture)
+{
+	texture.mips.clear();
+
+	const std::vector<char>* level = &texture.data;
+	uint32_t width = texture.width;
+	uint32_t height = texture.height;
+	while (width > 1 || height > 1)
+	{
+		uint32_t nextWidth = std::max(width / 2, 1u);
+		uint32_t nextHeight = std::max(height / 2, 1u);
+		texture.mips.push_back(Downsample(*level, width, height, nextWidth, nextHeight));
+		level = &texture.mips.back();
+		width = nextWidth;
+		height = nextHeight;
+	}
+}
+
+uint64_t CalcTextureBytes(int width, int height, CPUTextureFormat format)
+{
+	uint64_t bytes = 0;
+	while (true)
+	{
+		uint32_t rows = format == CPUTextureFormat::BC4 ? (height + 3) / 4 : height;
+		bytes += uint64_t(CalcRowPitch(width, format)) * rows;
+		if (width == 1 && height == 1) break;
+		width = std::max(width / 2, 1);
+		height = std::max(height / 2, 1);
+	}
+	return bytes;
+}
+
+uint32_t CalcRowPitch(int width, CPUTextureFormat format)
+{
+	switch (format)
+	{
+	case CPUTextureFormat::BC4: return std::max((width + 3) / 4, 1) * 8;
+	default: return width * 4;
+	}
+}
+
+std::vector<char> EncodeBC4(const std::vector<char>& bgra, uint32_t width, uint32_t height, uint32_t channel)
+{
+	uint32_t blocksX = std::max((width + 3) / 4, 1u);
+	uint32_t blocksY = std::max((height + 3) / 4, 1u);
+	std::vector<char> out(blocksX * blocksY * 8);
+
+	for (uint32_t blockY = 0; blockY < blocksY; ++blockY)
+	{
+		for (uint32_t blockX = 0; blockX < blocksX; ++blockX)
+		{
+			// Gather the block, clamping at the edges of levels smaller than a block.
+			uint8_t values[16];
+			uint8_t minValue = 255, maxValue = 0;
+			for (uint32_t i = 0; i < 16; ++i)
+			{
+				uint32_t x = std::min(blockX * 4 + i % 4, width - 1);
+				uint32_t y = std::min(blockY * 4 + i / 4, height - 1);
+				values[i] = uint8_t(bgra[(y * width + x) * 4 + channel]);
+				minValue = std::min(minValue, values[i]);
+				maxValue = std::max(maxValue, values[i]);
+			}
+
+			// red0 > red1 selects the 8-value mode. With red0 == red1 every index decodes to red0.
+			uint8_t palette[8];
+			palette[0] = maxValue;
+			palette[1] = minValue;
+			for (uint32_t i = 1; i < 7; ++i)
+			{
+				palette[i + 1] = uint8_t(((7 - i) * maxValue + i * minValue + 3) / 7);
+			}
+
+			uint64_t indices = 0;
+			for (uint32_t i = 0; i < 16; ++i)
+			{
+				uint32_t best = 0;
+				int bestError = 256;
+				for (uint32_t p = 0; p < 8; ++p)
+				{
+					int error = std::abs(int(values[i]) - int(palette[p]));
+					if (error < bestError)
+					{
+						bestError = error;
+						best = p;
+					}
+				}
+				indices |= uint64_t(best) << (3 * i);
+			}
+
+			char* block = &out[(blockY * blocksX + blockX) * 8];
+			block[0] = char(maxValue);
+			block[1] = char(minValue);
+			for (uint32_t i = 0; i < 6; ++i)
+			{
+				block[2 + i] = char((indices >> (8 * i)) & 0xFF);
+			}
+		}
+	}
+
+	return out;
+}
+
+std::vector<uint8_t> DecodeBC4(const std::vector<char>& blocks, uint32_t width, uint32_t height)
+{
+	uint32_t blocksX = std::max((width + 3) / 4, 1u);
+	uint32_t blocksY = std::max((height + 3) / 4, 1u);
+	assert(blocks.size() >= blocksX * blocksY * 8);
+	std::vector<uint8_t> out(width * height);
+
+	for (uint32_t blockY = 0; blockY < blocksY; ++blockY)
+	{
+		for (uint32_t blockX = 0; blockX < blocksX; ++blockX)
+		{
+			const char* block = &blocks[(blockY * blocksX + blockX) * 8];
+			uint8_t red0 = uint8_t(block[0]);
+			uint8_t red1 = uint8_t(block[1]);
+
+			// Both modes, as encoders other than EncodeBC4 may have written the 6-value one.
+			uint8_t palette[8];
+			palette[0] = red0;
+			palette[1] = red1;
+			if (red0 > red1)
+			{
+				for (uint32_t i = 1; i < 7; ++i) palette[i + 1] = uint8_t(((7 - i) * red0 + i * red1 + 3) / 7);
+			}
+			else
+			{
+				for (uint32_t i = 1; i < 5; ++i) palette[i + 1] = uint8_t(((5 - i) * red0 + i * red1 + 2) / 5);
+				palette[6] = 0;
+				palette[7] = 255;
+			}
+
+			uint64_t indices = 0;
+			for (uint32_t i = 0; i < 6; ++i) indices |= uint64_t(uint8_t(block[2 + i])) << (8 * i);
+
+			for (uint32_t i = 0; i < 16; ++i)
+			{
+				uint32_t x = blockX * 4 + i % 4;
+				uint32_t y = blockY * 4 + i / 4;
+				if (x < width && y < height) out[y * width + x] = palette[(indices >> (3 * i)) & 7];
+			}
+		}
+	}
+
+	return out;
+}
+
+void ConvertToBC4Mask(CPUTexture& texture, uint32_t channel)
+{
+	assert(texture.format == CPUTextureFormat::BGRA8);
+
+	uint32_t width = texture.width;
+	uint32_t height = texture.height;
+	texture.data = EncodeBC4(texture.data, width, height, channel);
+	for (auto& mip : texture.mips)
+	{
+		width = std::max(width / 2, 1u);
+		height = std::max(height / 2, 1u);
+		mip = EncodeBC4(mip, width, height, channel);
+	}
+	texture.format = CPUTextureFormat::BC4;
+}
+
+} // namespace TextureUtils
@@ -0,0 +1,30 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+
+#include "CPUTexture.h"
+
+namespace TextureUtils
+{
+// 2x2 box filter of a BGRA8 image. Odd edges clamp to the last row/column.
+std::vector<char> Downsample(const std::vector<char>& src, uint32_t srcWidth, uint32_t srcHeight, uint32_t dstWidth, uint32_t dstHeight);
+
+// Fills texture.mips with every level below the top one, down to 1x1.
+void GenerateMips(CPUTexture& texture);
+
+// Bytes taken by the texture and its full mip chain.
+uint64_t CalcTextureBytes(int width, int height, CPUTextureFormat format = CPUTextureFormat::BGRA8);
+
+// Bytes between rows of a level: texel rows for BGRA8, block rows for BC4.
+uint32_t CalcRowPitch(int width, CPUTextureFormat format);
+
+// Block-compresses one channel (0 = B, 3 = A) of a BGRA8 image to BC4. Each block uses the
+// 8-value mode between its min and max, so binary masks round-trip exactly.
+std::vector<char> EncodeBC4(const std::vector<char>& bgra, uint32_t width, uint32_t height, uint32_t channel);
+
+// Expands a BC4 level back to one byte per texel, for samplers that run on the CPU.
+std::vector<uint8_t> DecodeBC4(const std::vector<char>& blocks, uint32_t width, uint32_t height);
+
+// Turns a BGRA8 texture with mips into a single-channel BC4 coverage mask.
+void ConvertToBC4Mask(CPUTexture& texture, uint32_t channel);
+}
@@ -0,0 +1,44 @@
+#pragma once
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed set of worker threads pulling jobs from a shared FIFO.
+class ThreadPool
+{
+public:
+	// 0 uses one thread per hardware thread, leaving one for the main thread.
+	explicit ThreadPool(uint32_t numThreads = 0);
+	~ThreadPool();
+
+	ThreadPool(const ThreadPool&) = delete;
+	ThreadPool& operator=(const ThreadPool&) = delete;
+
+	void Enqueue(std::function<void()> job);
+
+	template <typename F>
+	auto Submit(F&& func) -> std::future<decltype(func())>
+	{
+		// std::function needs a copyable callable, so the task lives behind a shared_ptr.
+		auto task = std::make_shared<std::packaged_task<decltype(func())()>>(std::forward<F>(func));
+		auto future = task->get_future();
+		Enqueue([task]() { (*task)(); });
+		return future;
+	}
+
+	uint32_t GetNumThreads() const { return static_cast<uint32_t>(m_Threads.size()); }
+
+private:
+	void WorkerLoop();
+
+	std::vector<std::thread>			m_Threads;
+	std::deque<std::function<void()>>	m_Jobs;
+	std::mutex							m_Mutex;
+	std::condition_variable				m_Condition;
+	bool								m_Stopping = false;
+};
@@ -1,15 +1,57 @@
 #pragma once
-#include <memory>
+#include <cstdlib>
 
+// Owns a pointer and destroys it with a deleter function, like std::unique_ptr, but can also hand out the
+// address of the stored pointer for APIs that create objects through an out parameter.
 template <typename T>
-class UniquePtr : public std::unique_ptr<T, void(*)(T* ptr)>
+class UniquePtr
 {
 public:
 	// Constructor taking a specific deleter function to be called on destruction
-	UniquePtr(void(deleter)(T* ptr)) : std::unique_ptr<T, void(*)(T* ptr)>(nullptr, deleter) {};
+	UniquePtr(void(deleter)(T* ptr)) : m_Deleter(deleter) {};
+
+	UniquePtr(UniquePtr&& other) noexcept : m_Ptr(other.m_Ptr), m_Deleter(other.m_Deleter) { other.m_Ptr = nullptr; }
+	UniquePtr& operator=(UniquePtr&& other) noexcept
+	{
+		if (this != &other)
+		{
+			reset(other.release());
+			m_Deleter = other.m_Deleter;
+		}
+		return *this;
+	}
+	UniquePtr(const UniquePtr&) = delete;
+	UniquePtr& operator=(const UniquePtr&) = delete;
+
+	~UniquePtr() { reset(); }
+
+	T* get() const { return m_Ptr; }
+	T* operator->() const { return m_Ptr; }
+	T& operator*() const { return *m_Ptr; }
+	explicit operator bool() const { return m_Ptr != nullptr; }
+
+	// Destroys the current pointer, if any, and takes ownership of the new one.
+	void reset(T* ptr = nullptr)
+	{
+		T* old = m_Ptr;
+		m_Ptr = ptr;
+		if (old) m_Deleter(old);
+	}
+
+	// Gives up ownership without destroying.
+	T* release()
+	{
+		T* ptr = m_Ptr;
+		m_Ptr = nullptr;
+		return ptr;
+	}
 
 	// Returns a pointer to the internal pointer storage.
-	T** GetRef() { return reinterpret_cast<T**>(&_Mypair._Get_second()); }
+	T** GetRef() { return &m_Ptr; }
+
+private:
+	T* m_Ptr = nullptr;
+	void(*m_Deleter)(T* ptr);
 };
 
 template <typename T>
@@ -20,7 +62,7 @@ public:
 	UniqueReleasePtr() : UniquePtr<T>([](T* ptr) { ptr->Release(); }) {}
 
 	// Construct with a pointer
-	UniqueReleasePtr(T* ptr) : UniquePtr<T>([](T* ptr) { ptr->Release(); }) { reset(ptr); }
+	UniqueReleasePtr(T* ptr) : UniquePtr<T>([](T* ptr) { ptr->Release(); }) { this->reset(ptr); }
 };
 
 template <typename T>
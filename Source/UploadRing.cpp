@@ -0,0 +1,60 @@
+#include "UploadRing.h"
+
+#include <algorithm>
+#include <cassert>
+
+#include "sdl/SDL.h"
+
+void UploadRing::Init(uint32_t frameSize, uint32_t numFrames)
+{
+	assert(frameSize > 0 && numFrames > 0);
+	m_FrameSize = frameSize;
+	m_NumFrames = numFrames;
+	m_FrameIndex = 0;
+	m_Used = 0;
+	m_Stats = UploadRingStats();
+}
+
+void UploadRing::Resize(uint32_t frameSize)
+{
+	assert(frameSize > 0);
+	m_FrameSize = frameSize;
+	m_Used = 0;
+	m_FullLogged = false;
+}
+
+void UploadRing::BeginFrame(uint32_t frameIndex)
+{
+	assert(frameIndex < m_NumFrames);
+	m_FrameIndex = frameIndex;
+	m_Used = 0;
+	++m_Stats.numFrames;
+}
+
+bool UploadRing::Allocate(uint32_t size, uint32_t alignment, uint32_t& offset)
+{
+	assert(alignment > 0);
+	uint32_t begin = AlignUp(m_Used, alignment);
+	if (begin > m_FrameSize || size > m_FrameSize - begin)
+	{
+		if (!m_FullLogged) SDL_Log("Upload ring is full (%u KB per frame), uploads are being dropped.", m_FrameSize / 1024);
+		m_FullLogged = true;
+		++m_Stats.numFailedAllocations;
+		return false;
+	}
+
+	m_Used = begin + size;
+	m_Stats.bytesUploaded += size;
+	m_Stats.peakFrameBytes = std::max(m_Stats.peakFrameBytes, m_Used);
+	offset = m_FrameIndex * m_FrameSize + begin;
+	return true;
+}
+
+void UploadRing::LogStats(const char* name) const
+{
+	if (m_Stats.numFrames == 0) return;
+
+	SDL_Log("%s upload ring: %.1f KB uploaded per frame, peak %.1f of %u KB, %llu stalls, %llu failed allocations.", name,
+		m_Stats.bytesUploaded / double(m_Stats.numFrames) / 1024.0, m_Stats.peakFrameBytes / 1024.0, m_FrameSize / 1024,
+		static_cast<unsigned long long>(m_Stats.numStalls), static_cast<unsigned long long>(m_Stats.numFailedAllocations));
+}
\ No newline at end of file
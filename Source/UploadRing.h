@@ -0,0 +1,50 @@
+#pragma once
+#include <cstdint>
+
+struct UploadRingStats
+{
+	uint64_t numFrames = 0;
+	uint64_t bytesUploaded = 0;			// As requested, without alignment padding
+	uint32_t peakFrameBytes = 0;		// Most of one frame's part ever used, padding included
+	uint64_t numFailedAllocations = 0;
+	uint64_t numStalls = 0;				// Frames the backend had to wait on the GPU for before reusing their part
+};
+
+// Offsets into an upload buffer split evenly between the frames in flight. Each frame's part is bump
+// allocated and emptied when that frame comes round again. Owns no memory and knows nothing about the API:
+// the backend writes at the offsets, fences each part at the end of its frame and waits on that fence
+// before calling BeginFrame for the part again, so the GPU never reads data that is being overwritten.
+class UploadRing
+{
+public:
+	void Init(uint32_t frameSize, uint32_t numFrames);
+	// Changes the size of every frame's part, keeping the stats. Every offset moves, so the backend must have
+	// moved to a new buffer, and the current frame starts empty.
+	void Resize(uint32_t frameSize);
+
+	// Starts allocating from the start of frameIndex's part.
+	void BeginFrame(uint32_t frameIndex);
+	// Returns false, and logs once, when the frame's part can't fit size more bytes.
+	bool Allocate(uint32_t size, uint32_t alignment, uint32_t& offset);
+	void AddStall() { ++m_Stats.numStalls; }
+
+	uint32_t GetFrameSize() const { return m_FrameSize; }
+	uint32_t GetTotalSize() const { return m_FrameSize * m_NumFrames; }
+	uint32_t GetFrameIndex() const { return m_FrameIndex; }
+	// Bytes used in the current frame's part, padding included.
+	uint32_t GetFrameUsed() const { return m_Used; }
+
+	const UploadRingStats& GetStats() const { return m_Stats; }
+	// One line of per frame averages, prefixed with the name.
+	void LogStats(const char* name) const;
+
+	static uint32_t AlignUp(uint32_t value, uint32_t alignment) { return (value + alignment - 1) / alignment * alignment; }
+
+private:
+	uint32_t		m_FrameSize = 0;
+	uint32_t		m_NumFrames = 0;
+	uint32_t		m_FrameIndex = 0;
+	uint32_t		m_Used = 0;
+	bool			m_FullLogged = false;
+	UploadRingStats	m_Stats;
+};
\ No newline at end of file
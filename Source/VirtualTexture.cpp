@@ -0,0 +1,477 @@
+#include "VirtualTexture.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+#include <map>
+
+#include "sdl/SDL.h"
+
+#include "CPUTexture.h"
+#include "FileUtils.h"
+#include "TextureUtils.h"
+
+using namespace VirtualTexture;
+
+namespace
+{
+uint32_t DivRoundUp(uint32_t value, uint32_t divisor)
+{
+	return (value + divisor - 1) / divisor;
+}
+
+uint32_t CalcNumMips(uint32_t width, uint32_t height)
+{
+	uint32_t numMips = 1;
+	while ((width > 1 || height > 1) && numMips < MaxMips)
+	{
+		width = std::max(width / 2, 1u);
+		height = std::max(height / 2, 1u);
+		++numMips;
+	}
+	return numMips;
+}
+}
+
+CookedVirtualTexture CookedVirtualTexture::CookLayout(uint32_t width, uint32_t height)
+{
+	assert(width > 0 && height > 0);
+
+	CookedVirtualTexture cooked;
+	cooked.width = width;
+	cooked.height = height;
+	cooked.numMips = CalcNumMips(width, height);
+
+	uint32_t numPages = 0;
+	for (uint32_t mip = 0; mip < cooked.numMips; ++mip)
+	{
+		uint32_t mipWidth = std::max(width >> mip, 1u);
+		uint32_t mipHeight = std::max(height >> mip, 1u);
+		cooked.pagesX.push_back(DivRoundUp(mipWidth, PageSize));
+		cooked.pagesY.push_back(DivRoundUp(mipHeight, PageSize));
+		cooked.firstPage.push_back(numPages);
+		numPages += cooked.pagesX.back() * cooked.pagesY.back();
+	}
+
+	// The feedback encoding only has 10 bits per page coordinate.
+	assert(cooked.pagesX[0] <= 1024 && cooked.pagesY[0] <= 1024);
+	return cooked;
+}
+
+CookedVirtualTexture CookedVirtualTexture::Cook(const CPUTexture& texture)
+{
+	auto cooked = CookLayout(texture.width, texture.height);
+	cooked.pages.resize(cooked.GetNumPages());
+
+	std::vector<char> level = texture.data;
+	uint32_t levelWidth = texture.width;
+	uint32_t levelHeight = texture.height;
+	for (uint32_t mip = 0; mip < cooked.numMips; ++mip)
+	{
+		if (mip > 0)
+		{
+			uint32_t nextWidth = std::max(levelWidth / 2, 1u);
+			uint32_t nextHeight = std::max(levelHeight / 2, 1u);
+			level = TextureUtils::Downsample(level, levelWidth, levelHeight, nextWidth, nextHeight);
+			levelWidth = nextWidth;
+			levelHeight = nextHeight;
+		}
+
+		for (uint32_t pageY = 0; pageY < cooked.pagesY[mip]; ++pageY)
+		{
+			for (uint32_t pageX = 0; pageX < cooked.pagesX[mip]; ++pageX)
+			{
+				auto& page = cooked.pages[cooked.GetPageIndex(mip, pageX, pageY)];
+				page.resize(PageSize * PageSize * 4);
+
+				// Pages hanging off the edge of the level repeat its last row/column.
+				for (uint32_t y = 0; y < PageSize; ++y)
+				{
+					uint32_t srcY = std::min(pageY * PageSize + y, levelHeight - 1);
+					for (uint32_t x = 0; x < PageSize; ++x)
+					{
+						uint32_t srcX = std::min(pageX * PageSize + x, levelWidth - 1);
+						memcpy(&page[(y * PageSize + x) * 4], &level[(srcY * levelWidth + srcX) * 4], 4);
+					}
+				}
+			}
+		}
+	}
+
+	return cooked;
+}
+
+void PhysicalPageCache::Init(uint32_t numSlots)
+{
+	m_Slots.clear();
+	m_Slots.resize(numSlots);
+	m_Lru.clear();
+	m_PageToSlot.clear();
+	for (uint32_t slot = 0; slot < numSlots; ++slot)
+	{
+		m_Slots[slot].lruIter = m_Lru.insert(m_Lru.end(), slot);
+	}
+}
+
+uint32_t PhysicalPageCache::Find(uint32_t page) const
+{
+	auto iter = m_PageToSlot.find(page);
+	return iter != m_PageToSlot.end() ? iter->second : InvalidSlot;
+}
+
+void PhysicalPageCache::Touch(uint32_t slot, uint32_t frame)
+{
+	auto& entry = m_Slots[slot];
+	entry.lastUsedFrame = frame;
+	if (entry.pinned) return;
+	m_Lru.splice(m_Lru.end(), m_Lru, entry.lruIter);
+}
+
+uint32_t PhysicalPageCache::Allocate(uint32_t page, uint32_t frame, bool pinned, uint32_t* evictedPage)
+{
+	assert(Find(page) == InvalidSlot);
+	*evictedPage = InvalidFeedback;
+
+	if (m_Lru.empty()) return InvalidSlot;
+	uint32_t slot = m_Lru.front();
+	auto& entry = m_Slots[slot];
+	if (entry.page != InvalidFeedback)
+	{
+		// Everything older has been used this frame too, so the cache is oversubscribed.
+		if (entry.lastUsedFrame == frame) return InvalidSlot;
+		*evictedPage = entry.page;
+		m_PageToSlot.erase(entry.page);
+	}
+
+	entry.page = page;
+	entry.lastUsedFrame = frame;
+	entry.pinned = pinned;
+	m_PageToSlot[page] = slot;
+	m_Lru.erase(entry.lruIter);
+	entry.lruIter = pinned ? m_Lru.end() : m_Lru.insert(m_Lru.end(), slot);
+	return slot;
+}
+
+void PhysicalPageCache::Free(uint32_t slot)
+{
+	auto& entry = m_Slots[slot];
+	if (entry.page == InvalidFeedback) return;
+
+	m_PageToSlot.erase(entry.page);
+	if (!entry.pinned) m_Lru.erase(entry.lruIter);
+	entry = Slot();
+	entry.lruIter = m_Lru.insert(m_Lru.begin(), slot);
+}
+
+void VirtualTextureSystem::Init(const VirtualTextureConfig& config)
+{
+	m_Config = config;
+	m_Cache.Init(config.numPhysicalPages);
+	m_Textures.clear();
+	m_Indirection.clear();
+	m_IndirectionDirty.clear();
+	m_PendingLoads.clear();
+	m_Frame = 0;
+}
+
+bool VirtualTextureSystem::RegisterTexture(CookedVirtualTexture&& cooked, uint32_t& textureId)
+{
+	textureId = static_cast<uint32_t>(m_Textures.size());
+	if (textureId >= MaxTextures)
+	{
+		SDL_Log("Too many virtual textures, the feedback encoding only has room for %u.", MaxTextures);
+		return false;
+	}
+	m_Textures.push_back(std::move(cooked));
+	m_Indirection.emplace_back(m_Textures.back().GetNumPages(), IndirectionEntry{ PhysicalPageCache::InvalidSlot, 0 });
+	m_IndirectionDirty.push_back(false);
+
+	// Pin the coarsest mip so every lookup has something to fall back to.
+	const auto& texture = m_Textures.back();
+	uint32_t lastMip = texture.numMips - 1;
+	VirtualTextureFrameStats unused;
+	for (uint32_t y = 0; y < texture.pagesY[lastMip]; ++y)
+	{
+		for (uint32_t x = 0; x < texture.pagesX[lastMip]; ++x)
+		{
+			if (LoadPage(PackPage(textureId, lastMip, x, y), true, unused)) continue;
+
+			SDL_Log("No room to pin the last mip of virtual texture %u (%ux%u) in %u physical pages.",
+				textureId, texture.width, texture.height, m_Cache.GetNumSlots());
+			for (uint32_t pinnedY = 0; pinnedY < texture.pagesY[lastMip]; ++pinnedY)
+			{
+				for (uint32_t pinnedX = 0; pinnedX < texture.pagesX[lastMip]; ++pinnedX)
+				{
+					uint32_t slot = m_Cache.Find(PackPage(textureId, lastMip, pinnedX, pinnedY));
+					if (slot != PhysicalPageCache::InvalidSlot) m_Cache.Free(slot);
+				}
+			}
+			m_Textures.pop_back();
+			m_Indirection.pop_back();
+			m_IndirectionDirty.pop_back();
+			return false;
+		}
+	}
+	RebuildIndirection(textureId);
+	return true;
+}
+
+bool VirtualTextureSystem::IsValidPage(uint32_t page) const
+{
+	auto textureId = PageTextureId(page);
+	if (textureId >= m_Textures.size()) return false;
+	const auto& texture = m_Textures[textureId];
+	auto mip = PageMip(page);
+	return mip < texture.numMips && PageX(page) < texture.pagesX[mip] && PageY(page) < texture.pagesY[mip];
+}
+
+std::vector<VirtualTextureSystem::PageRequest> VirtualTextureSystem::AnalyzeFeedback(const uint32_t* feedback, size_t numEntries) const
+{
+	// std::map keeps the ordering independent of hashing, so replays are bit-for-bit repeatable.
+	std::map<uint32_t, uint32_t> counts;
+	for (size_t i = 0; i < numEntries; ++i)
+	{
+		uint32_t page = feedback[i];
+		if (page == InvalidFeedback || !IsValidPage(page)) continue;
+		++counts[page];
+	}
+
+	// Every requested page also needs its ancestors, so a fine page is never shown without a coarser fallback.
+	std::map<uint32_t, uint32_t> withAncestors = counts;
+	for (const auto& request : counts)
+	{
+		uint32_t page = request.first;
+		uint32_t textureId = PageTextureId(page);
+		uint32_t x = PageX(page);
+		uint32_t y = PageY(page);
+		for (uint32_t mip = PageMip(page) + 1; mip < m_Textures[textureId].numMips; ++mip)
+		{
+			x = std::min(x / 2, m_Textures[textureId].pagesX[mip] - 1);
+			y = std::min(y / 2, m_Textures[textureId].pagesY[mip] - 1);
+			withAncestors[PackPage(textureId, mip, x, y)] += request.second;
+		}
+	}
+
+	std::vector<PageRequest> requests;
+	for (const auto& request : withAncestors) requests.push_back({ request.first, request.second });
+
+	// Coarse mips first so fallbacks arrive before detail, then by how much of the screen wants them.
+	std::sort(requests.begin(), requests.end(), [](const PageRequest& a, const PageRequest& b) {
+		if (PageMip(a.page) != PageMip(b.page)) return PageMip(a.page) > PageMip(b.page);
+		if (a.count != b.count) return a.count > b.count;
+		return a.page < b.page;
+	});
+	return requests;
+}
+
+bool VirtualTextureSystem::LoadPage(uint32_t page, bool pinned, VirtualTextureFrameStats& stats)
+{
+	uint32_t evictedPage;
+	uint32_t slot = m_Cache.Allocate(page, m_Frame, pinned, &evictedPage);
+	if (slot == PhysicalPageCache::InvalidSlot) return false;
+
+	if (evictedPage != InvalidFeedback)
+	{
+		++stats.pagesEvicted;
+		m_IndirectionDirty[PageTextureId(evictedPage)] = true;
+	}
+
+	auto textureId = PageTextureId(page);
+	const auto& texture = m_Textures[textureId];
+	if (m_UploadCallback)
+	{
+		auto pageIndex = texture.GetPageIndex(PageMip(page), PageX(page), PageY(page));
+		m_UploadCallback(slot, texture.pages.empty() ? nullptr : texture.pages[pageIndex].data());
+	}
+
+	++stats.pagesLoaded;
+	m_IndirectionDirty[textureId] = true;
+	return true;
+}
+
+VirtualTextureFrameStats VirtualTextureSystem::Update(const uint32_t* feedback, size_t numEntries)
+{
+	++m_Frame;
+
+	VirtualTextureFrameStats stats;
+	stats.frame = m_Frame;
+	stats.feedbackEntries = static_cast<uint32_t>(numEntries);
+
+	auto requests = AnalyzeFeedback(feedback, numEntries);
+	stats.uniquePagesRequested = static_cast<uint32_t>(requests.size());
+
+	// Refresh everything still wanted first, so it cannot be evicted by this frame's loads.
+	std::vector<uint32_t> missing;
+	for (const auto& request : requests)
+	{
+		uint32_t slot = m_Cache.Find(request.page);
+		if (slot != PhysicalPageCache::InvalidSlot)
+		{
+			m_Cache.Touch(slot, m_Frame);
+			++stats.pagesAlreadyResident;
+		}
+		else
+		{
+			missing.push_back(request.page);
+		}
+	}
+
+	for (auto page : missing)
+	{
+		bool pending = std::any_of(m_PendingLoads.begin(), m_PendingLoads.end(), [&](const PendingLoad& load) { return load.page == page; });
+		if (!pending) m_PendingLoads.push_back({ page, m_Frame + m_Config.loadLatencyFrames });
+	}
+
+	// Complete loads in request order, up to the upload budget.
+	uint32_t uploads = 0;
+	for (auto iter = m_PendingLoads.begin(); iter != m_PendingLoads.end();)
+	{
+		if (iter->readyFrame > m_Frame || uploads >= m_Config.maxUploadsPerFrame)
+		{
+			++iter;
+			continue;
+		}
+		if (m_Cache.Find(iter->page) == PhysicalPageCache::InvalidSlot && !LoadPage(iter->page, false, stats))
+		{
+			break;
+		}
+		++uploads;
+		iter = m_PendingLoads.erase(iter);
+	}
+	stats.pagesDeferred = static_cast<uint32_t>(m_PendingLoads.size());
+
+	for (uint32_t textureId = 0; textureId < m_Textures.size(); ++textureId)
+	{
+		if (m_IndirectionDirty[textureId]) RebuildIndirection(textureId);
+	}
+
+	stats.pagesResident = m_Cache.GetNumResident();
+	return stats;
+}
+
+void VirtualTextureSystem::RebuildIndirection(uint32_t textureId)
+{
+	const auto& texture = m_Textures[textureId];
+	auto& table = m_Indirection[textureId];
+
+	// Walk from the coarsest mip down, inheriting the parent's entry wherever a page isn't resident.
+	for (int mip = int(texture.numMips) - 1; mip >= 0; --mip)
+	{
+		for (uint32_t y = 0; y < texture.pagesY[mip]; ++y)
+		{
+			for (uint32_t x = 0; x < texture.pagesX[mip]; ++x)
+			{
+				auto& entry = table[texture.GetPageIndex(mip, x, y)];
+				uint32_t slot = m_Cache.Find(PackPage(textureId, mip, x, y));
+				if (slot != PhysicalPageCache::InvalidSlot)
+				{
+					entry = { slot, uint32_t(mip) };
+				}
+				else if (mip + 1 < int(texture.numMips))
+				{
+					uint32_t parentX = std::min(x / 2, texture.pagesX[mip + 1] - 1);
+					uint32_t parentY = std::min(y / 2, texture.pagesY[mip + 1] - 1);
+					entry = table[texture.GetPageIndex(mip + 1, parentX, parentY)];
+				}
+				else
+				{
+					entry = { PhysicalPageCache::InvalidSlot, uint32_t(mip) };
+				}
+			}
+		}
+	}
+
+	m_IndirectionDirty[textureId] = false;
+}
+
+namespace
+{
+const uint32_t RecordingMagic = 0x42465456; // 'VTFB'
+const uint32_t RecordingVersion = 1;
+
+template <typename T>
+void Write(std::vector<char>& out, const T& value)
+{
+	auto bytes = reinterpret_cast<const char*>(&value);
+	out.insert(out.end(), bytes, bytes + sizeof(T));
+}
+
+template <typename T>
+bool Read(const FileUtils::FileView& in, size_t& offset, T& value)
+{
+	if (offset + sizeof(T) > in.size()) return false;
+	memcpy(&value, in.data() + offset, sizeof(T));
+	offset += sizeof(T);
+	return true;
+}
+}
+
+bool VirtualTextureRecording::Save(const std::string& absPath) const
+{
+	std::vector<char> out;
+	Write(out, RecordingMagic);
+	Write(out, RecordingVersion);
+	Write(out, uint32_t(textures.size()));
+	for (const auto& texture : textures)
+	{
+		Write(out, texture.width);
+		Write(out, texture.height);
+		Write(out, uint32_t(texture.path.size()));
+		out.insert(out.end(), texture.path.begin(), texture.path.end());
+	}
+	Write(out, uint32_t(frames.size()));
+	for (const auto& frame : frames)
+	{
+		Write(out, uint32_t(frame.size()));
+		auto bytes = reinterpret_cast<const char*>(frame.data());
+		out.insert(out.end(), bytes, bytes + frame.size() * sizeof(uint32_t));
+	}
+
+	SDL_RWops* file = SDL_RWFromFile(absPath.c_str(), "wb");
+	if (!file)
+	{
+		SDL_Log("Unable to open \"%s\" for writing.", absPath.c_str());
+		return false;
+	}
+	bool ok = SDL_RWwrite(file, out.data(), out.size(), 1) == 1;
+	SDL_RWclose(file);
+	return ok;
+}
+
+bool VirtualTextureRecording::Load(const std::string& absPath)
+{
+	auto in = FileUtils::MapFileAbsolute(absPath, FileUtils::AccessHint::Sequential);
+	if (!in.IsValid()) return false;
+	size_t offset = 0;
+
+	uint32_t magic, version, numTextures, numFrames;
+	if (!Read(in, offset, magic) || magic != RecordingMagic || !Read(in, offset, version) || version != RecordingVersion)
+	{
+		SDL_Log("\"%s\" is not a virtual texture feedback recording.", absPath.c_str());
+		return false;
+	}
+
+	if (!Read(in, offset, numTextures)) return false;
+	textures.resize(numTextures);
+	for (auto& texture : textures)
+	{
+		uint32_t pathLength;
+		if (!Read(in, offset, texture.width) || !Read(in, offset, texture.height) || !Read(in, offset, pathLength)) return false;
+		if (offset + pathLength > in.size()) return false;
+		texture.path.assign(in.data() + offset, pathLength);
+		offset += pathLength;
+	}
+
+	if (!Read(in, offset, numFrames)) return false;
+	frames.resize(numFrames);
+	for (auto& frame : frames)
+	{
+		uint32_t numEntries;
+		if (!Read(in, offset, numEntries)) return false;
+		if (offset + numEntries * sizeof(uint32_t) > in.size()) return false;
+		frame.resize(numEntries);
+		memcpy(frame.data(), in.data() + offset, numEntries * sizeof(uint32_t));
+		offset += numEntries * sizeof(uint32_t);
+	}
+	return true;
+}
\ No newline at end of file
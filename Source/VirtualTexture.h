@@ -0,0 +1,176 @@
+#pragma once
+#include <cstdint>
+#include <functional>
+#include <list>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+struct CPUTexture;
+
+namespace VirtualTexture
+{
+// Texels along one side of a page. Pages carry no border, so filtering across page edges
+// is left to the shader.
+const uint32_t PageSize = 128;
+const uint32_t MaxMips = 16;
+
+// Feedback entries are written by the feedback pass as one packed uint per pixel:
+// x:10 | y:10 | mip:4 | textureId:8. Cleared pixels hold InvalidFeedback.
+const uint32_t InvalidFeedback = 0xFFFFFFFF;
+const uint32_t MaxTextures = 256;
+
+inline uint32_t PackPage(uint32_t textureId, uint32_t mip, uint32_t x, uint32_t y)
+{
+	return (x & 0x3FF) | ((y & 0x3FF) << 10) | ((mip & 0xF) << 20) | ((textureId & 0xFF) << 24);
+}
+inline uint32_t PageX(uint32_t page) { return page & 0x3FF; }
+inline uint32_t PageY(uint32_t page) { return (page >> 10) & 0x3FF; }
+inline uint32_t PageMip(uint32_t page) { return (page >> 20) & 0xF; }
+inline uint32_t PageTextureId(uint32_t page) { return page >> 24; }
+}
+
+// A texture split into pages for every mip level, ready to be streamed into the physical cache.
+struct CookedVirtualTexture
+{
+	uint32_t width = 0;
+	uint32_t height = 0;
+	uint32_t numMips = 0;
+	std::vector<uint32_t> pagesX;			// Per mip
+	std::vector<uint32_t> pagesY;			// Per mip
+	std::vector<uint32_t> firstPage;		// Per mip, index into pages
+	std::vector<std::vector<char>> pages;	// PageSize * PageSize BGRA8 texels each, empty when cooked without texels
+
+	uint32_t GetPageIndex(uint32_t mip, uint32_t x, uint32_t y) const { return firstPage[mip] + y * pagesX[mip] + x; }
+	uint32_t GetNumPages() const { return firstPage.empty() ? 0 : firstPage.back() + pagesX.back() * pagesY.back(); }
+
+	// Lays out the page grid for a texture of the given size without producing texels.
+	static CookedVirtualTexture CookLayout(uint32_t width, uint32_t height);
+	// Generates the box-filtered mip chain and splits every level into pages.
+	static CookedVirtualTexture Cook(const CPUTexture& texture);
+};
+
+// Fixed pool of physical pages with least-recently-used replacement.
+class PhysicalPageCache
+{
+public:
+	static const uint32_t InvalidSlot = 0xFFFFFFFF;
+
+	void Init(uint32_t numSlots);
+
+	uint32_t Find(uint32_t page) const;
+	void Touch(uint32_t slot, uint32_t frame);
+	// Returns the slot now holding page, evicting the least recently used unpinned page.
+	// Pages touched this frame are never evicted; returns InvalidSlot if nothing can go.
+	uint32_t Allocate(uint32_t page, uint32_t frame, bool pinned, uint32_t* evictedPage);
+	// Empties the slot, pinned or not, and makes it the first to be reused.
+	void Free(uint32_t slot);
+
+	uint32_t GetNumSlots() const { return static_cast<uint32_t>(m_Slots.size()); }
+	uint32_t GetNumResident() const { return static_cast<uint32_t>(m_PageToSlot.size()); }
+	uint32_t GetSlotPage(uint32_t slot) const { return m_Slots[slot].page; }
+
+private:
+	struct Slot
+	{
+		uint32_t page = VirtualTexture::InvalidFeedback;
+		uint32_t lastUsedFrame = 0;
+		bool pinned = false;
+		std::list<uint32_t>::iterator lruIter;
+	};
+
+	std::vector<Slot>						m_Slots;
+	std::list<uint32_t>						m_Lru;		// Front is least recently used, pinned slots are not listed
+	std::unordered_map<uint32_t, uint32_t>	m_PageToSlot;
+};
+
+// Per-page lookup from virtual page to the physical slot holding it, or the closest resident ancestor.
+struct IndirectionEntry
+{
+	uint32_t slot;
+	uint32_t mip;
+};
+
+struct VirtualTextureFrameStats
+{
+	uint32_t frame = 0;
+	uint32_t feedbackEntries = 0;
+	uint32_t uniquePagesRequested = 0;
+	uint32_t pagesAlreadyResident = 0;
+	uint32_t pagesLoaded = 0;
+	uint32_t pagesDeferred = 0;
+	uint32_t pagesEvicted = 0;
+	uint32_t pagesResident = 0;
+};
+
+struct VirtualTextureConfig
+{
+	uint32_t numPhysicalPages = 1024;
+	uint32_t maxUploadsPerFrame = 32;
+	// Frames between a page being requested and it becoming resident. 0 loads in the same frame.
+	uint32_t loadLatencyFrames = 0;
+};
+
+class VirtualTextureSystem
+{
+public:
+	// Called for every page made resident with the slot and the page texels (null when cooked without texels).
+	typedef std::function<void(uint32_t slot, const char* texels)> UploadCallback;
+
+	void Init(const VirtualTextureConfig& config);
+	// Fails, registering nothing, if the texture's coarsest mip can't be pinned in the cache or there are already
+	// as many textures as the feedback encoding can name.
+	bool RegisterTexture(CookedVirtualTexture&& cooked, uint32_t& textureId);
+	void SetUploadCallback(UploadCallback callback) { m_UploadCallback = callback; }
+
+	// Consumes one frame of feedback: decides which pages to load, loads up to the per-frame budget,
+	// refreshes the LRU and rebuilds the indirection tables that changed.
+	VirtualTextureFrameStats Update(const uint32_t* feedback, size_t numEntries);
+
+	const CookedVirtualTexture& GetTexture(uint32_t textureId) const { return m_Textures[textureId]; }
+	const std::vector<IndirectionEntry>& GetIndirection(uint32_t textureId) const { return m_Indirection[textureId]; }
+	uint32_t GetNumTextures() const { return static_cast<uint32_t>(m_Textures.size()); }
+
+private:
+	struct PageRequest
+	{
+		uint32_t page;
+		uint32_t count;
+	};
+	struct PendingLoad
+	{
+		uint32_t page;
+		uint32_t readyFrame;
+	};
+
+	std::vector<PageRequest> AnalyzeFeedback(const uint32_t* feedback, size_t numEntries) const;
+	bool IsValidPage(uint32_t page) const;
+	bool LoadPage(uint32_t page, bool pinned, VirtualTextureFrameStats& stats);
+	void RebuildIndirection(uint32_t textureId);
+
+	VirtualTextureConfig					m_Config;
+	UploadCallback							m_UploadCallback;
+	PhysicalPageCache						m_Cache;
+	std::vector<CookedVirtualTexture>		m_Textures;
+	std::vector<std::vector<IndirectionEntry>> m_Indirection;
+	std::vector<bool>						m_IndirectionDirty;
+	std::vector<PendingLoad>				m_PendingLoads;
+	uint32_t								m_Frame = 0;
+};
+
+// Recorded feedback buffers, so page decisions can be replayed without a window or GPU.
+struct VirtualTextureRecording
+{
+	struct TextureInfo
+	{
+		uint32_t width;
+		uint32_t height;
+		std::string path;
+	};
+
+	std::vector<TextureInfo> textures;
+	std::vector<std::vector<uint32_t>> frames;
+
+	bool Save(const std::string& absPath) const;
+	bool Load(const std::string& absPath);
+};
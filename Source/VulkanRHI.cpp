@@ -0,0 +1,1771 @@
+#include "VulkanRHI.h"
+
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+#include <cstring>
+#include <future>
+#include <thread>
+
+#include "sdl/SDL.h"
+#ifdef _WIN32
+#include "sdl/SDL_syswm.h"
+#endif
+
+#include "glm/gtx/rotate_vector.hpp"
+#include "assimp/vector3.h"
+
+#include "CPUTexture.h"
+#include "Engine.h"
+#include "FileUtils.h"
+#include "Mesh.h"
+#include "TexturePacker.h"
+#include "ThreadPool.h"
+#include "Window.h"
+#include "Imgui/imgui.h"
+#include "Imgui/imgui_impl_sdl.h"
+
+namespace
+{
+struct DirectionalConstants
+{
+	glm::vec4 color;
+	glm::vec4 direction;
+};
+
+void Check(VkResult result, const char* call)
+{
+	if (result != VK_SUCCESS)
+	{
+		SDL_Log("%s failed (VkResult %d).", call, static_cast<int>(result));
+		assert(false);
+	}
+}
+
+uint32_t CalcMipLevels(uint32_t width, uint32_t height)
+{
+	uint32_t mipLevels = 1;
+	for (uint32_t size = width > height ? width : height; size > 1; size /= 2) ++mipLevels;
+	return mipLevels;
+}
+
+VkDeviceSize AlignUp(VkDeviceSize value, VkDeviceSize alignment)
+{
+	return (value + alignment - 1) / alignment * alignment;
+}
+
+// The viewport is flipped so clip space, winding and UVs behave as they do in D3D and the shaders port unchanged.
+void SetViewportAndScissor(VkCommandBuffer commandBuffer, uint32_t width, uint32_t height)
+{
+	VkViewport viewport = {};
+	viewport.x = 0.f;
+	viewport.y = static_cast<float>(height);
+	viewport.width = static_cast<float>(width);
+	viewport.height = -static_cast<float>(height);
+	viewport.minDepth = 0.f;
+	viewport.maxDepth = 1.f;
+	vkCmdSetViewport(commandBuffer, 0, 1, &viewport);
+
+	VkRect2D scissor = {};
+	scissor.extent = { width, height };
+	vkCmdSetScissor(commandBuffer, 0, 1, &scissor);
+}
+
+}
+
+VulkanRHI::VulkanRHI(bool headless)
+	: m_Headless(headless)
+{
+}
+
+VulkanRHI::~VulkanRHI()
+{
+	if (m_Device)
+	{
+		vkDeviceWaitIdle(m_Device);
+		m_RecordThreads.reset();
+
+		for (auto& frame : m_Frames)
+		{
+			for (auto& deletion : frame.deletions) deletion();
+			frame.deletions.clear();
+			for (auto pool : frame.recordPools) vkDestroyCommandPool(m_Device, pool, nullptr);
+			if (frame.commandPool) vkDestroyCommandPool(m_Device, frame.commandPool, nullptr);
+			if (frame.fence) vkDestroyFence(m_Device, frame.fence, nullptr);
+			if (frame.imageAcquired) vkDestroySemaphore(m_Device, frame.imageAcquired, nullptr);
+			if (frame.renderFinished) vkDestroySemaphore(m_Device, frame.renderFinished, nullptr);
+		}
+		if (m_TimestampPool) vkDestroyQueryPool(m_Device, m_TimestampPool, nullptr);
+
+		for (auto pipeline : { m_GeometryPipeline, m_MaskedGeometryPipeline, m_AmbientPipeline, m_DirectionalPipeline })
+		{
+			if (pipeline) vkDestroyPipeline(m_Device, pipeline, nullptr);
+		}
+		if (m_GeometryPipelineLayout) vkDestroyPipelineLayout(m_Device, m_GeometryPipelineLayout, nullptr);
+		if (m_LightingPipelineLayout) vkDestroyPipelineLayout(m_Device, m_LightingPipelineLayout, nullptr);
+		if (m_DescriptorPool) vkDestroyDescriptorPool(m_Device, m_DescriptorPool, nullptr);
+		if (m_GeometrySetLayout) vkDestroyDescriptorSetLayout(m_Device, m_GeometrySetLayout, nullptr);
+		if (m_LightingSetLayout) vkDestroyDescriptorSetLayout(m_Device, m_LightingSetLayout, nullptr);
+		if (m_Sampler) vkDestroySampler(m_Device, m_Sampler, nullptr);
+
+		for (auto& texture : m_Textures)
+		{
+			vkDestroyImageView(m_Device, texture.second->view, nullptr);
+			vkDestroyImage(m_Device, texture.second->image, nullptr);
+			vkFreeMemory(m_Device, texture.second->memory, nullptr);
+		}
+		for (auto& buffer : m_Buffers) vkDestroyBuffer(m_Device, buffer->buffer, nullptr);
+		for (auto& block : m_BufferBlocks) vkFreeMemory(m_Device, block.memory, nullptr);
+
+		DestroyFramebuffers();
+		DestroyGBuffers();
+		DestroyOutputTarget();
+		if (m_Swapchain) vkDestroySwapchainKHR(m_Device, m_Swapchain, nullptr);
+		if (m_GeometryRenderPass) vkDestroyRenderPass(m_Device, m_GeometryRenderPass, nullptr);
+		if (m_LightingRenderPass) vkDestroyRenderPass(m_Device, m_LightingRenderPass, nullptr);
+
+		vkDestroyDevice(m_Device, nullptr);
+	}
+	if (m_Surface) vkDestroySurfaceKHR(m_Instance, m_Surface, nullptr);
+	if (m_Instance) vkDestroyInstance(m_Instance, nullptr);
+}
+
+bool VulkanRHI::InitRHI(const Window& window)
+{
+	if (!m_Headless && !window.sdlWindow)
+	{
+		SDL_Log("The windowed Vulkan RHI needs a window.");
+		return false;
+	}
+#ifndef _WIN32
+	if (!m_Headless)
+	{
+		SDL_Log("The windowed Vulkan RHI is only implemented for Win32, use vulkan-headless.");
+		return false;
+	}
+#endif
+
+	m_Width = window.width;
+	m_Height = window.height;
+
+	if (!CreateInstanceAndDevice(window)) return false;
+
+	// The main thread records one chunk of the geometry pass itself, the pool's workers take the rest.
+	m_NumRecordSlots = g_Engine->RHIRecordThreads ? g_Engine->RHIRecordThreads : std::max(std::thread::hardware_concurrency(), 1u);
+	if (m_NumRecordSlots > 1) m_RecordThreads = std::make_unique<ThreadPool>(m_NumRecordSlots - 1);
+	m_RecordStateCaches.resize(m_NumRecordSlots);
+
+	CreateFrameResources();
+	if (m_Headless ? !CreateOutputTarget(m_Width, m_Height) : !CreateSwapchain(m_Width, m_Height)) return false;
+	CreateRenderPasses();
+	CreateGBuffers(m_Width, m_Height);
+	CreateFramebuffers();
+	CreateDescriptorLayouts();
+	CreatePipelines();
+	if (!m_GeometryPipeline || !m_MaskedGeometryPipeline || !m_AmbientPipeline || !m_DirectionalPipeline) return false;
+
+	CreateDebugTexture2D();
+	CreateFullscreenQuadBuffers();
+	CreateLightingResources();
+
+	SDL_Log("Vulkan device: %s, recording on %u threads.", m_DeviceProperties.deviceName, m_NumRecordSlots);
+	return true;
+}
+
+bool VulkanRHI::CreateInstanceAndDevice(const Window& window)
+{
+	VkApplicationInfo appInfo = {};
+	appInfo.sType = VK_STRUCTURE_TYPE_APPLICATION_INFO;
+	appInfo.pApplicationName = "Rndr";
+	appInfo.pEngineName = "Rndr";
+	appInfo.apiVersion = VK_API_VERSION_1_1;
+
+	std::vector<const char*> instanceExtensions;
+	if (!m_Headless)
+	{
+		instanceExtensions.push_back(VK_KHR_SURFACE_EXTENSION_NAME);
+#ifdef _WIN32
+		instanceExtensions.push_back(VK_KHR_WIN32_SURFACE_EXTENSION_NAME);
+#endif
+	}
+
+	VkInstanceCreateInfo instanceInfo = {};
+	instanceInfo.sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO;
+	instanceInfo.pApplicationInfo = &appInfo;
+	instanceInfo.enabledExtensionCount = static_cast<uint32_t>(instanceExtensions.size());
+	instanceInfo.ppEnabledExtensionNames = instanceExtensions.data();
+	if (vkCreateInstance(&instanceInfo, nullptr, &m_Instance) != VK_SUCCESS)
+	{
+		SDL_Log("vkCreateInstance failed.");
+		return false;
+	}
+
+#ifdef _WIN32
+	if (!m_Headless)
+	{
+		SDL_SysWMinfo wmInfo;
+		SDL_VERSION(&wmInfo.version);
+		if (!SDL_GetWindowWMInfo(window.sdlWindow.get(), &wmInfo))
+		{
+			SDL_Log("SDL_GetWindowWMInfo failed.");
+			return false;
+		}
+
+		VkWin32SurfaceCreateInfoKHR surfaceInfo = {};
+		surfaceInfo.sType = VK_STRUCTURE_TYPE_WIN32_SURFACE_CREATE_INFO_KHR;
+		surfaceInfo.hinstance = GetModuleHandle(nullptr);
+		surfaceInfo.hwnd = wmInfo.info.win.window;
+		if (vkCreateWin32SurfaceKHR(m_Instance, &surfaceInfo, nullptr, &m_Surface) != VK_SUCCESS)
+		{
+			SDL_Log("vkCreateWin32SurfaceKHR failed.");
+			return false;
+		}
+	}
+#endif
+
+	uint32_t numDevices = 0;
+	vkEnumeratePhysicalDevices(m_Instance, &numDevices, nullptr);
+	std::vector<VkPhysicalDevice> devices(numDevices);
+	vkEnumeratePhysicalDevices(m_Instance, &numDevices, devices.data());
+
+	// Discrete over integrated over anything else, which leaves CPU drivers like lavapipe for GPU-less machines.
+	int bestScore = -1;
+	for (auto device : devices)
+	{
+		uint32_t numFamilies = 0;
+		vkGetPhysicalDeviceQueueFamilyProperties(device, &numFamilies, nullptr);
+		std::vector<VkQueueFamilyProperties> families(numFamilies);
+		vkGetPhysicalDeviceQueueFamilyProperties(device, &numFamilies, families.data());
+
+		for (uint32_t family = 0; family < numFamilies; ++family)
+		{
+			if (!(families[family].queueFlags & VK_QUEUE_GRAPHICS_BIT)) continue;
+			if (m_Surface)
+			{
+				VkBool32 canPresent = VK_FALSE;
+				vkGetPhysicalDeviceSurfaceSupportKHR(device, family, m_Surface, &canPresent);
+				if (!canPresent) continue;
+			}
+
+			VkPhysicalDeviceProperties properties;
+			vkGetPhysicalDeviceProperties(device, &properties);
+			int score = properties.deviceType == VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU ? 2 : properties.deviceType == VK_PHYSICAL_DEVICE_TYPE_INTEGRATED_GPU ? 1 : 0;
+			if (score > bestScore)
+			{
+				bestScore = score;
+				m_PhysicalDevice = device;
+				m_QueueFamily = family;
+				m_HasTimestamps = families[family].timestampValidBits > 0;
+			}
+			break;
+		}
+	}
+	if (!m_PhysicalDevice)
+	{
+		SDL_Log("Failed to find a Vulkan device.");
+		return false;
+	}
+
+	vkGetPhysicalDeviceProperties(m_PhysicalDevice, &m_DeviceProperties);
+	vkGetPhysicalDeviceMemoryProperties(m_PhysicalDevice, &m_MemoryProperties);
+	m_MaxTextureArraySlices = m_DeviceProperties.limits.maxImageArrayLayers;
+	m_HasTimestamps = m_HasTimestamps && m_DeviceProperties.limits.timestampPeriod > 0.f;
+
+	// Masks are BC4, as on D3D11.
+	VkPhysicalDeviceFeatures supportedFeatures;
+	vkGetPhysicalDeviceFeatures(m_PhysicalDevice, &supportedFeatures);
+	if (!supportedFeatures.textureCompressionBC)
+	{
+		SDL_Log("%s doesn't support BC textures.", m_DeviceProperties.deviceName);
+		return false;
+	}
+	VkPhysicalDeviceFeatures features = {};
+	features.textureCompressionBC = VK_TRUE;
+
+	float queuePriority = 1.f;
+	VkDeviceQueueCreateInfo queueInfo = {};
+	queueInfo.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
+	queueInfo.queueFamilyIndex = m_QueueFamily;
+	queueInfo.queueCount = 1;
+	queueInfo.pQueuePriorities = &queuePriority;
+
+	std::vector<const char*> deviceExtensions;
+	if (!m_Headless) deviceExtensions.push_back(VK_KHR_SWAPCHAIN_EXTENSION_NAME);
+
+	VkDeviceCreateInfo deviceInfo = {};
+	deviceInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
+	deviceInfo.queueCreateInfoCount = 1;
+	deviceInfo.pQueueCreateInfos = &queueInfo;
+	deviceInfo.enabledExtensionCount = static_cast<uint32_t>(deviceExtensions.size());
+	deviceInfo.ppEnabledExtensionNames = deviceExtensions.data();
+	deviceInfo.pEnabledFeatures = &features;
+	if (vkCreateDevice(m_PhysicalDevice, &deviceInfo, nullptr, &m_Device) != VK_SUCCESS)
+	{
+		SDL_Log("vkCreateDevice failed.");
+		return false;
+	}
+	vkGetDeviceQueue(m_Device, m_QueueFamily, 0, &m_Queue);
+	return true;
+}
+
+void VulkanRHI::CreateFrameResources()
+{
+	for (auto& frame : m_Frames)
+	{
+		VkCommandPoolCreateInfo poolInfo = {};
+		poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+		poolInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+		poolInfo.queueFamilyIndex = m_QueueFamily;
+		Check(vkCreateCommandPool(m_Device, &poolInfo, nullptr, &frame.commandPool), "vkCreateCommandPool");
+
+		VkCommandBufferAllocateInfo allocInfo = {};
+		allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+		allocInfo.commandPool = frame.commandPool;
+		allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+		allocInfo.commandBufferCount = 1;
+		Check(vkAllocateCommandBuffers(m_Device, &allocInfo, &frame.commandBuffer), "vkAllocateCommandBuffers");
+
+		frame.recordPools.resize(m_NumRecordSlots);
+		frame.recordBuffers.resize(m_NumRecordSlots);
+		for (uint32_t slot = 0; slot < m_NumRecordSlots; ++slot)
+		{
+			Check(vkCreateCommandPool(m_Device, &poolInfo, nullptr, &frame.recordPools[slot]), "vkCreateCommandPool");
+			allocInfo.commandPool = frame.recordPools[slot];
+			allocInfo.level = VK_COMMAND_BUFFER_LEVEL_SECONDARY;
+			Check(vkAllocateCommandBuffers(m_Device, &allocInfo, &frame.recordBuffers[slot]), "vkAllocateCommandBuffers");
+		}
+
+		VkFenceCreateInfo fenceInfo = {};
+		fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+		fenceInfo.flags = VK_FENCE_CREATE_SIGNALED_BIT;
+		Check(vkCreateFence(m_Device, &fenceInfo, nullptr, &frame.fence), "vkCreateFence");
+
+		VkSemaphoreCreateInfo semaphoreInfo = {};
+		semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+		Check(vkCreateSemaphore(m_Device, &semaphoreInfo, nullptr, &frame.imageAcquired), "vkCreateSemaphore");
+		Check(vkCreateSemaphore(m_Device, &semaphoreInfo, nullptr, &frame.renderFinished), "vkCreateSemaphore");
+	}
+
+	if (m_HasTimestamps)
+	{
+		// Three per frame: geometry begin, geometry end and lighting end.
+		VkQueryPoolCreateInfo queryInfo = {};
+		queryInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+		queryInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+		queryInfo.queryCount = 3 * FramesInFlight;
+		Check(vkCreateQueryPool(m_Device, &queryInfo, nullptr, &m_TimestampPool), "vkCreateQueryPool");
+	}
+}
+
+bool VulkanRHI::CreateSwapchain(uint32_t width, uint32_t height)
+{
+	VkSurfaceCapabilitiesKHR capabilities;
+	Check(vkGetPhysicalDeviceSurfaceCapabilitiesKHR(m_PhysicalDevice, m_Surface, &capabilities), "vkGetPhysicalDeviceSurfaceCapabilitiesKHR");
+
+	uint32_t numFormats = 0;
+	vkGetPhysicalDeviceSurfaceFormatsKHR(m_PhysicalDevice, m_Surface, &numFormats, nullptr);
+	std::vector<VkSurfaceFormatKHR> formats(numFormats);
+	vkGetPhysicalDeviceSurfaceFormatsKHR(m_PhysicalDevice, m_Surface, &numFormats, formats.data());
+	if (formats.empty())
+	{
+		SDL_Log("The Vulkan surface has no formats.");
+		return false;
+	}
+	VkSurfaceFormatKHR surfaceFormat = formats[0];
+	for (const auto& format : formats)
+	{
+		if (format.format == VK_FORMAT_R8G8B8A8_UNORM || format.format == VK_FORMAT_B8G8R8A8_UNORM)
+		{
+			surfaceFormat = format;
+			break;
+		}
+	}
+	m_OutputFormat = surfaceFormat.format;
+
+	// Unthrottled like the D3D11 swap chain, falling back to vsync which every driver has.
+	uint32_t numModes = 0;
+	vkGetPhysicalDeviceSurfacePresentModesKHR(m_PhysicalDevice, m_Surface, &numModes, nullptr);
+	std::vector<VkPresentModeKHR> modes(numModes);
+	vkGetPhysicalDeviceSurfacePresentModesKHR(m_PhysicalDevice, m_Surface, &numModes, modes.data());
+	VkPresentModeKHR presentMode = std::find(modes.begin(), modes.end(), VK_PRESENT_MODE_IMMEDIATE_KHR) != modes.end() ? VK_PRESENT_MODE_IMMEDIATE_KHR : VK_PRESENT_MODE_FIFO_KHR;
+
+	VkExtent2D extent = capabilities.currentExtent;
+	if (extent.width == UINT32_MAX)
+	{
+		extent.width = glm::clamp(width, capabilities.minImageExtent.width, capabilities.maxImageExtent.width);
+		extent.height = glm::clamp(height, capabilities.minImageExtent.height, capabilities.maxImageExtent.height);
+	}
+	m_Width = extent.width;
+	m_Height = extent.height;
+
+	uint32_t numImages = capabilities.minImageCount + 1;
+	if (capabilities.maxImageCount > 0) numImages = std::min(numImages, capabilities.maxImageCount);
+
+	VkSwapchainKHR oldSwapchain = m_Swapchain;
+	VkSwapchainCreateInfoKHR swapchainInfo = {};
+	swapchainInfo.sType = VK_STRUCTURE_TYPE_SWAPCHAIN_CREATE_INFO_KHR;
+	swapchainInfo.surface = m_Surface;
+	swapchainInfo.minImageCount = numImages;
+	swapchainInfo.imageFormat = surfaceFormat.format;
+	swapchainInfo.imageColorSpace = surfaceFormat.colorSpace;
+	swapchainInfo.imageExtent = extent;
+	swapchainInfo.imageArrayLayers = 1;
+	swapchainInfo.imageUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
+	swapchainInfo.imageSharingMode = VK_SHARING_MODE_EXCLUSIVE;
+	swapchainInfo.preTransform = capabilities.currentTransform;
+	swapchainInfo.compositeAlpha = VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR;
+	swapchainInfo.presentMode = presentMode;
+	swapchainInfo.clipped = VK_TRUE;
+	swapchainInfo.oldSwapchain = oldSwapchain;
+	if (vkCreateSwapchainKHR(m_Device, &swapchainInfo, nullptr, &m_Swapchain) != VK_SUCCESS)
+	{
+		SDL_Log("vkCreateSwapchainKHR failed.");
+		return false;
+	}
+	if (oldSwapchain) vkDestroySwapchainKHR(m_Device, oldSwapchain, nullptr);
+
+	vkGetSwapchainImagesKHR(m_Device, m_Swapchain, &numImages, nullptr);
+	m_OutputImages.resize(numImages);
+	vkGetSwapchainImagesKHR(m_Device, m_Swapchain, &numImages, m_OutputImages.data());
+
+	for (auto image : m_OutputImages)
+	{
+		VkImageViewCreateInfo viewInfo = {};
+		viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+		viewInfo.image = image;
+		viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+		viewInfo.format = m_OutputFormat;
+		viewInfo.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 };
+		VkImageView view;
+		Check(vkCreateImageView(m_Device, &viewInfo, nullptr, &view), "vkCreateImageView");
+		m_OutputViews.push_back(view);
+	}
+	return true;
+}
+
+bool VulkanRHI::CreateOutputTarget(uint32_t width, uint32_t height)
+{
+	m_OutputFormat = VK_FORMAT_R8G8B8A8_UNORM;
+	m_OffscreenOutput = CreateRenderTarget(width, height, m_OutputFormat,
+		VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT, VK_IMAGE_ASPECT_COLOR_BIT);
+	m_OutputImages = { m_OffscreenOutput.image };
+	m_OutputViews = { m_OffscreenOutput.view };
+	return m_OffscreenOutput.image != VK_NULL_HANDLE;
+}
+
+void VulkanRHI::DestroyOutputTarget()
+{
+	if (m_Headless)
+	{
+		DestroyRenderTarget(m_OffscreenOutput);
+	}
+	else
+	{
+		// Swapchain images belong to the swapchain, which is kept to be passed as the old one.
+		for (auto view : m_OutputViews) vkDestroyImageView(m_Device, view, nullptr);
+	}
+	m_OutputImages.clear();
+	m_OutputViews.clear();
+}
+
+void VulkanRHI::CreateRenderPasses()
+{
+	// Geometry: colour is cleared, normals are fully overwritten (D3D11 discards them), depth only lives for the pass.
+	std::array<VkAttachmentDescription, 3> geometryAttachments = {};
+	for (uint32_t i = 0; i < 2; ++i)
+	{
+		geometryAttachments[i].format = VK_FORMAT_R16G16B16A16_SFLOAT;
+		geometryAttachments[i].samples = VK_SAMPLE_COUNT_1_BIT;
+		geometryAttachments[i].loadOp = i == 0 ? VK_ATTACHMENT_LOAD_OP_CLEAR : VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+		geometryAttachments[i].storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+		geometryAttachments[i].stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+		geometryAttachments[i].stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+		geometryAttachments[i].initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+		geometryAttachments[i].finalLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+	}
+	geometryAttachments[2].format = VK_FORMAT_D32_SFLOAT;
+	geometryAttachments[2].samples = VK_SAMPLE_COUNT_1_BIT;
+	geometryAttachments[2].loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+	geometryAttachments[2].storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+	geometryAttachments[2].stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+	geometryAttachments[2].stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+	geometryAttachments[2].initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+	geometryAttachments[2].finalLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+
+	std::array<VkAttachmentReference, 2> colorRefs = { { { 0, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL }, { 1, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL } } };
+	VkAttachmentReference depthRef = { 2, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL };
+
+	VkSubpassDescription geometrySubpass = {};
+	geometrySubpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+	geometrySubpass.colorAttachmentCount = static_cast<uint32_t>(colorRefs.size());
+	geometrySubpass.pColorAttachments = colorRefs.data();
+	geometrySubpass.pDepthStencilAttachment = &depthRef;
+
+	// The previous frame's lighting pass reads the G-buffer before this one overwrites it, and this frame's reads it after.
+	std::array<VkSubpassDependency, 2> geometryDependencies = {};
+	geometryDependencies[0].srcSubpass = VK_SUBPASS_EXTERNAL;
+	geometryDependencies[0].dstSubpass = 0;
+	geometryDependencies[0].srcStageMask = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+	geometryDependencies[0].dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT;
+	geometryDependencies[0].srcAccessMask = VK_ACCESS_SHADER_READ_BIT;
+	geometryDependencies[0].dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+	geometryDependencies[1].srcSubpass = 0;
+	geometryDependencies[1].dstSubpass = VK_SUBPASS_EXTERNAL;
+	geometryDependencies[1].srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+	geometryDependencies[1].dstStageMask = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+	geometryDependencies[1].srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+	geometryDependencies[1].dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+
+	VkRenderPassCreateInfo renderPassInfo = {};
+	renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
+	renderPassInfo.attachmentCount = static_cast<uint32_t>(geometryAttachments.size());
+	renderPassInfo.pAttachments = geometryAttachments.data();
+	renderPassInfo.subpassCount = 1;
+	renderPassInfo.pSubpasses = &geometrySubpass;
+	renderPassInfo.dependencyCount = static_cast<uint32_t>(geometryDependencies.size());
+	renderPassInfo.pDependencies = geometryDependencies.data();
+	Check(vkCreateRenderPass(m_Device, &renderPassInfo, nullptr, &m_GeometryRenderPass), "vkCreateRenderPass");
+
+	// Lighting accumulates into the output, which is presented, or left ready to be read back when headless.
+	VkAttachmentDescription outputAttachment = {};
+	outputAttachment.format = m_OutputFormat;
+	outputAttachment.samples = VK_SAMPLE_COUNT_1_BIT;
+	outputAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+	outputAttachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+	outputAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+	outputAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+	outputAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+	outputAttachment.finalLayout = m_Headless ? VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL : VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+
+	VkAttachmentReference outputRef = { 0, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL };
+	VkSubpassDescription lightingSubpass = {};
+	lightingSubpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+	lightingSubpass.colorAttachmentCount = 1;
+	lightingSubpass.pColorAttachments = &outputRef;
+
+	// Waits on the acquire semaphore at this stage, so the layout transition has to as well.
+	VkSubpassDependency lightingDependency = {};
+	lightingDependency.srcSubpass = VK_SUBPASS_EXTERNAL;
+	lightingDependency.dstSubpass = 0;
+	lightingDependency.srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+	lightingDependency.dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+	lightingDependency.srcAccessMask = 0;
+	lightingDependency.dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+
+	renderPassInfo.attachmentCount = 1;
+	renderPassInfo.pAttachments = &outputAttachment;
+	renderPassInfo.pSubpasses = &lightingSubpass;
+	renderPassInfo.dependencyCount = 1;
+	renderPassInfo.pDependencies = &lightingDependency;
+	Check(vkCreateRenderPass(m_Device, &renderPassInfo, nullptr, &m_LightingRenderPass), "vkCreateRenderPass");
+}
+
+void VulkanRHI::CreateGBuffers(uint32_t width, uint32_t height)
+{
+	m_ColorRT = CreateRenderTarget(width, height, VK_FORMAT_R16G16B16A16_SFLOAT, VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, VK_IMAGE_ASPECT_COLOR_BIT);
+	m_NormalRT = CreateRenderTarget(width, height, VK_FORMAT_R16G16B16A16_SFLOAT, VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, VK_IMAGE_ASPECT_COLOR_BIT);
+	m_DepthRT = CreateRenderTarget(width, height, VK_FORMAT_D32_SFLOAT, VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT, VK_IMAGE_ASPECT_DEPTH_BIT);
+}
+
+void VulkanRHI::DestroyGBuffers()
+{
+	DestroyRenderTarget(m_ColorRT);
+	DestroyRenderTarget(m_NormalRT);
+	DestroyRenderTarget(m_DepthRT);
+}
+
+void VulkanRHI::CreateFramebuffers()
+{
+	std::array<VkImageView, 3> geometryViews = { m_ColorRT.view, m_NormalRT.view, m_DepthRT.view };
+	VkFramebufferCreateInfo framebufferInfo = {};
+	framebufferInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
+	framebufferInfo.renderPass = m_GeometryRenderPass;
+	framebufferInfo.attachmentCount = static_cast<uint32_t>(geometryViews.size());
+	framebufferInfo.pAttachments = geometryViews.data();
+	framebufferInfo.width = m_Width;
+	framebufferInfo.height = m_Height;
+	framebufferInfo.layers = 1;
+	Check(vkCreateFramebuffer(m_Device, &framebufferInfo, nullptr, &m_GeometryFramebuffer), "vkCreateFramebuffer");
+
+	framebufferInfo.renderPass = m_LightingRenderPass;
+	framebufferInfo.attachmentCount = 1;
+	for (auto& view : m_OutputViews)
+	{
+		framebufferInfo.pAttachments = &view;
+		VkFramebuffer framebuffer;
+		Check(vkCreateFramebuffer(m_Device, &framebufferInfo, nullptr, &framebuffer), "vkCreateFramebuffer");
+		m_OutputFramebuffers.push_back(framebuffer);
+	}
+}
+
+void VulkanRHI::DestroyFramebuffers()
+{
+	if (m_GeometryFramebuffer) vkDestroyFramebuffer(m_Device, m_GeometryFramebuffer, nullptr);
+	m_GeometryFramebuffer = VK_NULL_HANDLE;
+	for (auto framebuffer : m_OutputFramebuffers) vkDestroyFramebuffer(m_Device, framebuffer, nullptr);
+	m_OutputFramebuffers.clear();
+}
+
+void VulkanRHI::HandleWindowResize(uint32_t windowWidth, uint32_t windowHeight)
+{
+	// Minimised
+	if (windowWidth == 0 || windowHeight == 0) return;
+
+	vkDeviceWaitIdle(m_Device);
+
+	DestroyFramebuffers();
+	DestroyGBuffers();
+	DestroyOutputTarget();
+
+	m_Width = windowWidth;
+	m_Height = windowHeight;
+	if (m_Headless) CreateOutputTarget(m_Width, m_Height);
+	else CreateSwapchain(m_Width, m_Height);
+	CreateGBuffers(m_Width, m_Height);
+	CreateFramebuffers();
+	WriteLightingDescriptorSets();
+}
+
+void VulkanRHI::CreateDescriptorLayouts()
+{
+	// Same filtering and addressing as the D3D11 default sampler, baked into the layouts.
+	VkSamplerCreateInfo samplerInfo = {};
+	samplerInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+	samplerInfo.magFilter = VK_FILTER_LINEAR;
+	samplerInfo.minFilter = VK_FILTER_LINEAR;
+	samplerInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR;
+	samplerInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+	samplerInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+	samplerInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+	samplerInfo.minLod = 0.f;
+	samplerInfo.maxLod = VK_LOD_CLAMP_NONE;
+	Check(vkCreateSampler(m_Device, &samplerInfo, nullptr, &m_Sampler), "vkCreateSampler");
+
+	// Both layouts are a dynamic uniform buffer followed by two textures.
+	std::array<VkDescriptorSetLayoutBinding, 3> bindings = {};
+	bindings[0].binding = 0;
+	bindings[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+	bindings[0].descriptorCount = 1;
+	for (uint32_t i = 1; i < 3; ++i)
+	{
+		bindings[i].binding = i;
+		bindings[i].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+		bindings[i].descriptorCount = 1;
+		bindings[i].stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+		bindings[i].pImmutableSamplers = &m_Sampler;
+	}
+
+	VkDescriptorSetLayoutCreateInfo layoutInfo = {};
+	layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+	layoutInfo.bindingCount = static_cast<uint32_t>(bindings.size());
+	layoutInfo.pBindings = bindings.data();
+
+	bindings[0].stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+	Check(vkCreateDescriptorSetLayout(m_Device, &layoutInfo, nullptr, &m_GeometrySetLayout), "vkCreateDescriptorSetLayout");
+	bindings[0].stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+	Check(vkCreateDescriptorSetLayout(m_Device, &layoutInfo, nullptr, &m_LightingSetLayout), "vkCreateDescriptorSetLayout");
+
+	VkPipelineLayoutCreateInfo pipelineLayoutInfo = {};
+	pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+	pipelineLayoutInfo.setLayoutCount = 1;
+	pipelineLayoutInfo.pSetLayouts = &m_GeometrySetLayout;
+	Check(vkCreatePipelineLayout(m_Device, &pipelineLayoutInfo, nullptr, &m_GeometryPipelineLayout), "vkCreatePipelineLayout");
+	pipelineLayoutInfo.pSetLayouts = &m_LightingSetLayout;
+	Check(vkCreatePipelineLayout(m_Device, &pipelineLayoutInfo, nullptr, &m_LightingPipelineLayout), "vkCreatePipelineLayout");
+
+	// One geometry set per mesh and texture pairing in use, which is bounded by the scene's mesh count.
+	const uint32_t maxSets = 4096;
+	std::array<VkDescriptorPoolSize, 2> poolSizes = { { { VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, maxSets }, { VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 2 * maxSets } } };
+	VkDescriptorPoolCreateInfo poolInfo = {};
+	poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+	poolInfo.flags = VK_DESCRIPTOR_POOL_CREATE_FREE_DESCRIPTOR_SET_BIT;
+	poolInfo.maxSets = maxSets;
+	poolInfo.poolSizeCount = static_cast<uint32_t>(poolSizes.size());
+	poolInfo.pPoolSizes = poolSizes.data();
+	Check(vkCreateDescriptorPool(m_Device, &poolInfo, nullptr, &m_DescriptorPool), "vkCreateDescriptorPool");
+}
+
+VkShaderModule VulkanRHI::LoadShaderModule(const std::string& name)
+{
+	auto path = FileUtils::Combine(g_Engine->ProjectDir, "Source/Shaders/GLSL/" + name + ".spv");
+	auto spirv = FileUtils::MapFileAbsolute(path);
+	if (!spirv.IsValid() || spirv.size() == 0 || spirv.size() % 4 != 0)
+	{
+		SDL_Log("Missing SPIR-V %s, compile Source/Shaders/GLSL with glslangValidator -V.", path.c_str());
+		return VK_NULL_HANDLE;
+	}
+
+	// Mapped views are page aligned, which satisfies the uint32_t alignment pCode needs.
+	VkShaderModuleCreateInfo moduleInfo = {};
+	moduleInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+	moduleInfo.codeSize = spirv.size();
+	moduleInfo.pCode = reinterpret_cast<const uint32_t*>(spirv.data());
+	VkShaderModule module;
+	Check(vkCreateShaderModule(m_Device, &moduleInfo, nullptr, &module), "vkCreateShaderModule");
+	return module;
+}
+
+VkPipeline VulkanRHI::CreatePipeline(VkShaderModule vertexShader, VkShaderModule fragmentShader, VkPipelineLayout layout, VkRenderPass renderPass,
+	uint32_t numColorAttachments, bool geometryVertexLayout, bool lighting)
+{
+	if (!vertexShader || !fragmentShader) return VK_NULL_HANDLE;
+
+	std::array<VkPipelineShaderStageCreateInfo, 2> stages = {};
+	stages[0].sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+	stages[0].stage = VK_SHADER_STAGE_VERTEX_BIT;
+	stages[0].module = vertexShader;
+	stages[0].pName = "main";
+	stages[1].sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+	stages[1].stage = VK_SHADER_STAGE_FRAGMENT_BIT;
+	stages[1].module = fragmentShader;
+	stages[1].pName = "main";
+
+	// One stream per attribute, as GPUMesh stores them: float3 position, normal and UV, or float2 position and UV.
+	uint32_t numStreams = geometryVertexLayout ? 3 : 2;
+	uint32_t stride = geometryVertexLayout ? sizeof(aiVector3D) : sizeof(glm::vec2);
+	VkFormat format = geometryVertexLayout ? VK_FORMAT_R32G32B32_SFLOAT : VK_FORMAT_R32G32_SFLOAT;
+	std::array<VkVertexInputBindingDescription, 3> vertexBindings = {};
+	std::array<VkVertexInputAttributeDescription, 3> vertexAttributes = {};
+	for (uint32_t i = 0; i < numStreams; ++i)
+	{
+		vertexBindings[i] = { i, stride, VK_VERTEX_INPUT_RATE_VERTEX };
+		vertexAttributes[i] = { i, i, format, 0 };
+	}
+
+	VkPipelineVertexInputStateCreateInfo vertexInput = {};
+	vertexInput.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
+	vertexInput.vertexBindingDescriptionCount = numStreams;
+	vertexInput.pVertexBindingDescriptions = vertexBindings.data();
+	vertexInput.vertexAttributeDescriptionCount = numStreams;
+	vertexInput.pVertexAttributeDescriptions = vertexAttributes.data();
+
+	VkPipelineInputAssemblyStateCreateInfo inputAssembly = {};
+	inputAssembly.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
+	inputAssembly.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
+
+	VkPipelineViewportStateCreateInfo viewportState = {};
+	viewportState.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
+	viewportState.viewportCount = 1;
+	viewportState.scissorCount = 1;
+
+	// Matches the D3D11 raster state, which the flipped viewport keeps meaningful.
+	VkPipelineRasterizationStateCreateInfo rasterState = {};
+	rasterState.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
+	rasterState.polygonMode = VK_POLYGON_MODE_FILL;
+	rasterState.cullMode = VK_CULL_MODE_BACK_BIT;
+	rasterState.frontFace = VK_FRONT_FACE_CLOCKWISE;
+	rasterState.lineWidth = 1.f;
+
+	VkPipelineMultisampleStateCreateInfo multisampleState = {};
+	multisampleState.sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
+	multisampleState.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
+
+	VkPipelineDepthStencilStateCreateInfo depthState = {};
+	depthState.sType = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO;
+	depthState.depthTestEnable = lighting ? VK_FALSE : VK_TRUE;
+	depthState.depthWriteEnable = lighting ? VK_FALSE : VK_TRUE;
+	depthState.depthCompareOp = VK_COMPARE_OP_LESS_OR_EQUAL;
+
+	// Lights add up in the output.
+	std::array<VkPipelineColorBlendAttachmentState, 2> blendAttachments = {};
+	for (auto& blend : blendAttachments)
+	{
+		blend.blendEnable = lighting ? VK_TRUE : VK_FALSE;
+		blend.srcColorBlendFactor = VK_BLEND_FACTOR_ONE;
+		blend.dstColorBlendFactor = VK_BLEND_FACTOR_ONE;
+		blend.colorBlendOp = VK_BLEND_OP_ADD;
+		blend.srcAlphaBlendFactor = VK_BLEND_FACTOR_ONE;
+		blend.dstAlphaBlendFactor = VK_BLEND_FACTOR_ONE;
+		blend.alphaBlendOp = VK_BLEND_OP_ADD;
+		blend.colorWriteMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT | VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT;
+	}
+
+	VkPipelineColorBlendStateCreateInfo blendState = {};
+	blendState.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
+	blendState.attachmentCount = numColorAttachments;
+	blendState.pAttachments = blendAttachments.data();
+
+	std::array<VkDynamicState, 2> dynamicStates = { VK_DYNAMIC_STATE_VIEWPORT, VK_DYNAMIC_STATE_SCISSOR };
+	VkPipelineDynamicStateCreateInfo dynamicState = {};
+	dynamicState.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
+	dynamicState.dynamicStateCount = static_cast<uint32_t>(dynamicStates.size());
+	dynamicState.pDynamicStates = dynamicStates.data();
+
+	VkGraphicsPipelineCreateInfo pipelineInfo = {};
+	pipelineInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
+	pipelineInfo.stageCount = static_cast<uint32_t>(stages.size());
+	pipelineInfo.pStages = stages.data();
+	pipelineInfo.pVertexInputState = &vertexInput;
+	pipelineInfo.pInputAssemblyState = &inputAssembly;
+	pipelineInfo.pViewportState = &viewportState;
+	pipelineInfo.pRasterizationState = &rasterState;
+	pipelineInfo.pMultisampleState = &multisampleState;
+	pipelineInfo.pDepthStencilState = &depthState;
+	pipelineInfo.pColorBlendState = &blendState;
+	pipelineInfo.pDynamicState = &dynamicState;
+	pipelineInfo.layout = layout;
+	pipelineInfo.renderPass = renderPass;
+	pipelineInfo.subpass = 0;
+
+	VkPipeline pipeline;
+	Check(vkCreateGraphicsPipelines(m_Device, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &pipeline), "vkCreateGraphicsPipelines");
+	return pipeline;
+}
+
+void VulkanRHI::CreatePipelines()
+{
+	auto geometryVS = LoadShaderModule("Geometry.vert");
+	auto geometryPS = LoadShaderModule("Geometry.frag");
+	auto geometryMaskedPS = LoadShaderModule("GeometryMasked.frag");
+	auto fullscreenVS = LoadShaderModule("Fullscreen.vert");
+	auto ambientPS = LoadShaderModule("Ambient.frag");
+	auto directionalPS = LoadShaderModule("Directional.frag");
+
+	m_GeometryPipeline = CreatePipeline(geometryVS, geometryPS, m_GeometryPipelineLayout, m_GeometryRenderPass, 2, true, false);
+	m_MaskedGeometryPipeline = CreatePipeline(geometryVS, geometryMaskedPS, m_GeometryPipelineLayout, m_GeometryRenderPass, 2, true, false);
+	m_AmbientPipeline = CreatePipeline(fullscreenVS, ambientPS, m_LightingPipelineLayout, m_LightingRenderPass, 1, false, true);
+	m_DirectionalPipeline = CreatePipeline(fullscreenVS, directionalPS, m_LightingPipelineLayout, m_LightingRenderPass, 1, false, true);
+
+	for (auto module : { geometryVS, geometryPS, geometryMaskedPS, fullscreenVS, ambientPS, directionalPS })
+	{
+		if (module) vkDestroyShaderModule(m_Device, module, nullptr);
+	}
+}
+
+uint32_t VulkanRHI::FindMemoryType(uint32_t typeBits, VkMemoryPropertyFlags required, VkMemoryPropertyFlags preferred) const
+{
+	for (auto flags : { required | preferred, required })
+	{
+		for (uint32_t i = 0; i < m_MemoryProperties.memoryTypeCount; ++i)
+		{
+			if ((typeBits & (1u << i)) && (m_MemoryProperties.memoryTypes[i].propertyFlags & flags) == flags) return i;
+		}
+	}
+	assert(false);
+	return UINT32_MAX;
+}
+
+VulkanRHI::RenderTarget VulkanRHI::CreateRenderTarget(uint32_t width, uint32_t height, VkFormat format, VkImageUsageFlags usage, VkImageAspectFlags aspect)
+{
+	RenderTarget target;
+
+	VkImageCreateInfo imageInfo = {};
+	imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+	imageInfo.imageType = VK_IMAGE_TYPE_2D;
+	imageInfo.format = format;
+	imageInfo.extent = { width, height, 1 };
+	imageInfo.mipLevels = 1;
+	imageInfo.arrayLayers = 1;
+	imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+	imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+	imageInfo.usage = usage;
+	imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+	imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+	Check(vkCreateImage(m_Device, &imageInfo, nullptr, &target.image), "vkCreateImage");
+
+	VkMemoryRequirements requirements;
+	vkGetImageMemoryRequirements(m_Device, target.image, &requirements);
+	VkMemoryAllocateInfo allocInfo = {};
+	allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+	allocInfo.allocationSize = requirements.size;
+	allocInfo.memoryTypeIndex = FindMemoryType(requirements.memoryTypeBits, 0, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+	Check(vkAllocateMemory(m_Device, &allocInfo, nullptr, &target.memory), "vkAllocateMemory");
+	Check(vkBindImageMemory(m_Device, target.image, target.memory, 0), "vkBindImageMemory");
+
+	VkImageViewCreateInfo viewInfo = {};
+	viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+	viewInfo.image = target.image;
+	viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+	viewInfo.format = format;
+	viewInfo.subresourceRange = { aspect, 0, 1, 0, 1 };
+	Check(vkCreateImageView(m_Device, &viewInfo, nullptr, &target.view), "vkCreateImageView");
+	return target;
+}
+
+void VulkanRHI::DestroyRenderTarget(RenderTarget& target)
+{
+	if (target.view) vkDestroyImageView(m_Device, target.view, nullptr);
+	if (target.image) vkDestroyImage(m_Device, target.image, nullptr);
+	if (target.memory) vkFreeMemory(m_Device, target.memory, nullptr);
+	target = RenderTarget();
+}
+
+RHIBuffer VulkanRHI::CreateBuffer(const void* data, VkDeviceSize size, VkBufferUsageFlags usage, VkDeviceSize frameSize)
+{
+	VkBufferCreateInfo bufferInfo = {};
+	bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+	bufferInfo.size = frameSize ? frameSize * FramesInFlight : size;
+	bufferInfo.usage = usage;
+	bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+	auto record = std::make_unique<BufferRecord>();
+	record->size = size;
+	record->frameSize = frameSize;
+	if (vkCreateBuffer(m_Device, &bufferInfo, nullptr, &record->buffer) != VK_SUCCESS)
+	{
+		SDL_Log("vkCreateBuffer failed");
+		return nullptr;
+	}
+
+	// Mesh data is small and never freed, so buffers are packed into persistently mapped blocks. Device-local
+	// host-visible memory is taken where there is some, so draws don't read across the bus.
+	VkMemoryRequirements requirements;
+	vkGetBufferMemoryRequirements(m_Device, record->buffer, &requirements);
+	uint32_t memoryType = FindMemoryType(requirements.memoryTypeBits, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+
+	MemoryBlock* block = nullptr;
+	for (auto& candidate : m_BufferBlocks)
+	{
+		if (candidate.memoryTypeIndex == memoryType && AlignUp(candidate.used, requirements.alignment) + requirements.size <= candidate.size)
+		{
+			block = &candidate;
+			break;
+		}
+	}
+	if (!block)
+	{
+		MemoryBlock newBlock = {};
+		newBlock.memoryTypeIndex = memoryType;
+		newBlock.size = std::max(BufferBlockSize, requirements.size);
+
+		VkMemoryAllocateInfo allocInfo = {};
+		allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+		allocInfo.allocationSize = newBlock.size;
+		allocInfo.memoryTypeIndex = memoryType;
+		if (vkAllocateMemory(m_Device, &allocInfo, nullptr, &newBlock.memory) != VK_SUCCESS)
+		{
+			SDL_Log("vkAllocateMemory failed");
+			vkDestroyBuffer(m_Device, record->buffer, nullptr);
+			return nullptr;
+		}
+		void* mapped;
+		Check(vkMapMemory(m_Device, newBlock.memory, 0, VK_WHOLE_SIZE, 0, &mapped), "vkMapMemory");
+		newBlock.mapped = static_cast<char*>(mapped);
+		m_BufferBlocks.push_back(newBlock);
+		block = &m_BufferBlocks.back();
+	}
+
+	VkDeviceSize offset = AlignUp(block->used, requirements.alignment);
+	block->used = offset + requirements.size;
+	Check(vkBindBufferMemory(m_Device, record->buffer, block->memory, offset), "vkBindBufferMemory");
+	record->mapped = block->mapped + offset;
+	if (data) memcpy(record->mapped, data, size);
+
+	auto handle = reinterpret_cast<RHIBuffer>(record.get());
+	m_Buffers.push_back(std::move(record));
+	return handle;
+}
+
+RHIBuffer VulkanRHI::CreateVertexBuffer(const void* data, uint32_t stride, uint32_t numVertices)
+{
+	assert(data);
+	assert(numVertices > 0);
+	return CreateBuffer(data, VkDeviceSize(stride) * numVertices, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, 0);
+}
+
+RHIBuffer VulkanRHI::CreateIndexBuffer(const std::vector<IndexType>& indices)
+{
+	assert(indices.size() > 0);
+	return CreateBuffer(indices.data(), sizeof(IndexType) * indices.size(), VK_BUFFER_USAGE_INDEX_BUFFER_BIT, 0);
+}
+
+RHIBuffer VulkanRHI::CreateConstantBuffer(int size)
+{
+	assert(size > 0);
+	auto frameSize = AlignUp(size, m_DeviceProperties.limits.minUniformBufferOffsetAlignment);
+	return CreateBuffer(nullptr, size, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, frameSize);
+}
+
+bool VulkanRHI::UpdateConstantBuffer(RHIBuffer buffer, const void* data, int numBytes)
+{
+	auto record = reinterpret_cast<BufferRecord*>(buffer);
+	assert(record->frameSize > 0 && VkDeviceSize(numBytes) <= record->size);
+
+	// The slot written is the current frame's, which the GPU is done with once BeginFrame has waited on it.
+	BeginFrame();
+	memcpy(record->mapped + record->frameSize * m_FrameIndex, data, numBytes);
+	return true;
+}
+
+void VulkanRHI::UpdateMaterialTable(const std::vector<GPUMaterial>& materials)
+{
+	// The SPIR-V shaders take their slices from the draw constants and shade from the diffuse texture alone.
+}
+
+VkBuffer VulkanRHI::CreateStagingBuffer(const void* data, VkDeviceSize size, char** mapped)
+{
+	VkBufferCreateInfo bufferInfo = {};
+	bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+	bufferInfo.size = size;
+	bufferInfo.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+	bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+	VkBuffer buffer;
+	Check(vkCreateBuffer(m_Device, &bufferInfo, nullptr, &buffer), "vkCreateBuffer");
+
+	VkMemoryRequirements requirements;
+	vkGetBufferMemoryRequirements(m_Device, buffer, &requirements);
+	VkMemoryAllocateInfo allocInfo = {};
+	allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+	allocInfo.allocationSize = requirements.size;
+	allocInfo.memoryTypeIndex = FindMemoryType(requirements.memoryTypeBits, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, 0);
+	VkDeviceMemory memory;
+	Check(vkAllocateMemory(m_Device, &allocInfo, nullptr, &memory), "vkAllocateMemory");
+	Check(vkBindBufferMemory(m_Device, buffer, memory, 0), "vkBindBufferMemory");
+
+	void* mappedMemory;
+	Check(vkMapMemory(m_Device, memory, 0, VK_WHOLE_SIZE, 0, &mappedMemory), "vkMapMemory");
+	if (data) memcpy(mappedMemory, data, size);
+	*mapped = static_cast<char*>(mappedMemory);
+
+	// Lives until the copies recorded from it this frame have run.
+	VkDevice device = m_Device;
+	m_Frames[m_FrameIndex].deletions.push_back([device, buffer, memory]()
+	{
+		vkDestroyBuffer(device, buffer, nullptr);
+		vkFreeMemory(device, memory, nullptr);
+	});
+	return buffer;
+}
+
+VulkanRHI::TextureRecord* VulkanRHI::CreateTextureRecord(uint32_t width, uint32_t height, uint32_t mipLevels, uint32_t arrayLayers, VkFormat format)
+{
+	auto record = std::make_unique<TextureRecord>();
+	record->format = format;
+	record->width = width;
+	record->height = height;
+	record->mipLevels = mipLevels;
+	record->arrayLayers = arrayLayers;
+
+	VkImageCreateInfo imageInfo = {};
+	imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+	imageInfo.imageType = VK_IMAGE_TYPE_2D;
+	imageInfo.format = format;
+	imageInfo.extent = { width, height, 1 };
+	imageInfo.mipLevels = mipLevels;
+	imageInfo.arrayLayers = arrayLayers;
+	imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+	imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+	// Transfer source too, for mip generation and for being packed into an array.
+	imageInfo.usage = VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+	imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+	imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+	if (vkCreateImage(m_Device, &imageInfo, nullptr, &record->image) != VK_SUCCESS)
+	{
+		SDL_Log("vkCreateImage failed");
+		return nullptr;
+	}
+
+	VkMemoryRequirements requirements;
+	vkGetImageMemoryRequirements(m_Device, record->image, &requirements);
+	VkMemoryAllocateInfo allocInfo = {};
+	allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+	allocInfo.allocationSize = requirements.size;
+	allocInfo.memoryTypeIndex = FindMemoryType(requirements.memoryTypeBits, 0, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+	if (vkAllocateMemory(m_Device, &allocInfo, nullptr, &record->memory) != VK_SUCCESS)
+	{
+		SDL_Log("vkAllocateMemory failed");
+		vkDestroyImage(m_Device, record->image, nullptr);
+		return nullptr;
+	}
+	Check(vkBindImageMemory(m_Device, record->image, record->memory, 0), "vkBindImageMemory");
+
+	// Always viewed as an array so the geometry shader can sample standalone and packed textures alike.
+	VkImageViewCreateInfo viewInfo = {};
+	viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+	viewInfo.image = record->image;
+	viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D_ARRAY;
+	viewInfo.format = format;
+	viewInfo.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, mipLevels, 0, arrayLayers };
+	Check(vkCreateImageView(m_Device, &viewInfo, nullptr, &record->view), "vkCreateImageView");
+
+	auto ret = record.get();
+	m_Textures.insert({ ret, std::move(record) });
+	return ret;
+}
+
+void VulkanRHI::ImageBarrier(VkCommandBuffer commandBuffer, VkImage image, uint32_t baseMip, uint32_t numMips, uint32_t numLayers,
+	VkImageLayout oldLayout, VkImageLayout newLayout, VkAccessFlags srcAccess, VkAccessFlags dstAccess,
+	VkPipelineStageFlags srcStage, VkPipelineStageFlags dstStage)
+{
+	VkImageMemoryBarrier barrier = {};
+	barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+	barrier.srcAccessMask = srcAccess;
+	barrier.dstAccessMask = dstAccess;
+	barrier.oldLayout = oldLayout;
+	barrier.newLayout = newLayout;
+	barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barrier.image = image;
+	barrier.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, baseMip, numMips, 0, numLayers };
+	vkCmdPipelineBarrier(commandBuffer, srcStage, dstStage, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+}
+
+RHITexture VulkanRHI::CreateTexture2D(const CPUTexture& cpuTexture)
+{
+	assert(!m_LightingPassOpen);
+	uint32_t mipLevels = CalcMipLevels(cpuTexture.width, cpuTexture.height);
+
+	// Mips generated on the CPU (e.g. by the decode workers) are uploaded with the top level, otherwise they're blitted down.
+	bool hasCpuMips = !cpuTexture.mips.empty();
+	assert(!hasCpuMips || cpuTexture.mips.size() + 1 == mipLevels);
+	// Block-compressed textures can't be blitted, so they must come with their mips.
+	bool isBlockCompressed = cpuTexture.format == CPUTextureFormat::BC4;
+	assert(hasCpuMips || !isBlockCompressed);
+
+	auto record = CreateTextureRecord(cpuTexture.width, cpuTexture.height, mipLevels, 1, isBlockCompressed ? VK_FORMAT_BC4_UNORM_BLOCK : VK_FORMAT_B8G8R8A8_UNORM);
+	if (!record) return nullptr;
+
+	uint32_t numUploadedLevels = hasCpuMips ? mipLevels : 1;
+	std::vector<VkBufferImageCopy> regions(numUploadedLevels);
+	VkDeviceSize stagingSize = 0;
+	uint32_t mipWidth = cpuTexture.width;
+	uint32_t mipHeight = cpuTexture.height;
+	for (uint32_t mip = 0; mip < numUploadedLevels; ++mip)
+	{
+		// Offsets must be a multiple of the texel block size and of 4.
+		stagingSize = AlignUp(stagingSize, 16);
+		regions[mip] = {};
+		regions[mip].bufferOffset = stagingSize;
+		regions[mip].imageSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, mip, 0, 1 };
+		regions[mip].imageExtent = { mipWidth, mipHeight, 1 };
+		stagingSize += (mip == 0 ? cpuTexture.data : cpuTexture.mips[mip - 1]).size();
+		mipWidth = std::max(mipWidth / 2, 1u);
+		mipHeight = std::max(mipHeight / 2, 1u);
+	}
+
+	VkCommandBuffer commandBuffer = BeginFrame();
+	char* staging;
+	VkBuffer stagingBuffer = CreateStagingBuffer(nullptr, stagingSize, &staging);
+	for (uint32_t mip = 0; mip < numUploadedLevels; ++mip)
+	{
+		const auto& level = mip == 0 ? cpuTexture.data : cpuTexture.mips[mip - 1];
+		memcpy(staging + regions[mip].bufferOffset, level.data(), level.size());
+	}
+
+	ImageBarrier(commandBuffer, record->image, 0, mipLevels, 1, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+		0, VK_ACCESS_TRANSFER_WRITE_BIT, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT);
+	vkCmdCopyBufferToImage(commandBuffer, stagingBuffer, record->image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, numUploadedLevels, regions.data());
+
+	if (hasCpuMips)
+	{
+		ImageBarrier(commandBuffer, record->image, 0, mipLevels, 1, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+			VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT);
+	}
+	else
+	{
+		int32_t srcWidth = cpuTexture.width;
+		int32_t srcHeight = cpuTexture.height;
+		for (uint32_t mip = 1; mip < mipLevels; ++mip)
+		{
+			int32_t dstWidth = std::max(srcWidth / 2, 1);
+			int32_t dstHeight = std::max(srcHeight / 2, 1);
+			ImageBarrier(commandBuffer, record->image, mip - 1, 1, 1, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+				VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_TRANSFER_READ_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT);
+
+			VkImageBlit blit = {};
+			blit.srcSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, mip - 1, 0, 1 };
+			blit.srcOffsets[1] = { srcWidth, srcHeight, 1 };
+			blit.dstSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, mip, 0, 1 };
+			blit.dstOffsets[1] = { dstWidth, dstHeight, 1 };
+			vkCmdBlitImage(commandBuffer, record->image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, record->image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &blit, VK_FILTER_LINEAR);
+
+			ImageBarrier(commandBuffer, record->image, mip - 1, 1, 1, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+				VK_ACCESS_TRANSFER_READ_BIT, VK_ACCESS_SHADER_READ_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT);
+			srcWidth = dstWidth;
+			srcHeight = dstHeight;
+		}
+		ImageBarrier(commandBuffer, record->image, mipLevels - 1, 1, 1, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+			VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT);
+	}
+
+	return reinterpret_cast<RHITexture>(record);
+}
+
+RHITexture VulkanRHI::CreateTexture2DArray(const TextureArrayPlan& arrayPlan)
+{
+	assert(!arrayPlan.slices.empty());
+	assert(!m_LightingPassOpen);
+
+	auto numSlices = static_cast<uint32_t>(arrayPlan.slices.size());
+	auto record = CreateTextureRecord(arrayPlan.width, arrayPlan.height, arrayPlan.mipLevels, numSlices, static_cast<VkFormat>(arrayPlan.format));
+	if (!record) return nullptr;
+
+	VkCommandBuffer commandBuffer = BeginFrame();
+	ImageBarrier(commandBuffer, record->image, 0, arrayPlan.mipLevels, numSlices, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+		0, VK_ACCESS_TRANSFER_WRITE_BIT, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT);
+
+	// The source textures already have their mips, so copy every level across.
+	std::vector<VkImageCopy> regions(arrayPlan.mipLevels);
+	for (uint32_t slice = 0; slice < numSlices; ++slice)
+	{
+		auto source = reinterpret_cast<TextureRecord*>(arrayPlan.slices[slice]);
+		assert(source->width == arrayPlan.width && source->height == arrayPlan.height && source->mipLevels == arrayPlan.mipLevels && source->format == record->format);
+
+		uint32_t mipWidth = arrayPlan.width;
+		uint32_t mipHeight = arrayPlan.height;
+		for (uint32_t mip = 0; mip < arrayPlan.mipLevels; ++mip)
+		{
+			regions[mip] = {};
+			regions[mip].srcSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, mip, 0, 1 };
+			regions[mip].dstSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, mip, slice, 1 };
+			regions[mip].extent = { mipWidth, mipHeight, 1 };
+			mipWidth = std::max(mipWidth / 2, 1u);
+			mipHeight = std::max(mipHeight / 2, 1u);
+		}
+
+		ImageBarrier(commandBuffer, source->image, 0, arrayPlan.mipLevels, 1, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+			VK_ACCESS_SHADER_READ_BIT, VK_ACCESS_TRANSFER_READ_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT);
+		vkCmdCopyImage(commandBuffer, source->image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, record->image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+			arrayPlan.mipLevels, regions.data());
+		ImageBarrier(commandBuffer, source->image, 0, arrayPlan.mipLevels, 1, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+			VK_ACCESS_TRANSFER_READ_BIT, VK_ACCESS_SHADER_READ_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT);
+	}
+
+	ImageBarrier(commandBuffer, record->image, 0, arrayPlan.mipLevels, numSlices, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+		VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT);
+
+	return reinterpret_cast<RHITexture>(record);
+}
+
+void VulkanRHI::ReleaseTexture2D(RHITexture texture)
+{
+	auto iter = m_Textures.find(reinterpret_cast<TextureRecord*>(texture));
+	assert(iter != m_Textures.end());
+	assert(texture != m_DebugTexture);
+
+	// Frames in flight may still sample it, so it and the sets naming it go once this frame has finished.
+	VkImageView view = iter->second->view;
+	std::vector<VkDescriptorSet> staleSets;
+	for (auto set = m_GeometrySets.begin(); set != m_GeometrySets.end();)
+	{
+		if (std::get<1>(set->first) == view || std::get<2>(set->first) == view)
+		{
+			staleSets.push_back(set->second);
+			set = m_GeometrySets.erase(set);
+		}
+		else
+		{
+			++set;
+		}
+	}
+
+	VkDevice device = m_Device;
+	VkDescriptorPool descriptorPool = m_DescriptorPool;
+	VkImage image = iter->second->image;
+	VkDeviceMemory memory = iter->second->memory;
+	m_Frames[m_FrameIndex].deletions.push_back([device, descriptorPool, staleSets, view, image, memory]()
+	{
+		if (!staleSets.empty()) vkFreeDescriptorSets(device, descriptorPool, static_cast<uint32_t>(staleSets.size()), staleSets.data());
+		vkDestroyImageView(device, view, nullptr);
+		vkDestroyImage(device, image, nullptr);
+		vkFreeMemory(device, memory, nullptr);
+	});
+	m_Textures.erase(iter);
+}
+
+TexturePackingInput VulkanRHI::GetTexturePackingInput(RHITexture texture) const
+{
+	auto record = reinterpret_cast<const TextureRecord*>(texture);
+
+	TexturePackingInput input;
+	input.texture = texture;
+	input.width = record->width;
+	input.height = record->height;
+	input.mipLevels = record->mipLevels;
+	input.format = record->format;
+	return input;
+}
+
+void VulkanRHI::CreateDebugTexture2D()
+{
+	CPUTexture debugTex;
+	debugTex.height = 2;
+	debugTex.width = 2;
+	for (int i = 0; i < debugTex.height * debugTex.width; i++)
+	{
+		debugTex.data.push_back(char(255));
+		debugTex.data.push_back(0);
+		debugTex.data.push_back(char(255));
+		debugTex.data.push_back(char(255));
+	}
+
+	m_DebugTexture = CreateTexture2D(debugTex);
+}
+
+void VulkanRHI::CreateFullscreenQuadBuffers()
+{
+	std::array<glm::vec2, 4> positions{
+		glm::vec2(-1.f, -1.f),
+		glm::vec2(-1.f, 1.f),
+		glm::vec2(1.f, -1.f),
+		glm::vec2(1.f, 1.f)
+	};
+
+	std::array<glm::vec2, 4> uvs{
+		glm::vec2(0, 1),
+		glm::vec2(0, 0),
+		glm::vec2(1, 1),
+		glm::vec2(1, 0)
+	};
+
+	std::vector<IndexType> indices{
+		0, 1, 2, 2, 1, 3
+	};
+
+	m_FullscreenQuadMesh.positionBuffer = CreateVertexBuffer(positions.data(), static_cast<uint32_t>(positions.size()));
+	m_FullscreenQuadMesh.uvBuffer = CreateVertexBuffer(uvs.data(), static_cast<uint32_t>(uvs.size()));
+	m_FullscreenQuadMesh.indexBuffer = CreateIndexBuffer(indices);
+}
+
+void VulkanRHI::CreateLightingResources()
+{
+	m_AmbientCb = CreateConstantBuffer(sizeof(glm::vec4));
+	m_DirectionalCb = CreateConstantBuffer(sizeof(DirectionalConstants));
+
+	std::array<VkDescriptorSetLayout, 2> layouts = { m_LightingSetLayout, m_LightingSetLayout };
+	std::array<VkDescriptorSet, 2> sets;
+	VkDescriptorSetAllocateInfo allocInfo = {};
+	allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+	allocInfo.descriptorPool = m_DescriptorPool;
+	allocInfo.descriptorSetCount = static_cast<uint32_t>(layouts.size());
+	allocInfo.pSetLayouts = layouts.data();
+	Check(vkAllocateDescriptorSets(m_Device, &allocInfo, sets.data()), "vkAllocateDescriptorSets");
+	m_AmbientSet = sets[0];
+	m_DirectionalSet = sets[1];
+
+	WriteLightingDescriptorSets();
+}
+
+void VulkanRHI::WriteLightingDescriptorSets()
+{
+	std::array<VkDescriptorImageInfo, 2> gbuffer = { {
+		{ VK_NULL_HANDLE, m_ColorRT.view, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL },
+		{ VK_NULL_HANDLE, m_NormalRT.view, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL } } };
+
+	for (auto setAndCb : { std::make_pair(m_AmbientSet, m_AmbientCb), std::make_pair(m_DirectionalSet, m_DirectionalCb) })
+	{
+		auto constantBuffer = reinterpret_cast<const BufferRecord*>(setAndCb.second);
+		VkDescriptorBufferInfo bufferInfo = { constantBuffer->buffer, 0, constantBuffer->size };
+
+		std::array<VkWriteDescriptorSet, 2> writes = {};
+		writes[0].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+		writes[0].dstSet = setAndCb.first;
+		writes[0].dstBinding = 0;
+		writes[0].descriptorCount = 1;
+		writes[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+		writes[0].pBufferInfo = &bufferInfo;
+		writes[1].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+		writes[1].dstSet = setAndCb.first;
+		writes[1].dstBinding = 1;
+		writes[1].descriptorCount = 2;
+		writes[1].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+		writes[1].pImageInfo = gbuffer.data();
+		vkUpdateDescriptorSets(m_Device, static_cast<uint32_t>(writes.size()), writes.data(), 0, nullptr);
+	}
+}
+
+VkDescriptorSet VulkanRHI::GetGeometryDescriptorSet(const BufferRecord* constantBuffer, const TextureRecord* diffuse, const TextureRecord* mask)
+{
+	auto key = std::make_tuple(constantBuffer->buffer, diffuse->view, mask ? mask->view : VK_NULL_HANDLE);
+	auto iter = m_GeometrySets.find(key);
+	if (iter != m_GeometrySets.end()) return iter->second;
+
+	VkDescriptorSet set;
+	VkDescriptorSetAllocateInfo allocInfo = {};
+	allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+	allocInfo.descriptorPool = m_DescriptorPool;
+	allocInfo.descriptorSetCount = 1;
+	allocInfo.pSetLayouts = &m_GeometrySetLayout;
+	Check(vkAllocateDescriptorSets(m_Device, &allocInfo, &set), "vkAllocateDescriptorSets");
+
+	// Opaque draws never sample the mask, but the binding still has to hold a valid image.
+	VkDescriptorBufferInfo bufferInfo = { constantBuffer->buffer, 0, constantBuffer->size };
+	auto debugTexture = reinterpret_cast<const TextureRecord*>(m_DebugTexture);
+	std::array<VkDescriptorImageInfo, 2> images = { {
+		{ VK_NULL_HANDLE, diffuse->view, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL },
+		{ VK_NULL_HANDLE, mask ? mask->view : debugTexture->view, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL } } };
+
+	std::array<VkWriteDescriptorSet, 2> writes = {};
+	writes[0].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+	writes[0].dstSet = set;
+	writes[0].dstBinding = 0;
+	writes[0].descriptorCount = 1;
+	writes[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+	writes[0].pBufferInfo = &bufferInfo;
+	writes[1].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+	writes[1].dstSet = set;
+	writes[1].dstBinding = 1;
+	writes[1].descriptorCount = 2;
+	writes[1].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+	writes[1].pImageInfo = images.data();
+	vkUpdateDescriptorSets(m_Device, static_cast<uint32_t>(writes.size()), writes.data(), 0, nullptr);
+
+	m_GeometrySets.insert({ key, set });
+	return set;
+}
+
+VkCommandBuffer VulkanRHI::BeginFrame()
+{
+	FrameResources& frame = m_Frames[m_FrameIndex];
+	if (m_FrameBegun) return frame.commandBuffer;
+
+	Check(vkWaitForFences(m_Device, 1, &frame.fence, VK_TRUE, UINT64_MAX), "vkWaitForFences");
+
+	if (frame.timed)
+	{
+		std::array<uint64_t, 3> timestamps;
+		if (vkGetQueryPoolResults(m_Device, m_TimestampPool, 3 * m_FrameIndex, 3, sizeof(timestamps), timestamps.data(), sizeof(uint64_t),
+			VK_QUERY_RESULT_64_BIT) == VK_SUCCESS)
+		{
+			double msPerTick = m_DeviceProperties.limits.timestampPeriod * 1e-6;
+			m_Stats.gpuGeometryMs += (timestamps[1] - timestamps[0]) * msPerTick;
+			m_Stats.gpuLightingMs += (timestamps[2] - timestamps[1]) * msPerTick;
+			++m_Stats.numTimedFrames;
+		}
+		frame.timed = false;
+	}
+
+	for (auto& deletion : frame.deletions) deletion();
+	frame.deletions.clear();
+
+	Check(vkResetCommandPool(m_Device, frame.commandPool, 0), "vkResetCommandPool");
+	for (auto pool : frame.recordPools) Check(vkResetCommandPool(m_Device, pool, 0), "vkResetCommandPool");
+
+	VkCommandBufferBeginInfo beginInfo = {};
+	beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+	beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+	Check(vkBeginCommandBuffer(frame.commandBuffer, &beginInfo), "vkBeginCommandBuffer");
+	if (m_HasTimestamps) vkCmdResetQueryPool(frame.commandBuffer, m_TimestampPool, 3 * m_FrameIndex, 3);
+
+	m_FrameBegun = true;
+	m_NumTimestamps = 0;
+	return frame.commandBuffer;
+}
+
+void VulkanRHI::BeginGeometryPass()
+{
+	BeginFrame();
+	m_DrawPackets.clear();
+	m_CurrentGeometryPipeline = m_GeometryPipeline;
+}
+
+void VulkanRHI::BeginMaskedGeometryPass()
+{
+	// Same targets and state as the opaque pass, only the fragment shader alpha tests.
+	m_CurrentGeometryPipeline = m_MaskedGeometryPipeline;
+}
+
+void VulkanRHI::SetGeometryShaderFeatures(uint32_t features)
+{
+	// The SPIR-V shaders have no variants, so debug views draw as the scene.
+}
+
+void VulkanRHI::DrawMesh(const Mesh& mesh, RHITexture diffuse, RHITexture mask)
+{
+	assert(m_CurrentGeometryPipeline);
+	auto constantBuffer = reinterpret_cast<const BufferRecord*>(mesh.constantBuffer);
+	auto diffuseTexture = reinterpret_cast<const TextureRecord*>(diffuse);
+	auto maskTexture = reinterpret_cast<const TextureRecord*>(mask);
+
+	DrawPacket packet;
+	packet.pipeline = m_CurrentGeometryPipeline;
+	packet.vertexBuffers = {
+		reinterpret_cast<const BufferRecord*>(mesh.gpuMesh.positionBuffer)->buffer,
+		reinterpret_cast<const BufferRecord*>(mesh.gpuMesh.normalBuffer)->buffer,
+		reinterpret_cast<const BufferRecord*>(mesh.gpuMesh.uvBuffer)->buffer };
+	packet.indexBuffer = reinterpret_cast<const BufferRecord*>(mesh.gpuMesh.indexBuffer)->buffer;
+	packet.numIndices = mesh.numFaces * 3;
+	packet.descriptorSet = GetGeometryDescriptorSet(constantBuffer, diffuseTexture, maskTexture);
+	packet.dynamicOffset = GetDynamicOffset(constantBuffer);
+	m_DrawPackets.push_back(packet);
+}
+
+void VulkanRHI::RecordDrawPackets(VkCommandBuffer commandBuffer, const DrawPacket* begin, const DrawPacket* end, RHIStateCache& stateCache) const
+{
+	VkCommandBufferInheritanceInfo inheritance = {};
+	inheritance.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO;
+	inheritance.renderPass = m_GeometryRenderPass;
+	inheritance.subpass = 0;
+	inheritance.framebuffer = m_GeometryFramebuffer;
+
+	VkCommandBufferBeginInfo beginInfo = {};
+	beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+	beginInfo.flags = VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT | VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+	beginInfo.pInheritanceInfo = &inheritance;
+	Check(vkBeginCommandBuffer(commandBuffer, &beginInfo), "vkBeginCommandBuffer");
+
+	SetViewportAndScissor(commandBuffer, m_Width, m_Height);
+
+	// Consecutive draws mostly share a pipeline and often a set, so only changes are bound. Nothing carries
+	// over from the previous command buffer.
+	stateCache.Reset();
+	const std::array<VkDeviceSize, 3> offsets = { 0, 0, 0 };
+	for (auto packet = begin; packet != end; ++packet)
+	{
+		if (stateCache.Set(RHIStateSlot::Pipeline, packet->pipeline))
+		{
+			vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, packet->pipeline);
+		}
+		if (stateCache.Set(RHIStateSlot::DescriptorSet, packet->descriptorSet, packet->dynamicOffset))
+		{
+			vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, m_GeometryPipelineLayout, 0, 1, &packet->descriptorSet, 1, &packet->dynamicOffset);
+		}
+		if (stateCache.Set(RHIStateSlot::VertexBuffers, packet->vertexBuffers[0], packet->vertexBuffers[1], packet->vertexBuffers[2]))
+		{
+			vkCmdBindVertexBuffers(commandBuffer, 0, 3, packet->vertexBuffers.data(), offsets.data());
+		}
+		if (stateCache.Set(RHIStateSlot::IndexBuffer, packet->indexBuffer))
+		{
+			vkCmdBindIndexBuffer(commandBuffer, packet->indexBuffer, 0, VK_INDEX_TYPE_UINT16);
+		}
+		vkCmdDrawIndexed(commandBuffer, packet->numIndices, 1, 0, 0, 0);
+	}
+
+	Check(vkEndCommandBuffer(commandBuffer), "vkEndCommandBuffer");
+}
+
+void VulkanRHI::RecordGeometryPass(VkCommandBuffer commandBuffer)
+{
+	if (m_HasTimestamps)
+	{
+		vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, m_TimestampPool, 3 * m_FrameIndex);
+		++m_NumTimestamps;
+	}
+
+	std::array<VkClearValue, 3> clearValues = {};
+	clearValues[0].color = { { 0.f, 0.f, 0.25f, 1.f } };
+	clearValues[2].depthStencil = { 1.f, 0 };
+
+	VkRenderPassBeginInfo renderPassBegin = {};
+	renderPassBegin.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+	renderPassBegin.renderPass = m_GeometryRenderPass;
+	renderPassBegin.framebuffer = m_GeometryFramebuffer;
+	renderPassBegin.renderArea.extent = { m_Width, m_Height };
+	renderPassBegin.clearValueCount = static_cast<uint32_t>(clearValues.size());
+	renderPassBegin.pClearValues = clearValues.data();
+	vkCmdBeginRenderPass(commandBuffer, &renderPassBegin, VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS);
+
+	// Draws are split into contiguous chunks, one per recording slot, so state filtering within a chunk still works.
+	// The main thread records the first chunk rather than waiting idle.
+	auto recordBegin = std::chrono::steady_clock::now();
+	FrameResources& frame = m_Frames[m_FrameIndex];
+	auto numPackets = static_cast<uint32_t>(m_DrawPackets.size());
+	uint32_t numChunks = glm::clamp((numPackets + MinDrawsPerChunk - 1) / MinDrawsPerChunk, 1u, m_NumRecordSlots);
+	auto chunkBegin = [&](uint32_t chunk) { return m_DrawPackets.data() + uint64_t(numPackets) * chunk / numChunks; };
+
+	std::vector<std::future<void>> chunksRecorded;
+	for (uint32_t chunk = 1; chunk < numChunks; ++chunk)
+	{
+		VkCommandBuffer chunkBuffer = frame.recordBuffers[chunk];
+		const DrawPacket* begin = chunkBegin(chunk);
+		const DrawPacket* end = chunkBegin(chunk + 1);
+		RHIStateCache* stateCache = &m_RecordStateCaches[chunk];
+		chunksRecorded.push_back(m_RecordThreads->Submit([this, chunkBuffer, begin, end, stateCache]() {
+			RecordDrawPackets(chunkBuffer, begin, end, *stateCache);
+		}));
+	}
+	RecordDrawPackets(frame.recordBuffers[0], chunkBegin(0), chunkBegin(1), m_RecordStateCaches[0]);
+	for (auto& recorded : chunksRecorded) recorded.get();
+	for (uint32_t chunk = 0; chunk < numChunks; ++chunk) m_Stats.stateCounts += m_RecordStateCaches[chunk].TakeCounts();
+
+	m_Stats.recordMs += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - recordBegin).count();
+	m_Stats.numRecordedChunks += numChunks;
+	m_Stats.numDraws += numPackets;
+
+	vkCmdExecuteCommands(commandBuffer, numChunks, frame.recordBuffers.data());
+	vkCmdEndRenderPass(commandBuffer);
+
+	if (m_HasTimestamps)
+	{
+		vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, m_TimestampPool, 3 * m_FrameIndex + 1);
+		++m_NumTimestamps;
+	}
+	m_DrawPackets.clear();
+	m_CurrentGeometryPipeline = VK_NULL_HANDLE;
+}
+
+void VulkanRHI::BeginLightingPass()
+{
+	VkCommandBuffer commandBuffer = BeginFrame();
+	RecordGeometryPass(commandBuffer);
+	// Executing secondary command buffers leaves the primary's bindings undefined.
+	m_LightingStateCache.Reset();
+
+	if (m_Headless)
+	{
+		m_OutputIndex = 0;
+	}
+	else
+	{
+		// Out of date means a resize is on its way, this frame just skips lighting.
+		VkResult result = vkAcquireNextImageKHR(m_Device, m_Swapchain, UINT64_MAX, m_Frames[m_FrameIndex].imageAcquired, VK_NULL_HANDLE, &m_OutputIndex);
+		if (result != VK_SUCCESS && result != VK_SUBOPTIMAL_KHR) return;
+		m_OutputAcquired = true;
+	}
+
+	VkClearValue clearValue = {};
+	clearValue.color = { { 0.f, 0.f, 0.f, 1.f } };
+
+	VkRenderPassBeginInfo renderPassBegin = {};
+	renderPassBegin.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+	renderPassBegin.renderPass = m_LightingRenderPass;
+	renderPassBegin.framebuffer = m_OutputFramebuffers[m_OutputIndex];
+	renderPassBegin.renderArea.extent = { m_Width, m_Height };
+	renderPassBegin.clearValueCount = 1;
+	renderPassBegin.pClearValues = &clearValue;
+	vkCmdBeginRenderPass(commandBuffer, &renderPassBegin, VK_SUBPASS_CONTENTS_INLINE);
+	SetViewportAndScissor(commandBuffer, m_Width, m_Height);
+	m_LightingPassOpen = true;
+}
+
+void VulkanRHI::BindFullscreenQuad(VkCommandBuffer commandBuffer)
+{
+	std::array<VkBuffer, 2> vertexBuffers = {
+		reinterpret_cast<const BufferRecord*>(m_FullscreenQuadMesh.positionBuffer)->buffer,
+		reinterpret_cast<const BufferRecord*>(m_FullscreenQuadMesh.uvBuffer)->buffer };
+	std::array<VkDeviceSize, 2> offsets = { 0, 0 };
+	if (m_LightingStateCache.Set(RHIStateSlot::VertexBuffers, vertexBuffers[0], vertexBuffers[1]))
+	{
+		vkCmdBindVertexBuffers(commandBuffer, 0, 2, vertexBuffers.data(), offsets.data());
+	}
+	VkBuffer indexBuffer = reinterpret_cast<const BufferRecord*>(m_FullscreenQuadMesh.indexBuffer)->buffer;
+	if (m_LightingStateCache.Set(RHIStateSlot::IndexBuffer, indexBuffer)) vkCmdBindIndexBuffer(commandBuffer, indexBuffer, 0, VK_INDEX_TYPE_UINT16);
+}
+
+void VulkanRHI::DrawAmbient(glm::vec3 color)
+{
+	if (!m_LightingPassOpen) return;
+	VkCommandBuffer commandBuffer = m_Frames[m_FrameIndex].commandBuffer;
+
+	glm::vec4 amb = glm::vec4(color, 1.0f);
+	UpdateConstantBuffer(m_AmbientCb, &amb, sizeof(amb));
+	uint32_t dynamicOffset = GetDynamicOffset(reinterpret_cast<const BufferRecord*>(m_AmbientCb));
+
+	if (m_LightingStateCache.Set(RHIStateSlot::Pipeline, m_AmbientPipeline))
+	{
+		vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, m_AmbientPipeline);
+	}
+	if (m_LightingStateCache.Set(RHIStateSlot::DescriptorSet, m_AmbientSet, dynamicOffset))
+	{
+		vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, m_LightingPipelineLayout, 0, 1, &m_AmbientSet, 1, &dynamicOffset);
+	}
+	BindFullscreenQuad(commandBuffer);
+	vkCmdDrawIndexed(commandBuffer, 6, 1, 0, 0, 0);
+}
+
+void VulkanRHI::DrawDirectionalLight(glm::vec3 color, glm::vec3 angles)
+{
+	if (!m_LightingPassOpen) return;
+	VkCommandBuffer commandBuffer = m_Frames[m_FrameIndex].commandBuffer;
+
+	auto lightDir = glm::vec3(1.0f, 0.0f, 0.0f);
+
+	const auto xDir = glm::vec3(1.0f, 0.0f, 0.0f);
+	const auto yDir = glm::vec3(0.0f, 1.0f, 0.0f);
+	const auto zDir = glm::vec3(0.0f, 0.0f, 1.0f);
+	glm::mat4 xRotMat = glm::rotate(glm::radians(angles.x), xDir);
+	glm::mat4 yRotMat = glm::rotate(glm::radians(angles.y), yDir);
+	glm::mat4 zRotMat = glm::rotate(glm::radians(angles.z), zDir);
+	glm::mat4 rotMat = xRotMat * yRotMat * zRotMat;
+
+	DirectionalConstants data;
+	data.color = glm::vec4(color, 1.0f);
+	data.direction = rotMat * glm::vec4(lightDir, 1.0f);
+	UpdateConstantBuffer(m_DirectionalCb, &data, sizeof(data));
+	uint32_t dynamicOffset = GetDynamicOffset(reinterpret_cast<const BufferRecord*>(m_DirectionalCb));
+
+	if (m_LightingStateCache.Set(RHIStateSlot::Pipeline, m_DirectionalPipeline))
+	{
+		vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, m_DirectionalPipeline);
+	}
+	if (m_LightingStateCache.Set(RHIStateSlot::DescriptorSet, m_DirectionalSet, dynamicOffset))
+	{
+		vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, m_LightingPipelineLayout, 0, 1, &m_DirectionalSet, 1, &dynamicOffset);
+	}
+	BindFullscreenQuad(commandBuffer);
+	vkCmdDrawIndexed(commandBuffer, 6, 1, 0, 0, 0);
+}
+
+void VulkanRHI::Present()
+{
+	FrameResources& frame = m_Frames[m_FrameIndex];
+	VkCommandBuffer commandBuffer = BeginFrame();
+
+	if (m_LightingPassOpen)
+	{
+		vkCmdEndRenderPass(commandBuffer);
+		m_LightingPassOpen = false;
+		if (m_HasTimestamps)
+		{
+			vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, m_TimestampPool, 3 * m_FrameIndex + 2);
+			++m_NumTimestamps;
+		}
+	}
+	frame.timed = m_NumTimestamps == 3;
+	Check(vkEndCommandBuffer(commandBuffer), "vkEndCommandBuffer");
+
+	VkPipelineStageFlags waitStage = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+	VkSubmitInfo submitInfo = {};
+	submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+	submitInfo.waitSemaphoreCount = m_OutputAcquired ? 1 : 0;
+	submitInfo.pWaitSemaphores = &frame.imageAcquired;
+	submitInfo.pWaitDstStageMask = &waitStage;
+	submitInfo.commandBufferCount = 1;
+	submitInfo.pCommandBuffers = &commandBuffer;
+	submitInfo.signalSemaphoreCount = m_OutputAcquired ? 1 : 0;
+	submitInfo.pSignalSemaphores = &frame.renderFinished;
+	Check(vkResetFences(m_Device, 1, &frame.fence), "vkResetFences");
+	Check(vkQueueSubmit(m_Queue, 1, &submitInfo, frame.fence), "vkQueueSubmit");
+
+	if (m_OutputAcquired)
+	{
+		VkPresentInfoKHR presentInfo = {};
+		presentInfo.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
+		presentInfo.waitSemaphoreCount = 1;
+		presentInfo.pWaitSemaphores = &frame.renderFinished;
+		presentInfo.swapchainCount = 1;
+		presentInfo.pSwapchains = &m_Swapchain;
+		presentInfo.pImageIndices = &m_OutputIndex;
+		// Out of date and suboptimal are left to the resize the window is about to report.
+		vkQueuePresentKHR(m_Queue, &presentInfo);
+		m_OutputAcquired = false;
+	}
+
+	m_Stats.stateCounts += m_LightingStateCache.TakeCounts();
+	++m_Stats.numFrames;
+	m_FrameBegun = false;
+	m_FrameIndex = (m_FrameIndex + 1) % FramesInFlight;
+}
+
+void VulkanRHI::InitImGui(const Window& window)
+{
+	ImGui_ImplSDL2_InitForVulkan(window.sdlWindow.get());
+
+	// NewFrame needs a built font atlas even though nothing uploads it.
+	unsigned char* pixels;
+	int width, height;
+	ImGui::GetIO().Fonts->GetTexDataAsRGBA32(&pixels, &width, &height);
+}
+
+void VulkanRHI::ShutdownImGui()
+{
+	ImGui_ImplSDL2_Shutdown();
+}
+
+void VulkanRHI::LogStats() const
+{
+	if (m_Stats.numFrames == 0) return;
+
+	double numFrames = static_cast<double>(m_Stats.numFrames);
+	SDL_Log("Vulkan (%s): %llu frames, %.1f draws per frame in %.2f chunks on %u threads, %.3f ms recording per frame (%.0f draws/ms).",
+		m_DeviceProperties.deviceName, static_cast<unsigned long long>(m_Stats.numFrames), m_Stats.numDraws / numFrames,
+		m_Stats.numRecordedChunks / numFrames, m_NumRecordSlots, m_Stats.recordMs / numFrames,
+		m_Stats.recordMs > 0.0 ? m_Stats.numDraws / m_Stats.recordMs : 0.0);
+	if (m_Stats.numTimedFrames > 0)
+	{
+		SDL_Log("Vulkan GPU time per frame over %llu frames: geometry %.3f ms, lighting %.3f ms.",
+			static_cast<unsigned long long>(m_Stats.numTimedFrames),
+			m_Stats.gpuGeometryMs / m_Stats.numTimedFrames, m_Stats.gpuLightingMs / m_Stats.numTimedFrames);
+	}
+	m_Stats.stateCounts.Log("Vulkan", m_Stats.numFrames);
+}
\ No newline at end of file
@@ -0,0 +1,262 @@
+#pragma once
+#include <array>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <string>
+#include <tuple>
+#include <vector>
+
+#ifdef _WIN32
+#define VK_USE_PLATFORM_WIN32_KHR
+#endif
+#include <vulkan/vulkan.h>
+
+#include "RHI.h"
+#include "RHIStateCache.h"
+#include "GPUMesh.h"
+
+class ThreadPool;
+
+struct VulkanRHIStats
+{
+	uint64_t numFrames = 0;
+	uint64_t numDraws = 0;
+	uint64_t numRecordedChunks = 0;
+	double recordMs = 0.0;				// CPU time spent recording the geometry pass, threads included
+	uint64_t numTimedFrames = 0;
+	double gpuGeometryMs = 0.0;
+	double gpuLightingMs = 0.0;
+	RHIStateCounts stateCounts;			// Every command buffer's binds, summed
+};
+
+// Vulkan 1.1 implementation of the same passes as D3D11RHI. Draws are queued as packets, and the geometry pass
+// is recorded from them into secondary command buffers spread over worker threads, each with its own command pool
+// per frame in flight. Headless, it renders into an offscreen image, which is how it runs on CPU drivers such as
+// lavapipe. Shaders are the SPIR-V built from Source/Shaders/GLSL. Handles are the backend's records, cast.
+class VulkanRHI : public RHI
+{
+public:
+	explicit VulkanRHI(bool headless);
+	~VulkanRHI();
+
+	const char* GetName() const override { return m_Headless ? "vulkan-headless" : "vulkan"; }
+	bool IsHeadless() const override { return m_Headless; }
+	uint32_t GetWindowFlags() const override { return 0; }
+	bool InitRHI(const Window& window) override;
+	void HandleWindowResize(uint32_t windowWidth, uint32_t windowHeight) override;
+
+	using RHI::CreateVertexBuffer;
+	RHIBuffer CreateVertexBuffer(const void* data, uint32_t stride, uint32_t numVertices) override;
+	RHIBuffer CreateIndexBuffer(const std::vector<IndexType>& indices) override;
+	RHIBuffer CreateConstantBuffer(int size) override;
+	bool UpdateConstantBuffer(RHIBuffer buffer, const void* data, int numBytes) override;
+	void UpdateMaterialTable(const std::vector<GPUMaterial>& materials) override;
+
+	RHITexture CreateTexture2D(const CPUTexture& cpuTexture) override;
+	RHITexture CreateTexture2DArray(const TextureArrayPlan& arrayPlan) override;
+	void ReleaseTexture2D(RHITexture texture) override;
+	TexturePackingInput GetTexturePackingInput(RHITexture texture) const override;
+	uint32_t GetMaxTextureArraySlices() const override { return m_MaxTextureArraySlices; }
+	RHITexture GetDebugTexture2D() override { return m_DebugTexture; }
+
+	void BeginGeometryPass() override;
+	void BeginMaskedGeometryPass() override;
+	void SetGeometryShaderFeatures(uint32_t features) override;
+	void DrawMesh(const Mesh& mesh, RHITexture diffuseTexture, RHITexture maskTexture) override;
+	void BeginLightingPass() override;
+	void DrawAmbient(glm::vec3 color) override;
+	void DrawDirectionalLight(glm::vec3 color, glm::vec3 angles) override;
+	void Present() override;
+
+	// The vendored ImGui has no Vulkan renderer, so only the platform half runs and the UI isn't drawn.
+	void InitImGui(const Window& window) override;
+	void NewImGuiFrame() override {}
+	void RenderImGui() override {}
+	void ShutdownImGui() override;
+
+	// Validation is left to the Khronos layer, enabled through the loader's environment.
+	uint32_t GetNumValidationErrors() const override { return 0; }
+	void LogStats() const override;
+	const VulkanRHIStats& GetStats() const { return m_Stats; }
+
+private:
+	static const uint32_t FramesInFlight = 2;
+	// Fewer draws than this aren't worth handing to another thread.
+	static const uint32_t MinDrawsPerChunk = 64;
+	// Host-visible memory is sub-allocated for buffers in blocks of this size.
+	static const VkDeviceSize BufferBlockSize = 32 * 1024 * 1024;
+
+	struct MemoryBlock
+	{
+		VkDeviceMemory memory;
+		uint32_t memoryTypeIndex;
+		VkDeviceSize size;
+		VkDeviceSize used;
+		char* mapped;
+	};
+
+	struct BufferRecord
+	{
+		VkBuffer buffer;
+		VkDeviceSize size;
+		char* mapped;
+		// Constant buffers hold one copy per frame in flight, frameSize apart, bound with a dynamic offset.
+		VkDeviceSize frameSize;
+	};
+
+	struct TextureRecord
+	{
+		VkImage image;
+		VkImageView view;
+		VkDeviceMemory memory;
+		VkFormat format;
+		uint32_t width;
+		uint32_t height;
+		uint32_t mipLevels;
+		uint32_t arrayLayers;
+	};
+
+	struct RenderTarget
+	{
+		VkImage image = VK_NULL_HANDLE;
+		VkImageView view = VK_NULL_HANDLE;
+		VkDeviceMemory memory = VK_NULL_HANDLE;
+	};
+
+	struct DrawPacket
+	{
+		VkPipeline pipeline;
+		std::array<VkBuffer, 3> vertexBuffers;
+		VkBuffer indexBuffer;
+		uint32_t numIndices;
+		VkDescriptorSet descriptorSet;
+		uint32_t dynamicOffset;
+	};
+
+	struct FrameResources
+	{
+		VkCommandPool commandPool = VK_NULL_HANDLE;
+		VkCommandBuffer commandBuffer = VK_NULL_HANDLE;
+		VkFence fence = VK_NULL_HANDLE;
+		VkSemaphore imageAcquired = VK_NULL_HANDLE;
+		VkSemaphore renderFinished = VK_NULL_HANDLE;
+		// One pool and secondary command buffer per recording slot, so threads never share a pool.
+		std::vector<VkCommandPool> recordPools;
+		std::vector<VkCommandBuffer> recordBuffers;
+		// Run once the frame's fence has signalled, i.e. when the GPU is done with what they release.
+		std::vector<std::function<void()>> deletions;
+		bool timed = false;
+	};
+
+	bool CreateInstanceAndDevice(const Window& window);
+	bool CreateSwapchain(uint32_t width, uint32_t height);
+	bool CreateOutputTarget(uint32_t width, uint32_t height);
+	void DestroyOutputTarget();
+	void CreateRenderPasses();
+	void CreateGBuffers(uint32_t width, uint32_t height);
+	void DestroyGBuffers();
+	void CreateFramebuffers();
+	void DestroyFramebuffers();
+	void CreateDescriptorLayouts();
+	void CreatePipelines();
+	VkShaderModule LoadShaderModule(const std::string& name);
+	VkPipeline CreatePipeline(VkShaderModule vertexShader, VkShaderModule fragmentShader, VkPipelineLayout layout, VkRenderPass renderPass,
+		uint32_t numColorAttachments, bool geometryVertexLayout, bool lighting);
+	void CreateFrameResources();
+	void CreateLightingResources();
+	void WriteLightingDescriptorSets();
+	void CreateDebugTexture2D();
+	void CreateFullscreenQuadBuffers();
+
+	uint32_t FindMemoryType(uint32_t typeBits, VkMemoryPropertyFlags required, VkMemoryPropertyFlags preferred) const;
+	RenderTarget CreateRenderTarget(uint32_t width, uint32_t height, VkFormat format, VkImageUsageFlags usage, VkImageAspectFlags aspect);
+	void DestroyRenderTarget(RenderTarget& target);
+	RHIBuffer CreateBuffer(const void* data, VkDeviceSize size, VkBufferUsageFlags usage, VkDeviceSize frameSize);
+	VkBuffer CreateStagingBuffer(const void* data, VkDeviceSize size, char** mapped);
+	TextureRecord* CreateTextureRecord(uint32_t width, uint32_t height, uint32_t mipLevels, uint32_t arrayLayers, VkFormat format);
+	void ImageBarrier(VkCommandBuffer commandBuffer, VkImage image, uint32_t baseMip, uint32_t numMips, uint32_t numLayers,
+		VkImageLayout oldLayout, VkImageLayout newLayout, VkAccessFlags srcAccess, VkAccessFlags dstAccess,
+		VkPipelineStageFlags srcStage, VkPipelineStageFlags dstStage);
+	VkDescriptorSet GetGeometryDescriptorSet(const BufferRecord* constantBuffer, const TextureRecord* diffuse, const TextureRecord* mask);
+
+	// Waits for this frame slot's previous use, then starts its command buffer. Idempotent within a frame.
+	VkCommandBuffer BeginFrame();
+	void RecordGeometryPass(VkCommandBuffer commandBuffer);
+	void RecordDrawPackets(VkCommandBuffer commandBuffer, const DrawPacket* begin, const DrawPacket* end, RHIStateCache& stateCache) const;
+	uint32_t GetDynamicOffset(const BufferRecord* constantBuffer) const { return static_cast<uint32_t>(constantBuffer->frameSize * m_FrameIndex); }
+	void BindFullscreenQuad(VkCommandBuffer commandBuffer);
+
+	bool								m_Headless;
+	uint32_t							m_Width = 0;
+	uint32_t							m_Height = 0;
+
+	VkInstance							m_Instance = VK_NULL_HANDLE;
+	VkPhysicalDevice					m_PhysicalDevice = VK_NULL_HANDLE;
+	VkPhysicalDeviceProperties			m_DeviceProperties;
+	VkPhysicalDeviceMemoryProperties	m_MemoryProperties;
+	VkDevice							m_Device = VK_NULL_HANDLE;
+	uint32_t							m_QueueFamily = 0;
+	VkQueue								m_Queue = VK_NULL_HANDLE;
+	uint32_t							m_MaxTextureArraySlices = 256;
+	bool								m_HasTimestamps = false;
+
+	VkSurfaceKHR						m_Surface = VK_NULL_HANDLE;
+	VkSwapchainKHR						m_Swapchain = VK_NULL_HANDLE;
+	VkFormat							m_OutputFormat = VK_FORMAT_R8G8B8A8_UNORM;
+	std::vector<VkImage>				m_OutputImages;
+	std::vector<VkImageView>			m_OutputViews;
+	std::vector<VkFramebuffer>			m_OutputFramebuffers;
+	RenderTarget						m_OffscreenOutput;		// Stands in for the swapchain when headless
+	uint32_t							m_OutputIndex = 0;
+	bool								m_OutputAcquired = false;
+
+	VkRenderPass						m_GeometryRenderPass = VK_NULL_HANDLE;
+	VkRenderPass						m_LightingRenderPass = VK_NULL_HANDLE;
+	RenderTarget						m_ColorRT;
+	RenderTarget						m_NormalRT;
+	RenderTarget						m_DepthRT;
+	VkFramebuffer						m_GeometryFramebuffer = VK_NULL_HANDLE;
+
+	VkSampler							m_Sampler = VK_NULL_HANDLE;
+	VkDescriptorSetLayout				m_GeometrySetLayout = VK_NULL_HANDLE;
+	VkDescriptorSetLayout				m_LightingSetLayout = VK_NULL_HANDLE;
+	VkPipelineLayout					m_GeometryPipelineLayout = VK_NULL_HANDLE;
+	VkPipelineLayout					m_LightingPipelineLayout = VK_NULL_HANDLE;
+	VkDescriptorPool					m_DescriptorPool = VK_NULL_HANDLE;
+	VkPipeline							m_GeometryPipeline = VK_NULL_HANDLE;
+	VkPipeline							m_MaskedGeometryPipeline = VK_NULL_HANDLE;
+	VkPipeline							m_AmbientPipeline = VK_NULL_HANDLE;
+	VkPipeline							m_DirectionalPipeline = VK_NULL_HANDLE;
+
+	RHIBuffer							m_AmbientCb = nullptr;
+	RHIBuffer							m_DirectionalCb = nullptr;
+	VkDescriptorSet						m_AmbientSet = VK_NULL_HANDLE;
+	VkDescriptorSet						m_DirectionalSet = VK_NULL_HANDLE;
+	GPUMesh								m_FullscreenQuadMesh;
+	RHITexture							m_DebugTexture = nullptr;
+
+	std::vector<MemoryBlock>			m_BufferBlocks;
+	std::vector<std::unique_ptr<BufferRecord>> m_Buffers;
+	std::map<TextureRecord*, std::unique_ptr<TextureRecord>> m_Textures;
+	// Geometry sets keyed by (constant buffer, diffuse, mask). Entries naming a released texture are dropped with it.
+	std::map<std::tuple<VkBuffer, VkImageView, VkImageView>, VkDescriptorSet> m_GeometrySets;
+
+	std::array<FrameResources, FramesInFlight> m_Frames;
+	uint32_t							m_FrameIndex = 0;
+	bool								m_FrameBegun = false;
+	bool								m_LightingPassOpen = false;
+	uint32_t							m_NumTimestamps = 0;	// Written into this frame's queries so far
+	VkQueryPool							m_TimestampPool = VK_NULL_HANDLE;
+
+	// Draws queued since BeginGeometryPass, recorded in bulk when the lighting pass begins.
+	std::vector<DrawPacket>				m_DrawPackets;
+	VkPipeline							m_CurrentGeometryPipeline = VK_NULL_HANDLE;
+	std::unique_ptr<ThreadPool>			m_RecordThreads;
+	std::vector<RHIStateCache>			m_RecordStateCaches;	// One per recording slot
+	RHIStateCache						m_LightingStateCache;	// For the frame's primary command buffer
+	uint32_t							m_NumRecordSlots = 1;
+
+	VulkanRHIStats						m_Stats;
+};
\ No newline at end of file
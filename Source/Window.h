@@ -13,6 +13,7 @@ public:
 
     uint32_t		width;
     uint32_t		height;
+    // Headless windows only carry a size for the render targets; sdlWindow stays null.
+    bool			headless = false;
     UniquePtr<SDL_Window> sdlWindow = UniquePtr<SDL_Window>([](SDL_Window* window) { SDL_DestroyWindow(window); });
-    SDL_SysWMinfo m_SdlWindowWMInfo;
 };
@@ -1,10 +1,27 @@
+#include "Compression.h"
 #include "Engine.h"
 
 int main(int argc, char** argv)
 {
 	Engine engine(argc, argv);
-	assert(engine.Init());
-	assert(engine.LoadContent());
-	assert(engine.Execute());
-	return 0;
+	engine.ParseArgs();
+
+	// Writes compressed copies of a directory's files, which the loaders then pick up in place of the originals.
+	if (!engine.CookDir.empty())
+	{
+		return Compression::CookDirectory(engine.CookDir) ? 0 : 1;
+	}
+
+	// Replays a captured RHI command stream on the backend picked with rhi=, without the scene.
+	if (!engine.RHIReplayPath.empty())
+	{
+		return CaptureRHI::Replay(engine.RHIReplayPath, engine.RHIName, engine.BenchmarkFrames) ? 0 : 1;
+	}
+
+	if (!engine.Init() || !engine.LoadContent())
+	{
+		return 1;
+	}
+	// Fails when a validating RHI rejected any calls, so headless runs can gate CI.
+	return engine.Execute() ? 0 : 1;
 }
\ No newline at end of file
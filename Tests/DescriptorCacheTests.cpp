@@ -0,0 +1,101 @@
+#include <cstring>
+#include <functional>
+#include <memory>
+
+#include "DescriptorCache.h"
+#include "Test.h"
+
+namespace
+{
+// Shaped like the D3D11 state descriptors: plain fields with padding between them.
+struct FakeDesc
+{
+	uint8_t mode;
+	uint32_t flags;
+	float bias;
+};
+
+FakeDesc MakeDesc(uint8_t mode, uint32_t flags, float bias)
+{
+	FakeDesc desc;
+	memset(&desc, 0, sizeof(desc));
+	desc.mode = mode;
+	desc.flags = flags;
+	desc.bias = bias;
+	return desc;
+}
+
+// Stands in for an API object, move only as a COM pointer would be. Counts the objects made, so a test can
+// tell a cached object from a new one that happens to look the same.
+class FakeFactory
+{
+public:
+	typedef std::unique_ptr<int> Object;
+
+	bool operator()(const FakeDesc& desc, Object& object)
+	{
+		++numCreates;
+		if (desc.flags == FailingFlags) return false;
+		object.reset(new int(numCreates));
+		return true;
+	}
+
+	static const uint32_t FailingFlags = 0xdead;
+	int numCreates = 0;
+};
+
+typedef DescriptorCache<FakeDesc, FakeFactory::Object> FakeCache;
+}
+
+TEST(DescriptorCacheReturnsOneObjectPerDescriptor)
+{
+	FakeCache cache;
+	FakeFactory factory;
+	auto first = cache.Get(MakeDesc(1, 2, 0.5f), std::ref(factory));
+	auto again = cache.Get(MakeDesc(1, 2, 0.5f), std::ref(factory));
+	EXPECT(first && *first && first == again);
+	EXPECT(factory.numCreates == 1);
+}
+
+TEST(DescriptorCacheKeepsDifferentDescriptorsApart)
+{
+	FakeCache cache;
+	FakeFactory factory;
+	// Each differs from the first in one field.
+	auto base = cache.Get(MakeDesc(1, 2, 0.5f), std::ref(factory));
+	auto mode = cache.Get(MakeDesc(3, 2, 0.5f), std::ref(factory));
+	auto flags = cache.Get(MakeDesc(1, 4, 0.5f), std::ref(factory));
+	auto bias = cache.Get(MakeDesc(1, 2, -0.5f), std::ref(factory));
+	EXPECT(base && mode && flags && bias);
+	EXPECT(base != mode && base != flags && base != bias && mode != flags && mode != bias && flags != bias);
+	EXPECT(**base != **mode && **base != **flags && **base != **bias);
+	EXPECT(factory.numCreates == 4);
+
+	// Entries stay where they are as the cache grows, so earlier pointers still hold their objects.
+	EXPECT(cache.Get(MakeDesc(1, 2, 0.5f), std::ref(factory)) == base && **base == 1);
+}
+
+TEST(DescriptorCacheDoesNotCacheFailedCreates)
+{
+	FakeCache cache;
+	FakeFactory factory;
+	FakeDesc failing = MakeDesc(1, FakeFactory::FailingFlags, 0.f);
+	EXPECT(cache.Get(failing, std::ref(factory)) == nullptr);
+	EXPECT(cache.Get(failing, std::ref(factory)) == nullptr);
+	EXPECT(factory.numCreates == 2);
+	EXPECT(cache.GetNumUnique() == 0);
+}
+
+TEST(DescriptorCacheCountsRequestsHitsAndUniqueObjects)
+{
+	FakeCache cache;
+	FakeFactory factory;
+	cache.Get(MakeDesc(1, 2, 0.5f), std::ref(factory));
+	cache.Get(MakeDesc(1, 2, 0.5f), std::ref(factory));
+	cache.Get(MakeDesc(1, 2, 0.5f), std::ref(factory));
+	cache.Get(MakeDesc(3, 2, 0.5f), std::ref(factory));
+	cache.Get(MakeDesc(1, FakeFactory::FailingFlags, 0.f), std::ref(factory));
+	EXPECT(cache.GetNumRequests() == 5);
+	EXPECT(cache.GetNumHits() == 2);
+	EXPECT(cache.GetNumUnique() == 2);
+}
\ No newline at end of file
@@ -0,0 +1,113 @@
+#include <algorithm>
+#include <map>
+
+#include "Material.h"
+#include "Test.h"
+
+namespace
+{
+// Handles by path, as the texture map hands them out, with two paths to one texture as its content dedup does.
+class MaterialFixture
+{
+public:
+	MaterialFixture()
+	{
+		arch.diffuseColor = glm::vec3(0.588f);
+		arch.specularPower = 10.f;
+		arch.diffusePath = "arch.tga";
+		leaf = arch;
+		leaf.diffusePath = "leaf.tga";
+		leaf.maskPath = "leaf_mask.tga";
+		untextured.diffuseColor = glm::vec3(0.8f, 0.1f, 0.1f);
+	}
+
+	uint32_t Add(const MaterialSource& source)
+	{
+		auto lookup = [this](const std::string& path) {
+			++numLookups;
+			auto found = m_Handles.find(path);
+			return found != m_Handles.end() ? found->second : InvalidTextureHandle;
+		};
+		return table.Add(Materials::Flatten(source, lookup, lookup));
+	}
+
+	MaterialTable	table;
+	uint32_t		numLookups = 0;
+	MaterialSource	arch;
+	MaterialSource	leaf;
+	MaterialSource	untextured;
+
+private:
+	std::map<std::string, TextureHandle> m_Handles = {
+		{ "arch.tga", 0 }, { "arch_copy.tga", 0 }, { "leaf.tga", 1 }, { "leaf_mask.tga", 2 }, { "floor.tga", 3 },
+	};
+};
+}
+
+TEST(MaterialTableMergesMaterialsThatFlattenEqual)
+{
+	MaterialFixture fixture;
+	uint32_t archIndex = fixture.Add(fixture.arch);
+
+	// The same texture under another path, and a value out of range clamped onto the original.
+	MaterialSource archCopy = fixture.arch;
+	archCopy.diffusePath = "arch_copy.tga";
+	EXPECT(fixture.Add(archCopy) == archIndex);
+	MaterialSource archOverbright = fixture.arch;
+	archOverbright.opacity = 1.5f;
+	EXPECT(fixture.Add(archOverbright) == archIndex);
+
+	uint32_t leafIndex = fixture.Add(fixture.leaf);
+	EXPECT(fixture.Add(fixture.leaf) == leafIndex);
+	EXPECT(fixture.table.GetNumMaterials() == 2 && fixture.table.GetNumAdds() == 5);
+}
+
+TEST(MaterialTableKeepsDifferentMaterialsApart)
+{
+	MaterialFixture fixture;
+	MaterialSource shiny = fixture.arch;
+	shiny.specularColor = glm::vec3(0.25f);
+	shiny.specularPower = 64.f;
+	MaterialSource floor = fixture.arch;
+	floor.diffusePath = "floor.tga";
+
+	std::vector<uint32_t> distinct = { fixture.Add(fixture.arch), fixture.Add(fixture.leaf), fixture.Add(shiny),
+		fixture.Add(fixture.untextured), fixture.Add(floor) };
+	std::sort(distinct.begin(), distinct.end());
+	EXPECT(std::unique(distinct.begin(), distinct.end()) == distinct.end());
+	EXPECT(fixture.table.GetNumMaterials() == 5);
+}
+
+TEST(MaterialFlattenLooksUpTexturesAndDefaultsMissingValues)
+{
+	MaterialFixture fixture;
+	const Material& leaf = fixture.table.Get(fixture.Add(fixture.leaf));
+	EXPECT(leaf.diffuseTexture == 1 && leaf.maskTexture == 2);
+	EXPECT(leaf.diffuseColor == glm::vec3(0.588f) && leaf.specularPower == 10.f);
+	EXPECT(fixture.numLookups == 2);
+
+	const Material& untextured = fixture.table.Get(fixture.Add(fixture.untextured));
+	EXPECT(fixture.numLookups == 2);
+	EXPECT(untextured.diffuseTexture == InvalidTextureHandle && untextured.maskTexture == InvalidTextureHandle);
+	EXPECT(untextured.opacity == 1.f && untextured.specularColor == glm::vec3(0.f));
+}
+
+TEST(MaterialGPUTableHasEachMaterialAtItsIndex)
+{
+	MaterialFixture fixture;
+	MaterialSource shiny = fixture.arch;
+	shiny.specularColor = glm::vec3(0.25f);
+	shiny.specularPower = 64.f;
+	uint32_t leafIndex = fixture.Add(fixture.leaf);
+	uint32_t shinyIndex = fixture.Add(shiny);
+	uint32_t untexturedIndex = fixture.Add(fixture.untextured);
+
+	// Slices as the texture map might have packed them.
+	auto gpuTable = fixture.table.BuildGPUTable([](TextureHandle texture) { return texture * 10 + 3; });
+	EXPECT(gpuTable.size() == fixture.table.GetNumMaterials());
+	if (gpuTable.size() != fixture.table.GetNumMaterials()) return;
+	EXPECT(gpuTable[leafIndex].textures == glm::uvec4(13, 23, 1, 0));
+	EXPECT(gpuTable[untexturedIndex].textures == glm::uvec4(0, 0, 0, 0));
+	EXPECT(gpuTable[shinyIndex].specular == glm::vec4(0.25f, 0.25f, 0.25f, 64.f));
+	EXPECT(gpuTable[untexturedIndex].diffuse == glm::vec4(0.8f, 0.1f, 0.1f, 1.f));
+}
\ No newline at end of file
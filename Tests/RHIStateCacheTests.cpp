@@ -0,0 +1,210 @@
+#include <string>
+#include <vector>
+
+#include "RHIStateCache.h"
+#include "Test.h"
+
+namespace
+{
+// Stands in for the API objects a backend binds. Only their addresses matter to the cache.
+struct FakeObject
+{
+	int id;
+};
+
+struct FakePipeline
+{
+	FakeObject* vertexShader;
+	FakeObject* pixelShader;
+	FakeObject* blendState;
+	uint32_t topology;
+};
+
+struct FakeDraw
+{
+	const FakePipeline* pipeline;
+	FakeObject* vertexBuffer;
+	FakeObject* indexBuffer;
+	FakeObject* constantBuffer;
+	uint32_t firstConstant;
+	FakeObject* diffuse;
+	FakeObject* mask;			// Null for opaque draws, which leave the slot as it is
+};
+
+// A mock device context that binds through a state cache the way the backends do and records every call
+// that gets past it, so a test sees exactly what the driver would have.
+class RecordingContext
+{
+public:
+	void Draw(const FakeDraw& draw)
+	{
+		BindPipeline(*draw.pipeline);
+		if (stateCache.Set(RHIStateSlot::VertexBuffers, draw.vertexBuffer)) calls.push_back("IASetVertexBuffers");
+		if (stateCache.Set(RHIStateSlot::IndexBuffer, draw.indexBuffer)) calls.push_back("IASetIndexBuffer");
+		if (stateCache.Set(RHIStateSlot::VSConstantBuffer, draw.constantBuffer, draw.firstConstant, 16)) calls.push_back("VSSetConstantBuffers");
+		if (stateCache.Set(RHIStateSlot::PSResource0, draw.diffuse)) calls.push_back("PSSetShaderResources0");
+		if (draw.mask && stateCache.Set(RHIStateSlot::PSResource1, draw.mask)) calls.push_back("PSSetShaderResources1");
+		calls.push_back("DrawIndexed");
+	}
+
+	// Binds null, as a pass clearing a texture slot it no longer samples does.
+	void UnbindDiffuse()
+	{
+		if (stateCache.Set(RHIStateSlot::PSResource0, nullptr)) calls.push_back("PSSetShaderResources0");
+	}
+
+	// The calls recorded since the last take.
+	std::vector<std::string> TakeCalls()
+	{
+		std::vector<std::string> taken;
+		taken.swap(calls);
+		return taken;
+	}
+
+	RHIStateCache				stateCache;
+	std::vector<std::string>	calls;
+
+private:
+	void BindPipeline(const FakePipeline& pipeline)
+	{
+		if (!stateCache.Set(RHIStateSlot::Pipeline, &pipeline)) return;
+
+		if (stateCache.Set(RHIStateSlot::VertexShader, pipeline.vertexShader)) calls.push_back("VSSetShader");
+		if (stateCache.Set(RHIStateSlot::PixelShader, pipeline.pixelShader)) calls.push_back("PSSetShader");
+		if (stateCache.Set(RHIStateSlot::BlendState, pipeline.blendState)) calls.push_back("OMSetBlendState");
+		if (stateCache.Set(RHIStateSlot::Topology, pipeline.topology)) calls.push_back("IASetPrimitiveTopology");
+	}
+};
+
+class StateCacheFixture
+{
+public:
+	StateCacheFixture()
+	{
+		opaque = { &vertexShader, &opaquePixelShader, &blendState, 4 };
+		masked = { &vertexShader, &maskedPixelShader, &blendState, 4 };
+		first = { &opaque, &vertexBuffer, &indexBuffer, &constantRing, 0, &brick, nullptr };
+		second = first;
+		second.firstConstant = 16;
+	}
+
+	FakeObject vertexShader = { 1 };
+	FakeObject opaquePixelShader = { 2 };
+	FakeObject maskedPixelShader = { 3 };
+	FakeObject blendState = { 4 };
+	FakeObject vertexBuffer = { 5 };
+	FakeObject indexBuffer = { 6 };
+	FakeObject constantRing = { 7 };
+	FakeObject brick = { 8 };
+	FakeObject leaf = { 9 };
+	FakeObject leafMask = { 10 };
+	FakePipeline opaque;
+	FakePipeline masked;
+	// Two draws of one mesh with one material, their constants at different offsets in the ring.
+	FakeDraw first;
+	FakeDraw second;
+	RecordingContext context;
+};
+
+const std::vector<std::string> FullDraw = {
+	"VSSetShader", "PSSetShader", "OMSetBlendState", "IASetPrimitiveTopology",
+	"IASetVertexBuffers", "IASetIndexBuffer", "VSSetConstantBuffers", "PSSetShaderResources0", "DrawIndexed",
+};
+
+size_t Index(RHIStateSlot slot)
+{
+	return static_cast<size_t>(slot);
+}
+}
+
+TEST(RHIStateCacheIssuesFirstBindsAndFiltersRepeats)
+{
+	StateCacheFixture fixture;
+	fixture.context.Draw(fixture.first);
+	EXPECT(fixture.context.TakeCalls() == FullDraw);
+
+	// Only the constant offset changed, so only the constants rebind.
+	fixture.context.Draw(fixture.second);
+	EXPECT(fixture.context.TakeCalls() == std::vector<std::string>({ "VSSetConstantBuffers", "DrawIndexed" }));
+	fixture.context.Draw(fixture.second);
+	EXPECT(fixture.context.TakeCalls() == std::vector<std::string>({ "DrawIndexed" }));
+}
+
+TEST(RHIStateCacheIssuesOnlyTheStateThatChanged)
+{
+	StateCacheFixture fixture;
+	fixture.context.Draw(fixture.first);
+	fixture.context.TakeCalls();
+
+	// Same vertex shader, blend state and topology: only the pixel shader and the new textures go through.
+	FakeDraw maskedDraw = fixture.first;
+	maskedDraw.pipeline = &fixture.masked;
+	maskedDraw.diffuse = &fixture.leaf;
+	maskedDraw.mask = &fixture.leafMask;
+	fixture.context.Draw(maskedDraw);
+	EXPECT(fixture.context.TakeCalls() == std::vector<std::string>({ "PSSetShader", "PSSetShaderResources0", "PSSetShaderResources1", "DrawIndexed" }));
+
+	// Unbinding is a change too, and unbinding again isn't.
+	fixture.context.UnbindDiffuse();
+	fixture.context.UnbindDiffuse();
+	EXPECT(fixture.context.TakeCalls() == std::vector<std::string>({ "PSSetShaderResources0" }));
+}
+
+TEST(RHIStateCacheComparesEveryValueOfASlot)
+{
+	RHIStateCache cache;
+	FakeObject a = { 1 };
+	FakeObject b = { 2 };
+	EXPECT(cache.Set(RHIStateSlot::RenderTargets, &a, &b, nullptr));
+	EXPECT(!cache.Set(RHIStateSlot::RenderTargets, &a, &b, nullptr));
+	EXPECT(cache.Set(RHIStateSlot::RenderTargets, &a, &b, &a));
+	EXPECT(cache.Set(RHIStateSlot::RenderTargets, &b, &a, &a));
+	// Fewer values is a different binding, even when the ones given match.
+	EXPECT(cache.Set(RHIStateSlot::RenderTargets, &b, &a));
+	EXPECT(!cache.Set(RHIStateSlot::RenderTargets, &b, &a));
+
+	// Slots are independent, so the same value in another slot is still a first bind.
+	EXPECT(cache.Set(RHIStateSlot::PSResource0, &a));
+	EXPECT(cache.Set(RHIStateSlot::PSResource1, &a));
+}
+
+TEST(RHIStateCacheReissuesEverythingAfterReset)
+{
+	StateCacheFixture fixture;
+	fixture.context.Draw(fixture.first);
+	fixture.context.Draw(fixture.first);
+	fixture.context.TakeCalls();
+
+	// As at the start of a frame or a new command list: nothing bound before can be assumed.
+	fixture.context.stateCache.Reset();
+	fixture.context.Draw(fixture.first);
+	EXPECT(fixture.context.TakeCalls() == FullDraw);
+	fixture.context.Draw(fixture.first);
+	EXPECT(fixture.context.TakeCalls() == std::vector<std::string>({ "DrawIndexed" }));
+}
+
+TEST(RHIStateCacheCountsIssuedAndFilteredBinds)
+{
+	StateCacheFixture fixture;
+	fixture.context.Draw(fixture.first);
+	fixture.context.Draw(fixture.second);
+	fixture.context.Draw(fixture.second);
+
+	// The first draw issues its nine binds and the second its new constants, the rest are filtered. The
+	// pipeline's own slots aren't looked at again once the pipeline itself is filtered.
+	RHIStateCounts counts = fixture.context.stateCache.TakeCounts();
+	EXPECT(counts.GetTotalIssued() == 10 && counts.GetTotalFiltered() == 9);
+	EXPECT(counts.issued[Index(RHIStateSlot::VSConstantBuffer)] == 2 && counts.filtered[Index(RHIStateSlot::VSConstantBuffer)] == 1);
+	EXPECT(counts.issued[Index(RHIStateSlot::Pipeline)] == 1 && counts.filtered[Index(RHIStateSlot::Pipeline)] == 2);
+	EXPECT(counts.filtered[Index(RHIStateSlot::PixelShader)] == 0);
+
+	// Taking the counts clears them, but leaves the shadowed state alone.
+	fixture.context.Draw(fixture.second);
+	counts = fixture.context.stateCache.TakeCounts();
+	EXPECT(counts.GetTotalIssued() == 0 && counts.GetTotalFiltered() == 5);
+
+	RHIStateCounts total;
+	total += counts;
+	total += counts;
+	EXPECT(total.GetTotalFiltered() == 10 && total.filtered[Index(RHIStateSlot::PSResource0)] == 2);
+}
\ No newline at end of file
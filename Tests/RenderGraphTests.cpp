@@ -0,0 +1,127 @@
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+#include "RenderGraph.h"
+#include "Test.h"
+
+namespace
+{
+const uint32_t Width = 1920;
+const uint32_t Height = 1080;
+// Formats are only compared, so any distinct values do.
+const uint32_t Rgba16f = 1;
+const uint32_t Rgba8 = 2;
+
+// Every pair of transients sharing a physical texture must have disjoint lifetimes and the same description,
+// and every texture a surviving pass touches must have a place to live.
+void ExpectValidAliasing(const RenderGraph& graph)
+{
+	for (RenderGraphTexture a = 0; a < graph.GetNumTextures(); ++a)
+	{
+		if (graph.IsImported(a) || graph.GetLifetime(a).firstPass == RenderGraph::Invalid) continue;
+		uint32_t physical = graph.GetPhysicalTexture(a);
+		EXPECT(physical != RenderGraph::Invalid);
+		if (physical == RenderGraph::Invalid) continue;
+		EXPECT(memcmp(&graph.GetPhysicalDesc(physical), &graph.GetDesc(a), sizeof(RenderGraphTextureDesc)) == 0);
+		for (RenderGraphTexture b = a + 1; b < graph.GetNumTextures(); ++b)
+		{
+			if (graph.IsImported(b) || graph.GetPhysicalTexture(b) != physical) continue;
+			RenderGraphLifetime lifetimeA = graph.GetLifetime(a);
+			RenderGraphLifetime lifetimeB = graph.GetLifetime(b);
+			EXPECT(lifetimeA.lastPass < lifetimeB.firstPass || lifetimeB.lastPass < lifetimeA.firstPass);
+		}
+	}
+}
+
+void ExpectCulled(const RenderGraph& graph, const std::vector<RenderGraphPass>& expectedCulled)
+{
+	for (RenderGraphPass pass = 0; pass < graph.GetNumPasses(); ++pass)
+	{
+		bool shouldCull = std::find(expectedCulled.begin(), expectedCulled.end(), pass) != expectedCulled.end();
+		EXPECT(graph.IsCulled(pass) == shouldCull);
+	}
+}
+}
+
+// The deferred renderer as it is: the G-buffer targets are read together, so nothing can share.
+TEST(RenderGraphKeepsTargetsReadTogetherApart)
+{
+	RenderGraph graph;
+	auto backBuffer = graph.ImportTexture("backbuffer");
+	auto depth = graph.ImportTexture("depth");
+	auto color = graph.CreateTexture("color", { Width, Height, Rgba16f, 8 });
+	auto normal = graph.CreateTexture("normal", { Width, Height, Rgba16f, 8 });
+	auto geometry = graph.AddPass("geometry");
+	graph.Write(geometry, color);
+	graph.Write(geometry, normal);
+	graph.WriteDepth(geometry, depth);
+	auto lighting = graph.AddPass("lighting");
+	graph.Read(lighting, color);
+	graph.Read(lighting, normal);
+	graph.Write(lighting, backBuffer);
+
+	EXPECT(graph.Compile());
+	ExpectValidAliasing(graph);
+	ExpectCulled(graph, {});
+	EXPECT(graph.GetPhysicalTexture(color) != graph.GetPhysicalTexture(normal));
+}
+
+// Lighting into HDR, a bloom chain down to an eighth and back, tonemapping and a debug view nobody reads.
+TEST(RenderGraphAliasesPostChainAndCullsUnreadPasses)
+{
+	RenderGraph graph;
+	auto backBuffer = graph.ImportTexture("backbuffer");
+	auto depth = graph.ImportTexture("depth");
+	auto color = graph.CreateTexture("color", { Width, Height, Rgba16f, 8 });
+	auto normal = graph.CreateTexture("normal", { Width, Height, Rgba16f, 8 });
+	auto hdr = graph.CreateTexture("hdr", { Width, Height, Rgba16f, 8 });
+	auto bright = graph.CreateTexture("bright", { Width / 2, Height / 2, Rgba16f, 8 });
+	auto down4 = graph.CreateTexture("down4", { Width / 4, Height / 4, Rgba16f, 8 });
+	auto down8 = graph.CreateTexture("down8", { Width / 8, Height / 8, Rgba16f, 8 });
+	auto up4 = graph.CreateTexture("up4", { Width / 4, Height / 4, Rgba16f, 8 });
+	auto up2 = graph.CreateTexture("up2", { Width / 2, Height / 2, Rgba16f, 8 });
+	auto ldr = graph.CreateTexture("ldr", { Width, Height, Rgba8, 4 });
+	auto debugView = graph.CreateTexture("debug", { Width, Height, Rgba8, 4 });
+
+	auto addPass = [&](const char* name, std::vector<RenderGraphTexture> reads, RenderGraphTexture write) {
+		auto pass = graph.AddPass(name);
+		for (auto texture : reads) graph.Read(pass, texture);
+		graph.Write(pass, write);
+		return pass;
+	};
+	auto geometry = graph.AddPass("geometry");
+	graph.Write(geometry, color);
+	graph.Write(geometry, normal);
+	graph.WriteDepth(geometry, depth);
+	addPass("lighting", { color, normal }, hdr);
+	addPass("bright", { hdr }, bright);
+	addPass("down4", { bright }, down4);
+	addPass("down8", { down4 }, down8);
+	addPass("up4", { down8, down4 }, up4);
+	addPass("up2", { up4 }, up2);
+	addPass("tonemap", { hdr, up2 }, ldr);
+	auto debug = addPass("debug", { normal }, debugView);
+	addPass("fxaa", { ldr }, backBuffer);
+
+	EXPECT(graph.Compile());
+	ExpectValidAliasing(graph);
+	ExpectCulled(graph, { debug });
+
+	// Bright is free again by up2, while down4 is still being read when up4 is written.
+	EXPECT(graph.GetPhysicalTexture(up2) == graph.GetPhysicalTexture(bright));
+	EXPECT(graph.GetPhysicalTexture(up4) != graph.GetPhysicalTexture(down4));
+	EXPECT(graph.GetPhysicalTexture(debugView) == RenderGraph::Invalid);
+	EXPECT(graph.GetPhysicalBytes() < graph.GetTransientBytes());
+}
+
+TEST(RenderGraphRejectsReadOfUnwrittenTexture)
+{
+	RenderGraph graph;
+	auto backBuffer = graph.ImportTexture("backbuffer");
+	auto unwritten = graph.CreateTexture("unwritten", { Width, Height, Rgba8, 4 });
+	auto pass = graph.AddPass("present");
+	graph.Read(pass, unwritten);
+	graph.Write(pass, backBuffer);
+	EXPECT(!graph.Compile());
+}
\ No newline at end of file
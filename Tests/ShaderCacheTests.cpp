@@ -0,0 +1,185 @@
+#include <atomic>
+#include <filesystem>
+#include <utility>
+
+#include "sdl/SDL.h"
+#include "FileUtils.h"
+#include "ShaderCache.h"
+#include "ThreadPool.h"
+#include "Test.h"
+
+namespace fs = std::filesystem;
+
+namespace
+{
+void WriteFile(const std::string& path, const std::string& text)
+{
+	SDL_RWops* file = SDL_RWFromFile(path.c_str(), "wb");
+	if (!file) return;
+	SDL_RWwrite(file, text.data(), text.size(), 1);
+	SDL_RWclose(file);
+}
+
+// A scratch directory of sources and a stub compiler whose bytecode is the text of everything that went in,
+// so a wrong hit shows up as different bytecode.
+class ShaderCacheFixture
+{
+public:
+	ShaderCacheFixture()
+	{
+		std::error_code error;
+		m_Directory = (fs::temp_directory_path(error) / "ShaderCacheTests").string();
+		fs::remove_all(m_Directory, error);
+		fs::create_directories(m_Directory, error);
+		EXPECT(!error);
+		cacheDir = FileUtils::Combine(m_Directory, "Cache");
+
+		commonPath = FileUtils::Combine(m_Directory, "Common.hlsli");
+		WriteFile(FileUtils::Combine(m_Directory, "Lighting.hlsl"), "#include \"Common.hlsli\"\nfloat4 main() : SV_Target { return Light(); }\n");
+		WriteFile(commonPath, "float4 Light() { return 1; }\n");
+		WriteFile(FileUtils::Combine(m_Directory, "Solid.hlsl"), "float4 main() : SV_Target { return 0; }\n");
+		WriteFile(FileUtils::Combine(m_Directory, "Broken.hlsl"), "#error Broken\n");
+		lighting = MakeRequest("Lighting.hlsl");
+		solid = MakeRequest("Solid.hlsl");
+		broken = MakeRequest("Broken.hlsl");
+
+		compiler.version = "stub 1";
+		compiler.compile = [this](const ShaderCompileRequest& request, const std::vector<char>& source, std::vector<char>& bytecode, std::string& errors) {
+			++m_NumCompiles;
+			std::string text(source.begin(), source.end());
+			if (text.find("#error") != std::string::npos)
+			{
+				errors = "Broken.hlsl(1): error: Broken";
+				return false;
+			}
+			text += request.entryPoint + request.target;
+			for (const auto& define : request.defines) text += define.first + define.second;
+			bytecode.assign(text.begin(), text.end());
+			return true;
+		};
+	}
+
+	~ShaderCacheFixture()
+	{
+		std::error_code error;
+		fs::remove_all(m_Directory, error);
+	}
+
+	ShaderCompileRequest MakeRequest(const char* fileName) const
+	{
+		return { FileUtils::Combine(m_Directory, fileName), "main", "ps_4_0", {} };
+	}
+
+	// Builds each request on a fresh cache, as a new run would, and returns the results and compiles it took.
+	std::pair<std::vector<ShaderBinaryPtr>, uint32_t> Run(const ShaderCompiler& runCompiler, const std::string& runCacheDir,
+		const std::vector<ShaderCompileRequest>& requests)
+	{
+		m_NumCompiles = 0;
+		ShaderCache cache(runCacheDir, runCompiler, &m_Pool);
+		std::vector<ShaderFuture> futures;
+		for (const auto& request : requests) futures.push_back(cache.Request(request));
+		std::vector<ShaderBinaryPtr> binaries;
+		for (auto& future : futures) binaries.push_back(future.get());
+		return std::make_pair(binaries, m_NumCompiles.load());
+	}
+
+	std::pair<std::vector<ShaderBinaryPtr>, uint32_t> Run(const std::vector<ShaderCompileRequest>& requests)
+	{
+		return Run(compiler, cacheDir, requests);
+	}
+
+	ShaderCompiler			compiler;
+	std::string				cacheDir;
+	std::string				commonPath;
+	ShaderCompileRequest	lighting;
+	ShaderCompileRequest	solid;
+	ShaderCompileRequest	broken;
+
+private:
+	std::string				m_Directory;
+	std::atomic<uint32_t>	m_NumCompiles{ 0 };
+	ThreadPool				m_Pool;
+};
+}
+
+TEST(ShaderCacheCompilesOnceAndHitsOnTheNextRun)
+{
+	ShaderCacheFixture fixture;
+	auto first = fixture.Run({ fixture.lighting, fixture.solid, fixture.lighting });
+	EXPECT(first.second == 2);
+	EXPECT(!first.first[0]->bytecode.empty() && !first.first[0]->fromCache);
+	EXPECT(first.first[0] == first.first[2]);
+
+	auto second = fixture.Run({ fixture.lighting, fixture.solid });
+	EXPECT(second.second == 0);
+	EXPECT(second.first[0]->fromCache && second.first[0]->bytecode == first.first[0]->bytecode);
+	EXPECT(second.first[1]->fromCache && second.first[1]->bytecode == first.first[1]->bytecode);
+}
+
+TEST(ShaderCacheMissesOnlyShadersIncludingAChangedFile)
+{
+	ShaderCacheFixture fixture;
+	fixture.Run({ fixture.lighting, fixture.solid });
+	WriteFile(fixture.commonPath, "float4 Light() { return 0.5; }\n");
+	auto included = fixture.Run({ fixture.lighting, fixture.solid });
+	EXPECT(included.second == 1);
+	EXPECT(!included.first[0]->fromCache && included.first[1]->fromCache);
+}
+
+TEST(ShaderCacheMissesOnDefineTargetOrCompilerChange)
+{
+	ShaderCacheFixture fixture;
+	fixture.Run({ fixture.lighting });
+
+	ShaderCompileRequest defined = fixture.lighting;
+	defined.defines = { { "ALPHA_TEST", "1" } };
+	ShaderCompileRequest retargeted = fixture.lighting;
+	retargeted.target = "ps_5_0";
+	auto variants = fixture.Run({ defined, retargeted, fixture.lighting });
+	EXPECT(variants.second == 2 && variants.first[2]->fromCache);
+	EXPECT(variants.first[0]->bytecode != variants.first[2]->bytecode);
+
+	ShaderCompiler newCompiler = fixture.compiler;
+	newCompiler.version = "stub 2";
+	EXPECT(fixture.Run(newCompiler, fixture.cacheDir, { fixture.lighting }).second == 1);
+}
+
+TEST(ShaderCacheReportsButNeverCachesFailures)
+{
+	ShaderCacheFixture fixture;
+	auto failed = fixture.Run({ fixture.broken });
+	EXPECT(failed.first[0]->bytecode.empty() && !failed.first[0]->errors.empty());
+	EXPECT(fixture.Run({ fixture.broken }).second == 1);
+
+	auto unread = fixture.Run({ fixture.MakeRequest("Missing.hlsl") });
+	EXPECT(unread.second == 0 && unread.first[0]->bytecode.empty());
+}
+
+TEST(ShaderCacheReplacesDamagedEntries)
+{
+	ShaderCacheFixture fixture;
+	auto first = fixture.Run({ fixture.solid });
+
+	// Cut the entry short, as a crash mid write would have before renaming.
+	std::vector<char> source;
+	uint64_t key = 0;
+	std::string errors;
+	ShaderCache keys(fixture.cacheDir, fixture.compiler, nullptr);
+	EXPECT(keys.CalcKey(fixture.solid, source, key, errors));
+	std::error_code error;
+	auto entryPath = keys.GetEntryPath(key);
+	fs::resize_file(entryPath, fs::file_size(entryPath, error) - 1, error);
+	EXPECT(!error);
+
+	auto damaged = fixture.Run({ fixture.solid });
+	EXPECT(damaged.second == 1 && damaged.first[0]->bytecode == first.first[0]->bytecode);
+	EXPECT(fixture.Run({ fixture.solid }).second == 0);
+}
+
+TEST(ShaderCacheKeptOffDiskNeverHits)
+{
+	ShaderCacheFixture fixture;
+	fixture.Run(fixture.compiler, "", { fixture.lighting, fixture.solid });
+	auto uncached = fixture.Run(fixture.compiler, "", { fixture.lighting, fixture.solid });
+	EXPECT(uncached.second == 2 && !uncached.first[0]->fromCache);
+}
\ No newline at end of file
@@ -0,0 +1,217 @@
+#include <cstdlib>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+#include <glm/gtc/matrix_transform.hpp>
+
+#include "sdl/SDL.h"
+#include "CPUTexture.h"
+#include "FileUtils.h"
+#include "Mesh.h"
+#include "SoftwareRHI.h"
+#include "TextureUtils.h"
+#include "Window.h"
+#include "Test.h"
+
+namespace fs = std::filesystem;
+
+// The engine isn't linked, and the backend keeps its own defaults without one.
+class Engine;
+Engine* g_Engine = nullptr;
+
+namespace
+{
+const uint32_t Width = 256;
+const uint32_t Height = 144;
+// Edges may land a pixel either way between compilers, so a few pixels may differ outright, and the rest
+// only by rounding.
+const int MaxChannelDifference = 8;
+const double MaxDifferingPixelFraction = 1.0 / 200.0;
+
+// The reference images live in the source tree, found from the runner the way the engine finds config.txt.
+std::string GetGoldenPath(const char* name)
+{
+	auto projectDir = fs::canonical(std::string(SDL_GetBasePath()) + "../../../../");
+	return (projectDir / "Tests" / "Golden" / (std::string(name) + ".tga")).string();
+}
+
+// Squares of two colors, with mips as the loader makes them.
+CPUTexture MakeChecker(uint32_t size, uint32_t squareSize, glm::u8vec4 a, glm::u8vec4 b)
+{
+	CPUTexture texture;
+	texture.width = size;
+	texture.height = size;
+	for (uint32_t y = 0; y < size; ++y)
+	{
+		for (uint32_t x = 0; x < size; ++x)
+		{
+			glm::u8vec4 color = ((x / squareSize + y / squareSize) % 2) ? a : b;
+			texture.data.insert(texture.data.end(), { char(color.b), char(color.g), char(color.r), char(color.a) });
+		}
+	}
+	TextureUtils::GenerateMips(texture);
+	return texture;
+}
+
+// A box with a texture and, in the masked pass, a cutout mask, its constants filled in each frame.
+struct SceneBox
+{
+	Mesh mesh;
+	RHITexture diffuse;
+	RHITexture mask;
+};
+
+class GoldenScene
+{
+public:
+	explicit GoldenScene(SoftwareRHI& rhi)
+		: m_Rhi(rhi)
+	{
+		auto brick = rhi.CreateTexture2D(MakeChecker(64, 8, { 180, 80, 60, 255 }, { 220, 200, 170, 255 }));
+		auto stone = rhi.CreateTexture2D(MakeChecker(64, 32, { 90, 100, 110, 255 }, { 140, 150, 160, 255 }));
+		CPUTexture stripes = MakeChecker(64, 8, { 255, 255, 255, 255 }, { 0, 0, 0, 0 });
+		TextureUtils::ConvertToBC4Mask(stripes, 3);
+		auto cutout = rhi.CreateTexture2D(stripes);
+
+		// A floor running under the camera, so it is clipped against the near plane, boxes at a few depths
+		// overlapping each other, and masked boxes in front.
+		AddBox(glm::vec3(0.f, -1.5f, 10.f), glm::vec3(20.f, 0.5f, 20.f), stone, nullptr);
+		AddBox(glm::vec3(-1.5f, 0.f, 4.f), glm::vec3(0.7f), brick, nullptr);
+		AddBox(glm::vec3(0.5f, 0.3f, 6.f), glm::vec3(1.f), stone, nullptr);
+		AddBox(glm::vec3(2.5f, -0.2f, 9.f), glm::vec3(1.2f, 2.f, 0.6f), brick, nullptr);
+		AddBox(glm::vec3(-0.5f, 0.8f, 3.f), glm::vec3(0.4f), brick, cutout);
+		AddBox(glm::vec3(1.2f, -0.4f, 2.5f), glm::vec3(0.3f, 0.6f, 0.3f), stone, cutout);
+	}
+
+	void Render()
+	{
+		glm::mat4 projection = glm::perspective(glm::radians(60.f), float(Width) / Height, 0.1f, 100.f);
+		glm::vec3 eye(0.3f, 0.6f, -1.f);
+		glm::mat4 view = glm::lookAt(eye, eye + glm::vec3(0.05f, -0.1f, 1.f), glm::vec3(0.f, 1.f, 0.f));
+		for (auto& box : m_Boxes)
+		{
+			GeometryConstantBufferLayout constants;
+			constants.mvpMatrix = projection * view * box.mesh.modelMatrix;
+			constants.textureSlices = glm::uvec4(0);
+			m_Rhi.UpdateConstantBuffer(box.mesh.constantBuffer, &constants, sizeof(constants));
+		}
+
+		m_Rhi.BeginGeometryPass();
+		for (auto& box : m_Boxes)
+		{
+			if (box.mesh.alphaMode == AlphaMode::Opaque) m_Rhi.DrawMesh(box.mesh, box.diffuse, nullptr);
+		}
+		m_Rhi.BeginMaskedGeometryPass();
+		for (auto& box : m_Boxes)
+		{
+			if (box.mesh.alphaMode == AlphaMode::Masked) m_Rhi.DrawMesh(box.mesh, box.diffuse, box.mask);
+		}
+		m_Rhi.BeginLightingPass();
+		m_Rhi.DrawAmbient(glm::vec3(0.3f));
+		m_Rhi.DrawDirectionalLight(glm::vec3(0.9f, 0.85f, 0.8f), glm::vec3(20.f, 60.f, -50.f));
+		m_Rhi.Present();
+	}
+
+private:
+	void AddBox(glm::vec3 center, glm::vec3 halfSize, RHITexture diffuse, RHITexture mask)
+	{
+		std::vector<glm::vec3> positions;
+		std::vector<glm::vec3> normals;
+		std::vector<glm::vec3> uvs;
+		std::vector<IndexType> indices;
+		const glm::vec3 faceNormals[] = { { 1, 0, 0 }, { -1, 0, 0 }, { 0, 1, 0 }, { 0, -1, 0 }, { 0, 0, 1 }, { 0, 0, -1 } };
+		for (const auto& normal : faceNormals)
+		{
+			glm::vec3 tangent = std::abs(normal.y) > 0.5f ? glm::vec3(1, 0, 0) : glm::vec3(0, 1, 0);
+			glm::vec3 bitangent = glm::cross(normal, tangent);
+			const glm::vec3 corners[] = { normal - tangent - bitangent, normal - tangent + bitangent, normal + tangent - bitangent, normal + tangent + bitangent };
+			auto base = static_cast<IndexType>(positions.size());
+			for (uint32_t i = 0; i < 4; ++i)
+			{
+				positions.push_back(corners[i] * halfSize);
+				normals.push_back(normal);
+				uvs.push_back(glm::vec3(float(i / 2) * 2.f, float(i % 2) * 2.f, 0.f));
+			}
+
+			// Wound clockwise seen from outside, as the scene's meshes are.
+			bool frontFacing = glm::dot(glm::cross(corners[1] - corners[0], corners[2] - corners[0]), normal) > 0.f;
+			if (frontFacing) indices.insert(indices.end(), { base, IndexType(base + 1), IndexType(base + 2), IndexType(base + 2), IndexType(base + 1), IndexType(base + 3) });
+			else indices.insert(indices.end(), { base, IndexType(base + 2), IndexType(base + 1), IndexType(base + 2), IndexType(base + 3), IndexType(base + 1) });
+		}
+
+		SceneBox box = {};
+		box.mesh.gpuMesh.positionBuffer = m_Rhi.CreateVertexBuffer(positions.data(), static_cast<uint32_t>(positions.size()));
+		box.mesh.gpuMesh.normalBuffer = m_Rhi.CreateVertexBuffer(normals.data(), static_cast<uint32_t>(normals.size()));
+		box.mesh.gpuMesh.uvBuffer = m_Rhi.CreateVertexBuffer(uvs.data(), static_cast<uint32_t>(uvs.size()));
+		box.mesh.gpuMesh.indexBuffer = m_Rhi.CreateIndexBuffer(indices);
+		box.mesh.constantBuffer = m_Rhi.CreateConstantBuffer(sizeof(GeometryConstantBufferLayout));
+		box.mesh.numFaces = static_cast<uint32_t>(indices.size() / 3);
+		box.mesh.alphaMode = mask ? AlphaMode::Masked : AlphaMode::Opaque;
+		box.mesh.modelMatrix = glm::translate(glm::mat4(1.f), center);
+		box.diffuse = diffuse;
+		box.mask = mask;
+		m_Boxes.push_back(box);
+	}
+
+	SoftwareRHI&			m_Rhi;
+	std::vector<SceneBox>	m_Boxes;
+};
+
+// Compares against the reference image of that name. Without one, or on a mismatch, writes what was rendered
+// next to it as <name>.actual.tga, which can be looked at and renamed over the reference to accept it.
+void ExpectMatchesGolden(const CPUTexture& output, const char* name)
+{
+	auto goldenPath = GetGoldenPath(name);
+	auto actualPath = goldenPath.substr(0, goldenPath.size() - 4) + ".actual.tga";
+	bool matches = false;
+	if (!fs::exists(goldenPath))
+	{
+		SDL_Log("No reference image at \"%s\".", goldenPath.c_str());
+	}
+	else
+	{
+		CPUTexture golden = FileUtils::LoadUncompressedTGA(goldenPath);
+		EXPECT(golden.width == output.width && golden.height == output.height);
+		if (golden.data.size() == output.data.size())
+		{
+			uint32_t numDiffering = 0;
+			for (size_t pixel = 0; pixel < output.data.size(); pixel += 4)
+			{
+				for (size_t channel = pixel; channel < pixel + 4; ++channel)
+				{
+					if (std::abs(int(uint8_t(golden.data[channel])) - int(uint8_t(output.data[channel]))) > MaxChannelDifference)
+					{
+						++numDiffering;
+						break;
+					}
+				}
+			}
+			uint32_t maxDiffering = static_cast<uint32_t>(output.data.size() / 4 * MaxDifferingPixelFraction);
+			SDL_Log("%s: %u pixels differ from the reference, %u allowed.", name, numDiffering, maxDiffering);
+			matches = numDiffering <= maxDiffering;
+		}
+	}
+
+	EXPECT(matches);
+	if (!matches && FileUtils::SaveUncompressedTGA(output, actualPath)) SDL_Log("Wrote \"%s\".", actualPath.c_str());
+}
+}
+
+TEST(SoftwareRHIMatchesGoldenImage)
+{
+	SoftwareRHI rhi;
+	Window window(Width, Height);
+	window.headless = true;
+	EXPECT(rhi.InitRHI(window));
+
+	GoldenScene scene(rhi);
+	scene.Render();
+	EXPECT(rhi.GetStats().numDraws == 6);
+	ExpectMatchesGolden(rhi.GetOutput(), "SoftwareRHIScene");
+
+	// Nothing carries over between frames, so a second frame is the same image.
+	std::vector<char> first = rhi.GetOutput().data;
+	scene.Render();
+	EXPECT(rhi.GetOutput().data == first);
+}
\ No newline at end of file
@@ -0,0 +1,19 @@
+#pragma once
+
+// Just enough of a test framework for the engine's CPU side. Each TEST registers itself before main runs,
+// and a failed EXPECT logs the condition and its location and fails the running test without stopping it,
+// so one run reports everything that is wrong.
+namespace Tests
+{
+	typedef void (*TestFunction)();
+
+	bool Register(const char* name, TestFunction function);
+	void Fail(const char* file, int line, const char* condition);
+}
+
+#define TEST(name) \
+	static void name(); \
+	static const bool name##Registered = Tests::Register(#name, name); \
+	static void name()
+
+#define EXPECT(condition) do { if (!(condition)) Tests::Fail(__FILE__, __LINE__, #condition); } while (false)
\ No newline at end of file
@@ -0,0 +1,58 @@
+#include <string>
+#include <vector>
+
+#include "sdl/SDL.h"
+
+#include "Test.h"
+
+namespace
+{
+struct TestEntry
+{
+	const char* name;
+	Tests::TestFunction function;
+};
+
+// Function local, as tests register from static initializers in any order.
+std::vector<TestEntry>& GetTests()
+{
+	static std::vector<TestEntry> tests;
+	return tests;
+}
+
+uint32_t g_NumFailures = 0;
+}
+
+bool Tests::Register(const char* name, TestFunction function)
+{
+	GetTests().push_back({ name, function });
+	return true;
+}
+
+void Tests::Fail(const char* file, int line, const char* condition)
+{
+	SDL_Log("%s(%d): expected %s", file, line, condition);
+	++g_NumFailures;
+}
+
+// Runs every test, or only those whose names contain the first argument, and fails if any did.
+int main(int argc, char** argv)
+{
+	std::string filter = argc > 1 ? argv[1] : "";
+	uint32_t numRun = 0;
+	uint32_t numFailed = 0;
+	for (const auto& test : GetTests())
+	{
+		if (std::string(test.name).find(filter) == std::string::npos) continue;
+
+		uint32_t failuresBefore = g_NumFailures;
+		test.function();
+		bool passed = g_NumFailures == failuresBefore;
+		SDL_Log("%s %s", passed ? "[ ok ]" : "[FAIL]", test.name);
+		++numRun;
+		numFailed += passed ? 0 : 1;
+	}
+
+	SDL_Log("%u tests run, %u failed.", numRun, numFailed);
+	return numRun > 0 && numFailed == 0 ? 0 : 1;
+}
\ No newline at end of file
@@ -0,0 +1,157 @@
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+#include "TexturePacker.h"
+#include "Test.h"
+
+namespace
+{
+// The packer only compares and orders handles, so any distinct non-null values will do.
+RHITexture MakeHandle(uintptr_t id)
+{
+	return reinterpret_cast<RHITexture>(id);
+}
+
+TexturePackingInput MakeInput(uintptr_t id, uint32_t size, uint32_t mipLevels, uint32_t format)
+{
+	return { MakeHandle(id), size, size, mipLevels, format };
+}
+
+bool HasSlot(const TexturePackingPlan& plan, uintptr_t id, uint32_t arrayIndex, uint32_t slice)
+{
+	auto iter = plan.slots.find(MakeHandle(id));
+	return iter != plan.slots.end() && iter->second.arrayIndex == arrayIndex && iter->second.slice == slice;
+}
+
+const uint32_t FormatBGRA8 = 87;
+const uint32_t FormatBC1 = 71;
+}
+
+TEST(TexturePackerGroupsBySizeMipsAndFormat)
+{
+	const std::vector<TexturePackingInput> inputs = {
+		MakeInput(1, 512, 10, FormatBGRA8),
+		MakeInput(2, 256, 9, FormatBGRA8),
+		MakeInput(3, 512, 10, FormatBGRA8),
+		MakeInput(4, 512, 10, FormatBC1),
+		MakeInput(5, 512, 9, FormatBGRA8),
+		// Materials sharing a texture list it again, which must not take a second slice.
+		MakeInput(1, 512, 10, FormatBGRA8),
+	};
+	auto plan = TexturePacker::BuildPlan(inputs, 8);
+
+	EXPECT(plan.arrays.size() == 4 && plan.slots.size() == 5);
+	EXPECT(HasSlot(plan, 1, 0, 0) && HasSlot(plan, 3, 0, 1));
+	EXPECT(HasSlot(plan, 2, 1, 0) && HasSlot(plan, 4, 2, 0) && HasSlot(plan, 5, 3, 0));
+	if (plan.arrays.size() == 4)
+	{
+		EXPECT(plan.arrays[0].slices.size() == 2);
+		EXPECT(plan.arrays[0].width == 512 && plan.arrays[0].height == 512);
+		EXPECT(plan.arrays[0].mipLevels == 10 && plan.arrays[0].format == FormatBGRA8);
+		EXPECT(plan.arrays[1].width == 256 && plan.arrays[1].mipLevels == 9);
+		EXPECT(plan.arrays[2].format == FormatBC1);
+		EXPECT(plan.arrays[3].mipLevels == 9);
+	}
+	EXPECT(TexturePacker::ValidatePlan(plan, inputs, 8));
+
+	// Nothing to pack is a valid, empty plan.
+	auto empty = TexturePacker::BuildPlan({}, 8);
+	EXPECT(empty.arrays.empty() && TexturePacker::ValidatePlan(empty, {}, 8));
+}
+
+TEST(TexturePackerSplitsArraysAtTheLayerLimit)
+{
+	std::vector<TexturePackingInput> inputs;
+	for (uintptr_t id = 1; id <= 7; ++id)
+	{
+		inputs.push_back(MakeInput(id, 1024, 11, FormatBC1));
+		// A texture of another format in between mustn't close the open array.
+		if (id == 2) inputs.push_back(MakeInput(100, 1024, 11, FormatBGRA8));
+	}
+	auto plan = TexturePacker::BuildPlan(inputs, 3);
+
+	EXPECT(plan.arrays.size() == 4);
+	if (plan.arrays.size() == 4)
+	{
+		EXPECT(plan.arrays[0].slices.size() == 3 && plan.arrays[1].slices.size() == 1);
+		EXPECT(plan.arrays[2].slices.size() == 3 && plan.arrays[3].slices.size() == 1);
+		EXPECT(plan.arrays[1].format == FormatBGRA8);
+	}
+	EXPECT(HasSlot(plan, 1, 0, 0) && HasSlot(plan, 2, 0, 1) && HasSlot(plan, 100, 1, 0) && HasSlot(plan, 3, 0, 2));
+	EXPECT(HasSlot(plan, 4, 2, 0) && HasSlot(plan, 6, 2, 2) && HasSlot(plan, 7, 3, 0));
+	EXPECT(TexturePacker::ValidatePlan(plan, inputs, 3));
+
+	// The same plan is over the limit of a device with fewer layers.
+	EXPECT(!TexturePacker::ValidatePlan(plan, inputs, 2));
+
+	// A limit of one layer gives every texture its own array.
+	auto single = TexturePacker::BuildPlan(inputs, 1);
+	EXPECT(single.arrays.size() == inputs.size());
+	EXPECT(TexturePacker::ValidatePlan(single, inputs, 1));
+}
+
+TEST(TexturePackerRejectsBadPlans)
+{
+	const std::vector<TexturePackingInput> inputs = {
+		MakeInput(1, 512, 10, FormatBGRA8),
+		MakeInput(2, 512, 10, FormatBGRA8),
+		MakeInput(3, 256, 9, FormatBGRA8),
+	};
+	const auto good = TexturePacker::BuildPlan(inputs, 8);
+	EXPECT(good.arrays.size() == 2 && TexturePacker::ValidatePlan(good, inputs, 8));
+	if (good.arrays.size() != 2) return;
+
+	auto missing = good;
+	missing.slots.erase(MakeHandle(3));
+	missing.arrays[1].slices.clear();
+	missing.arrays.pop_back();
+	EXPECT(!TexturePacker::ValidatePlan(missing, inputs, 8));
+
+	// An input the plan never saw.
+	EXPECT(!TexturePacker::ValidatePlan(good, { MakeInput(1, 512, 10, FormatBGRA8), MakeInput(4, 512, 10, FormatBGRA8) }, 8));
+
+	auto twice = good;
+	twice.arrays[0].slices.push_back(MakeHandle(1));
+	EXPECT(!TexturePacker::ValidatePlan(twice, inputs, 8));
+
+	auto swapped = good;
+	std::swap(swapped.slots[MakeHandle(1)], swapped.slots[MakeHandle(2)]);
+	EXPECT(!TexturePacker::ValidatePlan(swapped, inputs, 8));
+
+	auto wrongFormat = good;
+	wrongFormat.arrays[0].format = FormatBC1;
+	EXPECT(!TexturePacker::ValidatePlan(wrongFormat, inputs, 8));
+
+	auto wrongSize = good;
+	wrongSize.arrays[1].width = 512;
+	EXPECT(!TexturePacker::ValidatePlan(wrongSize, inputs, 8));
+
+	auto emptyArray = good;
+	emptyArray.arrays.push_back(TextureArrayPlan{ 64, 64, 7, FormatBGRA8, {} });
+	EXPECT(!TexturePacker::ValidatePlan(emptyArray, inputs, 8));
+
+	auto strayArray = good;
+	strayArray.arrays.push_back(TextureArrayPlan{ 64, 64, 7, FormatBGRA8, { MakeHandle(9) } });
+	EXPECT(!TexturePacker::ValidatePlan(strayArray, inputs, 8));
+}
+
+TEST(TexturePackerCountsOnlyBindsThatChangeTheTexture)
+{
+	auto a = MakeHandle(1);
+	auto b = MakeHandle(2);
+	auto stats = TexturePacker::CountBinds({ a, a, b, b, a, nullptr, nullptr });
+	EXPECT(stats.numDraws == 7 && stats.srvBinds == 4);
+
+	// Draws without a texture before the first bind need none.
+	stats = TexturePacker::CountBinds({ nullptr, a, a });
+	EXPECT(stats.numDraws == 3 && stats.srvBinds == 1);
+
+	// Once everything sits in one array every draw binds the same texture.
+	auto array = MakeHandle(3);
+	stats = TexturePacker::CountBinds(std::vector<RHITexture>(5, array));
+	EXPECT(stats.numDraws == 5 && stats.srvBinds == 1);
+
+	stats = TexturePacker::CountBinds({});
+	EXPECT(stats.numDraws == 0 && stats.srvBinds == 0);
+}
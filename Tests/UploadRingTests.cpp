@@ -0,0 +1,124 @@
+#include "UploadRing.h"
+#include "Test.h"
+
+namespace
+{
+// Three frames in flight of 1 KB each, as the backends size theirs, only smaller.
+const uint32_t FrameSize = 1024;
+const uint32_t NumFrames = 3;
+// D3D11 binds constants in 16 constant (256 byte) steps.
+const uint32_t ConstantAlignment = 256;
+}
+
+TEST(UploadRingAlignsEachAllocation)
+{
+	EXPECT(UploadRing::AlignUp(0, 256) == 0);
+	EXPECT(UploadRing::AlignUp(1, 256) == 256);
+	EXPECT(UploadRing::AlignUp(256, 256) == 256);
+	EXPECT(UploadRing::AlignUp(257, 16) == 272);
+
+	UploadRing ring;
+	ring.Init(FrameSize, NumFrames);
+	ring.BeginFrame(0);
+	uint32_t first = ~0u;
+	uint32_t second = ~0u;
+	uint32_t third = ~0u;
+	EXPECT(ring.Allocate(80, ConstantAlignment, first) && first == 0);
+	EXPECT(ring.Allocate(80, ConstantAlignment, second) && second == 256);
+	// Packed tightly when the alignment allows it.
+	EXPECT(ring.Allocate(4, 4, third) && third == 336);
+	EXPECT(ring.GetFrameUsed() == 340);
+}
+
+TEST(UploadRingGivesEachFrameItsOwnPartAndWrapsAround)
+{
+	UploadRing ring;
+	ring.Init(FrameSize, NumFrames);
+	EXPECT(ring.GetTotalSize() == FrameSize * NumFrames);
+
+	for (uint32_t frame = 0; frame < 2 * NumFrames; ++frame)
+	{
+		uint32_t frameIndex = frame % NumFrames;
+		ring.BeginFrame(frameIndex);
+		EXPECT(ring.GetFrameIndex() == frameIndex && ring.GetFrameUsed() == 0);
+
+		// Every offset lands inside the frame's own part, starting from its beginning each time round.
+		uint32_t offset = ~0u;
+		EXPECT(ring.Allocate(100, ConstantAlignment, offset) && offset == frameIndex * FrameSize);
+		EXPECT(ring.Allocate(100, ConstantAlignment, offset) && offset == frameIndex * FrameSize + 256);
+	}
+}
+
+TEST(UploadRingFailsAllocationsThatDoNotFit)
+{
+	UploadRing ring;
+	ring.Init(FrameSize, NumFrames);
+	ring.BeginFrame(NumFrames - 1);
+	uint32_t offset = 0;
+	EXPECT(!ring.Allocate(FrameSize + 1, 4, offset));
+	EXPECT(ring.Allocate(FrameSize, 4, offset) && offset == (NumFrames - 1) * FrameSize);
+	EXPECT(!ring.Allocate(1, 1, offset));
+
+	// Fits by size, but not once aligned.
+	ring.BeginFrame(0);
+	EXPECT(ring.Allocate(FrameSize - 300, 4, offset));
+	EXPECT(!ring.Allocate(280, ConstantAlignment, offset));
+	EXPECT(ring.Allocate(280, 4, offset) && offset == FrameSize - 300);
+
+	// Aligning the used bytes up carries the start past the end of the part, which mustn't wrap the size check.
+	UploadRing odd;
+	odd.Init(1000, NumFrames);
+	odd.BeginFrame(0);
+	EXPECT(odd.Allocate(900, 1, offset));
+	EXPECT(!odd.Allocate(0, 1024, offset));
+	EXPECT(!odd.Allocate(1, 1024, offset));
+	EXPECT(odd.GetFrameUsed() == 900);
+
+	// The next frame round starts empty again.
+	odd.BeginFrame(1);
+	EXPECT(odd.Allocate(1000, 1, offset) && offset == 1000);
+}
+
+TEST(UploadRingResizesEveryFramePartAndKeepsItsStats)
+{
+	UploadRing ring;
+	ring.Init(FrameSize, NumFrames);
+	uint32_t offset = 0;
+	ring.BeginFrame(1);
+	EXPECT(ring.Allocate(FrameSize, 4, offset));
+	EXPECT(!ring.Allocate(4, 4, offset));
+
+	// The current frame starts over in its part of the larger buffer.
+	ring.Resize(2 * FrameSize);
+	EXPECT(ring.GetTotalSize() == 2 * FrameSize * NumFrames && ring.GetFrameUsed() == 0);
+	EXPECT(ring.Allocate(2 * FrameSize, 4, offset) && offset == 2 * FrameSize);
+	ring.BeginFrame(2);
+	EXPECT(ring.Allocate(4, 4, offset) && offset == 4 * FrameSize);
+	EXPECT(ring.GetStats().numFrames == 2 && ring.GetStats().numFailedAllocations == 1);
+}
+
+TEST(UploadRingCountsWhatWasUploadedAndDropped)
+{
+	UploadRing ring;
+	ring.Init(FrameSize, NumFrames);
+	uint32_t offset = 0;
+	ring.BeginFrame(0);
+	ring.Allocate(80, ConstantAlignment, offset);
+	ring.Allocate(80, ConstantAlignment, offset);
+	ring.BeginFrame(1);
+	ring.Allocate(FrameSize, ConstantAlignment, offset);
+	ring.Allocate(1, 1, offset);
+	ring.Allocate(1, 1, offset);
+	ring.AddStall();
+
+	const UploadRingStats& stats = ring.GetStats();
+	EXPECT(stats.numFrames == 2);
+	// As requested, leaving out the padding between the first frame's two allocations.
+	EXPECT(stats.bytesUploaded == 80 + 80 + FrameSize);
+	EXPECT(stats.peakFrameBytes == FrameSize);
+	EXPECT(stats.numFailedAllocations == 2);
+	EXPECT(stats.numStalls == 1);
+
+	ring.Init(FrameSize, NumFrames);
+	EXPECT(ring.GetStats().numFrames == 0 && ring.GetStats().bytesUploaded == 0);
+}
\ No newline at end of file
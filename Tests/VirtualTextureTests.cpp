@@ -0,0 +1,341 @@
+#include <cstring>
+#include <filesystem>
+#include <vector>
+
+#include "sdl/SDL.h"
+#include "FileUtils.h"
+#include "VirtualTexture.h"
+#include "Test.h"
+
+namespace fs = std::filesystem;
+using namespace VirtualTexture;
+
+namespace
+{
+VirtualTextureConfig MakeConfig(uint32_t numPhysicalPages, uint32_t maxUploadsPerFrame, uint32_t loadLatencyFrames)
+{
+	VirtualTextureConfig config;
+	config.numPhysicalPages = numPhysicalPages;
+	config.maxUploadsPerFrame = maxUploadsPerFrame;
+	config.loadLatencyFrames = loadLatencyFrames;
+	return config;
+}
+
+const IndirectionEntry& Lookup(const VirtualTextureSystem& system, uint32_t textureId, uint32_t mip, uint32_t x, uint32_t y)
+{
+	return system.GetIndirection(textureId)[system.GetTexture(textureId).GetPageIndex(mip, x, y)];
+}
+
+bool SameEntry(const IndirectionEntry& a, const IndirectionEntry& b)
+{
+	return a.slot == b.slot && a.mip == b.mip;
+}
+
+// Everything a replay decides, so two runs of the same recording can be compared.
+struct ReplayResult
+{
+	std::vector<VirtualTextureFrameStats> stats;
+	std::vector<uint32_t> uploadedSlots;
+	std::vector<std::vector<IndirectionEntry>> indirection;
+};
+
+ReplayResult Replay(const VirtualTextureRecording& recording, const VirtualTextureConfig& config)
+{
+	ReplayResult result;
+	VirtualTextureSystem system;
+	system.Init(config);
+	system.SetUploadCallback([&](uint32_t slot, const char*) { result.uploadedSlots.push_back(slot); });
+	for (const auto& texture : recording.textures)
+	{
+		uint32_t textureId;
+		EXPECT(system.RegisterTexture(CookedVirtualTexture::CookLayout(texture.width, texture.height), textureId));
+	}
+	for (const auto& frame : recording.frames)
+	{
+		result.stats.push_back(system.Update(frame.data(), frame.size()));
+	}
+	for (uint32_t textureId = 0; textureId < system.GetNumTextures(); ++textureId)
+	{
+		result.indirection.push_back(system.GetIndirection(textureId));
+	}
+	return result;
+}
+
+// A camera panning over two textures at a few distances, with some background that wrote no feedback.
+VirtualTextureRecording MakeRecording()
+{
+	VirtualTextureRecording recording;
+	recording.textures = { { 1024, 1024, "Textures/Ground.tga" }, { 512, 512, "Textures/Wall.tga" } };
+
+	const uint32_t numFrames = 12;
+	const uint32_t numPixels = 64;
+	for (uint32_t frame = 0; frame < numFrames; ++frame)
+	{
+		std::vector<uint32_t> feedback;
+		for (uint32_t pixel = 0; pixel < numPixels; ++pixel)
+		{
+			if (pixel % 16 == 15)
+			{
+				feedback.push_back(InvalidFeedback);
+				continue;
+			}
+			uint32_t textureId = pixel % 2;
+			uint32_t mip = (frame + pixel) % 3;
+			uint32_t pagesAcross = (recording.textures[textureId].width / PageSize) >> mip;
+			feedback.push_back(PackPage(textureId, mip, (frame + pixel) % pagesAcross, (pixel / 8) % pagesAcross));
+		}
+		recording.frames.push_back(feedback);
+	}
+	return recording;
+}
+}
+
+TEST(PhysicalPageCacheEvictsLeastRecentlyUsed)
+{
+	const uint32_t pageA = PackPage(0, 0, 0, 0);
+	const uint32_t pageB = PackPage(0, 0, 1, 0);
+	const uint32_t pageC = PackPage(0, 0, 2, 0);
+	const uint32_t pageD = PackPage(0, 0, 3, 0);
+	const uint32_t pageE = PackPage(0, 0, 4, 0);
+
+	PhysicalPageCache cache;
+	cache.Init(3);
+	uint32_t evicted = 0;
+	uint32_t slotA = cache.Allocate(pageA, 1, false, &evicted);
+	EXPECT(slotA != PhysicalPageCache::InvalidSlot && evicted == InvalidFeedback);
+	uint32_t slotB = cache.Allocate(pageB, 1, false, &evicted);
+	uint32_t slotC = cache.Allocate(pageC, 1, false, &evicted);
+	EXPECT(slotB != slotA && slotC != slotA && slotC != slotB);
+	EXPECT(cache.GetNumResident() == 3);
+
+	// A is used again, so B is now the oldest.
+	cache.Touch(slotA, 2);
+	EXPECT(cache.Allocate(pageD, 2, false, &evicted) == slotB && evicted == pageB);
+	EXPECT(cache.Find(pageB) == PhysicalPageCache::InvalidSlot);
+	EXPECT(cache.Find(pageA) == slotA && cache.Find(pageD) == slotB);
+	EXPECT(cache.Allocate(pageE, 2, false, &evicted) == slotC && evicted == pageC);
+	EXPECT(cache.GetSlotPage(slotC) == pageE);
+
+	// Everything left was used this frame.
+	EXPECT(cache.Allocate(pageB, 2, false, &evicted) == PhysicalPageCache::InvalidSlot && evicted == InvalidFeedback);
+	EXPECT(cache.GetNumResident() == 3);
+}
+
+TEST(PhysicalPageCacheNeverEvictsPinnedPages)
+{
+	const uint32_t tail = PackPage(0, 3, 0, 0);
+	PhysicalPageCache cache;
+	cache.Init(2);
+	uint32_t evicted = 0;
+	uint32_t pinned = cache.Allocate(tail, 1, true, &evicted);
+	EXPECT(pinned != PhysicalPageCache::InvalidSlot);
+
+	uint32_t other = cache.Allocate(PackPage(0, 0, 0, 0), 1, false, &evicted);
+	EXPECT(cache.Allocate(PackPage(0, 0, 1, 0), 1, false, &evicted) == PhysicalPageCache::InvalidSlot);
+	// Later frames keep reusing the one unpinned slot, however old the pinned page gets.
+	EXPECT(cache.Allocate(PackPage(0, 0, 1, 0), 2, false, &evicted) == other && evicted == PackPage(0, 0, 0, 0));
+	EXPECT(cache.Allocate(PackPage(0, 0, 2, 0), 3, false, &evicted) == other && evicted == PackPage(0, 0, 1, 0));
+	EXPECT(cache.Find(tail) == pinned);
+
+	// Freeing empties the slot without counting as an eviction and makes it the next one handed out.
+	cache.Free(pinned);
+	cache.Free(pinned);
+	EXPECT(cache.Find(tail) == PhysicalPageCache::InvalidSlot && cache.GetNumResident() == 1);
+	EXPECT(cache.Allocate(PackPage(0, 0, 3, 0), 3, false, &evicted) == pinned && evicted == InvalidFeedback);
+}
+
+TEST(VirtualTextureLoadsAncestorsCoarsestFirstWithinTheBudget)
+{
+	VirtualTextureSystem system;
+	system.Init(MakeConfig(64, 3, 0));
+	uint32_t textureId = ~0u;
+	// 4x2 pages at mip 0, 2x1 at mip 1 and one page from mip 2 down to the pinned 1x1 mip 9.
+	EXPECT(system.RegisterTexture(CookedVirtualTexture::CookLayout(512, 256), textureId) && textureId == 0);
+	EXPECT(system.GetTexture(0).numMips == 10);
+	EXPECT(Lookup(system, 0, 0, 3, 1).mip == 9 && Lookup(system, 0, 0, 3, 1).slot != PhysicalPageCache::InvalidSlot);
+
+	// Out of range pages and textures are dropped along with cleared pixels.
+	const std::vector<uint32_t> feedback = {
+		PackPage(0, 0, 1, 1), PackPage(0, 0, 1, 1), PackPage(0, 0, 1, 1), PackPage(0, 0, 2, 0),
+		InvalidFeedback, PackPage(0, 0, 10, 0), PackPage(5, 0, 0, 0),
+	};
+
+	// Two mip 0 pages, their two parents at mip 1 and the shared chain from mip 2 to 9.
+	auto stats = system.Update(feedback.data(), feedback.size());
+	EXPECT(stats.frame == 1 && stats.feedbackEntries == 7);
+	EXPECT(stats.uniquePagesRequested == 12 && stats.pagesAlreadyResident == 1);
+	EXPECT(stats.pagesLoaded == 3 && stats.pagesDeferred == 8 && stats.pagesEvicted == 0 && stats.pagesResident == 4);
+	EXPECT(Lookup(system, 0, 0, 1, 1).mip == 6);
+
+	stats = system.Update(feedback.data(), feedback.size());
+	EXPECT(stats.pagesLoaded == 3 && stats.pagesDeferred == 5);
+	EXPECT(Lookup(system, 0, 0, 1, 1).mip == 3);
+
+	// Both mip 1 pages arrive before any mip 0 one.
+	stats = system.Update(feedback.data(), feedback.size());
+	EXPECT(stats.pagesLoaded == 3 && stats.pagesDeferred == 2);
+	EXPECT(Lookup(system, 0, 0, 1, 1).mip == 1 && Lookup(system, 0, 0, 2, 0).mip == 1);
+
+	stats = system.Update(feedback.data(), feedback.size());
+	EXPECT(stats.pagesLoaded == 2 && stats.pagesDeferred == 0);
+	EXPECT(stats.pagesAlreadyResident == 10 && stats.pagesResident == 12);
+	EXPECT(Lookup(system, 0, 0, 1, 1).mip == 0 && Lookup(system, 0, 0, 2, 0).mip == 0);
+
+	// Pages that were never requested show their closest resident ancestor.
+	EXPECT(SameEntry(Lookup(system, 0, 0, 0, 0), Lookup(system, 0, 1, 0, 0)));
+	EXPECT(SameEntry(Lookup(system, 0, 0, 3, 1), Lookup(system, 0, 1, 1, 0)));
+	EXPECT(!SameEntry(Lookup(system, 0, 0, 1, 1), Lookup(system, 0, 1, 0, 0)));
+}
+
+TEST(VirtualTextureHoldsLoadsForTheLatency)
+{
+	VirtualTextureSystem system;
+	system.Init(MakeConfig(64, 32, 2));
+	uint32_t textureId;
+	EXPECT(system.RegisterTexture(CookedVirtualTexture::CookLayout(256, 256), textureId));
+
+	const uint32_t page = PackPage(0, 0, 0, 0);
+	auto stats = system.Update(&page, 1);
+	EXPECT(stats.uniquePagesRequested == 9 && stats.pagesLoaded == 0 && stats.pagesDeferred == 8);
+	EXPECT(Lookup(system, 0, 0, 0, 0).mip == 8);
+	stats = system.Update(&page, 1);
+	EXPECT(stats.pagesLoaded == 0 && stats.pagesDeferred == 8);
+	stats = system.Update(&page, 1);
+	EXPECT(stats.pagesLoaded == 8 && stats.pagesDeferred == 0);
+	EXPECT(Lookup(system, 0, 0, 0, 0).mip == 0);
+}
+
+TEST(VirtualTextureEvictsTheLeastRecentlyRequestedPage)
+{
+	// One pinned tail page, the eight pages from mip 0 to mip 7 a single mip 0 page needs, and one spare.
+	VirtualTextureSystem system;
+	system.Init(MakeConfig(10, 32, 0));
+	uint32_t textureId;
+	EXPECT(system.RegisterTexture(CookedVirtualTexture::CookLayout(256, 256), textureId));
+	std::vector<uint32_t> uploadedSlots;
+	system.SetUploadCallback([&](uint32_t slot, const char* texels) {
+		EXPECT(texels == nullptr);
+		uploadedSlots.push_back(slot);
+	});
+
+	const uint32_t pageA = PackPage(0, 0, 0, 0);
+	const uint32_t pageB = PackPage(0, 0, 1, 0);
+	const uint32_t pageC = PackPage(0, 0, 0, 1);
+	auto stats = system.Update(&pageA, 1);
+	EXPECT(stats.pagesLoaded == 8 && stats.pagesEvicted == 0 && stats.pagesResident == 9);
+	EXPECT(uploadedSlots.size() == 8);
+
+	stats = system.Update(&pageB, 1);
+	EXPECT(stats.pagesAlreadyResident == 8 && stats.pagesLoaded == 1 && stats.pagesEvicted == 0 && stats.pagesResident == 10);
+
+	// A was last wanted before B, and the shared ancestors were wanted this frame.
+	uint32_t slotA = Lookup(system, 0, 0, 0, 0).slot;
+	stats = system.Update(&pageC, 1);
+	EXPECT(stats.pagesLoaded == 1 && stats.pagesEvicted == 1 && stats.pagesResident == 10);
+	EXPECT(uploadedSlots.back() == slotA);
+	EXPECT(Lookup(system, 0, 0, 0, 1).mip == 0 && Lookup(system, 0, 0, 0, 1).slot == slotA);
+	EXPECT(SameEntry(Lookup(system, 0, 0, 0, 0), Lookup(system, 0, 1, 0, 0)));
+	EXPECT(Lookup(system, 0, 0, 1, 0).mip == 0);
+
+	stats = system.Update(&pageA, 1);
+	EXPECT(stats.pagesEvicted == 1);
+	EXPECT(Lookup(system, 0, 0, 0, 0).mip == 0 && Lookup(system, 0, 0, 0, 1).mip == 0);
+	EXPECT(SameEntry(Lookup(system, 0, 0, 1, 0), Lookup(system, 0, 1, 0, 0)));
+	EXPECT(Lookup(system, 0, 8, 0, 0).slot != PhysicalPageCache::InvalidSlot);
+}
+
+TEST(VirtualTextureRegistrationFailsWithoutRoomForTheTail)
+{
+	VirtualTextureSystem empty;
+	empty.Init(MakeConfig(0, 32, 0));
+	uint32_t textureId;
+	EXPECT(!empty.RegisterTexture(CookedVirtualTexture::CookLayout(256, 256), textureId));
+	EXPECT(empty.GetNumTextures() == 0);
+
+	// The first texture takes the only page, and the one that doesn't fit leaves it alone.
+	VirtualTextureSystem system;
+	system.Init(MakeConfig(1, 32, 0));
+	EXPECT(system.RegisterTexture(CookedVirtualTexture::CookLayout(256, 256), textureId) && textureId == 0);
+	uint32_t tailSlot = Lookup(system, 0, 8, 0, 0).slot;
+	EXPECT(tailSlot != PhysicalPageCache::InvalidSlot);
+	EXPECT(!system.RegisterTexture(CookedVirtualTexture::CookLayout(128, 128), textureId));
+	EXPECT(system.GetNumTextures() == 1);
+
+	// Feedback naming the texture that failed is ignored like any other unknown one.
+	const uint32_t page = PackPage(1, 0, 0, 0);
+	auto stats = system.Update(&page, 1);
+	EXPECT(stats.uniquePagesRequested == 0 && stats.pagesResident == 1);
+	EXPECT(Lookup(system, 0, 8, 0, 0).slot == tailSlot);
+
+	// The feedback encoding names at most MaxTextures textures.
+	VirtualTextureSystem many;
+	many.Init(MakeConfig(MaxTextures + 8, 32, 0));
+	for (uint32_t i = 0; i < MaxTextures; ++i)
+	{
+		EXPECT(many.RegisterTexture(CookedVirtualTexture::CookLayout(1, 1), textureId) && textureId == i);
+	}
+	EXPECT(!many.RegisterTexture(CookedVirtualTexture::CookLayout(1, 1), textureId));
+	EXPECT(many.GetNumTextures() == MaxTextures);
+}
+
+TEST(VirtualTextureRecordingReplaysIdentically)
+{
+	std::error_code error;
+	auto directory = (fs::temp_directory_path(error) / "VirtualTextureTests").string();
+	fs::remove_all(directory, error);
+	fs::create_directories(directory, error);
+	EXPECT(!error);
+
+	auto recording = MakeRecording();
+	auto path = FileUtils::Combine(directory, "feedback.vtfb");
+	EXPECT(recording.Save(path));
+
+	VirtualTextureRecording loaded;
+	EXPECT(loaded.Load(path));
+	EXPECT(loaded.textures.size() == recording.textures.size());
+	for (size_t i = 0; i < loaded.textures.size() && i < recording.textures.size(); ++i)
+	{
+		EXPECT(loaded.textures[i].width == recording.textures[i].width);
+		EXPECT(loaded.textures[i].height == recording.textures[i].height);
+		EXPECT(loaded.textures[i].path == recording.textures[i].path);
+	}
+	EXPECT(loaded.frames == recording.frames);
+
+	// A cache and budget small enough that replays defer and evict, which is where ordering could differ.
+	auto config = MakeConfig(24, 6, 1);
+	auto first = Replay(loaded, config);
+	auto second = Replay(loaded, config);
+	EXPECT(first.stats.size() == recording.frames.size() && second.stats.size() == first.stats.size());
+	uint32_t evicted = 0;
+	uint32_t deferred = 0;
+	for (size_t frame = 0; frame < first.stats.size() && frame < second.stats.size(); ++frame)
+	{
+		EXPECT(memcmp(&first.stats[frame], &second.stats[frame], sizeof(VirtualTextureFrameStats)) == 0);
+		evicted += first.stats[frame].pagesEvicted;
+		deferred += first.stats[frame].pagesDeferred;
+	}
+	EXPECT(evicted > 0 && deferred > 0);
+	EXPECT(first.uploadedSlots == second.uploadedSlots);
+	EXPECT(first.indirection.size() == 2 && second.indirection.size() == 2);
+	for (size_t textureId = 0; textureId < first.indirection.size() && textureId < second.indirection.size(); ++textureId)
+	{
+		const auto& a = first.indirection[textureId];
+		const auto& b = second.indirection[textureId];
+		EXPECT(a.size() == b.size());
+		for (size_t i = 0; i < a.size() && i < b.size(); ++i) EXPECT(SameEntry(a[i], b[i]));
+	}
+
+	// Anything else is refused rather than replayed.
+	SDL_RWops* file = SDL_RWFromFile(path.c_str(), "wb");
+	EXPECT(file != nullptr);
+	if (file)
+	{
+		const char garbage[] = "not a recording";
+		SDL_RWwrite(file, garbage, sizeof(garbage), 1);
+		SDL_RWclose(file);
+	}
+	VirtualTextureRecording rejected;
+	EXPECT(!rejected.Load(path));
+
+	fs::remove_all(directory, error);
+}